@@ -0,0 +1,113 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Image checks and lookup. This file has no ESP-IDF dependencies, so the same code serves the
+mapped partition on the target and the mapped file on the host.
+*/
+
+#include "asset_bundle.h"
+
+#include <string.h>
+
+static bool in_image(uint32_t offset, uint32_t len, uint32_t image_size)
+{
+    return (offset <= image_size) && (len <= image_size - offset);
+}
+
+// A terminated string that starts in the image must also end in it
+static bool is_string_in_image(const uint8_t* image, uint32_t offset, uint32_t image_size)
+{
+    return (offset < image_size) && (memchr(&image[offset], '\0', image_size - offset) != NULL);
+}
+
+uint32_t asset_bundle_hash(uint32_t seed, const char* path, size_t len)
+{
+    uint32_t hash = 2166136261U ^ seed;
+
+    // FNV-1a
+    while (len--) {
+        hash = (hash ^ (uint8_t)*path++) * 16777619U;
+    }
+    // Final mix of MurmurHash3, so that consecutive seeds give unrelated hashes
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35U;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+bool asset_bundle_init(asset_bundle_t* bundle, const void* image, size_t size)
+{
+    const asset_bundle_header_t* hdr = image;
+    const uint8_t* base = image;
+    uint32_t entries_offset;
+
+    if ((size < sizeof(*hdr)) || (hdr->magic != ASSET_BUNDLE_MAGIC) ||
+        (hdr->version != ASSET_BUNDLE_VERSION) || (hdr->image_size > size) ||
+        ((hdr->num_entries > 0) && (hdr->num_buckets == 0))) {
+        return false;
+    }
+    entries_offset = (sizeof(*hdr) + hdr->num_buckets * sizeof(uint16_t) + 3) & ~3U;
+    if (!in_image(entries_offset, hdr->num_entries * sizeof(asset_bundle_entry_t),
+                  hdr->image_size)) {
+        return false;
+    }
+
+    const asset_bundle_entry_t* entries = (const asset_bundle_entry_t*)&base[entries_offset];
+    for (int idx = 0; idx < hdr->num_entries; idx++) {
+        const asset_bundle_entry_t* entry = &entries[idx];
+        if (!in_image(entry->path_offset, entry->path_len, hdr->image_size) ||
+            !in_image(entry->data_offset, entry->data_len, hdr->image_size) ||
+            !is_string_in_image(base, entry->mime_offset, hdr->image_size) ||
+            !is_string_in_image(base, entry->etag_offset, hdr->image_size)) {
+            return false;
+        }
+    }
+
+    bundle->base = base;
+    bundle->size = size;
+    bundle->displacement = (const uint16_t*)(hdr + 1);
+    bundle->entries = entries;
+    bundle->num_buckets = hdr->num_buckets;
+    bundle->num_entries = hdr->num_entries;
+    return true;
+}
+
+bool asset_bundle_find(const asset_bundle_t* bundle, const char* path, size_t path_len,
+                       asset_bundle_file_t* file)
+{
+    if (bundle->num_entries == 0) {
+        return false;
+    }
+
+    uint32_t bucket = asset_bundle_hash(0, path, path_len) % bundle->num_buckets;
+    uint32_t slot =
+        asset_bundle_hash(bundle->displacement[bucket], path, path_len) % bundle->num_entries;
+    const asset_bundle_entry_t* entry = &bundle->entries[slot];
+
+    // Every path lands on some entry, so check that it is this one.
+    if ((entry->path_len != path_len) ||
+        (memcmp(&bundle->base[entry->path_offset], path, path_len) != 0)) {
+        return false;
+    }
+
+    file->data = &bundle->base[entry->data_offset];
+    file->len = entry->data_len;
+    file->mimetype = (const char*)&bundle->base[entry->mime_offset];
+    file->etag = (const char*)&bundle->base[entry->etag_offset];
+    file->encoding = entry->encoding;
+    return true;
+}
@@ -0,0 +1,72 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Maps the image from a flash partition. The contents are read through the flash cache, so they
+never need a RAM copy.
+*/
+
+#include "asset_bundle.h"
+
+#include "esp_log.h"
+#include "esp_partition.h"
+
+static const char* TAG = "asset_bundle";
+
+esp_err_t asset_bundle_map_partition(const char* label, asset_bundle_t* bundle)
+{
+    asset_bundle_header_t hdr;
+    spi_flash_mmap_handle_t handle;
+    const void* image;
+    esp_err_t ret;
+
+    const esp_partition_t* partition =
+        esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+    if (partition == NULL) {
+        ESP_LOGE(TAG, "No partition \"%s\"", label);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    // Read the header first, so only the image and not the whole partition gets mapped.
+    ret = esp_partition_read(partition, 0, &hdr, sizeof(hdr));
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if ((hdr.magic != ASSET_BUNDLE_MAGIC) || (hdr.image_size > partition->size)) {
+        ESP_LOGE(TAG, "No asset image in partition \"%s\"", label);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    ret = esp_partition_mmap(partition, 0, hdr.image_size, SPI_FLASH_MMAP_DATA, &image, &handle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map partition \"%s\" (%s)", label, esp_err_to_name(ret));
+        return ret;
+    }
+    if (!asset_bundle_init(bundle, image, hdr.image_size)) {
+        ESP_LOGE(TAG, "Corrupt asset image in partition \"%s\"", label);
+        spi_flash_munmap(handle);
+        return ESP_ERR_INVALID_ARG;
+    }
+    bundle->mmap_handle = handle;
+
+    ESP_LOGI(TAG, "Mapped %u files, %u bytes", bundle->num_entries, (unsigned)hdr.image_size);
+    return ESP_OK;
+}
+
+void asset_bundle_unmap_partition(asset_bundle_t* bundle)
+{
+    spi_flash_munmap(bundle->mmap_handle);
+    bundle->base = NULL;
+    bundle->num_entries = 0;
+}
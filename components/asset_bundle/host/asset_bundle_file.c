@@ -0,0 +1,62 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Linux reader for asset images. Maps an image file the way the target maps the partition, so the
+lookup and serving path can be run and measured on the host. Build it together with
+../asset_bundle.c, e.g.
+
+    cc -O2 -Iinclude asset_bundle.c host/asset_bundle_file.c my_bench.c
+*/
+
+#include "asset_bundle.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+bool asset_bundle_map_file(const char* path, asset_bundle_t* bundle)
+{
+    struct stat st;
+    void* image;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    if ((fstat(fd, &st) != 0) || (st.st_size == 0)) {
+        close(fd);
+        return false;
+    }
+    image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping holds its own reference to the file.
+    close(fd);
+    if (image == MAP_FAILED) {
+        return false;
+    }
+
+    if (!asset_bundle_init(bundle, image, st.st_size)) {
+        munmap(image, st.st_size);
+        return false;
+    }
+    return true;
+}
+
+void asset_bundle_unmap_file(asset_bundle_t* bundle)
+{
+    munmap((void*)bundle->base, bundle->size);
+    bundle->base = NULL;
+    bundle->num_entries = 0;
+}
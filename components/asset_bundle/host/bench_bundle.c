@@ -0,0 +1,295 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Host benchmark of the serving path of asset images. Build and run from this directory with
+
+    make bench
+
+which packs the demo's build output, or run ./bench_bundle image.bin [web_dir] on any image.
+
+It first times asset_bundle_find() for every path of the image and for paths it does not hold.
+It then serves every file in turn as send_bundle_file() in rest_server does: look up the path,
+format the headers and send headers and body straight from the mapping to a socket, whose other
+end a thread drains. Given web_dir, the directory the image was packed from, it serves the same
+files the way the file system deploy modes do, with open(), fstat() and read() through a
+scratch buffer, for comparison. Each part runs for about a second.
+*/
+
+#include "asset_bundle.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Run each part until this much time has passed */
+#define MIN_RUN_NS (1000000000LL)
+
+/* Same size as the scratch buffer of rest_server */
+#define SCRATCH_BUFSIZE (10240)
+
+#define PATH_MAX_LEN (256)
+
+typedef struct {
+    char path[PATH_MAX_LEN];
+    size_t path_len;
+    size_t len;
+    asset_bundle_encoding_t encoding;
+} request_t;
+
+typedef struct {
+    int fd;
+    long long bytes;
+} drain_t;
+
+static request_t* _requests;
+static int _num_requests;
+
+static char _scratch[SCRATCH_BUFSIZE];
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Reads the client end of the socket until it is closed */
+static void* drain(void* arg)
+{
+    static char buf[65536];
+    drain_t* client = arg;
+    ssize_t len;
+
+    while ((len = read(client->fd, buf, sizeof(buf))) > 0) {
+        client->bytes += len;
+    }
+    return NULL;
+}
+
+static int compare_paths(const void* a, const void* b)
+{
+    return strcmp(((const request_t*)a)->path, ((const request_t*)b)->path);
+}
+
+static int send_all(int fd, const void* data, size_t len)
+{
+    const char* pos = data;
+
+    while (len > 0) {
+        ssize_t sent = write(fd, pos, len);
+        if (sent <= 0) {
+            return -1;
+        }
+        pos += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+static int format_headers(const char* mimetype, size_t len, asset_bundle_encoding_t encoding,
+                          const char* etag)
+{
+    return snprintf(_scratch, sizeof(_scratch),
+                    "HTTP/1.1 200 OK\r\n"
+                    "Content-Type: %s\r\n"
+                    "Content-Length: %u\r\n"
+                    "%s"
+                    "ETag: %s\r\n"
+                    "Cache-Control: no-cache\r\n"
+                    "\r\n",
+                    mimetype, (unsigned)len,
+                    (encoding == ASSET_BUNDLE_ENCODING_GZIP) ? "Content-Encoding: gzip\r\n" : "",
+                    etag);
+}
+
+/* send_bundle_file(): headers, then the body straight from the mapping */
+static int serve_from_bundle(const asset_bundle_t* bundle, const request_t* request, int fd)
+{
+    asset_bundle_file_t file;
+    int hdr_len;
+
+    if (!asset_bundle_find(bundle, request->path, request->path_len, &file)) {
+        return -1;
+    }
+    hdr_len = format_headers(file.mimetype, file.len, file.encoding, file.etag);
+    if (send_all(fd, _scratch, hdr_len) != 0) {
+        return -1;
+    }
+    return send_all(fd, file.data, file.len);
+}
+
+/* send_file(): open the file, take its size from fstat(), then read it through the scratch
+ * buffer. The headers come from the image, as if the file system path had them for free. */
+static int serve_from_dir(const asset_bundle_t* bundle, const char* dir, const request_t* request,
+                          int fd)
+{
+    char filepath[PATH_MAX_LEN * 2];
+    asset_bundle_file_t file;
+    struct stat st;
+    int hdr_len;
+    int file_fd;
+    int ret = 0;
+
+    snprintf(filepath, sizeof(filepath), "%s%s%s", dir, request->path,
+             (request->encoding == ASSET_BUNDLE_ENCODING_GZIP) ? ".gz" : "");
+    file_fd = open(filepath, O_RDONLY);
+    if (file_fd == -1) {
+        return -1;
+    }
+    if ((fstat(file_fd, &st) != 0) ||
+        !asset_bundle_find(bundle, request->path, request->path_len, &file)) {
+        close(file_fd);
+        return -1;
+    }
+    hdr_len = format_headers(file.mimetype, st.st_size, file.encoding, file.etag);
+    ret = send_all(fd, _scratch, hdr_len);
+    for (size_t left = st.st_size; (ret == 0) && (left > 0);) {
+        ssize_t read_bytes = read(file_fd, _scratch, sizeof(_scratch));
+        if (read_bytes <= 0) {
+            ret = -1;
+            break;
+        }
+        ret = send_all(fd, _scratch, read_bytes);
+        left -= read_bytes;
+    }
+    close(file_fd);
+    return ret;
+}
+
+static void bench_lookup(const asset_bundle_t* bundle)
+{
+    asset_bundle_file_t file;
+    long long lookups = 0;
+    long long wrong = 0;
+    long long start_ns = now_ns();
+    long long elapsed_ns;
+
+    do {
+        for (int idx = 0; idx < _num_requests; idx++) {
+            const request_t* request = &_requests[idx];
+            if (!asset_bundle_find(bundle, request->path, request->path_len, &file)) {
+                wrong++;
+            }
+            // The same path with one more character is not in the image
+            if (asset_bundle_find(bundle, request->path, request->path_len + 1, &file)) {
+                wrong++;
+            }
+        }
+        lookups += 2 * _num_requests;
+        elapsed_ns = now_ns() - start_ns;
+    } while (elapsed_ns < MIN_RUN_NS);
+
+    printf("lookup    %12.0f lookups/s  %8.1f ns/lookup%s\n", lookups * 1e9 / elapsed_ns,
+           (double)elapsed_ns / lookups, wrong ? "  WRONG RESULTS" : "");
+}
+
+/* Serves all requests over and over, from the image or with dir from the file system. Returns
+ * false on an error. */
+static bool bench_serve(const char* label, const asset_bundle_t* bundle, const char* dir)
+{
+    drain_t client = {-1, 0};
+    long long body_bytes = 0;
+    long long served = 0;
+    long long start_ns;
+    long long elapsed_ns;
+    pthread_t thread;
+    int fds[2];
+    int ret = 0;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        perror("socketpair");
+        return false;
+    }
+    client.fd = fds[1];
+    pthread_create(&thread, NULL, drain, &client);
+
+    start_ns = now_ns();
+    do {
+        for (int idx = 0; (ret == 0) && (idx < _num_requests); idx++) {
+            if (dir) {
+                ret = serve_from_dir(bundle, dir, &_requests[idx], fds[0]);
+            } else {
+                ret = serve_from_bundle(bundle, &_requests[idx], fds[0]);
+            }
+            body_bytes += _requests[idx].len;
+        }
+        served += _num_requests;
+        elapsed_ns = now_ns() - start_ns;
+    } while ((ret == 0) && (elapsed_ns < MIN_RUN_NS));
+
+    close(fds[0]);
+    pthread_join(thread, NULL);
+    close(fds[1]);
+    if (ret != 0) {
+        fprintf(stderr, "%s: failed to serve a file\n", label);
+        return false;
+    }
+
+    printf("%-9s %12.0f requests/s %8.1f us/request  %8.1f MB/s of files, %.1f%% headers\n",
+           label, served * 1e9 / elapsed_ns, elapsed_ns / 1e3 / served,
+           body_bytes * 1e3 / elapsed_ns, 100.0 * (client.bytes - body_bytes) / client.bytes);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    asset_bundle_t bundle;
+    size_t total_len = 0;
+
+    if ((argc < 2) || (argc > 3)) {
+        fprintf(stderr, "Usage: %s image.bin [web_dir]\n", argv[0]);
+        return 2;
+    }
+    if (!asset_bundle_map_file(argv[1], &bundle)) {
+        fprintf(stderr, "%s: not a valid asset image\n", argv[1]);
+        return 1;
+    }
+    if (bundle.num_entries == 0) {
+        fprintf(stderr, "%s: no files\n", argv[1]);
+        return 1;
+    }
+
+    // Requests for every file, in path order rather than the image's hash order
+    _num_requests = bundle.num_entries;
+    _requests = calloc(_num_requests, sizeof(*_requests));
+    for (int idx = 0; idx < _num_requests; idx++) {
+        const asset_bundle_entry_t* entry = &bundle.entries[idx];
+        request_t* request = &_requests[idx];
+        request->path_len = (entry->path_len < PATH_MAX_LEN - 1) ? entry->path_len
+                                                                 : PATH_MAX_LEN - 2;
+        memcpy(request->path, &bundle.base[entry->path_offset], request->path_len);
+        request->len = entry->data_len;
+        request->encoding = entry->encoding;
+        total_len += entry->data_len;
+    }
+    qsort(_requests, _num_requests, sizeof(*_requests), compare_paths);
+
+    printf("%d files, %zu bytes\n", _num_requests, total_len);
+    bench_lookup(&bundle);
+    if (!bench_serve("bundle", &bundle, NULL) ||
+        ((argc == 3) && !bench_serve("file", &bundle, argv[2]))) {
+        return 1;
+    }
+
+    free(_requests);
+    asset_bundle_unmap_file(&bundle);
+    return 0;
+}
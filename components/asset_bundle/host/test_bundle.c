@@ -0,0 +1,205 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Unit tests of the asset image reader, on an image that mkassetbundle.py packs from testdata.
+Build and run from this directory with
+
+    make test
+*/
+
+#include "asset_bundle.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TESTDATA_DIR "testdata"
+
+static int _failures = 0;
+
+#define CHECK(cond)                                                                        \
+    do {                                                                                   \
+        if (!(cond)) {                                                                     \
+            fprintf(stderr, "%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, __func__, \
+                    #cond);                                                                \
+            _failures++;                                                                   \
+        }                                                                                  \
+    } while (0)
+
+typedef struct {
+    const char* path;     /* Request path */
+    const char* filename; /* File in TESTDATA_DIR */
+    const char* mimetype;
+    asset_bundle_encoding_t encoding;
+} expected_file_t;
+
+static const expected_file_t FILES[] = {
+    {"/index.html", "/index.html", "text/html", ASSET_BUNDLE_ENCODING_IDENTITY},
+    {"/prov/index.html", "/prov/index.html", "text/html", ASSET_BUNDLE_ENCODING_IDENTITY},
+    {"/css/app.css", "/css/app.css", "text/css", ASSET_BUNDLE_ENCODING_IDENTITY},
+    {"/js/app.js", "/js/app.js.gz", "application/javascript", ASSET_BUNDLE_ENCODING_GZIP},
+    {"/img/logo.PNG", "/img/logo.PNG", "image/png", ASSET_BUNDLE_ENCODING_IDENTITY},
+    {"/config.proto", "/config.proto", "text/plain", ASSET_BUNDLE_ENCODING_IDENTITY},
+    {"/VERSION", "/VERSION", "text/plain", ASSET_BUNDLE_ENCODING_IDENTITY},
+};
+#define NUM_FILES (sizeof(FILES) / sizeof(FILES[0]))
+
+/* Reads a whole file into a new buffer, NULL if it cannot be read */
+static uint8_t* read_file(const char* path, size_t* len)
+{
+    FILE* file = fopen(path, "rb");
+    uint8_t* buf;
+    long size;
+
+    if (!file) {
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    buf = malloc(size ? size : 1);
+    if (buf && (fread(buf, 1, size, file) != (size_t)size)) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(file);
+    *len = size;
+    return buf;
+}
+
+/* rest_etag_format() of rest_server */
+static void format_etag(char* etag, size_t size, const uint8_t* data, size_t len)
+{
+    uint32_t hash = 2166136261U;
+
+    for (size_t idx = 0; idx < len; idx++) {
+        hash = (hash ^ data[idx]) * 16777619U;
+    }
+    snprintf(etag, size, "\"%08x-%zx\"", hash, len);
+}
+
+static void test_every_file_found(const asset_bundle_t* bundle)
+{
+    CHECK(bundle->num_entries == NUM_FILES);
+
+    for (size_t idx = 0; idx < NUM_FILES; idx++) {
+        const expected_file_t* expected = &FILES[idx];
+        char filename[256];
+        char etag[32];
+        asset_bundle_file_t file;
+        size_t len;
+
+        snprintf(filename, sizeof(filename), "%s%s", TESTDATA_DIR, expected->filename);
+        uint8_t* contents = read_file(filename, &len);
+        CHECK(contents != NULL);
+        if (!contents) {
+            continue;
+        }
+        format_etag(etag, sizeof(etag), contents, len);
+
+        CHECK(asset_bundle_find(bundle, expected->path, strlen(expected->path), &file));
+        CHECK(file.len == len);
+        CHECK((file.len == len) && (memcmp(file.data, contents, len) == 0));
+        CHECK(((uintptr_t)file.data % ASSET_BUNDLE_DATA_ALIGN) == 0);
+        CHECK(strcmp(file.mimetype, expected->mimetype) == 0);
+        CHECK(strcmp(file.etag, etag) == 0);
+        CHECK(file.encoding == expected->encoding);
+        free(contents);
+    }
+}
+
+static void test_path_len_is_used(const asset_bundle_t* bundle)
+{
+    static const char PATHS[] = "/css/app.css/index.html";
+    asset_bundle_file_t file;
+
+    // The path need not be terminated, only its first path_len characters count
+    CHECK(asset_bundle_find(bundle, PATHS, strlen("/css/app.css"), &file));
+    CHECK(strcmp(file.mimetype, "text/css") == 0);
+}
+
+static void test_other_paths_not_found(const asset_bundle_t* bundle)
+{
+    static const char* const PATHS[] = {
+        "",           "/",          "/index.htm", "/index.html/", "/INDEX.HTML",
+        "/js/app.js.gz", "/prov",   "/prov/",     "/img/logo.png", "/missing.html",
+    };
+    asset_bundle_file_t file;
+
+    for (size_t idx = 0; idx < sizeof(PATHS) / sizeof(PATHS[0]); idx++) {
+        if (asset_bundle_find(bundle, PATHS[idx], strlen(PATHS[idx]), &file)) {
+            fprintf(stderr, "found %s\n", PATHS[idx]);
+            _failures++;
+        }
+    }
+}
+
+static void test_broken_image_rejected(const asset_bundle_t* bundle)
+{
+    asset_bundle_header_t hdr;
+    asset_bundle_t copy;
+    uint32_t* image = malloc(bundle->size);
+
+    CHECK(asset_bundle_init(&copy, bundle->base, bundle->size));
+    CHECK(!asset_bundle_init(&copy, bundle->base, sizeof(hdr) - 1));
+    CHECK(!asset_bundle_init(&copy, bundle->base, bundle->size - 1));
+
+    memcpy(image, bundle->base, bundle->size);
+    memcpy(&hdr, image, sizeof(hdr));
+    hdr.magic ^= 1;
+    memcpy(image, &hdr, sizeof(hdr));
+    CHECK(!asset_bundle_init(&copy, image, bundle->size));
+
+    memcpy(image, bundle->base, bundle->size);
+    hdr.magic ^= 1;
+    hdr.version++;
+    memcpy(image, &hdr, sizeof(hdr));
+    CHECK(!asset_bundle_init(&copy, image, bundle->size));
+
+    // An entry whose contents run past the end of the image
+    memcpy(image, bundle->base, bundle->size);
+    asset_bundle_entry_t* entry =
+        (asset_bundle_entry_t*)((uint8_t*)image + ((const uint8_t*)bundle->entries - bundle->base));
+    entry->data_len = bundle->size;
+    CHECK(!asset_bundle_init(&copy, image, bundle->size));
+    free(image);
+}
+
+int main(int argc, char** argv)
+{
+    asset_bundle_t bundle;
+
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s image.bin\n", argv[0]);
+        return 2;
+    }
+    if (!asset_bundle_map_file(argv[1], &bundle)) {
+        fprintf(stderr, "%s: not a valid asset image\n", argv[1]);
+        return 1;
+    }
+
+    test_every_file_found(&bundle);
+    test_path_len_is_used(&bundle);
+    test_other_paths_not_found(&bundle);
+    test_broken_image_rejected(&bundle);
+
+    asset_bundle_unmap_file(&bundle);
+    if (_failures) {
+        fprintf(stderr, "%d checks failed\n", _failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,192 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ASSET_BUNDLE_H_
+#define ASSET_BUNDLE_H_
+
+/*
+Read-only image of the web files, built on the host by tools/mkassetbundle.py and served straight
+from where it is mapped: a flash partition on the target, a file on Linux.
+
+Files are looked up by request path through a minimal perfect hash: the path's hash picks a
+bucket, the bucket's displacement gives a second hash, and that picks the entry. A lookup is
+two hashes of the path and one compare, however many files the image holds.
+
+All fields are little-endian. The image is:
+  - asset_bundle_header_t
+  - uint16_t displacement[num_buckets], padded to 4 bytes
+  - asset_bundle_entry_t[num_entries], in hash order
+  - the paths (not terminated), MIME types and ETags (terminated)
+  - the file contents, each starting at a multiple of ASSET_BUNDLE_DATA_ALIGN
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ASSET_BUNDLE_MAGIC      (0x42545341) /* "ASTB" */
+#define ASSET_BUNDLE_VERSION    (2)
+#define ASSET_BUNDLE_DATA_ALIGN (4)
+
+/**
+ * @brief   Content-Encoding of a file.
+ */
+typedef enum
+{
+    ASSET_BUNDLE_ENCODING_IDENTITY, /*!< Sent as stored */
+    ASSET_BUNDLE_ENCODING_GZIP,     /*!< Stored gzipped, sent with "Content-Encoding: gzip" */
+} asset_bundle_encoding_t;
+
+/**
+ * @brief   Image header.
+ */
+typedef struct {
+    uint32_t magic;       /*!< ASSET_BUNDLE_MAGIC */
+    uint16_t version;     /*!< ASSET_BUNDLE_VERSION */
+    uint16_t num_entries; /*!< Number of files */
+    uint32_t image_size;  /*!< Size of the whole image in bytes */
+    uint16_t num_buckets; /*!< Size of the displacement table */
+    uint16_t reserved;
+} asset_bundle_header_t;
+
+/**
+ * @brief   Image entry of a file.
+ */
+typedef struct {
+    uint32_t path_offset; /*!< Offset of the request path, e.g. "/prov/index.html" */
+    uint32_t data_offset; /*!< Offset of the contents */
+    uint32_t data_len;    /*!< Size of the contents */
+    uint32_t mime_offset; /*!< Offset of the MIME type, e.g. "text/html" */
+    uint32_t etag_offset; /*!< Offset of the quoted strong ETag */
+    uint16_t path_len;    /*!< Length of the request path */
+    uint8_t encoding;     /*!< asset_bundle_encoding_t */
+    uint8_t reserved;
+} asset_bundle_entry_t;
+
+_Static_assert(sizeof(asset_bundle_header_t) == 16, "Image header must not have padding");
+_Static_assert(sizeof(asset_bundle_entry_t) == 24, "Image entry must not have padding");
+
+/**
+ * @brief   Mapped image.
+ */
+typedef struct {
+    const uint8_t* base;                 /*!< Start of the image */
+    size_t size;                         /*!< Size of the mapping */
+    const uint16_t* displacement;        /*!< Second hash seed per bucket */
+    const asset_bundle_entry_t* entries; /*!< Entries in hash order */
+    uint16_t num_buckets;
+    uint16_t num_entries;
+    uint32_t mmap_handle; /*!< Target only: handle from esp_partition_mmap() */
+} asset_bundle_t;
+
+/**
+ * @brief   File in the image.
+ *
+ * All pointers are valid as long as the image is mapped.
+ */
+typedef struct {
+    const uint8_t* data;
+    size_t len;
+    const char* mimetype;
+    const char* etag; /*!< Quoted, ready for the ETag header */
+    asset_bundle_encoding_t encoding;
+} asset_bundle_file_t;
+
+/**
+ * @brief   Hash of a path, as used by the index.
+ *
+ * tools/mkassetbundle.py has the same function.
+ *
+ * @param[in] seed 0 for the bucket, the bucket's displacement for the entry
+ * @param[in] path Path
+ * @param[in] len  Length of path
+ *
+ * @return Hash
+ */
+uint32_t asset_bundle_hash(uint32_t seed, const char* path, size_t len);
+
+/**
+ * @brief   Checks an image and gets it ready for asset_bundle_find().
+ *
+ * Every entry is checked against the image bounds, so lookups need no further checks.
+ *
+ * @param[out] bundle Bundle to initialize
+ * @param[in]  image  Start of the mapped image, aligned to 4 bytes
+ * @param[in]  size   Size of the mapping
+ *
+ * @return true if the image is valid
+ */
+bool asset_bundle_init(asset_bundle_t* bundle, const void* image, size_t size);
+
+/**
+ * @brief   Finds a file by request path.
+ *
+ * The path names the file as requested, without ".gz" for gzipped files.
+ *
+ * @param[in]  bundle   Initialized bundle
+ * @param[in]  path     Path relative to the web file root, e.g. "/prov/index.html"
+ * @param[in]  path_len Length of path
+ * @param[out] file     Contents and headers of the file
+ *
+ * @return true if found
+ */
+bool asset_bundle_find(const asset_bundle_t* bundle, const char* path, size_t path_len,
+                       asset_bundle_file_t* file);
+
+#ifdef ESP_PLATFORM
+#include "esp_err.h"
+
+/**
+ * @brief   Maps the image in a data partition into the address space.
+ *
+ * Only the image, not the whole partition, takes up MMU pages.
+ *
+ * @param[in]  label  Partition label, e.g. "www"
+ * @param[out] bundle Bundle of the mapped image
+ *
+ * @return
+ *  - ESP_OK              : Success
+ *  - ESP_ERR_NOT_FOUND   : No such partition
+ *  - ESP_ERR_INVALID_ARG : Partition holds no valid image
+ *  - Others              : Errors of esp_partition_mmap()
+ */
+esp_err_t asset_bundle_map_partition(const char* label, asset_bundle_t* bundle);
+
+/**
+ * @brief   Unmaps an image mapped with asset_bundle_map_partition().
+ *
+ * @param[in] bundle Bundle of the mapped image
+ */
+void asset_bundle_unmap_partition(asset_bundle_t* bundle);
+#else
+
+/**
+ * @brief   Maps an image file on the host with mmap().
+ *
+ * @param[in]  path   Image file
+ * @param[out] bundle Bundle of the mapped image
+ *
+ * @return true on success
+ */
+bool asset_bundle_map_file(const char* path, asset_bundle_t* bundle);
+
+/**
+ * @brief   Unmaps an image mapped with asset_bundle_map_file().
+ *
+ * @param[in] bundle Bundle of the mapped image
+ */
+void asset_bundle_unmap_file(asset_bundle_t* bundle);
+#endif
+
+#endif /* ASSET_BUNDLE_H_ */
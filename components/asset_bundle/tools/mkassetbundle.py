@@ -0,0 +1,205 @@
+#!/usr/bin/env python
+#
+# Copyright 2021 Aaron Fontaine
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Packs a directory of web files into an asset image with a perfect hash index.
+
+The layout is described in include/asset_bundle.h.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+MAGIC = 0x42545341  # "ASTB"
+VERSION = 2
+DATA_ALIGN = 4
+
+ENCODING_IDENTITY = 0
+ENCODING_GZIP = 1
+
+# Average number of files per bucket. Larger makes a smaller table but a slower build.
+FILES_PER_BUCKET = 4
+MAX_DISPLACEMENT = 0xffff
+
+HEADER = struct.Struct('<IHHIHH')
+ENTRY = struct.Struct('<IIIIIHBB')
+
+# Lines of rest_server_mime_types.h
+MIME_TYPE_RE = re.compile(r'^REST_MIME_TYPE\(\s*"([^"]+)"\s*,\s*"([^"]+)"', re.MULTILINE)
+DEFAULT_MIME_TYPE_RE = re.compile(r'^#define\s+REST_DEFAULT_MIME_TYPE\s+"([^"]+)"', re.MULTILINE)
+
+
+def fnv1a(data, hash=2166136261):
+    for b in bytearray(data):
+        hash = ((hash ^ b) * 16777619) & 0xffffffff
+    return hash
+
+
+def path_hash(seed, path):
+    """Same as asset_bundle_hash()"""
+    h = fnv1a(path, 2166136261 ^ seed)
+    h ^= h >> 16
+    h = (h * 0x85ebca6b) & 0xffffffff
+    h ^= h >> 13
+    h = (h * 0xc2b2ae35) & 0xffffffff
+    h ^= h >> 16
+    return h
+
+
+def etag(contents):
+    """Same format as rest_etag_format() in rest_server"""
+    return '"%08x-%x"' % (fnv1a(contents), len(contents))
+
+
+def align(offset):
+    return (offset + DATA_ALIGN - 1) & ~(DATA_ALIGN - 1)
+
+
+def load_mime_types(path):
+    """Returns the extension to type map and the default type from rest_server_mime_types.h"""
+    with open(path) as f:
+        text = f.read()
+    types = dict((ext.lower(), mimetype) for ext, mimetype in MIME_TYPE_RE.findall(text))
+    default = DEFAULT_MIME_TYPE_RE.search(text)
+    if not types or not default:
+        sys.exit('No content types found in %s' % path)
+    return types, default.group(1)
+
+
+class Asset(object):
+    def __init__(self, rel_path, contents, mime_types, default_mime_type):
+        self.path = ('/' + rel_path).encode('utf-8')
+        self.encoding = ENCODING_IDENTITY
+        # Gzipped files are requested without ".gz"
+        if self.path.endswith(b'.gz'):
+            self.path = self.path[:-3]
+            self.encoding = ENCODING_GZIP
+        ext = os.path.splitext(self.path.decode('utf-8'))[1].lower()
+        self.mimetype = mime_types.get(ext, default_mime_type)
+        self.contents = contents
+        self.etag = etag(contents)
+
+
+def collect_assets(root, mime_types, default_mime_type):
+    assets = {}
+    for dirpath, _, filenames in os.walk(root):
+        for name in sorted(filenames):
+            full = os.path.join(dirpath, name)
+            with open(full, 'rb') as f:
+                asset = Asset(os.path.relpath(full, root).replace(os.sep, '/'), f.read(),
+                              mime_types, default_mime_type)
+            if asset.path in assets:
+                raise ValueError('%s exists both plain and gzipped' % asset.path.decode('utf-8'))
+            assets[asset.path] = asset
+    return sorted(assets.values(), key=lambda asset: asset.path)
+
+
+def build_index(assets):
+    """Hash and displace: finds a displacement per bucket so that every asset gets its own slot.
+
+    Returns the displacement table and the assets in slot order.
+    """
+    num_slots = len(assets)
+    num_buckets = max(1, (num_slots + FILES_PER_BUCKET - 1) // FILES_PER_BUCKET)
+    buckets = [[] for _ in range(num_buckets)]
+    for asset in assets:
+        buckets[path_hash(0, asset.path) % num_buckets].append(asset)
+
+    displacement = [0] * num_buckets
+    slots = [None] * num_slots
+    # Place the fullest buckets first, while there is the most room
+    for bucket in sorted(range(num_buckets), key=lambda b: -len(buckets[b])):
+        if not buckets[bucket]:
+            break
+        for d in range(1, MAX_DISPLACEMENT + 1):
+            wanted = [path_hash(d, asset.path) % num_slots for asset in buckets[bucket]]
+            if len(set(wanted)) == len(wanted) and all(slots[s] is None for s in wanted):
+                break
+        else:
+            raise ValueError('no perfect hash found')
+        displacement[bucket] = d
+        for slot, asset in zip(wanted, buckets[bucket]):
+            slots[slot] = asset
+    return displacement, slots
+
+
+def build_image(assets):
+    if len(assets) > 0xffff:
+        raise ValueError('too many files')
+
+    displacement, slots = build_index(assets)
+
+    # Paths, then the terminated MIME types and ETags. Equal strings are stored once.
+    strings_offset = align(HEADER.size + 2 * len(displacement)) + ENTRY.size * len(slots)
+    strings = bytearray()
+    shared = {}
+
+    def add_string(value, terminate):
+        if terminate:
+            value += b'\0'
+            if value in shared:
+                return shared[value]
+            shared[value] = strings_offset + len(strings)
+        offset = strings_offset + len(strings)
+        strings.extend(value)
+        return offset
+
+    refs = []
+    for asset in slots:
+        refs.append((add_string(asset.path, False),
+                     add_string(asset.mimetype.encode('ascii'), True),
+                     add_string(asset.etag.encode('ascii'), True)))
+
+    data_offset = align(strings_offset + len(strings))
+    data = b''
+    entries = b''
+    for asset, (path_offset, mime_offset, etag_offset) in zip(slots, refs):
+        data += b'\0' * (align(data_offset + len(data)) - (data_offset + len(data)))
+        entries += ENTRY.pack(path_offset, data_offset + len(data), len(asset.contents),
+                              mime_offset, etag_offset, len(asset.path), asset.encoding, 0)
+        data += asset.contents
+
+    header = HEADER.pack(MAGIC, VERSION, len(slots), data_offset + len(data), len(displacement), 0)
+    table = struct.pack('<%dH' % len(displacement), *displacement)
+    table += b'\0' * (align(len(table)) - len(table))
+    padding = b'\0' * (data_offset - strings_offset - len(strings))
+    return header + table + entries + bytes(strings) + padding + data
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('src_dir', help='Directory of web files, e.g. front/web-demo/dist')
+    parser.add_argument('output', help='Image file to write')
+    parser.add_argument('--mime-types', required=True,
+                        help='Content types by extension: components/rest_server/'
+                             'rest_server_mime_types.h')
+    parser.add_argument('--max-size', type=lambda x: int(x, 0), default=0,
+                        help='Fail if the image is larger, e.g. the partition size')
+    args = parser.parse_args()
+
+    mime_types, default_mime_type = load_mime_types(args.mime_types)
+    image = build_image(collect_assets(args.src_dir, mime_types, default_mime_type))
+    if args.max_size and len(image) > args.max_size:
+        sys.exit('Asset image is %d bytes, larger than %d' % (len(image), args.max_size))
+
+    with open(args.output, 'wb') as f:
+        f.write(image)
+
+
+if __name__ == '__main__':
+    main()
@@ -27,501 +27,210 @@ the internal webserver.
 */
 
 #include "capt_dns.h"
+#include "capt_dns_priv.h"
 
-#include <errno.h>
 #include <stdbool.h>
-#include <string.h>
-
-#include "freertos/FreeRTOS.h"
-#include "freertos/event_groups.h"
-#include "freertos/queue.h"
-#include "freertos/task.h"
 
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
 
-#include "lwip/err.h"
-#include "lwip/sockets.h"
-
-#define DNS_LEN  512
-#define DNS_PORT 53
+#include "lwip/inet.h"
+#if CONFIG_CAPT_DNS_ANSWER_AAAA
+#include "lwip/ip6_addr.h"
+#include "lwip/netif.h"
+#include "lwip/priv/tcpip_priv.h"
+#endif
 
 static const char* TAG = "capt_dns";
 
-static int _sockFd;
+static bool _is_started = false;
 static esp_netif_ip_info_t _ip_info_of_softap;
+static capt_dns_stats_t _stats;
+static capt_dns_mode_t _mode = CAPT_DNS_MODE_CAPTIVE;
+static capt_dns_client_filter_t _client_filter = NULL;
 
-/* Signal Wi-Fi events on this event-group */
-const EventBits_t DNS_SERVER_STOP_REQUESTED_EVENT = BIT0;
-const EventBits_t DNS_SERVER_STOP_COMPLETE_EVENT = BIT1;
-static EventGroupHandle_t _capt_dns_event_group = NULL;
-
-typedef struct __attribute__((packed)) {
-    uint16_t id;
-    uint8_t flags;
-    uint8_t rcode;
-    uint16_t qdcount;
-    uint16_t ancount;
-    uint16_t nscount;
-    uint16_t arcount;
-} DnsHeader;
-
-typedef struct __attribute__((packed)) {
-    uint8_t len;
-    uint8_t data;
-} DnsLabel;
-
-typedef struct __attribute__((packed)) {
-    // before: label
-    uint16_t type;
-    uint16_t class;
-} DnsQuestionFooter;
-
-typedef struct __attribute__((packed)) {
-    // before: label
-    uint16_t type;
-    uint16_t class;
-    uint32_t ttl;
-    uint16_t rdlength;
-    // after: rdata
-} DnsResourceFooter;
-
-typedef struct __attribute__((packed)) {
-    uint16_t prio;
-    uint16_t weight;
-} DnsUriHdr;
-
-#define FLAG_QR (1 << 7)
-#define FLAG_AA (1 << 2)
-#define FLAG_TC (1 << 1)
-#define FLAG_RD (1 << 0)
-
-#define QTYPE_A     1
-#define QTYPE_NS    2
-#define QTYPE_CNAME 5
-#define QTYPE_SOA   6
-#define QTYPE_WKS   11
-#define QTYPE_PTR   12
-#define QTYPE_HINFO 13
-#define QTYPE_MINFO 14
-#define QTYPE_MX    15
-#define QTYPE_TXT   16
-#define QTYPE_URI   256
-
-#define QCLASS_IN  1
-#define QCLASS_ANY 255
-#define QCLASS_URI 256
-
-/**
- * Note: The following replacements for host/network byte order conversion
- * functions since we are using packed structs to access the various DNS query
- * and response fields.
- */
-
-// Function to put unaligned 16-bit network values
-static void setn16(void* pp, int16_t n)
+static inline bool is_split_horizon(void)
 {
-    char* p = pp;
-    *p++ = (n >> 8);
-    *p++ = (n & 0xff);
+    return (_mode == CAPT_DNS_MODE_SPLIT_HORIZON);
 }
 
-// Function to put unaligned 32-bit network values
-static void setn32(void* pp, int32_t n)
-{
-    char* p = pp;
-    *p++ = (n >> 24) & 0xff;
-    *p++ = (n >> 16) & 0xff;
-    *p++ = (n >> 8) & 0xff;
-    *p++ = (n & 0xff);
-}
+#if CONFIG_CAPT_DNS_ANSWER_AAAA
+typedef struct {
+    struct tcpip_api_call_data call;
+    struct netif* netif;
+    const ip6_addr_t* addr;
+} add_ip6_call_t;
 
-// ntohs function for unaligned 16-bit network values
-static uint16_t my_ntohs(uint16_t* in)
+static err_t add_ip6_in_tcpip(struct tcpip_api_call_data* call)
 {
-    char* p = (char*)in;
-    return ((p[0] << 8) & 0xff00) | (p[1] & 0xff);
-}
+    add_ip6_call_t* msg = (add_ip6_call_t*)call;
+    s8_t idx;
 
-// Parses the QNAME field of a Question into a C-string containing a dotted domain name.
-// Returns pointer to start of next fields in packet (i.e. QTYPE and QCLASS).
-static char* label_to_str(char* packet, char* qnamePtr, int packetSz, char* res, int resMaxLen)
-{
-    int resIdx, currentLabelLen, currentLabelIdx;
-    char* endPtr = NULL;
-
-    resIdx = 0;
-
-    // For each label in QNAME field...
-    do {
-        if ((*qnamePtr & 0xC0) == 0) {
-            // Get length of this label and move past length octet.
-            currentLabelLen = *qnamePtr++;
-
-            // Add separator period if this is not the first label in qname field.
-            if (resIdx < resMaxLen && resIdx != 0)
-                res[resIdx++] = '.';
-
-            // Copy the label into the response buffer
-            for (currentLabelIdx = 0; currentLabelIdx < currentLabelLen; currentLabelIdx++) {
-                if ((qnamePtr - packet) > packetSz) {
-                    // Sanity check to ensure we do not run past the end of the DNS Query Request
-                    // packet.
-                    return NULL;
-                }
-                if (resIdx < resMaxLen) {
-                    // Copy one character
-                    res[resIdx++] = *qnamePtr++;
-                }
-            }
-        } else if ((*qnamePtr & 0xC0) == 0xC0) {
-            // Compressed label pointer
-            // Labels cannot be longer than 63 bytes. A length octet beginning with b11 means we
-            // have a 14-bit offset from start of DNS packet from which to read the rest of the
-            // QNAME field.
-            endPtr = qnamePtr + 2;
-
-            int offset = my_ntohs(((uint16_t*)qnamePtr)) & 0x3FFF;
-
-            // Check if offset points to somewhere outside of the packet
-            if (offset > packetSz) {
-                return NULL;
-            }
-
-            qnamePtr = &packet[offset];
-        }
-
-        // check for out-of-bound-ness
-        if ((qnamePtr - packet) > packetSz) {
-            return NULL;
-        }
-    } while (*qnamePtr != 0);
-
-    res[resIdx] = 0; // zero-terminate
-
-    // If end-pointer is not null, then we had a compressed field in the Query and qnamePtr is no
-    // longer pointing to the end of the same QNAME field. If end-pointer is null, then it was not
-    // used and qnamePtr is still referencing the same QNAME field.
-    if (endPtr == NULL) {
-        endPtr = qnamePtr + 1;
-    }
-
-    // Pointer to first byte following QNAME field we were asked to parses
-    return endPtr;
+    // Finds the existing slot if the address was added by an earlier start
+    return netif_add_ip6_address(msg->netif, msg->addr, &idx);
 }
 
-// Convert a dotted hostname string into a DNS QNAME field.
-static char* str_to_label(char* str, char* outBuff, int maxLen)
+// Adds the configured unique local address to the soft AP. Returns false if AAAA queries are to
+// get NODATA instead.
+static bool add_ula(esp_netif_t* softap_netif_handle, ip6_addr_t* ula)
 {
-    char* lenPtr = outBuff;       // Pointer to length byte preceding label currently being written.
-    char* writePtr = outBuff + 1; // Position in outBuff currently being written.
-
-    while (1) {
-        if ((*str == '.') || (*str == 0)) {
-            // Finished writing current label
-            *lenPtr = ((writePtr - lenPtr) - 1); // Write out the length for this label
-            lenPtr = writePtr; // Reposition the pointer to length byte for the next label
-            writePtr++;        // Update the write pointer
-            if (*str == 0)
-                break; // Exit if done
-            str++;     // Update the read pointer for the next label
-        } else {
-            *writePtr++ = *str++; // Copy one byte
-
-            // Check out of bounds
-            if ((writePtr - outBuff) > maxLen) {
-                return NULL;
-            }
-        }
-    }
+    esp_ip6_addr_t linklocal;
+    add_ip6_call_t msg = {.netif = esp_netif_get_netif_impl(softap_netif_handle), .addr = ula};
 
-    // Set final byte of QNAME field to 0 to indicate completion.
-    // (Compression is not used when writing QNAMEs back into the response.)
-    *lenPtr = 0;
-
-    // Return pointer to first free byte in response.
-    return writePtr;
+    if (!ip6addr_aton(CONFIG_CAPT_DNS_AAAA_ULA, ula) || !ip6_addr_isuniquelocal(ula)) {
+        ESP_LOGW(TAG, "\"%s\" is not a unique local address. AAAA queries get NODATA.",
+                 CONFIG_CAPT_DNS_AAAA_ULA);
+        return false;
+    }
+    if ((msg.netif == NULL) ||
+        (esp_netif_get_ip6_linklocal(softap_netif_handle, &linklocal) != ESP_OK)) {
+        ESP_LOGW(TAG, "Soft AP has no IPv6. AAAA queries get NODATA.");
+        return false;
+    }
+    // netif functions must only be called from the TCP/IP thread.
+    if (tcpip_api_call(add_ip6_in_tcpip, &msg.call) != ERR_OK) {
+        ESP_LOGW(TAG, "No room for another IPv6 address. AAAA queries get NODATA.");
+        return false;
+    }
+    return true;
 }
+#endif
 
-static bool is_stop_pending(void)
+static void build_record_templates(esp_netif_t* softap_netif_handle)
 {
-    EventBits_t bits = xEventGroupGetBits(_capt_dns_event_group);
-    if (bits & DNS_SERVER_STOP_REQUESTED_EVENT) {
-        return true;
-    } else {
-        return false;
+    uint8_t ip4[4] = {ip4_addr1(&_ip_info_of_softap.ip), ip4_addr2(&_ip_info_of_softap.ip),
+                      ip4_addr3(&_ip_info_of_softap.ip), ip4_addr4(&_ip_info_of_softap.ip)};
+    const uint8_t* ip6_bytes = NULL;
+
+#if CONFIG_CAPT_DNS_ANSWER_AAAA
+    ip6_addr_t ula;
+    if (add_ula(softap_netif_handle, &ula)) {
+        // ip6_addr_t holds the address as four words already in network byte order.
+        ip6_bytes = (const uint8_t*)ula.addr;
     }
+#endif
+
+    capt_dns_query_init(ip4, ip6_bytes);
 }
 
-// Receive a DNS packet and maybe send a response back
-static void capt_dns_recv(struct sockaddr_in* premote_addr, char* pusrdata, unsigned short length)
+static int answer_query(uint32_t src_key, const uint8_t* query, int length, uint8_t* reply,
+                        int reply_max)
 {
-    char buff[DNS_LEN];
-    char reply[DNS_LEN];
-    int i;
-    char* rend = &reply[length];
-    char* p = pusrdata;
-    DnsHeader* hdr = (DnsHeader*)p;
-    DnsHeader* rhdr = (DnsHeader*)&reply[0];
-    p += sizeof(DnsHeader);
-
-    ESP_LOGD(
-        TAG,
-        "DNS packet: id 0x%X flags 0x%X rcode 0x%X qcnt %d ancnt %d nscount %d arcount %d len %d",
-        my_ntohs(&hdr->id), hdr->flags, hdr->rcode, my_ntohs(&hdr->qdcount),
-        my_ntohs(&hdr->ancount), my_ntohs(&hdr->nscount), my_ntohs(&hdr->arcount), length);
-
-    // Some sanity checks:
-    // TODO: Should an error be returned to the requester if the sanity checks fail?
-
-    if (length > DNS_LEN) {
-        // Packet is longer than DNS implementation allows.
-        return;
+    int reply_len;
+
+    _stats.queries++;
+
+#if CONFIG_CAPT_DNS_RATELIMIT
+    switch (capt_dns_ratelimit_check(src_key)) {
+    case CAPT_DNS_RATELIMIT_DROP:
+        _stats.dropped++;
+        return 0;
+    case CAPT_DNS_RATELIMIT_REFUSE:
+        _stats.refused++;
+        return capt_dns_build_error_reply(query, length, reply, reply_max, DNS_RCODE_REFUSED);
+    default:
+        break;
     }
+#endif
 
-    if (length < sizeof(DnsHeader)) {
-        // Packet is too short.
-        return;
+#if CONFIG_CAPT_DNS_SPLIT_HORIZON
+    if (is_split_horizon() && !capt_dns_is_local_query(query, length)) {
+        _stats.forwarded++;
+        return CAPT_DNS_FORWARD;
     }
 
-    if (hdr->ancount || hdr->nscount || hdr->arcount) {
-        // This is a reply... but we are the server.
-        // Don't know what to do with it.
-        return;
+    if (!is_split_horizon() && _client_filter && !_client_filter(src_key)) {
+        // Exempt from the portal: no made-up answers for this client
+        _stats.forwarded++;
+        return CAPT_DNS_FORWARD;
     }
+#endif
 
-    if (hdr->flags & FLAG_TC) {
-        // The packet is truncated. We can't work with truncated packets.
-        return;
+    reply_len = capt_dns_build_reply(query, length, reply, reply_max);
+    if (reply_len > 0) {
+        _stats.answered++;
     }
+    return reply_len;
+}
 
-    // Reply is basically the request plus the needed data
-    memcpy(reply, pusrdata, length);
-
-    // Set Query Response flag in response header
-    rhdr->flags |= FLAG_QR;
-
-    // For each Question in request packet...
-    for (i = 0; i < my_ntohs(&hdr->qdcount); i++) {
-        // Grab the labels in the QNAME field
-        // These, concatenated together with dots, represent the domain name being queried.
-        p = label_to_str(pusrdata, p, length, buff, sizeof(buff));
-        if (p == NULL) {
-            // Invalid request. Return error?
-            return;
-        }
-
-        DnsQuestionFooter* qf = (DnsQuestionFooter*)p;
-        p += sizeof(DnsQuestionFooter);
-
-        ESP_LOGI(TAG, "DNS: Q (type 0x%X class 0x%X) for %s", my_ntohs(&qf->type),
-                 my_ntohs(&qf->class), buff);
-
-        if (my_ntohs(&qf->type) == QTYPE_A) {
-            // They want to know the IPv4 address of something.
-            // Build the response.
-
-            // This is where we institute our captive portal and return our local IP address for
-            // everything.
-
-            // Add the label
-            rend = str_to_label(buff, rend, sizeof(reply) - (rend - reply));
-            if (rend == NULL) {
-                return;
-            }
-
-            DnsResourceFooter* rf = (DnsResourceFooter*)rend;
-            rend += sizeof(DnsResourceFooter);
-
-            setn16(&rf->type, QTYPE_A);
-            setn16(&rf->class, QCLASS_IN);
-            setn32(&rf->ttl, 0);
-            setn16(&rf->rdlength, 4); // Response is IPv4 address, which is 4 bytes
-
-            // Always respond with our IP address
-            *rend++ = ip4_addr1(&_ip_info_of_softap.ip);
-            *rend++ = ip4_addr2(&_ip_info_of_softap.ip);
-            *rend++ = ip4_addr3(&_ip_info_of_softap.ip);
-            *rend++ = ip4_addr4(&_ip_info_of_softap.ip);
-
-            setn16(&rhdr->ancount, my_ntohs(&rhdr->ancount) + 1);
-
-            ESP_LOGD(TAG, "IP Address:  %s", inet_ntoa(_ip_info_of_softap.ip));
-            ESP_LOGD(TAG, "Added A rec to resp. Resp len is %d", (rend - reply));
-
-        } else if (my_ntohs(&qf->type) == QTYPE_NS) {
-            // They are requesting a name server.
-            // Basically, we can respond with whatever we want because it will get resolved
-            // to our IP address later anyway.
-
-            rend = str_to_label(buff, rend, sizeof(reply) - (rend - reply));
-
-            DnsResourceFooter* rf = (DnsResourceFooter*)rend;
-            rend += sizeof(DnsResourceFooter);
-
-            setn16(&rf->type, QTYPE_NS);
-            setn16(&rf->class, QCLASS_IN);
-            setn16(&rf->ttl, 0);
-            setn16(&rf->rdlength, 4);
-
-            // Here is the "whatever we want" part.
-            // Our name server is "ns".
-            *rend++ = 2;
-            *rend++ = 'n';
-            *rend++ = 's';
-            *rend++ = 0;
-
-            setn16(&rhdr->ancount, my_ntohs(&rhdr->ancount) + 1);
-
-            ESP_LOGD(TAG, "Added NS rec to resp. Resp len is %d", (rend - reply));
-
-        } else if (my_ntohs(&qf->type) == QTYPE_URI) {
-            // Give uri to us
-
-            rend = str_to_label(buff, rend, sizeof(reply) - (rend - reply));
-
-            DnsResourceFooter* rf = (DnsResourceFooter*)rend;
-            rend += sizeof(DnsResourceFooter);
-
-            DnsUriHdr* uh = (DnsUriHdr*)rend;
-            rend += sizeof(DnsUriHdr);
-
-            setn16(&rf->type, QTYPE_URI);
-            setn16(&rf->class, QCLASS_URI);
-            setn16(&rf->ttl, 0);
-            setn16(&rf->rdlength, 4 + 16);
-
-            setn16(&uh->prio, 10);
-            setn16(&uh->weight, 1);
-            memcpy(rend, "http://esp.nonet", 16);
-            rend += 16;
-            setn16(&rhdr->ancount, my_ntohs(&rhdr->ancount) + 1);
-
-            ESP_LOGD(TAG, "Added NS rec to resp. Resp len is %d", (rend - reply));
-        }
-    }
+int capt_dns_handle_query(uint32_t src_key, const uint8_t* query, int length, uint8_t* reply,
+                          int reply_max)
+{
+#if CONFIG_CAPT_DNS_TELEMETRY
+    int64_t start_us = esp_timer_get_time();
+    int reply_len = answer_query(src_key, query, length, reply, reply_max);
+    capt_dns_telemetry_record(src_key, query, length, esp_timer_get_time() - start_us);
+    return reply_len;
+#else
+    return answer_query(src_key, query, length, reply, reply_max);
+#endif
+}
 
-    // Send the response
-    ESP_LOGD(TAG, "Sending response");
-    sendto(_sockFd, (uint8_t*)reply, rend - reply, 0, (struct sockaddr*)premote_addr,
-           sizeof(struct sockaddr_in));
+void capt_dns_get_stats(capt_dns_stats_t* stats)
+{
+    *stats = _stats;
 }
 
-static void capt_dns_task(void* pvParameters)
+esp_err_t capt_dns_start(const capt_dns_config_t* config)
 {
-    struct sockaddr_in server_addr;
-    int ret;
-    struct sockaddr_in from;
-    socklen_t fromlen;
-    char udp_msg[DNS_LEN];
-
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(DNS_PORT);
-    server_addr.sin_len = sizeof(server_addr);
-
-    _sockFd = -1;
-    while ((_sockFd == -1) && (!is_stop_pending())) {
-        _sockFd = socket(AF_INET, SOCK_DGRAM, 0);
-        if (_sockFd == -1) {
-            ESP_LOGW(TAG, "capt_dns_task failed to create socket!\nTrying again in 1000ms.");
-            vTaskDelay(1000 / portTICK_RATE_MS);
-        }
-    }
+    esp_netif_t* softap_netif_handle = config->netif_handle;
 
-    ret = -1;
-    while ((ret != 0) && (!is_stop_pending())) {
-        ret = bind(_sockFd, (struct sockaddr*)&server_addr, sizeof(server_addr));
-        if (ret != 0) {
-            ESP_LOGW(TAG, "capt_dns_task failed to bind sock!\nTrying again in 1000ms.");
-            vTaskDelay(1000 / portTICK_RATE_MS);
-        }
+    if (_is_started) {
+        return ESP_ERR_INVALID_STATE;
     }
 
-    // We need socket to be non-blocking so that we can keep checking
-    // whether there's been a request to stop the DNS server.
-    ret = -1;
-    while ((ret != 0) && (!is_stop_pending())) {
-        int flags = fcntl(_sockFd, F_GETFL, 0);
-        if (flags == -1) {
-            continue;
-        }
-        flags |= O_NONBLOCK;
-        ret = fcntl(_sockFd, F_SETFL, flags);
+#if CONFIG_CAPT_DNS_SPLIT_HORIZON
+    if ((config->mode == CAPT_DNS_MODE_SPLIT_HORIZON) &&
+        !capt_dns_set_local_names(config->local_hosts, config->num_local_hosts)) {
+        ESP_LOGE(TAG, "Invalid local host names.");
+        return ESP_ERR_INVALID_ARG;
     }
-
-    if (!is_stop_pending()) {
-        ESP_LOGI(TAG, "capt_dns initialization complete.");
+#else
+    if (config->mode != CAPT_DNS_MODE_CAPTIVE) {
+        return ESP_ERR_NOT_SUPPORTED;
     }
-
-    while (!is_stop_pending()) {
-        memset(&from, 0, sizeof(from));
-        fromlen = sizeof(struct sockaddr_in);
-
-        do {
-            ret = recvfrom(_sockFd, (uint8_t*)udp_msg, DNS_LEN, 0, (struct sockaddr*)&from,
-                           (socklen_t*)&fromlen);
-            vTaskDelay(200 / portTICK_RATE_MS);
-        } while ((ret == -1) && (errno == EWOULDBLOCK) && (!is_stop_pending()));
-
-        if (ret > 0) {
-            // The DNS server sees incoming packets from both AP and STA interfaces.
-            // We need to make sure we only respond to requests on the AP interface.
-            if ((from.sin_addr.s_addr & _ip_info_of_softap.netmask.addr) ==
-                (_ip_info_of_softap.ip.addr & _ip_info_of_softap.netmask.addr)) {
-                capt_dns_recv(&from, udp_msg, ret);
-            } else {
-                ESP_LOGI(TAG, "Ignoring packet from wrong interface.");
-            }
-        }
+#endif
+    if (!capt_dns_set_policies(config->policies, config->num_policies)) {
+        ESP_LOGE(TAG, "Invalid DNS policies.");
+        return ESP_ERR_INVALID_ARG;
     }
+    _mode = config->mode;
+    _client_filter = config->client_filter;
 
-    ESP_LOGI(TAG, "Closing captive portal DNS listen socket");
-    close(_sockFd);
-
-    xEventGroupClearBits(_capt_dns_event_group, DNS_SERVER_STOP_REQUESTED_EVENT);
-    xEventGroupSetBits(_capt_dns_event_group, DNS_SERVER_STOP_COMPLETE_EVENT);
-
-    vTaskDelete(NULL);
-}
-
-esp_err_t capt_dns_start(esp_netif_t* softap_netif_handle)
-{
     esp_err_t ret = esp_netif_get_ip_info(softap_netif_handle, &_ip_info_of_softap);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to get IP info for softAP interface.");
         return ret;
     }
 
-    // xEventGroupCreateStatic() is not available?
-    _capt_dns_event_group = xEventGroupCreate();
+    build_record_templates(softap_netif_handle);
+#if CONFIG_CAPT_DNS_RATELIMIT
+    capt_dns_ratelimit_reset();
+#endif
 
-    ESP_LOGI(TAG, "Activating captive portal DNS server");
+    ESP_LOGI(TAG, "Activating %s DNS server",
+             is_split_horizon() ? "split-horizon" : "captive portal");
 
-    // ESP-IDF UDP server example passes the address family as the pvParameters
-    // argument to xTaskCreate.  In our case, we are always using AF_INET, so
-    // we pass NULL for pvParameters instead.
-    xTaskCreate(capt_dns_task, "captdns_task", 4096, NULL, 5, NULL);
+    ret = capt_dns_backend_start(softap_netif_handle, &_ip_info_of_softap);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start DNS server backend.");
+        return ret;
+    }
 
+    _is_started = true;
     return ESP_OK;
 }
 
 void capt_dns_stop(void)
 {
-    if (!_capt_dns_event_group) {
+    if (!_is_started) {
         return;
     }
 
-    ESP_LOGI(TAG, "Signaling DNS server task to close socket and shut down");
-
-    // Signal the server thread to stop and then wait for it to signal back.
-    xEventGroupSetBits(_capt_dns_event_group, DNS_SERVER_STOP_REQUESTED_EVENT);
-    xEventGroupWaitBits(_capt_dns_event_group, DNS_SERVER_STOP_COMPLETE_EVENT, false, true,
-                        portMAX_DELAY);
-
-    vEventGroupDelete(_capt_dns_event_group);
-    _capt_dns_event_group = NULL;
+    capt_dns_backend_stop();
+    _is_started = false;
 
     ESP_LOGI(TAG, "Captive portal DNS server deactivated.");
 }
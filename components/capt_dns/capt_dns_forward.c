@@ -0,0 +1,377 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Upstream forwarder for split-horizon mode. Queries for names outside the local host table are
+relayed to the DNS server of the station interface under a fresh message ID, and the replies are
+matched back to the client. Answers are kept in a small LRU cache and served with their TTLs
+counted down.
+
+Everything here runs in the socket backend's task, so no locking is needed.
+*/
+
+#include "capt_dns_priv.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_system.h"
+#include "sdkconfig.h"
+
+#include "lwip/sockets.h"
+
+static const char* TAG = "capt_dns_fwd";
+
+/* Pending queries older than this are considered lost and their slots are reused */
+#define FORWARD_TIMEOUT_MS 5000
+
+/* Port of the upstream server. The host test points it at its stand-in resolver. */
+#ifndef CAPT_DNS_UPSTREAM_PORT
+#define CAPT_DNS_UPSTREAM_PORT DNS_PORT
+#endif
+
+/* Larger replies are passed on but not cached. A handful of A/AAAA records fit easily. */
+#define CACHE_MSG_MAX 256
+
+#define DNS_FLAG_QR    0x80 // Byte 2 of the header
+#define DNS_FLAG_TC    0x02 // Byte 2 of the header
+#define DNS_RCODE_MASK 0x0F // Byte 3 of the header
+#define DNS_NOERROR    0
+#define DNS_NXDOMAIN   3
+#define DNS_TYPE_OPT   41
+
+typedef struct {
+    bool in_use;
+    uint16_t upstream_id;
+    uint16_t client_id;
+    uint32_t key;
+    uint32_t sent_ms;
+    struct sockaddr_storage client;
+    struct sockaddr_in server;
+} PendingQuery;
+
+typedef struct {
+    uint16_t len; // 0 for an empty entry
+    uint32_t key;
+    uint32_t stored_ms;
+    uint32_t expires_ms;
+    uint32_t last_used; // LRU stamp
+    uint8_t msg[CACHE_MSG_MAX];
+} CacheEntry;
+
+static int _fwdFd = -1;
+static PendingQuery _pending[CONFIG_CAPT_DNS_FORWARD_PENDING];
+static CacheEntry _cache[CONFIG_CAPT_DNS_FORWARD_CACHE_SIZE];
+static uint32_t _lru_clock;
+
+/* Outgoing queries are rewritten here */
+static uint8_t _upstream_msg[DNS_LEN];
+
+static uint32_t now_ms(void)
+{
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+static uint16_t get16(const uint8_t* p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static void put16(uint8_t* p, uint16_t n)
+{
+    p[0] = n >> 8;
+    p[1] = n & 0xff;
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static void put32(uint8_t* p, uint32_t n)
+{
+    put16(p, n >> 16);
+    put16(p + 2, n & 0xffff);
+}
+
+// Looks up the main DNS server of the station interface, as obtained by DHCP.
+static bool get_upstream_server(struct sockaddr_in* server)
+{
+    esp_netif_dns_info_t dns;
+
+    esp_netif_t* sta = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+    if ((sta == NULL) || (esp_netif_get_dns_info(sta, ESP_NETIF_DNS_MAIN, &dns) != ESP_OK) ||
+        (dns.ip.type != ESP_IPADDR_TYPE_V4) || (dns.ip.u_addr.ip4.addr == 0)) {
+        return false;
+    }
+
+    memset(server, 0, sizeof(*server));
+    server->sin_family = AF_INET;
+    server->sin_addr.s_addr = dns.ip.u_addr.ip4.addr;
+    server->sin_port = htons(CAPT_DNS_UPSTREAM_PORT);
+    server->sin_len = sizeof(*server);
+    return true;
+}
+
+// Record visitors. rr points at TYPE, followed by CLASS (+2), TTL (+4) and RDLENGTH (+8).
+
+// Keep the upstream reply within what we can receive: advertise no more than DNS_LEN.
+static void clamp_udp_size(uint16_t type, uint8_t* rr, void* arg)
+{
+    if ((type == DNS_TYPE_OPT) && (get16(rr + 2) > DNS_LEN)) {
+        put16(rr + 2, DNS_LEN);
+    }
+}
+
+static void find_min_ttl(uint16_t type, uint8_t* rr, void* arg)
+{
+    uint32_t* min_ttl = arg;
+    if ((type != DNS_TYPE_OPT) && (get32(rr + 4) < *min_ttl)) {
+        *min_ttl = get32(rr + 4);
+    }
+}
+
+static void age_ttl(uint16_t type, uint8_t* rr, void* arg)
+{
+    uint32_t elapsed_s = *(uint32_t*)arg;
+    uint32_t ttl = get32(rr + 4);
+    if (type != DNS_TYPE_OPT) {
+        put32(rr + 4, (ttl > elapsed_s) ? (ttl - elapsed_s) : 0);
+    }
+}
+
+static CacheEntry* cache_find(uint32_t key, const uint8_t* query, int questionEnd, uint32_t now)
+{
+    int idx;
+
+    for (idx = 0; idx < CONFIG_CAPT_DNS_FORWARD_CACHE_SIZE; idx++) {
+        CacheEntry* entry = &_cache[idx];
+        if ((entry->len == 0) || (entry->key != key)) {
+            continue;
+        }
+        if ((int32_t)(entry->expires_ms - now) <= 0) {
+            entry->len = 0;
+            continue;
+        }
+        if ((entry->len >= questionEnd) &&
+            capt_dns_question_equal(entry->msg, questionEnd, query, questionEnd)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void cache_store(uint32_t key, const uint8_t* reply, int length, uint32_t now)
+{
+    CacheEntry* victim = NULL;
+    uint32_t ttl = CONFIG_CAPT_DNS_FORWARD_CACHE_MAX_TTL;
+    int idx;
+
+    if ((length > CACHE_MSG_MAX) || (reply[2] & DNS_FLAG_TC)) {
+        return;
+    }
+    if (((reply[3] & DNS_RCODE_MASK) != DNS_NOERROR) &&
+        ((reply[3] & DNS_RCODE_MASK) != DNS_NXDOMAIN)) {
+        return;
+    }
+
+    // Reuse the entry of the same key, or else the first empty one, or else the least recently
+    // used one.
+    for (idx = 0; idx < CONFIG_CAPT_DNS_FORWARD_CACHE_SIZE; idx++) {
+        CacheEntry* entry = &_cache[idx];
+        if ((entry->len != 0) && (entry->key == key)) {
+            victim = entry;
+            break;
+        }
+        if ((victim == NULL) || ((victim->len != 0) &&
+                                 ((entry->len == 0) || (entry->last_used < victim->last_used)))) {
+            victim = entry;
+        }
+    }
+
+    memcpy(victim->msg, reply, length);
+    // The OPT record of the reply belongs to the requester that triggered it.
+    int cachedLen = capt_dns_strip_additional(victim->msg, length);
+    if ((cachedLen < 0) ||
+        (capt_dns_for_each_record(victim->msg, cachedLen, find_min_ttl, &ttl) != 0)) {
+        victim->len = 0;
+        return;
+    }
+
+    if ((get16(&victim->msg[6]) == 0) && (get16(&victim->msg[8]) == 0)) {
+        // Negative answer without SOA
+        ttl = (ttl < CONFIG_CAPT_DNS_NEGATIVE_TTL) ? ttl : CONFIG_CAPT_DNS_NEGATIVE_TTL;
+    }
+
+    if (ttl == 0) {
+        victim->len = 0;
+        return;
+    }
+
+    victim->len = cachedLen;
+    victim->key = key;
+    victim->stored_ms = now;
+    victim->expires_ms = now + ttl * 1000;
+    victim->last_used = ++_lru_clock;
+}
+
+static int cache_serve(CacheEntry* entry, const uint8_t* query, int questionEnd, uint8_t* reply,
+                       int reply_max, uint32_t now)
+{
+    uint32_t elapsed_s = (now - entry->stored_ms) / 1000;
+
+    if (entry->len > reply_max) {
+        return 0;
+    }
+    memcpy(reply, entry->msg, entry->len);
+    // Echo ID and question as asked; clients may randomize the case of the name (0x20 bit).
+    memcpy(reply, query, 2);
+    memcpy(&reply[12], &query[12], questionEnd - 12);
+    capt_dns_for_each_record(reply, entry->len, age_ttl, &elapsed_s);
+
+    entry->last_used = ++_lru_clock;
+    return entry->len;
+}
+
+static PendingQuery* pending_alloc(uint32_t now)
+{
+    PendingQuery* oldest = &_pending[0];
+    int idx;
+
+    for (idx = 0; idx < CONFIG_CAPT_DNS_FORWARD_PENDING; idx++) {
+        PendingQuery* p = &_pending[idx];
+        if (!p->in_use || ((now - p->sent_ms) > FORWARD_TIMEOUT_MS)) {
+            return p;
+        }
+        if ((int32_t)(p->sent_ms - oldest->sent_ms) < 0) {
+            oldest = p;
+        }
+    }
+    // All slots busy. The oldest query is the most likely to be lost anyway.
+    return oldest;
+}
+
+static PendingQuery* pending_find(uint16_t upstream_id)
+{
+    int idx;
+
+    for (idx = 0; idx < CONFIG_CAPT_DNS_FORWARD_PENDING; idx++) {
+        if (_pending[idx].in_use && (_pending[idx].upstream_id == upstream_id)) {
+            return &_pending[idx];
+        }
+    }
+    return NULL;
+}
+
+int capt_dns_forward_open(void)
+{
+    memset(_pending, 0, sizeof(_pending));
+
+    _fwdFd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (_fwdFd == -1) {
+        ESP_LOGW(TAG, "Failed to create upstream socket.");
+    }
+    return _fwdFd;
+}
+
+void capt_dns_forward_close(void)
+{
+    if (_fwdFd != -1) {
+        close(_fwdFd);
+        _fwdFd = -1;
+    }
+    memset(_pending, 0, sizeof(_pending));
+}
+
+int capt_dns_forward_query(const struct sockaddr_storage* client, const uint8_t* query,
+                           int length, uint8_t* reply, int reply_max)
+{
+    struct sockaddr_in server;
+    uint32_t key;
+    uint32_t now = now_ms();
+
+    int questionEnd = capt_dns_question_key(query, length, &key);
+    if (questionEnd < 0) {
+        return 0;
+    }
+
+    CacheEntry* entry = cache_find(key, query, questionEnd, now);
+    if (entry != NULL) {
+        return cache_serve(entry, query, questionEnd, reply, reply_max, now);
+    }
+
+    if ((_fwdFd == -1) || !get_upstream_server(&server) ||
+        ((client->ss_family == AF_INET) &&
+         (server.sin_addr.s_addr == ((const struct sockaddr_in*)client)->sin_addr.s_addr))) {
+        // No usable upstream (station not connected yet). Fail fast rather than let the
+        // client time out.
+        return capt_dns_build_error_reply(query, length, reply, reply_max, DNS_RCODE_SERVFAIL);
+    }
+
+    PendingQuery* p = pending_alloc(now);
+    do {
+        p->upstream_id = esp_random() & 0xffff;
+    } while (pending_find(p->upstream_id) != NULL);
+    p->client_id = get16(query);
+    p->key = key;
+    p->sent_ms = now;
+    p->client = *client;
+    p->server = server;
+    p->in_use = true;
+
+    memcpy(_upstream_msg, query, length);
+    put16(_upstream_msg, p->upstream_id);
+    capt_dns_for_each_record(_upstream_msg, length, clamp_udp_size, NULL);
+
+    if (sendto(_fwdFd, _upstream_msg, length, 0, (struct sockaddr*)&server, sizeof(server)) < 0) {
+        ESP_LOGD(TAG, "Forwarding failed (errno %d)", errno);
+        p->in_use = false;
+    }
+    return 0;
+}
+
+int capt_dns_forward_recv(struct sockaddr_storage* client, uint8_t* reply, int reply_max)
+{
+    struct sockaddr_in from;
+    socklen_t fromlen = sizeof(from);
+    uint32_t key;
+
+    int length =
+        recvfrom(_fwdFd, reply, reply_max, MSG_DONTWAIT, (struct sockaddr*)&from, &fromlen);
+    if ((length < 12) || !(reply[2] & DNS_FLAG_QR)) {
+        return 0;
+    }
+
+    // Only accept the reply from the server the query was sent to and for the same question.
+    PendingQuery* p = pending_find(get16(reply));
+    if ((p == NULL) || (from.sin_addr.s_addr != p->server.sin_addr.s_addr) ||
+        (from.sin_port != p->server.sin_port) ||
+        (capt_dns_question_key(reply, length, &key) < 0) || (key != p->key)) {
+        ESP_LOGD(TAG, "Dropping unexpected upstream reply");
+        return 0;
+    }
+    p->in_use = false;
+
+    cache_store(key, reply, length, now_ms());
+
+    put16(reply, p->client_id);
+    *client = p->client;
+    return length;
+}
@@ -0,0 +1,195 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CAPT_DNS_PRIV_H
+#define CAPT_DNS_PRIV_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <esp_netif.h>
+
+#include "sdkconfig.h"
+
+#include "lwip/sockets.h"
+
+#include "capt_dns_query.h"
+
+/* Returned by capt_dns_handle_query() in split-horizon mode for queries that
+ * are not about a local host name and have to be forwarded upstream. */
+#define CAPT_DNS_FORWARD (-1)
+
+/**
+ * @brief   Source key of an IPv6 address: its four words XORed together.
+ *
+ * @param[in] words Address as four words in network byte order
+ */
+static inline uint32_t capt_dns_ip6_key(const uint32_t words[4])
+{
+    return words[0] ^ words[1] ^ words[2] ^ words[3];
+}
+
+/**
+ * @brief   Handles a DNS query and builds the reply to it.
+ *
+ * This is the query-processing core shared by the backends. It applies rate
+ * limiting, updates the statistics and does no I/O.
+ *
+ * @param[in]  src_key   Source address of the query (IPv4 address in network
+ *                       byte order, or the four words of an IPv6 address
+ *                       XORed together) used to select its rate-limit bucket
+ * @param[in]  query     Received DNS message
+ * @param[in]  length    Length of the received message
+ * @param[out] reply     Buffer to build the reply into
+ * @param[in]  reply_max Size of the reply buffer
+ *
+ * @return
+ *  - Length of the reply in bytes
+ *  - 0 if the message should not be answered
+ *  - CAPT_DNS_FORWARD if the query has to be resolved upstream
+ */
+int capt_dns_handle_query(uint32_t src_key, const uint8_t* query, int length, uint8_t* reply,
+                          int reply_max);
+
+/**
+ * @brief   Starts the backend that receives queries and sends replies.
+ *
+ * Implemented by either capt_dns_sock.c or capt_dns_raw.c depending on
+ * CONFIG_CAPT_DNS_BACKEND.
+ *
+ * @param[in] softap_netif_handle Interface on which to answer queries
+ * @param[in] ip_info             IP info of that interface
+ */
+esp_err_t capt_dns_backend_start(esp_netif_t* softap_netif_handle,
+                                 const esp_netif_ip_info_t* ip_info);
+
+/**
+ * @brief   Stops the backend. Returns once no more queries will be processed.
+ */
+void capt_dns_backend_stop(void);
+
+typedef enum
+{
+    CAPT_DNS_RATELIMIT_ADMIT,
+    CAPT_DNS_RATELIMIT_DROP,
+    CAPT_DNS_RATELIMIT_REFUSE,
+} capt_dns_ratelimit_verdict_t;
+
+/**
+ * @brief   Charges one query against the bucket of its source and the overall
+ *          budget. Implemented in capt_dns_ratelimit.c.
+ *
+ * @param[in] src_key Source address of the query
+ *
+ * @return  Whether to answer, drop or refuse the query
+ */
+capt_dns_ratelimit_verdict_t capt_dns_ratelimit_check(uint32_t src_key);
+
+/**
+ * @brief   Forgets all sources and refills the overall budget.
+ */
+void capt_dns_ratelimit_reset(void);
+
+/**
+ * @brief   Records one query in the telemetry ring and counters. Implemented in
+ *          capt_dns_telemetry.c. Must only be called from a single task.
+ *
+ * @param[in] src_key    Source address of the query
+ * @param[in] query      Received DNS message
+ * @param[in] length     Length of the received message
+ * @param[in] service_us Time taken to handle the query
+ */
+void capt_dns_telemetry_record(uint32_t src_key, const uint8_t* query, int length,
+                               uint32_t service_us);
+
+#if CONFIG_CAPT_DNS_SPLIT_HORIZON
+/**
+ * @brief   Opens the upstream socket of the forwarder. Implemented in
+ *          capt_dns_forward.c and driven by the socket backend's task.
+ *
+ * @return  Socket to wait on for upstream replies, or -1 on failure
+ */
+int capt_dns_forward_open(void);
+
+/**
+ * @brief   Closes the upstream socket and forgets all pending queries. The
+ *          answer cache is kept.
+ */
+void capt_dns_forward_close(void);
+
+/**
+ * @brief   Answers a query from the cache or sends it to the upstream server.
+ *
+ * @param[in]  client    Address the query came from
+ * @param[in]  query     Query, already validated by capt_dns_handle_query()
+ * @param[in]  length    Length of the query
+ * @param[out] reply     Buffer for a reply that can be sent right away
+ * @param[in]  reply_max Size of the reply buffer
+ *
+ * @return  Length of the reply, or 0 if the query was forwarded (or dropped)
+ */
+int capt_dns_forward_query(const struct sockaddr_storage* client, const uint8_t* query,
+                           int length, uint8_t* reply, int reply_max);
+
+/**
+ * @brief   Receives one reply from the upstream server and matches it to its
+ *          pending query.
+ *
+ * @param[out] client    Address to send the reply to
+ * @param[out] reply     Buffer for the reply
+ * @param[in]  reply_max Size of the reply buffer
+ *
+ * @return  Length of the reply, or 0 if nothing is to be sent
+ */
+int capt_dns_forward_recv(struct sockaddr_storage* client, uint8_t* reply, int reply_max);
+#endif
+
+#if CONFIG_CAPT_DNS_TCP
+/**
+ * @brief   Opens the TCP listener. Implemented in capt_dns_tcp.c and driven by
+ *          the socket backend's task.
+ *
+ * @return  false if the listener could not be opened (TCP is then not served)
+ */
+bool capt_dns_tcp_start(void);
+
+/**
+ * @brief   Closes all client connections and the listener.
+ */
+void capt_dns_tcp_stop(void);
+
+/**
+ * @brief   Adds the listener and all client connections to a select() read set.
+ *
+ * @return  New highest descriptor in the set
+ */
+int capt_dns_tcp_fill_fdset(fd_set* read_set, int max_fd);
+
+/**
+ * @brief   Whether no client connection is open. Otherwise select() has to
+ *          time out in time to close idle connections.
+ */
+bool capt_dns_tcp_is_idle(void);
+
+/**
+ * @brief   Accepts new connections, answers complete messages and closes idle
+ *          connections.
+ *
+ * @param[in] read_set Result of select()
+ * @param[in] ip_info  Soft AP IP info, connections from other subnets are refused
+ */
+void capt_dns_tcp_process(const fd_set* read_set, const esp_netif_ip_info_t* ip_info);
+#endif
+
+#endif
@@ -0,0 +1,1166 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Jeroen Domburg <jeroen@spritesmods.com> wrote this file. As long as you retain
+ * this notice you can do whatever you want with this stuff. If we meet some day,
+ * and you think this stuff is worth it, you can buy me a beer in return.
+ *
+ * modified for ESP32 by Cornelis
+ * Cornelis' version is available at: https://github.com/cornelis-61/esp32_Captdns
+ *
+ * modified for ESP32 v4.2 by Aaron Fontaine
+ * Additional modifications by Aaron Fontaine
+ *  - Fixed IP taken from network interface provided to start function.
+ *  - Captive DNS operation restricted to interface provided to start function.
+ *  - Ability to stop the DNS server.
+ *
+ * Note: This code appears to have originally been copied from ESP-IDF UDP server
+ * example and modified (license CC0 or Public Domain at user's discretion.)
+ * ----------------------------------------------------------------------------
+ */
+
+/*
+Query parsing and reply building of the captive portal DNS server. This file only uses the C
+library so it can be built and exercised on a development host; the ESP-IDF specifics stay in
+capt_dns.c and the backends.
+*/
+
+#include "capt_dns_query.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "esp_log.h"
+#include "sdkconfig.h"
+#else
+// Host build: no logging, and the defaults of the Kconfig options used here. Query logging is
+// on so that label_to_str() runs, but its output goes nowhere.
+#define ESP_LOG_INFO           3
+#define esp_log_level_get(tag) ESP_LOG_INFO
+#define ESP_LOGD(tag, ...) \
+    do {                   \
+        (void)(tag);       \
+    } while (0)
+#define ESP_LOGI ESP_LOGD
+#ifndef CONFIG_CAPT_DNS_LOG_QUERIES
+#define CONFIG_CAPT_DNS_LOG_QUERIES 1
+#endif
+#ifndef CONFIG_CAPT_DNS_NEGATIVE_TTL
+#define CONFIG_CAPT_DNS_NEGATIVE_TTL 60
+#endif
+#ifndef CONFIG_CAPT_DNS_SPLIT_HORIZON
+#define CONFIG_CAPT_DNS_SPLIT_HORIZON 1
+#endif
+#ifndef CONFIG_CAPT_DNS_LOCAL_HOSTS_MAX
+#define CONFIG_CAPT_DNS_LOCAL_HOSTS_MAX 4
+#endif
+#ifndef CONFIG_CAPT_DNS_POLICY_MAX
+#define CONFIG_CAPT_DNS_POLICY_MAX 16
+#endif
+#endif
+
+#if CONFIG_CAPT_DNS_LOG_QUERIES
+static const char* TAG = "capt_dns";
+#endif
+
+typedef struct __attribute__((packed)) {
+    uint16_t id;
+    uint8_t flags;
+    uint8_t rcode;
+    uint16_t qdcount;
+    uint16_t ancount;
+    uint16_t nscount;
+    uint16_t arcount;
+} DnsHeader;
+
+typedef struct __attribute__((packed)) {
+    uint8_t len;
+    uint8_t data;
+} DnsLabel;
+
+typedef struct __attribute__((packed)) {
+    // before: label
+    uint16_t type;
+    uint16_t class;
+} DnsQuestionFooter;
+
+typedef struct __attribute__((packed)) {
+    // before: label
+    uint16_t type;
+    uint16_t class;
+    uint32_t ttl;
+    uint16_t rdlength;
+    // after: rdata
+} DnsResourceFooter;
+
+typedef struct __attribute__((packed)) {
+    uint16_t prio;
+    uint16_t weight;
+} DnsUriHdr;
+
+#define FLAG_QR (1 << 7)
+#define FLAG_AA (1 << 2)
+#define FLAG_TC (1 << 1)
+#define FLAG_RD (1 << 0)
+
+#define QTYPE_A     1
+#define QTYPE_NS    2
+#define QTYPE_CNAME 5
+#define QTYPE_SOA   6
+#define QTYPE_WKS   11
+#define QTYPE_PTR   12
+#define QTYPE_HINFO 13
+#define QTYPE_MINFO 14
+#define QTYPE_MX    15
+#define QTYPE_TXT   16
+#define QTYPE_AAAA  28
+#define QTYPE_OPT   41
+#define QTYPE_URI   256
+
+#define QCLASS_IN  1
+#define QCLASS_ANY 255
+#define QCLASS_URI 256
+
+#define RCODE_NOERROR 0
+#define RCODE_FORMERR 1
+#define RCODE_NXDOMAIN 3
+#define RCODE_REFUSED 5
+#define RCODE_MASK    0x0F
+
+/* EDNS0 (RFC 6891) */
+#define EDNS_UDP_PAYLOAD_SIZE DNS_LEN // Advertised in our OPT record
+#define EDNS_VERSION          0
+#define EDNS_FLAG_DO          0x80 // DNSSEC OK bit (high byte of the OPT flags)
+#define EDNS_BADVERS_EXT      1    // Upper 8 bits of 12-bit rcode BADVERS (16)
+#define EDNS_OPT_RR_LEN       11   // Root name + fixed fields + empty RDATA
+
+typedef struct {
+    bool present;
+    uint16_t udp_size;
+    uint8_t version;
+    uint8_t flags;
+} EdnsInfo;
+
+/**
+ * Note: The following replacements for host/network byte order conversion
+ * functions since we are using packed structs to access the various DNS query
+ * and response fields.
+ */
+
+// Function to put unaligned 16-bit network values
+static void setn16(void* pp, int16_t n)
+{
+    char* p = pp;
+    *p++ = (n >> 8);
+    *p++ = (n & 0xff);
+}
+
+// Function to put unaligned 32-bit network values
+static void setn32(void* pp, int32_t n)
+{
+    char* p = pp;
+    *p++ = (n >> 24) & 0xff;
+    *p++ = (n >> 16) & 0xff;
+    *p++ = (n >> 8) & 0xff;
+    *p++ = (n & 0xff);
+}
+
+// ntohs function for unaligned 16-bit network values
+static uint16_t my_ntohs(uint16_t* in)
+{
+    uint8_t* p = (uint8_t*)in;
+    return (p[0] << 8) | p[1];
+}
+
+// ASCII-only case folding, as DNS names compare case-insensitively (RFC 4343)
+static inline uint8_t fold_case(uint8_t c)
+{
+    return ((c >= 'A') && (c <= 'Z')) ? (c + ('a' - 'A')) : c;
+}
+
+static bool equal_nocase(const uint8_t* a, const uint8_t* b, int len)
+{
+    int i;
+    for (i = 0; i < len; i++) {
+        if (fold_case(a[i]) != fold_case(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#if CONFIG_CAPT_DNS_LOG_QUERIES
+// Parses the QNAME field of a Question into a C-string containing a dotted domain name.
+// Returns pointer to start of next fields in packet (i.e. QTYPE and QCLASS), or NULL if the
+// name is malformed. Every byte is checked against packetSz before it is read.
+static char* label_to_str(char* packet, char* qnamePtr, int packetSz, char* res, int resMaxLen)
+{
+    int resIdx, currentLabelLen, currentLabelIdx;
+    int jumps = 0;
+    char* endPtr = NULL;
+
+    resIdx = 0;
+
+    if ((qnamePtr - packet) >= packetSz) {
+        return NULL;
+    }
+
+    // For each label in QNAME field...
+    while (*qnamePtr != 0) {
+        if ((*qnamePtr & 0xC0) == 0) {
+            // Get length of this label and move past length octet.
+            currentLabelLen = *qnamePtr++;
+
+            // Add separator period if this is not the first label in qname field.
+            if (resIdx < resMaxLen && resIdx != 0)
+                res[resIdx++] = '.';
+
+            // Copy the label into the response buffer
+            for (currentLabelIdx = 0; currentLabelIdx < currentLabelLen; currentLabelIdx++) {
+                if ((qnamePtr - packet) >= packetSz) {
+                    // Sanity check to ensure we do not run past the end of the DNS Query Request
+                    // packet.
+                    return NULL;
+                }
+                if (resIdx < resMaxLen) {
+                    // Copy one character
+                    res[resIdx++] = *qnamePtr;
+                }
+                qnamePtr++;
+            }
+        } else if ((*qnamePtr & 0xC0) == 0xC0) {
+            // Compressed label pointer
+            // Labels cannot be longer than 63 bytes. A length octet beginning with b11 means we
+            // have a 14-bit offset from start of DNS packet from which to read the rest of the
+            // QNAME field.
+            if ((qnamePtr + 1 - packet) >= packetSz) {
+                // Second byte of the pointer is missing
+                return NULL;
+            }
+            // A name can hold at most 127 labels, so more jumps than that means a pointer loop.
+            if (++jumps > 127) {
+                return NULL;
+            }
+            if (endPtr == NULL) {
+                endPtr = qnamePtr + 2;
+            }
+
+            int offset = ((uint8_t)qnamePtr[0] & 0x3F) << 8 | (uint8_t)qnamePtr[1];
+
+            // Check if offset points to somewhere outside of the packet
+            if (offset >= packetSz) {
+                return NULL;
+            }
+
+            qnamePtr = &packet[offset];
+        } else {
+            // Label types 0x40 and 0x80 are reserved
+            return NULL;
+        }
+
+        // check for out-of-bound-ness
+        if ((qnamePtr - packet) >= packetSz) {
+            return NULL;
+        }
+    }
+
+    res[resIdx] = 0; // zero-terminate
+
+    // If end-pointer is not null, then we had a compressed field in the Query and qnamePtr is no
+    // longer pointing to the end of the same QNAME field. If end-pointer is null, then it was not
+    // used and qnamePtr is still referencing the same QNAME field.
+    if (endPtr == NULL) {
+        endPtr = qnamePtr + 1;
+    }
+
+    // Pointer to first byte following QNAME field we were asked to parses
+    return endPtr;
+}
+#endif
+
+// Returns offset of the first byte following the (possibly compressed) name starting at
+// offset, or -1 if the name runs past the end of the packet or uses a reserved label type.
+static int skip_name(const uint8_t* packet, int packetSz, int offset)
+{
+    while (offset < packetSz) {
+        uint8_t len = packet[offset];
+        if (len == 0) {
+            // Root label terminates the name
+            return offset + 1;
+        } else if ((len & 0xC0) == 0xC0) {
+            // Compression pointer always terminates the name
+            return ((offset + 2) <= packetSz) ? (offset + 2) : -1;
+        } else if ((len & 0xC0) != 0) {
+            // Reserved/extended label types are not supported
+            return -1;
+        }
+        offset += len + 1;
+    }
+    return -1;
+}
+
+// Append a resource record whose NAME is a compression pointer to the question at qnameOffset.
+// Returns pointer to the first free byte in the reply or NULL if the reply buffer is too short.
+static uint8_t* append_answer(uint8_t* rend, const uint8_t* rlimit, int qnameOffset,
+                              uint16_t type, uint16_t class, uint32_t ttl, const void* rdata,
+                              uint16_t rdlength)
+{
+    if ((rlimit - rend) < (int)(2 + sizeof(DnsResourceFooter) + rdlength)) {
+        return NULL;
+    }
+
+    setn16(rend, 0xC000 | qnameOffset);
+    rend += 2;
+
+    DnsResourceFooter* rf = (DnsResourceFooter*)rend;
+    rend += sizeof(DnsResourceFooter);
+
+    setn16(&rf->type, type);
+    setn16(&rf->class, class);
+    setn32(&rf->ttl, ttl);
+    setn16(&rf->rdlength, rdlength);
+
+    memcpy(rend, rdata, rdlength);
+    return rend + rdlength;
+}
+
+// Precompiled records. The NAME field of each is a compression pointer to the QNAME of the
+// first question (offset 12, directly after the header), so the records are the same for every
+// query and are built only once in capt_dns_query_init().
+typedef struct {
+    uint8_t data[2 + sizeof(DnsResourceFooter) + 22];
+    uint16_t len;
+} RecordTemplate;
+
+// A: our soft AP IPv4 address
+static RecordTemplate _a_answer_template;
+// AAAA: our soft AP unique local address (only if CONFIG_CAPT_DNS_ANSWER_AAAA)
+static RecordTemplate _aaaa_answer_template;
+// SOA for the authority section of NODATA answers. Carries the negative-caching TTL (RFC 2308).
+static RecordTemplate _soa_authority_template;
+
+static void build_record_template(RecordTemplate* tmpl, uint16_t type, uint32_t ttl,
+                                  const void* rdata, uint16_t rdlength)
+{
+    uint8_t* end = append_answer(tmpl->data, &tmpl->data[sizeof(tmpl->data)], sizeof(DnsHeader),
+                                 type, QCLASS_IN, ttl, rdata, rdlength);
+    tmpl->len = (end != NULL) ? (end - tmpl->data) : 0;
+}
+
+void capt_dns_query_init(const uint8_t ip4[4], const uint8_t ip6[16])
+{
+    build_record_template(&_a_answer_template, QTYPE_A, 0, ip4, 4);
+
+    // SOA RDATA: MNAME and RNAME are the root name, followed by serial, refresh, retry,
+    // expire and minimum. Resolvers cache the negative answer for min(TTL, minimum).
+    uint8_t soa[22] = {0};
+    setn32(&soa[2], 1);                             // SERIAL
+    setn32(&soa[6], 3600);                          // REFRESH
+    setn32(&soa[10], 600);                          // RETRY
+    setn32(&soa[14], 86400);                        // EXPIRE
+    setn32(&soa[18], CONFIG_CAPT_DNS_NEGATIVE_TTL); // MINIMUM
+    build_record_template(&_soa_authority_template, QTYPE_SOA, CONFIG_CAPT_DNS_NEGATIVE_TTL, soa,
+                          sizeof(soa));
+
+    _aaaa_answer_template.len = 0;
+    if (ip6 != NULL) {
+        build_record_template(&_aaaa_answer_template, QTYPE_AAAA, 0, ip6, 16);
+    }
+}
+
+// Append a precompiled record, redirecting its NAME pointer if the question is not the first.
+// An empty template appends nothing. Returns NULL if the reply buffer is too short.
+static uint8_t* append_template(uint8_t* rend, const uint8_t* rlimit, int qnameOffset,
+                                const RecordTemplate* tmpl)
+{
+    if (tmpl->len == 0) {
+        return rend;
+    }
+    if ((rlimit - rend) < tmpl->len) {
+        return NULL;
+    }
+    memcpy(rend, tmpl->data, tmpl->len);
+    if (qnameOffset != sizeof(DnsHeader)) {
+        setn16(rend, 0xC000 | qnameOffset);
+    }
+    return rend + tmpl->len;
+}
+
+// Per-qtype answer handlers. Each appends its answer record(s) for the question whose QNAME is
+// at qnameOffset and returns the new end of the reply. If it has nothing to add, it returns rend
+// unchanged (and the question is answered with NODATA). NULL means the reply buffer is full.
+typedef uint8_t* (*QtypeHandler)(uint8_t* rend, const uint8_t* rlimit, int qnameOffset);
+
+static uint8_t* answer_a(uint8_t* rend, const uint8_t* rlimit, int qnameOffset)
+{
+    // They want to know the IPv4 address of something.
+    // This is where we institute our captive portal and return our local IP address for
+    // everything, using the precompiled answer record.
+    return append_template(rend, rlimit, qnameOffset, &_a_answer_template);
+}
+
+static uint8_t* answer_aaaa(uint8_t* rend, const uint8_t* rlimit, int qnameOffset)
+{
+    // Template is empty unless AAAA answers are enabled and the soft AP has its ULA.
+    return append_template(rend, rlimit, qnameOffset, &_aaaa_answer_template);
+}
+
+static uint8_t* answer_ns(uint8_t* rend, const uint8_t* rlimit, int qnameOffset)
+{
+    // They are requesting a name server.
+    // Basically, we can respond with whatever we want because it will get resolved
+    // to our IP address later anyway.
+    // Here is the "whatever we want" part. Our name server is "ns".
+    static const uint8_t ns_rdata[] = {2, 'n', 's', 0};
+
+    return append_answer(rend, rlimit, qnameOffset, QTYPE_NS, QCLASS_IN, 0, ns_rdata,
+                         sizeof(ns_rdata));
+}
+
+static uint8_t* answer_uri(uint8_t* rend, const uint8_t* rlimit, int qnameOffset)
+{
+    // Give uri to us
+    uint8_t uri_rdata[sizeof(DnsUriHdr) + 16];
+    DnsUriHdr* uh = (DnsUriHdr*)uri_rdata;
+
+    setn16(&uh->prio, 10);
+    setn16(&uh->weight, 1);
+    memcpy(&uri_rdata[sizeof(DnsUriHdr)], "http://esp.nonet", 16);
+
+    return append_answer(rend, rlimit, qnameOffset, QTYPE_URI, QCLASS_URI, 0, uri_rdata,
+                         sizeof(uri_rdata));
+}
+
+typedef struct {
+    uint16_t qtype;
+    QtypeHandler handler;
+} QtypeDispatch;
+
+// Any qtype not listed here (HTTPS, SVCB, MX, TXT, ...) gets a NODATA answer with an SOA record
+// so that the client caches the negative result instead of retrying.
+static const QtypeDispatch _qtype_dispatch[] = {
+    {QTYPE_A, answer_a},
+    {QTYPE_AAAA, answer_aaaa},
+    {QTYPE_NS, answer_ns},
+    {QTYPE_URI, answer_uri},
+};
+
+#define NUM_QTYPE_HANDLERS (sizeof(_qtype_dispatch) / sizeof(_qtype_dispatch[0]))
+
+static QtypeHandler find_qtype_handler(uint16_t qtype)
+{
+    int idx;
+    for (idx = 0; idx < NUM_QTYPE_HANDLERS; idx++) {
+        if (_qtype_dispatch[idx].qtype == qtype) {
+            return _qtype_dispatch[idx].handler;
+        }
+    }
+    return NULL;
+}
+
+// Parse the additional section of a query, which starts at offset. The only record we act on is
+// the EDNS0 OPT pseudo-record; anything else (e.g. TSIG) is skipped over. Returns RCODE_FORMERR if
+// the section is malformed or holds more than one OPT record.
+static int parse_additional(const uint8_t* packet, int packetSz, int offset, int arcount,
+                            EdnsInfo* edns)
+{
+    int i;
+
+    memset(edns, 0, sizeof(*edns));
+
+    for (i = 0; i < arcount; i++) {
+        int nameOffset = offset;
+
+        offset = skip_name(packet, packetSz, offset);
+        if ((offset < 0) || ((offset + (int)sizeof(DnsResourceFooter)) > packetSz)) {
+            return RCODE_FORMERR;
+        }
+
+        DnsResourceFooter* rf = (DnsResourceFooter*)&packet[offset];
+        offset += sizeof(DnsResourceFooter) + my_ntohs(&rf->rdlength);
+        if (offset > packetSz) {
+            return RCODE_FORMERR;
+        }
+
+        if (my_ntohs(&rf->type) == QTYPE_OPT) {
+            // OPT must be owned by the root name and may only appear once.
+            if (edns->present || (packet[nameOffset] != 0)) {
+                memset(edns, 0, sizeof(*edns));
+                return RCODE_FORMERR;
+            }
+            // CLASS holds the requester's UDP payload size and TTL holds
+            // extended rcode (8 bits), version (8 bits) and flags (16 bits).
+            const uint8_t* ttl = (const uint8_t*)&rf->ttl;
+            edns->present = true;
+            edns->udp_size = my_ntohs(&rf->class);
+            edns->version = ttl[1];
+            edns->flags = ttl[2];
+        }
+    }
+
+    return RCODE_NOERROR;
+}
+
+// Append our OPT pseudo-record to the reply. The DO bit is copied from the query (RFC 3225).
+static uint8_t* append_opt(uint8_t* rend, const EdnsInfo* edns, uint8_t extRcode)
+{
+    *rend++ = 0; // Root name
+
+    DnsResourceFooter* rf = (DnsResourceFooter*)rend;
+    rend += sizeof(DnsResourceFooter);
+
+    setn16(&rf->type, QTYPE_OPT);
+    setn16(&rf->class, EDNS_UDP_PAYLOAD_SIZE);
+    uint8_t* ttl = (uint8_t*)&rf->ttl;
+    ttl[0] = extRcode;
+    ttl[1] = EDNS_VERSION;
+    ttl[2] = edns->flags & EDNS_FLAG_DO;
+    ttl[3] = 0;
+    setn16(&rf->rdlength, 0);
+
+    return rend;
+}
+
+// Sanity checks a query and walks its question section. Returns the offset of the first byte
+// following the questions, or -1 if the message should not be answered at all.
+static int validate_query(const uint8_t* packet, int length)
+{
+    DnsHeader* hdr = (DnsHeader*)packet;
+    int qdcount, offset, i;
+
+    // Some sanity checks:
+    // TODO: Should an error be returned to the requester if the sanity checks fail?
+
+    if (length > DNS_LEN) {
+        // Packet is longer than DNS implementation allows.
+        return -1;
+    }
+
+    if (length < sizeof(DnsHeader)) {
+        // Packet is too short.
+        return -1;
+    }
+
+#if CONFIG_CAPT_DNS_LOG_QUERIES
+    ESP_LOGD(
+        TAG,
+        "DNS packet: id 0x%X flags 0x%X rcode 0x%X qcnt %d ancnt %d nscount %d arcount %d len %d",
+        my_ntohs(&hdr->id), hdr->flags, hdr->rcode, my_ntohs(&hdr->qdcount),
+        my_ntohs(&hdr->ancount), my_ntohs(&hdr->nscount), my_ntohs(&hdr->arcount), length);
+#endif
+
+    if ((hdr->flags & FLAG_QR) || hdr->ancount || hdr->nscount) {
+        // This is a reply... but we are the server.
+        // Don't know what to do with it.
+        // (Queries may carry additional records, e.g. EDNS0 OPT. Those are parsed later.)
+        return -1;
+    }
+
+    // Find the end of the question section. The reply is the header and questions of the
+    // request followed by our answers, which refer back to the questions by pointer.
+    qdcount = my_ntohs(&hdr->qdcount);
+    offset = sizeof(DnsHeader);
+    for (i = 0; i < qdcount; i++) {
+        offset = skip_name(packet, length, offset);
+        if ((offset < 0) || ((offset + (int)sizeof(DnsQuestionFooter)) > length)) {
+            // Invalid request. Return error?
+            return -1;
+        }
+        offset += sizeof(DnsQuestionFooter);
+    }
+
+    return offset;
+}
+
+int capt_dns_build_error_reply(const uint8_t* packet, int length, uint8_t* reply, int reply_max,
+                               int rcode)
+{
+    DnsHeader* rhdr = (DnsHeader*)&reply[0];
+
+    int questionsEnd = validate_query(packet, length);
+    if ((questionsEnd < 0) || (questionsEnd > reply_max)) {
+        return 0;
+    }
+
+    memcpy(reply, packet, questionsEnd);
+    rhdr->flags = (rhdr->flags & ~FLAG_TC) | FLAG_QR;
+    rhdr->rcode = (rhdr->rcode & ~RCODE_MASK) | rcode;
+    rhdr->ancount = 0;
+    rhdr->nscount = 0;
+    rhdr->arcount = 0;
+
+    return questionsEnd;
+}
+
+// Hashes the uncompressed name at offset (FNV-1a over the wire format, folded to lower case).
+// Returns the length of the name including the root label, or -1 if the name is compressed or
+// runs past the end of the packet.
+static int hash_name(const uint8_t* packet, int packetSz, int offset, uint32_t* hash)
+{
+    int start = offset;
+    uint32_t h = 2166136261u;
+
+    while (offset < packetSz) {
+        uint8_t len = packet[offset];
+        if ((len & 0xC0) != 0) {
+            return -1;
+        }
+        if ((offset + len + 1) > packetSz) {
+            return -1;
+        }
+        // Length octets are below 64 and thus never changed by the case folding.
+        for (int i = 0; i <= len; i++) {
+            h = (h ^ fold_case(packet[offset + i])) * 16777619u;
+        }
+        offset += len + 1;
+        if (len == 0) {
+            *hash = h;
+            return offset - start;
+        }
+    }
+    return -1;
+}
+
+int capt_dns_question_key(const uint8_t* msg, int length, uint32_t* key)
+{
+    DnsHeader* hdr = (DnsHeader*)msg;
+    uint32_t h;
+
+    if ((length < (int)sizeof(DnsHeader)) || (my_ntohs(&hdr->qdcount) == 0)) {
+        return -1;
+    }
+    int nameLen = hash_name(msg, length, sizeof(DnsHeader), &h);
+    int end = sizeof(DnsHeader) + nameLen + sizeof(DnsQuestionFooter);
+    if ((nameLen < 0) || (end > length)) {
+        return -1;
+    }
+    // Mix in type and class
+    for (int i = end - sizeof(DnsQuestionFooter); i < end; i++) {
+        h = (h ^ msg[i]) * 16777619u;
+    }
+    *key = h;
+    return end;
+}
+
+int capt_dns_question_info(const uint8_t* msg, int length, uint32_t* name_hash, uint16_t* qtype)
+{
+    DnsHeader* hdr = (DnsHeader*)msg;
+
+    if ((length < (int)sizeof(DnsHeader)) || (my_ntohs(&hdr->qdcount) == 0)) {
+        return -1;
+    }
+    int nameLen = hash_name(msg, length, sizeof(DnsHeader), name_hash);
+    int end = sizeof(DnsHeader) + nameLen + sizeof(DnsQuestionFooter);
+    if ((nameLen < 0) || (end > length)) {
+        return -1;
+    }
+    *qtype = my_ntohs(&((DnsQuestionFooter*)&msg[end - sizeof(DnsQuestionFooter)])->type);
+    return end;
+}
+
+bool capt_dns_question_equal(const uint8_t* msg_a, int end_a, const uint8_t* msg_b, int end_b)
+{
+    return (end_a == end_b) && equal_nocase(&msg_a[sizeof(DnsHeader)], &msg_b[sizeof(DnsHeader)],
+                                            end_a - sizeof(DnsHeader));
+}
+
+// Returns the offset of the first resource record following the question section, or -1.
+static int skip_questions(const uint8_t* msg, int length)
+{
+    DnsHeader* hdr = (DnsHeader*)msg;
+    int offset = sizeof(DnsHeader);
+    int i;
+
+    if (length < (int)sizeof(DnsHeader)) {
+        return -1;
+    }
+    for (i = 0; i < my_ntohs(&hdr->qdcount); i++) {
+        offset = skip_name(msg, length, offset);
+        if ((offset < 0) || ((offset + (int)sizeof(DnsQuestionFooter)) > length)) {
+            return -1;
+        }
+        offset += sizeof(DnsQuestionFooter);
+    }
+    return offset;
+}
+
+// Walks count resource records starting at offset. Returns the offset following them, or -1.
+static int walk_records(uint8_t* msg, int length, int offset, int count,
+                        capt_dns_record_visitor_t visitor, void* arg)
+{
+    int i;
+
+    for (i = 0; (i < count) && (offset >= 0); i++) {
+        offset = skip_name(msg, length, offset);
+        if ((offset < 0) || ((offset + (int)sizeof(DnsResourceFooter)) > length)) {
+            return -1;
+        }
+        DnsResourceFooter* rf = (DnsResourceFooter*)&msg[offset];
+        if (visitor != NULL) {
+            visitor(my_ntohs(&rf->type), &msg[offset], arg);
+        }
+        offset += sizeof(DnsResourceFooter) + my_ntohs(&rf->rdlength);
+        if (offset > length) {
+            return -1;
+        }
+    }
+    return offset;
+}
+
+int capt_dns_for_each_record(uint8_t* msg, int length, capt_dns_record_visitor_t visitor,
+                             void* arg)
+{
+    DnsHeader* hdr = (DnsHeader*)msg;
+
+    int offset = skip_questions(msg, length);
+    if (offset < 0) {
+        return -1;
+    }
+    int count = my_ntohs(&hdr->ancount) + my_ntohs(&hdr->nscount) + my_ntohs(&hdr->arcount);
+    return (walk_records(msg, length, offset, count, visitor, arg) < 0) ? -1 : 0;
+}
+
+int capt_dns_strip_additional(uint8_t* msg, int length)
+{
+    DnsHeader* hdr = (DnsHeader*)msg;
+
+    int offset = skip_questions(msg, length);
+    if (offset < 0) {
+        return -1;
+    }
+    offset = walk_records(msg, length, offset,
+                          my_ntohs(&hdr->ancount) + my_ntohs(&hdr->nscount), NULL, NULL);
+    if (offset < 0) {
+        return -1;
+    }
+    hdr->arcount = 0;
+    return offset;
+}
+
+// Converts a dotted name to lower-case wire format. Returns its length, or -1 if malformed.
+static int str_to_name(const char* str, uint8_t* name, int nameMax)
+{
+    int len = 0;
+    const char* label = str;
+
+    if (*str == 0) {
+        return -1;
+    }
+    while (true) {
+        const char* dot = strchr(label, '.');
+        int labelLen = (dot != NULL) ? (dot - label) : strlen(label);
+
+        if (labelLen == 0) {
+            // Empty label. Allow a single trailing dot only.
+            if ((dot == NULL) && (len > 0)) {
+                break;
+            }
+            return -1;
+        }
+        if ((labelLen > 63) || ((len + labelLen + 2) > nameMax)) {
+            return -1;
+        }
+        name[len++] = labelLen;
+        for (int i = 0; i < labelLen; i++) {
+            name[len++] = fold_case(label[i]);
+        }
+        if (dot == NULL) {
+            break;
+        }
+        label = dot + 1;
+    }
+    name[len++] = 0;
+    return len;
+}
+
+// Hostname policies. Patterns are hashed label by label from the right, so walking a query name
+// from its last label to its first yields the hash of each of its suffixes in turn. Each suffix
+// is one lookup in an open-addressed table, so the cost depends on the number of labels in the
+// name and not on the number of policies.
+#define POLICY_SLOTS (2 * CONFIG_CAPT_DNS_POLICY_MAX)
+#define MAX_LABELS   127 // In a name of at most 255 bytes
+
+typedef struct {
+    uint32_t hash;
+    uint16_t policy; // Index into _policies plus one, 0 for an empty slot
+} PolicySlot;
+
+static PolicySlot _policy_slots[POLICY_SLOTS];
+static const capt_dns_policy_t* _policies;
+
+// Finds the labels of the uncompressed name at offset. labels[count] is the offset of the root
+// label. Returns the number of labels, or -1 if the name is malformed, compressed or too long.
+static int split_labels(const uint8_t* packet, int packetSz, int offset, uint16_t* labels)
+{
+    int count = 0;
+
+    while (offset < packetSz) {
+        uint8_t len = packet[offset];
+        labels[count] = offset;
+        if (len == 0) {
+            return count;
+        }
+        if (((len & 0xC0) != 0) || (count == MAX_LABELS) || ((offset + len + 1) > packetSz)) {
+            return -1;
+        }
+        count++;
+        offset += len + 1;
+    }
+    return -1;
+}
+
+// Extends the hash of a suffix by the label in front of it
+static uint32_t hash_label(uint32_t hash, const uint8_t* label)
+{
+    // Length octets are below 64 and thus never changed by the case folding.
+    for (int i = 0; i <= label[0]; i++) {
+        hash = (hash ^ fold_case(label[i])) * 16777619u;
+    }
+    return hash;
+}
+
+// Whether the labels starting at offset spell out the dotted pattern
+static bool labels_match_pattern(const uint8_t* packet, int offset, const char* pattern)
+{
+    while (packet[offset] != 0) {
+        int len = packet[offset++];
+        for (int i = 0; i < len; i++) {
+            if ((pattern[i] == 0) || (fold_case(packet[offset + i]) != fold_case(pattern[i]))) {
+                return false;
+            }
+        }
+        offset += len;
+        pattern += len;
+        if (*pattern == '.') {
+            pattern++;
+        } else if (*pattern != 0) {
+            return false;
+        }
+    }
+    if (*pattern == '.') {
+        // Root pattern
+        pattern++;
+    }
+    return (*pattern == 0);
+}
+
+static const capt_dns_policy_t* probe_policy(uint32_t hash, capt_dns_match_t match,
+                                             const uint8_t* packet, int offset)
+{
+    int idx = hash % POLICY_SLOTS;
+    int probe;
+
+    for (probe = 0; probe < POLICY_SLOTS; probe++) {
+        const PolicySlot* slot = &_policy_slots[idx];
+        if (slot->policy == 0) {
+            return NULL;
+        }
+        const capt_dns_policy_t* policy = &_policies[slot->policy - 1];
+        if ((slot->hash == hash) && (policy->match == match) &&
+            labels_match_pattern(packet, offset, policy->pattern)) {
+            return policy;
+        }
+        idx = (idx + 1) % POLICY_SLOTS;
+    }
+    return NULL;
+}
+
+// Returns the policy for the name at qnameOffset, or NULL if none applies
+static const capt_dns_policy_t* find_policy(const uint8_t* packet, int packetSz, int qnameOffset)
+{
+    uint16_t labels[MAX_LABELS + 1];
+    const capt_dns_policy_t* found = NULL;
+    const capt_dns_policy_t* policy;
+    uint32_t hash = 2166136261u;
+    int count, k;
+
+    if (_policies == NULL) {
+        return NULL;
+    }
+    count = split_labels(packet, packetSz, qnameOffset, labels);
+    if (count < 0) {
+        return NULL;
+    }
+
+    // Shortest suffix (the root) first, so that each longer match replaces the previous one
+    for (k = count; k >= 0; k--) {
+        if (k < count) {
+            hash = hash_label(hash, &packet[labels[k]]);
+        }
+        policy = probe_policy(hash, CAPT_DNS_MATCH_SUFFIX, packet, labels[k]);
+        if (policy != NULL) {
+            found = policy;
+        }
+    }
+    policy = probe_policy(hash, CAPT_DNS_MATCH_EXACT, packet, qnameOffset);
+    return (policy != NULL) ? policy : found;
+}
+
+bool capt_dns_set_policies(const capt_dns_policy_t* policies, size_t count)
+{
+    size_t n;
+
+    memset(_policy_slots, 0, sizeof(_policy_slots));
+    _policies = NULL;
+    if (count > CONFIG_CAPT_DNS_POLICY_MAX) {
+        return false;
+    }
+
+    for (n = 0; n < count; n++) {
+        const char* pattern = policies[n].pattern;
+        uint8_t name[255];
+        uint16_t labels[MAX_LABELS + 1];
+        uint32_t hash = 2166136261u;
+        int nameLen, labelCount, k;
+
+        if (pattern == NULL) {
+            goto invalid;
+        }
+        if ((pattern[0] == 0) || (strcmp(pattern, ".") == 0)) {
+            name[0] = 0;
+            nameLen = 1;
+        } else {
+            nameLen = str_to_name(pattern, name, sizeof(name));
+        }
+        labelCount = (nameLen > 0) ? split_labels(name, nameLen, 0, labels) : -1;
+        if (labelCount < 0) {
+            goto invalid;
+        }
+        for (k = labelCount - 1; k >= 0; k--) {
+            hash = hash_label(hash, &name[labels[k]]);
+        }
+
+        // The table has twice as many slots as entries, so there is always a free one. Later
+        // entries go further down the probe sequence, so the first of two duplicates wins.
+        int idx = hash % POLICY_SLOTS;
+        while (_policy_slots[idx].policy != 0) {
+            idx = (idx + 1) % POLICY_SLOTS;
+        }
+        _policy_slots[idx].hash = hash;
+        _policy_slots[idx].policy = n + 1;
+    }
+    _policies = (count > 0) ? policies : NULL;
+    return true;
+
+invalid:
+    memset(_policy_slots, 0, sizeof(_policy_slots));
+    return false;
+}
+
+#if CONFIG_CAPT_DNS_SPLIT_HORIZON
+// Local host table, open-addressed with linear probing. Names are kept in lower-case wire
+// format so that a query's QNAME can be hashed and compared in place.
+#define LOCAL_HOSTS_SLOTS (2 * CONFIG_CAPT_DNS_LOCAL_HOSTS_MAX)
+#define MAX_NAME_LEN      64 // Wire format, enough for "<device-name>.local"
+
+typedef struct {
+    uint32_t hash;
+    uint16_t len; // 0 for an empty slot
+    uint8_t name[MAX_NAME_LEN];
+} LocalHost;
+
+static LocalHost _local_hosts[LOCAL_HOSTS_SLOTS];
+
+bool capt_dns_is_local_query(const uint8_t* packet, int length)
+{
+    uint32_t hash;
+    int idx, probe;
+
+    if ((validate_query(packet, length) < 0) || (my_ntohs(&((DnsHeader*)packet)->qdcount) == 0)) {
+        return false;
+    }
+
+    int nameLen = hash_name(packet, length, sizeof(DnsHeader), &hash);
+    if (nameLen < 0) {
+        return false;
+    }
+
+    idx = hash % LOCAL_HOSTS_SLOTS;
+    for (probe = 0; probe < LOCAL_HOSTS_SLOTS; probe++) {
+        const LocalHost* host = &_local_hosts[idx];
+        if (host->len == 0) {
+            return false;
+        }
+        if ((host->hash == hash) && (host->len == nameLen) &&
+            equal_nocase(&packet[sizeof(DnsHeader)], host->name, nameLen)) {
+            return true;
+        }
+        idx = (idx + 1) % LOCAL_HOSTS_SLOTS;
+    }
+    return false;
+}
+
+bool capt_dns_set_local_names(const char* const* hostnames, size_t count)
+{
+    size_t n;
+
+    if (count > CONFIG_CAPT_DNS_LOCAL_HOSTS_MAX) {
+        return false;
+    }
+
+    memset(_local_hosts, 0, sizeof(_local_hosts));
+    for (n = 0; n < count; n++) {
+        uint8_t name[MAX_NAME_LEN];
+        uint32_t hash;
+
+        int nameLen = str_to_name(hostnames[n], name, sizeof(name));
+        if (nameLen < 0) {
+            memset(_local_hosts, 0, sizeof(_local_hosts));
+            return false;
+        }
+        hash_name(name, nameLen, 0, &hash);
+
+        // The table has twice as many slots as entries, so there is always a free one.
+        int idx = hash % LOCAL_HOSTS_SLOTS;
+        while (_local_hosts[idx].len != 0) {
+            idx = (idx + 1) % LOCAL_HOSTS_SLOTS;
+        }
+        _local_hosts[idx].hash = hash;
+        _local_hosts[idx].len = nameLen;
+        memcpy(_local_hosts[idx].name, name, nameLen);
+    }
+    return true;
+}
+#endif
+
+int capt_dns_build_reply(const uint8_t* packet, int length, uint8_t* reply, int reply_max)
+{
+    const uint8_t* rlimit = &reply[reply_max];
+    uint8_t* rend;
+    DnsHeader* hdr = (DnsHeader*)packet;
+    DnsHeader* rhdr = (DnsHeader*)&reply[0];
+    int qdcount, questionsEnd, offset, i;
+    uint16_t ancount = 0;
+    uint16_t nscount = 0;
+    int nodataQnameOffset = -1;
+    bool truncated = false;
+    bool nxdomain = false;
+    int rcode;
+    uint8_t extRcode = 0;
+    EdnsInfo edns;
+
+    questionsEnd = validate_query(packet, length);
+    if ((questionsEnd < 0) || (questionsEnd > reply_max)) {
+        return 0;
+    }
+    qdcount = my_ntohs(&hdr->qdcount);
+
+    rcode = parse_additional(packet, length, questionsEnd, my_ntohs(&hdr->arcount), &edns);
+    if (edns.present) {
+        // Leave room for our own OPT record at the end of the reply.
+        rlimit -= EDNS_OPT_RR_LEN;
+        if (edns.version > EDNS_VERSION) {
+            // Unsupported EDNS version. Answer with BADVERS and no records (RFC 6891 6.1.3).
+            extRcode = EDNS_BADVERS_EXT;
+            qdcount = 0;
+        }
+#if CONFIG_CAPT_DNS_LOG_QUERIES
+        else {
+            ESP_LOGD(TAG, "EDNS0: udp payload %d flags 0x%X", edns.udp_size, edns.flags);
+        }
+#endif
+    }
+    if (rcode != RCODE_NOERROR) {
+        qdcount = 0;
+    }
+
+    memcpy(reply, packet, questionsEnd);
+    rend = &reply[questionsEnd];
+
+    // Set Query Response flag in response header. A TC flag on the query means nothing to us;
+    // on the reply it is only set below if the answers do not fit.
+    rhdr->flags = (rhdr->flags & ~FLAG_TC) | FLAG_QR;
+
+    // For each Question in request packet...
+    offset = sizeof(DnsHeader);
+    for (i = 0; i < qdcount; i++) {
+        int qnameOffset = offset;
+        offset = skip_name(packet, length, offset);
+
+        DnsQuestionFooter* qf = (DnsQuestionFooter*)&packet[offset];
+        offset += sizeof(DnsQuestionFooter);
+
+        uint16_t qtype = my_ntohs(&qf->type);
+
+#if CONFIG_CAPT_DNS_LOG_QUERIES
+        // Only decode the name into a string if somebody is going to read it. The console
+        // write is slow, so the whole thing is compiled out unless asked for in the config;
+        // the telemetry ring is the cheap way to watch queries.
+        if (esp_log_level_get(TAG) >= ESP_LOG_INFO) {
+            char buff[DNS_LEN];
+            if (label_to_str((char*)packet, (char*)&packet[qnameOffset], length, buff,
+                             sizeof(buff) - 1) != NULL) {
+                ESP_LOGI(TAG, "DNS: Q (type 0x%X class 0x%X) for %s", qtype,
+                         my_ntohs(&qf->class), buff);
+            }
+        }
+#endif
+
+        const capt_dns_policy_t* policy = find_policy(packet, length, qnameOffset);
+        capt_dns_action_t action = (policy != NULL) ? policy->action : CAPT_DNS_ACTION_AP_IP;
+        uint8_t* answerEnd = rend;
+        if (action == CAPT_DNS_ACTION_AP_IP) {
+            QtypeHandler handler = find_qtype_handler(qtype);
+            answerEnd = (handler != NULL) ? handler(rend, rlimit, qnameOffset) : rend;
+        } else if ((action == CAPT_DNS_ACTION_IP) && (qtype == QTYPE_A)) {
+            answerEnd = append_answer(rend, rlimit, qnameOffset, QTYPE_A, QCLASS_IN, 0,
+                                      &policy->ip, sizeof(policy->ip));
+        } else if (action == CAPT_DNS_ACTION_NXDOMAIN) {
+            nxdomain = true;
+        }
+
+        if (answerEnd == NULL) {
+            // Out of room. Send what we have and let the client retry over TCP.
+            truncated = true;
+            break;
+        } else if (answerEnd != rend) {
+            rend = answerEnd;
+            ancount++;
+#if CONFIG_CAPT_DNS_LOG_QUERIES
+            ESP_LOGD(TAG, "Added type %d rec to resp. Resp len is %d", qtype, (rend - reply));
+#endif
+        } else if (nodataQnameOffset < 0) {
+            nodataQnameOffset = qnameOffset;
+        }
+    }
+
+    // NODATA or NXDOMAIN: nothing to answer with, so put an SOA in the authority section.
+    // Clients then cache the negative result instead of retrying (e.g. AAAA and HTTPS on
+    // dual-stack hosts).
+    if (!truncated && (ancount == 0) && (nodataQnameOffset >= 0)) {
+        uint8_t* authorityEnd =
+            append_template(rend, rlimit, nodataQnameOffset, &_soa_authority_template);
+        if (authorityEnd == NULL) {
+            truncated = true;
+        } else if (authorityEnd != rend) {
+            rend = authorityEnd;
+            nscount = 1;
+        }
+    }
+
+    if (truncated) {
+        rhdr->flags |= FLAG_TC;
+    }
+
+    if (nxdomain && (ancount == 0) && (rcode == RCODE_NOERROR)) {
+        rcode = RCODE_NXDOMAIN;
+    }
+
+    setn16(&rhdr->ancount, ancount);
+    setn16(&rhdr->nscount, nscount);
+    rhdr->rcode = (rhdr->rcode & ~RCODE_MASK) | rcode;
+
+    // Replace whatever additional records the query had with our own OPT record, if the
+    // requester spoke EDNS0.
+    if (edns.present) {
+        rend = append_opt(rend, &edns, extRcode);
+        setn16(&rhdr->arcount, 1);
+    } else {
+        setn16(&rhdr->arcount, 0);
+    }
+
+    return rend - reply;
+}
+
@@ -0,0 +1,149 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Parsing and answering of DNS messages. Nothing in here depends on ESP-IDF, lwIP or FreeRTOS, so
+capt_dns_query.c also compiles as plain C on a development host (e.g. for fuzzing the parser).
+*/
+
+#ifndef CAPT_DNS_QUERY_H
+#define CAPT_DNS_QUERY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "capt_dns_policy.h"
+
+#define DNS_LEN  512
+#define DNS_PORT 53
+
+#define DNS_RCODE_SERVFAIL 2
+#define DNS_RCODE_REFUSED  5
+
+/**
+ * @brief   Sets the addresses that queries are answered with.
+ *
+ * @param[in] ip4 IPv4 address of the soft AP, in network byte order
+ * @param[in] ip6 IPv6 unique local address of the soft AP, in network byte
+ *                order, or NULL to answer AAAA queries with NODATA
+ */
+void capt_dns_query_init(const uint8_t ip4[4], const uint8_t ip6[16]);
+
+/**
+ * @brief   Builds the captive portal reply to a query. Every question about
+ *          an A or AAAA record is answered with our own address.
+ *
+ * @param[in]  packet    Received DNS message
+ * @param[in]  length    Length of the received message
+ * @param[out] reply     Buffer to build the reply into
+ * @param[in]  reply_max Size of the reply buffer
+ *
+ * @return  Length of the reply in bytes, or 0 if the message should not be
+ *          answered
+ */
+int capt_dns_build_reply(const uint8_t* packet, int length, uint8_t* reply, int reply_max);
+
+/**
+ * @brief   Replaces the hostname policy table. The policies are referenced,
+ *          not copied, and must stay valid until the table is replaced.
+ *
+ * @param[in] policies Policies, or NULL if count is 0
+ * @param[in] count    Number of policies, at most CONFIG_CAPT_DNS_POLICY_MAX
+ *
+ * @return  false if there are too many policies or a pattern is not a valid
+ *          name. The table is empty then.
+ */
+bool capt_dns_set_policies(const capt_dns_policy_t* policies, size_t count);
+
+/**
+ * @brief   Whether a query is well-formed and its first question is about a
+ *          name set with capt_dns_set_local_names(). Only available with
+ *          CONFIG_CAPT_DNS_SPLIT_HORIZON.
+ */
+bool capt_dns_is_local_query(const uint8_t* packet, int length);
+
+/**
+ * @brief   Replaces the table of local host names (matched case-insensitively).
+ *          Only available with CONFIG_CAPT_DNS_SPLIT_HORIZON.
+ *
+ * @return  false if there are too many names or one of them is not a valid
+ *          host name. The table is empty then.
+ */
+bool capt_dns_set_local_names(const char* const* hostnames, size_t count);
+
+/**
+ * @brief   Builds a reply that echoes the header and questions of a query with
+ *          the given rcode and no records.
+ *
+ * @return  Length of the reply, or 0 if the query is malformed
+ */
+int capt_dns_build_error_reply(const uint8_t* query, int length, uint8_t* reply, int reply_max,
+                               int rcode);
+
+/**
+ * @brief   Hashes the first question of a message (name folded to lower case,
+ *          type and class).
+ *
+ * @param[in]  msg    DNS message
+ * @param[in]  length Length of the message
+ * @param[out] key    Hash of the question
+ *
+ * @return  Offset of the first byte following the first question, or -1 if the
+ *          message has no question or it is malformed
+ */
+int capt_dns_question_key(const uint8_t* msg, int length, uint32_t* key);
+
+/**
+ * @brief   Hashes the name of the first question of a message (folded to lower
+ *          case) and gets its type.
+ *
+ * @param[in]  msg       DNS message
+ * @param[in]  length    Length of the message
+ * @param[out] name_hash Hash of the name
+ * @param[out] qtype     Type of the question
+ *
+ * @return  Offset of the first byte following the first question, or -1 if the
+ *          message has no question or it is malformed
+ */
+int capt_dns_question_info(const uint8_t* msg, int length, uint32_t* name_hash, uint16_t* qtype);
+
+/**
+ * @brief   Compares the first questions of two messages case-insensitively.
+ *          Both must have been checked with capt_dns_question_key().
+ */
+bool capt_dns_question_equal(const uint8_t* msg_a, int end_a, const uint8_t* msg_b, int end_b);
+
+/**
+ * @brief   Called for each resource record of a message. rr points at the TYPE
+ *          field of the record, followed by CLASS, TTL and RDLENGTH.
+ */
+typedef void (*capt_dns_record_visitor_t)(uint16_t type, uint8_t* rr, void* arg);
+
+/**
+ * @brief   Walks the answer, authority and additional sections of a message.
+ *
+ * @return  0 on success, -1 if the message is malformed
+ */
+int capt_dns_for_each_record(uint8_t* msg, int length, capt_dns_record_visitor_t visitor,
+                             void* arg);
+
+/**
+ * @brief   Removes the additional section (e.g. the OPT record) of a message.
+ *
+ * @return  New length of the message, or -1 if it is malformed
+ */
+int capt_dns_strip_additional(uint8_t* msg, int length);
+
+#endif
@@ -0,0 +1,144 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Token-bucket rate limiting for the captive portal DNS server. Each source address gets a bucket
+in one of two neighbouring slots of a small table, so lookup is a hash and two compares. A source
+that finds both slots held by other addresses evicts the one idle the longest and takes over its
+bucket at the level it has refilled to. A fresh, full bucket would let sources that collide
+reset each other's limit with every query. All queries additionally draw from one overall bucket
+so that many sources together cannot starve the rest of the system.
+
+Only ever called from the single context that processes queries (DNS task or TCP/IP thread).
+*/
+
+#include "capt_dns_priv.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "sdkconfig.h"
+
+/* Bucket levels are kept in milli-tokens so that a rate in queries per second
+ * refills exactly that many milli-tokens per millisecond. */
+#define TOKEN_COST 1000U
+
+#define SOURCE_RATE    CONFIG_CAPT_DNS_RATELIMIT_SOURCE_QPS
+#define SOURCE_CAPA    (CONFIG_CAPT_DNS_RATELIMIT_SOURCE_BURST * TOKEN_COST)
+#define OVERALL_RATE   CONFIG_CAPT_DNS_RATELIMIT_TOTAL_QPS
+#define OVERALL_CAPA   (CONFIG_CAPT_DNS_RATELIMIT_TOTAL_BURST * TOKEN_COST)
+#define NUM_SOURCES    CONFIG_CAPT_DNS_RATELIMIT_TABLE_SIZE
+
+typedef struct {
+    uint32_t src_key;
+    uint32_t tokens;
+    TickType_t last_refill;
+} token_bucket_t;
+
+static token_bucket_t _sources[NUM_SOURCES];
+static token_bucket_t _overall;
+
+static uint32_t now_ms(void)
+{
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+static void refill(token_bucket_t* bucket, uint32_t rate, uint32_t capacity, uint32_t now)
+{
+    uint32_t elapsed = now - bucket->last_refill;
+    uint64_t tokens = bucket->tokens + (uint64_t)elapsed * rate;
+
+    bucket->tokens = (tokens > capacity) ? capacity : (uint32_t)tokens;
+    bucket->last_refill = now;
+}
+
+// Takes one query's worth of tokens from the bucket if it has them.
+static bool take(token_bucket_t* bucket)
+{
+    if (bucket->tokens < TOKEN_COST) {
+        return false;
+    }
+    bucket->tokens -= TOKEN_COST;
+    return true;
+}
+
+// Multiplicative hash so that sequential DHCP leases spread over the table.
+static uint32_t source_index(uint32_t src_key)
+{
+    uint32_t h = src_key * 2654435761U;
+    return (h ^ (h >> 16)) % NUM_SOURCES;
+}
+
+// Finds the bucket of a source, refilled up to now.
+static token_bucket_t* find_source(uint32_t src_key, uint32_t now)
+{
+    uint32_t idx = source_index(src_key);
+    token_bucket_t* first = &_sources[idx];
+    token_bucket_t* second = &_sources[(idx + 1) % NUM_SOURCES];
+    token_bucket_t* source;
+
+    if (first->src_key == src_key) {
+        source = first;
+    } else if (second->src_key == src_key) {
+        source = second;
+    } else {
+        // Evict the fuller bucket, whose source has been quiet the longest. Empty slots are
+        // full, so a source that has a slot to itself starts with a full burst.
+        refill(first, SOURCE_RATE, SOURCE_CAPA, now);
+        refill(second, SOURCE_RATE, SOURCE_CAPA, now);
+        source = (second->tokens > first->tokens) ? second : first;
+        source->src_key = src_key;
+    }
+    refill(source, SOURCE_RATE, SOURCE_CAPA, now);
+    return source;
+}
+
+capt_dns_ratelimit_verdict_t capt_dns_ratelimit_check(uint32_t src_key)
+{
+    uint32_t now = now_ms();
+    token_bucket_t* source = find_source(src_key, now);
+
+    refill(&_overall, OVERALL_RATE, OVERALL_CAPA, now);
+
+    if (!take(source)) {
+#if CONFIG_CAPT_DNS_RATELIMIT_REFUSE
+        // Refusing costs a reply, so only do it while the overall budget allows.
+        return take(&_overall) ? CAPT_DNS_RATELIMIT_REFUSE : CAPT_DNS_RATELIMIT_DROP;
+#else
+        return CAPT_DNS_RATELIMIT_DROP;
+#endif
+    }
+
+    if (!take(&_overall)) {
+        return CAPT_DNS_RATELIMIT_DROP;
+    }
+
+    return CAPT_DNS_RATELIMIT_ADMIT;
+}
+
+void capt_dns_ratelimit_reset(void)
+{
+    uint32_t now = now_ms();
+
+    // A key of 0 (0.0.0.0) never appears as a query source, so such slots are empty.
+    for (int idx = 0; idx < NUM_SOURCES; idx++) {
+        _sources[idx].src_key = 0;
+        _sources[idx].tokens = SOURCE_CAPA;
+        _sources[idx].last_refill = now;
+    }
+
+    _overall.src_key = 0;
+    _overall.tokens = OVERALL_CAPA;
+    _overall.last_refill = now;
+}
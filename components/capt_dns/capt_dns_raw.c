@@ -0,0 +1,148 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+lwIP raw API backend for the captive portal DNS server. A udp_pcb bound to the soft AP netif
+receives queries in the TCP/IP thread. The reply is built into a static buffer and copied into a
+pbuf of its exact size. There is no task and no intermediate receive buffer.
+*/
+
+#include "capt_dns_priv.h"
+
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+#include "lwip/err.h"
+#include "lwip/pbuf.h"
+#include "lwip/priv/tcpip_priv.h"
+#include "lwip/udp.h"
+
+static const char* TAG = "capt_dns";
+
+static struct udp_pcb* _pcb = NULL;
+
+/* Only used if a query arrives split across a pbuf chain */
+static uint8_t _query_copy[DNS_LEN];
+
+/* Replies are built here, then copied into a pbuf of their size */
+static uint8_t _reply[DNS_LEN];
+
+typedef struct {
+    struct tcpip_api_call_data call;
+    struct netif* netif;
+} raw_api_call_t;
+
+// Called by lwIP in the TCP/IP thread for each datagram received on the DNS port.
+static void capt_dns_udp_recv(void* arg, struct udp_pcb* pcb, struct pbuf* p,
+                              const ip_addr_t* addr, u16_t port)
+{
+    const uint8_t* query = p->payload;
+    int length = p->tot_len;
+    uint32_t src_key;
+
+    if (length > DNS_LEN) {
+        pbuf_free(p);
+        return;
+    }
+    if (p->len != p->tot_len) {
+        pbuf_copy_partial(p, _query_copy, length, 0);
+        query = _query_copy;
+    }
+
+#if LWIP_IPV6
+    if (IP_IS_V6(addr)) {
+        src_key = capt_dns_ip6_key(ip_2_ip6(addr)->addr);
+    } else
+#endif
+    {
+        src_key = ip4_addr_get_u32(ip_2_ip4(addr));
+    }
+
+    int reply_len = capt_dns_handle_query(src_key, query, length, _reply, sizeof(_reply));
+    pbuf_free(p);
+    if (reply_len <= 0) {
+        return;
+    }
+
+    struct pbuf* reply = pbuf_alloc(PBUF_TRANSPORT, reply_len, PBUF_RAM);
+    if (reply == NULL) {
+        return;
+    }
+    memcpy(reply->payload, _reply, reply_len);
+    udp_sendto(pcb, reply, addr, port);
+    pbuf_free(reply);
+}
+
+static err_t raw_start_in_tcpip(struct tcpip_api_call_data* call)
+{
+    raw_api_call_t* msg = (raw_api_call_t*)call;
+
+    _pcb = udp_new();
+    if (_pcb == NULL) {
+        return ERR_MEM;
+    }
+
+    // Binding to the netif replaces the source subnet check done by the socket backend:
+    // queries arriving on any other interface never reach the callback.
+    udp_bind_netif(_pcb, msg->netif);
+
+    err_t err = udp_bind(_pcb, IP_ANY_TYPE, DNS_PORT);
+    if (err != ERR_OK) {
+        udp_remove(_pcb);
+        _pcb = NULL;
+        return err;
+    }
+
+    udp_recv(_pcb, capt_dns_udp_recv, NULL);
+    return ERR_OK;
+}
+
+static err_t raw_stop_in_tcpip(struct tcpip_api_call_data* call)
+{
+    if (_pcb) {
+        udp_remove(_pcb);
+        _pcb = NULL;
+    }
+    return ERR_OK;
+}
+
+esp_err_t capt_dns_backend_start(esp_netif_t* softap_netif_handle,
+                                 const esp_netif_ip_info_t* ip_info)
+{
+    raw_api_call_t msg = {.netif = esp_netif_get_netif_impl(softap_netif_handle)};
+
+    if (msg.netif == NULL) {
+        ESP_LOGE(TAG, "No lwIP netif for softAP interface.");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // pcb functions must only be called from the TCP/IP thread.
+    if (tcpip_api_call(raw_start_in_tcpip, &msg.call) != ERR_OK) {
+        ESP_LOGE(TAG, "Failed to bind DNS pcb.");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "capt_dns initialization complete.");
+    return ESP_OK;
+}
+
+void capt_dns_backend_stop(void)
+{
+    raw_api_call_t msg = {.netif = NULL};
+
+    // Once this returns, the TCP/IP thread will not call capt_dns_udp_recv() again.
+    tcpip_api_call(raw_stop_in_tcpip, &msg.call);
+}
@@ -0,0 +1,535 @@
+/*
+ * ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * Jeroen Domburg <jeroen@spritesmods.com> wrote this file. As long as you retain
+ * this notice you can do whatever you want with this stuff. If we meet some day,
+ * and you think this stuff is worth it, you can buy me a beer in return.
+ *
+ * modified for ESP32 by Cornelis
+ * Cornelis' version is available at: https://github.com/cornelis-61/esp32_Captdns
+ *
+ * modified for ESP32 v4.2 by Aaron Fontaine
+ * Additional modifications by Aaron Fontaine
+ *  - Fixed IP taken from network interface provided to start function.
+ *  - Captive DNS operation restricted to interface provided to start function.
+ *  - Ability to stop the DNS server.
+ *
+ * Note: This code appears to have originally been copied from ESP-IDF UDP server
+ * example and modified (license CC0 or Public Domain at user's discretion.)
+ * ----------------------------------------------------------------------------
+ */
+
+/*
+BSD socket backend for the captive portal DNS server. A dedicated task blocks in select() on the
+DNS socket and answers queries through capt_dns_handle_query().
+
+The task, its stack and event group are allocated statically and created on the first start.
+On stop the task closes the DNS sockets and parks, and the next start wakes it up again, so
+start/stop cycles do not allocate anything but the sockets. Closing the sockets lets clients get
+an ICMP port unreachable while the server is stopped, instead of their queries piling up unread.
+*/
+
+#include "capt_dns_priv.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "lwip/err.h"
+#include "lwip/sockets.h"
+
+#if !configSUPPORT_STATIC_ALLOCATION
+#error "capt_dns requires CONFIG_FREERTOS_SUPPORT_STATIC_ALLOCATION"
+#endif
+
+/* Upper bound on how long the task can block in select() before rechecking
+ * for a stop request. Normally the control socket wakes the task immediately;
+ * this only matters if the loopback datagram could not be delivered. */
+#define STOP_POLL_INTERVAL_MS 1000
+
+#define CAPT_DNS_TASK_STACK_SIZE 4096
+#define CAPT_DNS_TASK_PRIORITY   5
+
+static const char* TAG = "capt_dns";
+
+static int _sockFd = -1;
+static esp_netif_ip_info_t _ip_info_of_softap;
+
+/* Receive buffers for one batch of queries, drained per wakeup of the task */
+typedef struct {
+    struct sockaddr_storage from;
+    unsigned short len;
+    uint8_t msg[DNS_LEN];
+} DnsRxSlot;
+
+static DnsRxSlot _rx_batch[CONFIG_CAPT_DNS_BATCH_SIZE];
+
+/* Replies are built here and sent before the next one is built */
+static uint8_t _reply[DNS_LEN];
+
+#if CONFIG_CAPT_DNS_IPV6
+/* IPv6 socket, bound to the soft AP's link-local address */
+static int _sock6Fd = -1;
+/* Address and interface index to serve IPv6 on, as of the last start */
+static bool _ip6_valid;
+static esp_ip6_addr_t _ip6_linklocal;
+static int _ip6_scope;
+#endif
+
+/* Socket for queries forwarded upstream in split-horizon mode */
+static int _fwdFd = -1;
+
+/* Loopback socket used by capt_dns_stop() to wake the task out of select() */
+static int _ctrlFd = -1;
+static volatile uint16_t _ctrl_port = 0;
+
+/* Signal start and stop requests to the task on this event-group */
+const EventBits_t DNS_SERVER_STOP_REQUESTED_EVENT = BIT0;
+const EventBits_t DNS_SERVER_STOP_COMPLETE_EVENT = BIT1;
+const EventBits_t DNS_SERVER_START_REQUESTED_EVENT = BIT2;
+static EventGroupHandle_t _capt_dns_event_group = NULL;
+static StaticEventGroup_t _capt_dns_event_group_buf;
+
+static StaticTask_t _capt_dns_task_buf;
+static StackType_t _capt_dns_task_stack[CAPT_DNS_TASK_STACK_SIZE];
+
+static bool is_stop_pending(void)
+{
+    EventBits_t bits = xEventGroupGetBits(_capt_dns_event_group);
+    if (bits & DNS_SERVER_STOP_REQUESTED_EVENT) {
+        return true;
+    } else {
+        return false;
+    }
+}
+
+// The DNS server sees incoming packets from both AP and STA interfaces.
+// We need to make sure we only respond to requests on the AP interface.
+static bool is_from_softap(const struct sockaddr_storage* from)
+{
+    if (from->ss_family == AF_INET) {
+        const struct sockaddr_in* from4 = (const struct sockaddr_in*)from;
+        return ((from4->sin_addr.s_addr & _ip_info_of_softap.netmask.addr) ==
+                (_ip_info_of_softap.ip.addr & _ip_info_of_softap.netmask.addr));
+    }
+#if CONFIG_CAPT_DNS_IPV6
+    if (from->ss_family == AF_INET6) {
+        // The socket is bound to the soft AP's link-local address, so it only sees that
+        // interface. Answer on-link (fe80::/10) sources only, the IPv6 analogue of the
+        // netmask check above.
+        const struct sockaddr_in6* from6 = (const struct sockaddr_in6*)from;
+        return (from6->sin6_addr.s6_addr[0] == 0xfe) &&
+               ((from6->sin6_addr.s6_addr[1] & 0xc0) == 0x80) &&
+               ((from6->sin6_scope_id == 0) || (from6->sin6_scope_id == _ip6_scope));
+    }
+#endif
+    return false;
+}
+
+// Rate-limit key of a source address. IPv6 addresses are folded into 32 bits.
+static uint32_t source_key(const struct sockaddr_storage* from)
+{
+#if CONFIG_CAPT_DNS_IPV6
+    if (from->ss_family == AF_INET6) {
+        uint32_t words[4];
+        memcpy(words, &((const struct sockaddr_in6*)from)->sin6_addr, sizeof(words));
+        return capt_dns_ip6_key(words);
+    }
+#endif
+    return ((const struct sockaddr_in*)from)->sin_addr.s_addr;
+}
+
+static socklen_t sockaddr_len(const struct sockaddr_storage* addr)
+{
+#if CONFIG_CAPT_DNS_IPV6
+    if (addr->ss_family == AF_INET6) {
+        return sizeof(struct sockaddr_in6);
+    }
+#endif
+    return sizeof(struct sockaddr_in);
+}
+
+// Receive a DNS packet and maybe send a response back through the socket it came in on
+static void capt_dns_recv(int fd, struct sockaddr_storage* premote_addr, uint8_t* query,
+                          unsigned short length)
+{
+    int reply_len = capt_dns_handle_query(source_key(premote_addr), query, length, _reply,
+                                          sizeof(_reply));
+#if CONFIG_CAPT_DNS_SPLIT_HORIZON
+    if (reply_len == CAPT_DNS_FORWARD) {
+        // Either answered from the cache right away, or the reply arrives on _fwdFd later.
+        reply_len = capt_dns_forward_query(premote_addr, query, length, _reply, sizeof(_reply));
+    }
+#endif
+    if (reply_len <= 0) {
+        return;
+    }
+
+    // Send the response
+    ESP_LOGD(TAG, "Sending response");
+    sendto(fd, _reply, reply_len, 0, (struct sockaddr*)premote_addr, sockaddr_len(premote_addr));
+}
+
+// Create the loopback control socket and publish its port for capt_dns_stop().
+// Returns -1 on failure, in which case the task falls back to polling for stop requests.
+static int open_ctrl_socket(void)
+{
+    struct sockaddr_in ctrl_addr;
+    socklen_t addr_len = sizeof(ctrl_addr);
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    memset(&ctrl_addr, 0, sizeof(ctrl_addr));
+    ctrl_addr.sin_family = AF_INET;
+    ctrl_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ctrl_addr.sin_port = 0; // Let the stack pick an ephemeral port
+    ctrl_addr.sin_len = sizeof(ctrl_addr);
+
+    if ((bind(fd, (struct sockaddr*)&ctrl_addr, sizeof(ctrl_addr)) != 0) ||
+        (getsockname(fd, (struct sockaddr*)&ctrl_addr, &addr_len) != 0)) {
+        close(fd);
+        return -1;
+    }
+
+    _ctrl_port = ntohs(ctrl_addr.sin_port);
+    return fd;
+}
+
+// Wake the DNS task out of select() by sending a datagram to its control socket.
+// The control socket sends to itself, so no socket is created for this.
+static void send_ctrl_wakeup(void)
+{
+    struct sockaddr_in ctrl_addr;
+    uint8_t wakeup = 0;
+
+    if (_ctrl_port == 0) {
+        // Task has not opened its control socket (yet). It will see the stop
+        // request before blocking or at the next poll interval.
+        return;
+    }
+
+    memset(&ctrl_addr, 0, sizeof(ctrl_addr));
+    ctrl_addr.sin_family = AF_INET;
+    ctrl_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ctrl_addr.sin_port = htons(_ctrl_port);
+    ctrl_addr.sin_len = sizeof(ctrl_addr);
+
+    sendto(_ctrlFd, &wakeup, sizeof(wakeup), 0, (struct sockaddr*)&ctrl_addr, sizeof(ctrl_addr));
+}
+
+// Open the DNS socket, and the control socket if it is not open yet. Only the control socket
+// stays open while the task is parked.
+// Returns false if a stop was requested before the DNS socket could be bound.
+static bool open_sockets(void)
+{
+    struct sockaddr_in server_addr;
+
+    if (_ctrlFd == -1) {
+        _ctrlFd = open_ctrl_socket();
+        if (_ctrlFd == -1) {
+            ESP_LOGW(TAG, "Failed to create control socket. Stop requests will be polled.");
+        }
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(DNS_PORT);
+    server_addr.sin_len = sizeof(server_addr);
+
+    while ((_sockFd == -1) && (!is_stop_pending())) {
+        _sockFd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (_sockFd == -1) {
+            ESP_LOGW(TAG, "capt_dns_task failed to create socket!\nTrying again in 1000ms.");
+            vTaskDelay(1000 / portTICK_RATE_MS);
+        } else if (bind(_sockFd, (struct sockaddr*)&server_addr, sizeof(server_addr)) != 0) {
+            ESP_LOGW(TAG, "capt_dns_task failed to bind sock!\nTrying again in 1000ms.");
+            close(_sockFd);
+            _sockFd = -1;
+            vTaskDelay(1000 / portTICK_RATE_MS);
+        }
+    }
+
+    return (_sockFd != -1);
+}
+
+#if CONFIG_CAPT_DNS_IPV6
+// Bind the IPv6 socket to the soft AP's link-local address. Failing here only disables IPv6.
+static void open_ipv6_socket(void)
+{
+    struct sockaddr_in6 server_addr6;
+
+    if (!_ip6_valid) {
+        return;
+    }
+
+    memset(&server_addr6, 0, sizeof(server_addr6));
+    server_addr6.sin6_family = AF_INET6;
+    server_addr6.sin6_port = htons(DNS_PORT);
+    memcpy(&server_addr6.sin6_addr, _ip6_linklocal.addr, sizeof(server_addr6.sin6_addr));
+    server_addr6.sin6_scope_id = _ip6_scope;
+    server_addr6.sin6_len = sizeof(server_addr6);
+
+    _sock6Fd = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (_sock6Fd == -1) {
+        ESP_LOGW(TAG, "Failed to create IPv6 socket. Serving IPv4 only.");
+        return;
+    }
+    if (bind(_sock6Fd, (struct sockaddr*)&server_addr6, sizeof(server_addr6)) != 0) {
+        ESP_LOGW(TAG, "Failed to bind IPv6 socket. Serving IPv4 only.");
+        close(_sock6Fd);
+        _sock6Fd = -1;
+        return;
+    }
+}
+#endif
+
+// Close the DNS sockets when parking. Queries sent while the server is stopped are then turned
+// away by the stack right away.
+static void close_sockets(void)
+{
+    if (_sockFd != -1) {
+        close(_sockFd);
+        _sockFd = -1;
+    }
+#if CONFIG_CAPT_DNS_IPV6
+    if (_sock6Fd != -1) {
+        close(_sock6Fd);
+        _sock6Fd = -1;
+    }
+#endif
+}
+
+// Discard a stale wakeup left on the control socket, so it does not end the next session early.
+static void drain_ctrl_socket(void)
+{
+    if (_ctrlFd == -1) {
+        return;
+    }
+    while (recv(_ctrlFd, _reply, sizeof(_reply), MSG_DONTWAIT) > 0) {
+    }
+}
+
+// Answer the queries queued on a socket.
+static void serve_batch(int fd)
+{
+    socklen_t fromlen;
+    int ret, batch_len, idx;
+
+    // A client joining the AP fires a burst of queries. Drain everything that is queued
+    // (up to the batch size) first, then send the replies back-to-back.
+    for (batch_len = 0; batch_len < CONFIG_CAPT_DNS_BATCH_SIZE; batch_len++) {
+        DnsRxSlot* slot = &_rx_batch[batch_len];
+
+        memset(&slot->from, 0, sizeof(slot->from));
+        fromlen = sizeof(slot->from);
+
+        ret = recvfrom(fd, slot->msg, DNS_LEN, MSG_DONTWAIT, (struct sockaddr*)&slot->from,
+                       &fromlen);
+        if (ret <= 0) {
+            break;
+        }
+        slot->len = ret;
+    }
+
+    for (idx = 0; idx < batch_len; idx++) {
+        DnsRxSlot* slot = &_rx_batch[idx];
+
+        if (is_from_softap(&slot->from)) {
+            capt_dns_recv(fd, &slot->from, slot->msg, slot->len);
+        } else {
+            ESP_LOGI(TAG, "Ignoring packet from wrong interface.");
+        }
+    }
+}
+
+// Serve queries until a stop is requested.
+static void serve_queries(void)
+{
+    int ret;
+    uint8_t ctrl_msg[4];
+    fd_set read_set;
+    struct timeval timeout;
+    int max_fd;
+
+    // The task blocks in select() on both the DNS socket and a loopback control
+    // socket. Incoming queries are served as soon as they arrive, and
+    // capt_dns_stop() sends a datagram to the control socket to wake us up.
+    max_fd = (_ctrlFd > _sockFd) ? _ctrlFd : _sockFd;
+#if CONFIG_CAPT_DNS_IPV6
+    max_fd = (_sock6Fd > max_fd) ? _sock6Fd : max_fd;
+#endif
+
+#if CONFIG_CAPT_DNS_SPLIT_HORIZON
+    _fwdFd = capt_dns_forward_open();
+    max_fd = (_fwdFd > max_fd) ? _fwdFd : max_fd;
+#endif
+
+#if CONFIG_CAPT_DNS_TCP
+    bool tcp_ok = capt_dns_tcp_start();
+#endif
+
+    if (!is_stop_pending()) {
+        ESP_LOGI(TAG, "capt_dns initialization complete.");
+    }
+
+    while (!is_stop_pending()) {
+        FD_ZERO(&read_set);
+        FD_SET(_sockFd, &read_set);
+        if (_ctrlFd != -1) {
+            FD_SET(_ctrlFd, &read_set);
+        }
+        if (_fwdFd != -1) {
+            FD_SET(_fwdFd, &read_set);
+        }
+#if CONFIG_CAPT_DNS_IPV6
+        if (_sock6Fd != -1) {
+            FD_SET(_sock6Fd, &read_set);
+        }
+#endif
+
+        int wait_ms = STOP_POLL_INTERVAL_MS;
+        int nfds = max_fd + 1;
+#if CONFIG_CAPT_DNS_TCP
+        if (tcp_ok) {
+            nfds = capt_dns_tcp_fill_fdset(&read_set, max_fd) + 1;
+            if (!capt_dns_tcp_is_idle() && (CONFIG_CAPT_DNS_TCP_IDLE_TIMEOUT_MS < wait_ms)) {
+                wait_ms = CONFIG_CAPT_DNS_TCP_IDLE_TIMEOUT_MS;
+            }
+        }
+#endif
+
+        timeout.tv_sec = wait_ms / 1000;
+        timeout.tv_usec = (wait_ms % 1000) * 1000;
+
+        ret = select(nfds, &read_set, NULL, NULL, &timeout);
+        if (ret < 0) {
+            if (errno != EINTR) {
+                ESP_LOGW(TAG, "select() failed (errno %d)", errno);
+                vTaskDelay(100 / portTICK_RATE_MS);
+            }
+            continue;
+        }
+
+        if ((_ctrlFd != -1) && FD_ISSET(_ctrlFd, &read_set)) {
+            // Drain the wakeup datagram. The loop condition picks up the stop request.
+            recv(_ctrlFd, ctrl_msg, sizeof(ctrl_msg), 0);
+        }
+
+#if CONFIG_CAPT_DNS_TCP
+        if (tcp_ok) {
+            capt_dns_tcp_process(&read_set, &_ip_info_of_softap);
+        }
+#endif
+
+#if CONFIG_CAPT_DNS_SPLIT_HORIZON
+        if ((_fwdFd != -1) && FD_ISSET(_fwdFd, &read_set)) {
+            struct sockaddr_storage client;
+            int reply_len = capt_dns_forward_recv(&client, _reply, sizeof(_reply));
+            if (reply_len > 0) {
+                int fd = _sockFd;
+#if CONFIG_CAPT_DNS_IPV6
+                fd = (client.ss_family == AF_INET6) ? _sock6Fd : fd;
+#endif
+                sendto(fd, _reply, reply_len, 0, (struct sockaddr*)&client,
+                       sockaddr_len(&client));
+            }
+        }
+#endif
+
+        if (FD_ISSET(_sockFd, &read_set)) {
+            serve_batch(_sockFd);
+        }
+#if CONFIG_CAPT_DNS_IPV6
+        if ((_sock6Fd != -1) && FD_ISSET(_sock6Fd, &read_set)) {
+            serve_batch(_sock6Fd);
+        }
+#endif
+    }
+
+#if CONFIG_CAPT_DNS_TCP
+    capt_dns_tcp_stop();
+#endif
+#if CONFIG_CAPT_DNS_SPLIT_HORIZON
+    capt_dns_forward_close();
+    _fwdFd = -1;
+#endif
+}
+
+static void capt_dns_task(void* pvParameters)
+{
+    while (true) {
+        // Parked here between capt_dns_stop() and the next capt_dns_start()
+        xEventGroupWaitBits(_capt_dns_event_group, DNS_SERVER_START_REQUESTED_EVENT, true, true,
+                            portMAX_DELAY);
+
+        if (open_sockets()) {
+#if CONFIG_CAPT_DNS_IPV6
+            open_ipv6_socket();
+#endif
+            drain_ctrl_socket();
+            serve_queries();
+        }
+        close_sockets();
+
+        ESP_LOGI(TAG, "Captive portal DNS server task parked");
+        xEventGroupClearBits(_capt_dns_event_group, DNS_SERVER_STOP_REQUESTED_EVENT);
+        xEventGroupSetBits(_capt_dns_event_group, DNS_SERVER_STOP_COMPLETE_EVENT);
+    }
+}
+
+esp_err_t capt_dns_backend_start(esp_netif_t* softap_netif_handle,
+                                 const esp_netif_ip_info_t* ip_info)
+{
+    _ip_info_of_softap = *ip_info;
+
+#if CONFIG_CAPT_DNS_IPV6
+    _ip6_valid = (esp_netif_get_ip6_linklocal(softap_netif_handle, &_ip6_linklocal) == ESP_OK);
+    _ip6_scope = esp_netif_get_netif_impl_index(softap_netif_handle);
+    if (!_ip6_valid) {
+        ESP_LOGW(TAG, "Soft AP has no IPv6 link-local address. Serving IPv4 only.");
+    }
+#endif
+
+    if (!_capt_dns_event_group) {
+        // First start. The task and event group live for the rest of the program.
+        _capt_dns_event_group = xEventGroupCreateStatic(&_capt_dns_event_group_buf);
+
+        // ESP-IDF UDP server example passes the address family as the pvParameters
+        // argument to xTaskCreate.  In our case, we are always using AF_INET, so
+        // we pass NULL for pvParameters instead.
+        xTaskCreateStatic(capt_dns_task, "captdns_task", CAPT_DNS_TASK_STACK_SIZE, NULL,
+                          CAPT_DNS_TASK_PRIORITY, _capt_dns_task_stack, &_capt_dns_task_buf);
+    }
+
+    xEventGroupClearBits(_capt_dns_event_group, DNS_SERVER_STOP_COMPLETE_EVENT);
+    xEventGroupSetBits(_capt_dns_event_group, DNS_SERVER_START_REQUESTED_EVENT);
+
+    return ESP_OK;
+}
+
+void capt_dns_backend_stop(void)
+{
+    if (!_capt_dns_event_group) {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Signaling DNS server task to stop serving");
+
+    // Signal the server thread to stop and then wait for it to signal back.
+    xEventGroupSetBits(_capt_dns_event_group, DNS_SERVER_STOP_REQUESTED_EVENT);
+    send_ctrl_wakeup();
+    xEventGroupWaitBits(_capt_dns_event_group, DNS_SERVER_STOP_COMPLETE_EVENT, true, true,
+                        portMAX_DELAY);
+}
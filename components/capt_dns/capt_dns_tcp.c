@@ -0,0 +1,270 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+DNS over TCP (RFC 7766) for clients that retry a truncated answer. Each message is preceded by
+a two-byte length. A handful of connections are served from static buffers in the socket
+backend's task; connections over the limit are closed right away and idle ones are closed
+after a short timeout, so a client never waits on a connection nobody will serve.
+*/
+
+#include "capt_dns_priv.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#include "lwip/sockets.h"
+
+static const char* TAG = "capt_dns_tcp";
+
+/* Replies repeat the question, so leave room for answers after a full-size query */
+#define DNS_TCP_REPLY_MAX (2 * DNS_LEN)
+
+typedef struct {
+    int fd; // -1 if the slot is free
+    uint32_t src_key;
+    uint32_t last_active_ms;
+    uint16_t have;            // Bytes received into buf
+    uint8_t buf[2 + DNS_LEN]; // Length prefix and message
+} DnsTcpConn;
+
+static int _listenFd = -1;
+static DnsTcpConn _conns[CONFIG_CAPT_DNS_TCP_MAX_CONNS];
+static uint8_t _tcp_reply[2 + DNS_TCP_REPLY_MAX];
+
+static uint32_t now_ms(void)
+{
+    return xTaskGetTickCount() * portTICK_PERIOD_MS;
+}
+
+static void close_conn(DnsTcpConn* conn)
+{
+    close(conn->fd);
+    conn->fd = -1;
+    conn->have = 0;
+}
+
+bool capt_dns_tcp_start(void)
+{
+    struct sockaddr_in server_addr;
+    int idx;
+
+    for (idx = 0; idx < CONFIG_CAPT_DNS_TCP_MAX_CONNS; idx++) {
+        _conns[idx].fd = -1;
+        _conns[idx].have = 0;
+    }
+
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(DNS_PORT);
+    server_addr.sin_len = sizeof(server_addr);
+
+    _listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (_listenFd == -1) {
+        ESP_LOGW(TAG, "Failed to create TCP listen socket.");
+        return false;
+    }
+    // Connections closed by the last session may still be in TIME_WAIT on port 53.
+    int reuse = 1;
+    setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if ((bind(_listenFd, (struct sockaddr*)&server_addr, sizeof(server_addr)) != 0) ||
+        (listen(_listenFd, CONFIG_CAPT_DNS_TCP_MAX_CONNS) != 0)) {
+        ESP_LOGW(TAG, "Failed to listen on TCP port %d.", DNS_PORT);
+        close(_listenFd);
+        _listenFd = -1;
+        return false;
+    }
+    fcntl(_listenFd, F_SETFL, O_NONBLOCK);
+    return true;
+}
+
+void capt_dns_tcp_stop(void)
+{
+    int idx;
+
+    for (idx = 0; idx < CONFIG_CAPT_DNS_TCP_MAX_CONNS; idx++) {
+        if (_conns[idx].fd != -1) {
+            close_conn(&_conns[idx]);
+        }
+    }
+
+    // Without a listener, clients get a reset right away instead of a connection that nobody
+    // serves until the next start.
+    if (_listenFd != -1) {
+        close(_listenFd);
+        _listenFd = -1;
+    }
+}
+
+int capt_dns_tcp_fill_fdset(fd_set* read_set, int max_fd)
+{
+    int idx;
+
+    if (_listenFd == -1) {
+        return max_fd;
+    }
+    FD_SET(_listenFd, read_set);
+    max_fd = (_listenFd > max_fd) ? _listenFd : max_fd;
+
+    for (idx = 0; idx < CONFIG_CAPT_DNS_TCP_MAX_CONNS; idx++) {
+        int fd = _conns[idx].fd;
+        if (fd != -1) {
+            FD_SET(fd, read_set);
+            max_fd = (fd > max_fd) ? fd : max_fd;
+        }
+    }
+    return max_fd;
+}
+
+bool capt_dns_tcp_is_idle(void)
+{
+    int idx;
+
+    for (idx = 0; idx < CONFIG_CAPT_DNS_TCP_MAX_CONNS; idx++) {
+        if (_conns[idx].fd != -1) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void accept_conn(const esp_netif_ip_info_t* ip_info)
+{
+    struct sockaddr_in from;
+    socklen_t fromlen = sizeof(from);
+    DnsTcpConn* conn = NULL;
+    int idx;
+
+    int fd = accept(_listenFd, (struct sockaddr*)&from, &fromlen);
+    if (fd < 0) {
+        return;
+    }
+
+    // Same interface restriction as for UDP
+    if ((from.sin_addr.s_addr & ip_info->netmask.addr) !=
+        (ip_info->ip.addr & ip_info->netmask.addr)) {
+        close(fd);
+        return;
+    }
+
+    for (idx = 0; idx < CONFIG_CAPT_DNS_TCP_MAX_CONNS; idx++) {
+        if (_conns[idx].fd == -1) {
+            conn = &_conns[idx];
+            break;
+        }
+    }
+    if (conn == NULL) {
+        // All slots busy. Closing right away lets the client move on rather than wait.
+        ESP_LOGD(TAG, "Too many connections");
+        close(fd);
+        return;
+    }
+
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    conn->fd = fd;
+    conn->src_key = from.sin_addr.s_addr;
+    conn->last_active_ms = now_ms();
+    conn->have = 0;
+}
+
+// Answers every complete message in the connection's buffer. Returns false if the connection
+// has to be closed.
+static bool answer_messages(DnsTcpConn* conn)
+{
+    while (conn->have >= 2) {
+        int msg_len = (conn->buf[0] << 8) | conn->buf[1];
+        if ((msg_len == 0) || (msg_len > DNS_LEN)) {
+            return false;
+        }
+        if (conn->have < (2 + msg_len)) {
+            // Wait for the rest
+            return true;
+        }
+
+        int reply_len = capt_dns_handle_query(conn->src_key, &conn->buf[2], msg_len,
+                                              &_tcp_reply[2], DNS_TCP_REPLY_MAX);
+        if (reply_len == CAPT_DNS_FORWARD) {
+            // Upstream replies are routed back over UDP only.
+            reply_len = capt_dns_build_error_reply(&conn->buf[2], msg_len, &_tcp_reply[2],
+                                                   DNS_TCP_REPLY_MAX, DNS_RCODE_SERVFAIL);
+        }
+        if (reply_len <= 0) {
+            // No answer over TCP means the client is waiting in vain.
+            return false;
+        }
+
+        _tcp_reply[0] = reply_len >> 8;
+        _tcp_reply[1] = reply_len & 0xff;
+        if (send(conn->fd, _tcp_reply, 2 + reply_len, MSG_DONTWAIT) != (2 + reply_len)) {
+            return false;
+        }
+
+        // Keep any pipelined message that followed
+        conn->have -= 2 + msg_len;
+        memmove(conn->buf, &conn->buf[2 + msg_len], conn->have);
+    }
+    return true;
+}
+
+void capt_dns_tcp_process(const fd_set* read_set, const esp_netif_ip_info_t* ip_info)
+{
+    uint32_t now = now_ms();
+    int idx;
+
+    if (_listenFd == -1) {
+        return;
+    }
+
+    for (idx = 0; idx < CONFIG_CAPT_DNS_TCP_MAX_CONNS; idx++) {
+        DnsTcpConn* conn = &_conns[idx];
+        if (conn->fd == -1) {
+            continue;
+        }
+
+        if (FD_ISSET(conn->fd, read_set)) {
+            int ret = recv(conn->fd, &conn->buf[conn->have], sizeof(conn->buf) - conn->have,
+                           MSG_DONTWAIT);
+            if ((ret == 0) || ((ret < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+                // Closed by the client, or an error
+                close_conn(conn);
+                continue;
+            }
+            if (ret > 0) {
+                conn->have += ret;
+                conn->last_active_ms = now;
+                if (!answer_messages(conn)) {
+                    close_conn(conn);
+                    continue;
+                }
+            }
+        }
+
+        if ((now - conn->last_active_ms) >= CONFIG_CAPT_DNS_TCP_IDLE_TIMEOUT_MS) {
+            ESP_LOGD(TAG, "Closing idle connection");
+            close_conn(conn);
+        }
+    }
+
+    if (FD_ISSET(_listenFd, read_set)) {
+        accept_conn(ip_info);
+    }
+}
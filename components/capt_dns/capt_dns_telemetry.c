@@ -0,0 +1,161 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Query telemetry. The backend's task is the only writer: it stores a compact record of each query
+in a ring and bumps a per-type counter and a service time histogram bucket. Readers in other
+tasks (e.g. an HTTP handler) never block the writer. They copy the ring and then check the write
+count again to throw away any record that was overwritten while they were copying.
+*/
+
+#include "capt_dns.h"
+#include "capt_dns_priv.h"
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "sdkconfig.h"
+
+#define RING_SIZE CONFIG_CAPT_DNS_TELEMETRY_RING_SIZE
+
+// The write count wraps around at 2^32, which keeps the slot index continuous only if the ring
+// size divides it.
+_Static_assert((RING_SIZE & (RING_SIZE - 1)) == 0, "Telemetry ring size must be a power of two");
+
+#define QTYPE_A     1
+#define QTYPE_NS    2
+#define QTYPE_SOA   6
+#define QTYPE_PTR   12
+#define QTYPE_AAAA  28
+#define QTYPE_SVCB  64
+#define QTYPE_HTTPS 65
+
+static capt_dns_query_record_t _ring[RING_SIZE];
+static atomic_uint _ring_written; // Records written since boot. Slot is (count % RING_SIZE).
+static atomic_uint _qtype_count[CAPT_DNS_QTYPE_COUNT];
+static atomic_uint _latency_count[CAPT_DNS_LATENCY_BUCKETS];
+
+static const char* const _qtype_bucket_names[CAPT_DNS_QTYPE_COUNT] = {
+    [CAPT_DNS_QTYPE_A] = "A",         [CAPT_DNS_QTYPE_AAAA] = "AAAA",
+    [CAPT_DNS_QTYPE_HTTPS] = "HTTPS", [CAPT_DNS_QTYPE_PTR] = "PTR",
+    [CAPT_DNS_QTYPE_NS] = "NS",       [CAPT_DNS_QTYPE_OTHER] = "other",
+};
+
+static capt_dns_qtype_bucket_t qtype_bucket(uint16_t qtype)
+{
+    switch (qtype) {
+    case QTYPE_A:
+        return CAPT_DNS_QTYPE_A;
+    case QTYPE_AAAA:
+        return CAPT_DNS_QTYPE_AAAA;
+    case QTYPE_SVCB:
+    case QTYPE_HTTPS:
+        return CAPT_DNS_QTYPE_HTTPS;
+    case QTYPE_PTR:
+        return CAPT_DNS_QTYPE_PTR;
+    case QTYPE_NS:
+    case QTYPE_SOA:
+        return CAPT_DNS_QTYPE_NS;
+    default:
+        return CAPT_DNS_QTYPE_OTHER;
+    }
+}
+
+// floor(log2(us)), with 0 and 1 us both in bucket 0 and everything too long in the last bucket
+static int latency_bucket(uint32_t us)
+{
+    int bucket = 31 - __builtin_clz(us | 1);
+    return (bucket < CAPT_DNS_LATENCY_BUCKETS) ? bucket : (CAPT_DNS_LATENCY_BUCKETS - 1);
+}
+
+void capt_dns_telemetry_record(uint32_t src_key, const uint8_t* query, int length,
+                               uint32_t service_us)
+{
+    uint32_t name_hash = 0;
+    uint16_t qtype = 0;
+
+    if (capt_dns_question_info(query, length, &name_hash, &qtype) < 0) {
+        name_hash = 0;
+        qtype = 0;
+    }
+
+    // Only this task writes the count, so a relaxed read is enough.
+    unsigned int written = atomic_load_explicit(&_ring_written, memory_order_relaxed);
+    capt_dns_query_record_t* rec = &_ring[written % RING_SIZE];
+    rec->timestamp_ms = xTaskGetTickCount() * portTICK_PERIOD_MS;
+    rec->src_key = src_key;
+    rec->qname_hash = name_hash;
+    rec->qtype = qtype;
+    rec->service_us = (service_us > UINT16_MAX) ? UINT16_MAX : service_us;
+    // Publish the record
+    atomic_store_explicit(&_ring_written, written + 1, memory_order_release);
+
+    atomic_fetch_add_explicit(&_qtype_count[qtype_bucket(qtype)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&_latency_count[latency_bucket(service_us)], 1,
+                              memory_order_relaxed);
+}
+
+void capt_dns_get_telemetry(capt_dns_telemetry_t* telemetry)
+{
+    int idx;
+
+    for (idx = 0; idx < CAPT_DNS_QTYPE_COUNT; idx++) {
+        telemetry->qtype[idx] = atomic_load_explicit(&_qtype_count[idx], memory_order_relaxed);
+    }
+    for (idx = 0; idx < CAPT_DNS_LATENCY_BUCKETS; idx++) {
+        telemetry->latency[idx] =
+            atomic_load_explicit(&_latency_count[idx], memory_order_relaxed);
+    }
+}
+
+size_t capt_dns_get_recent_queries(capt_dns_query_record_t* records, size_t max_records)
+{
+    unsigned int first, end, seq;
+    size_t count;
+
+    // The slot after the newest record may be in the middle of being written.
+    if (max_records > (RING_SIZE - 1)) {
+        max_records = RING_SIZE - 1;
+    }
+
+    end = atomic_load_explicit(&_ring_written, memory_order_acquire);
+    count = (end < max_records) ? end : max_records;
+    first = end - count;
+    for (seq = first; seq != end; seq++) {
+        records[seq - first] = _ring[seq % RING_SIZE];
+    }
+
+    // The writer may have lapped us while copying. Record seq is intact only if the writer has
+    // not yet started on record seq + RING_SIZE, which goes into the same slot.
+    atomic_thread_fence(memory_order_acquire);
+    unsigned int written = atomic_load_explicit(&_ring_written, memory_order_relaxed);
+    unsigned int overwritten = written - first;
+    if (overwritten > RING_SIZE - 1) {
+        size_t lost = overwritten - (RING_SIZE - 1);
+        if (lost >= count) {
+            return 0;
+        }
+        memmove(records, &records[lost], (count - lost) * sizeof(records[0]));
+        count -= lost;
+    }
+    return count;
+}
+
+const char* capt_dns_qtype_bucket_name(capt_dns_qtype_bucket_t bucket)
+{
+    return (bucket < CAPT_DNS_QTYPE_COUNT) ? _qtype_bucket_names[bucket] : "?";
+}
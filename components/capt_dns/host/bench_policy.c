@@ -0,0 +1,241 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Cost of the host name policy lookup against the number of policies. For each table size up to
+CONFIG_CAPT_DNS_POLICY_MAX (the largest Kconfig allows, in this build), it fills the table with
+exact and suffix policies and times capt_dns_build_reply() for queries that hit an exact policy,
+hit a suffix policy, or match none. A scan of the same policies one by one, on the dotted name,
+is timed next to it for comparison. Build and run from this directory with
+
+    make bench-policy
+*/
+
+#include "capt_dns_query.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+/* Run each measurement until this much time has passed */
+#define MIN_RUN_NS (200000000LL)
+
+#define NUM_QUERIES (256)
+
+#define NAME_MAX_LEN (64)
+
+typedef enum
+{
+    KIND_EXACT,
+    KIND_SUFFIX,
+    KIND_MISS,
+    NUM_KINDS,
+} kind_t;
+
+static const char* const KIND_NAMES[NUM_KINDS] = {"exact hit", "suffix hit", "miss"};
+
+typedef struct {
+    uint8_t data[DNS_LEN];
+    int len;
+    char dotted[NAME_MAX_LEN];
+} query_t;
+
+static const uint8_t AP_IP4[4] = {192, 168, 4, 1};
+
+static capt_dns_policy_t _policies[CONFIG_CAPT_DNS_POLICY_MAX];
+static char _patterns[CONFIG_CAPT_DNS_POLICY_MAX][NAME_MAX_LEN];
+static query_t _queries[NUM_KINDS][NUM_QUERIES];
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void build_query(query_t* query, const char* dotted)
+{
+    static const uint8_t HEADER[] = {0x12, 0x34, 0x01, 0x00, 0, 1, 0, 0, 0, 0, 0, 0};
+    int len = sizeof(HEADER);
+
+    memcpy(query->data, HEADER, len);
+    while (*dotted) {
+        const char* dot = strchr(dotted, '.');
+        int label_len = dot ? (int)(dot - dotted) : (int)strlen(dotted);
+        query->data[len++] = label_len;
+        memcpy(&query->data[len], dotted, label_len);
+        len += label_len;
+        dotted += label_len + (dot ? 1 : 0);
+    }
+    query->data[len++] = 0;
+    query->data[len++] = 0; // QTYPE A
+    query->data[len++] = 1;
+    query->data[len++] = 0; // QCLASS IN
+    query->data[len++] = 1;
+    query->len = len;
+}
+
+/* Policy n: even ones exact, odd ones suffix, each on a name of its own */
+static void fill_policies(int count)
+{
+    for (int n = 0; n < count; n++) {
+        bool is_suffix = (n % 2);
+        snprintf(_patterns[n], NAME_MAX_LEN, "%s%d.zone%d.example", is_suffix ? "site" : "host",
+                 n, n % 7);
+        _policies[n].pattern = _patterns[n];
+        _policies[n].match = is_suffix ? CAPT_DNS_MATCH_SUFFIX : CAPT_DNS_MATCH_EXACT;
+        _policies[n].action = CAPT_DNS_ACTION_IP;
+        _policies[n].ip = 0x0100000a + n;
+    }
+}
+
+/* Queries spread over the whole table of an even number of policies */
+static void fill_queries(int count)
+{
+    for (int idx = 0; idx < NUM_QUERIES; idx++) {
+        int exact = (idx * 2) % count;
+        int suffix = exact + 1;
+        char dotted[NAME_MAX_LEN];
+
+        snprintf(dotted, sizeof(dotted), "host%d.zone%d.example", exact, exact % 7);
+        build_query(&_queries[KIND_EXACT][idx], dotted);
+        strcpy(_queries[KIND_EXACT][idx].dotted, dotted);
+
+        snprintf(dotted, sizeof(dotted), "www.site%d.zone%d.example", suffix, suffix % 7);
+        build_query(&_queries[KIND_SUFFIX][idx], dotted);
+        strcpy(_queries[KIND_SUFFIX][idx].dotted, dotted);
+
+        snprintf(dotted, sizeof(dotted), "other%d.zone%d.example", idx, idx % 7);
+        build_query(&_queries[KIND_MISS][idx], dotted);
+        strcpy(_queries[KIND_MISS][idx].dotted, dotted);
+    }
+}
+
+/* The policy for a dotted name, by looking at every policy in turn */
+static const capt_dns_policy_t* scan_policies(const char* dotted, int count)
+{
+    const capt_dns_policy_t* found = NULL;
+    size_t found_len = 0;
+    size_t name_len = strlen(dotted);
+
+    for (int n = 0; n < count; n++) {
+        const capt_dns_policy_t* policy = &_policies[n];
+        size_t len = strlen(policy->pattern);
+
+        if (policy->match == CAPT_DNS_MATCH_EXACT) {
+            if (strcasecmp(dotted, policy->pattern) == 0) {
+                return policy;
+            }
+        } else if ((len <= name_len) && (!found || (len > found_len)) &&
+                   (strcasecmp(&dotted[name_len - len], policy->pattern) == 0) &&
+                   ((len == name_len) || (dotted[name_len - len - 1] == '.'))) {
+            found = policy;
+            found_len = len;
+        }
+    }
+    return found;
+}
+
+/* Nanoseconds per query through capt_dns_build_reply(), and per query through the scan */
+static void time_kind(kind_t kind, int count, double* reply_ns, double* scan_ns)
+{
+    static uint8_t reply[DNS_LEN];
+    volatile uintptr_t sink = 0;
+    long long replayed = 0;
+    long long start_ns = now_ns();
+    long long elapsed_ns;
+
+    do {
+        for (int idx = 0; idx < NUM_QUERIES; idx++) {
+            const query_t* query = &_queries[kind][idx];
+            sink ^= capt_dns_build_reply(query->data, query->len, reply, sizeof(reply));
+        }
+        replayed += NUM_QUERIES;
+        elapsed_ns = now_ns() - start_ns;
+    } while (elapsed_ns < MIN_RUN_NS);
+    *reply_ns = (double)elapsed_ns / replayed;
+
+    replayed = 0;
+    start_ns = now_ns();
+    do {
+        for (int idx = 0; idx < NUM_QUERIES; idx++) {
+            sink ^= (uintptr_t)scan_policies(_queries[kind][idx].dotted, count);
+        }
+        replayed += NUM_QUERIES;
+        elapsed_ns = now_ns() - start_ns;
+    } while (elapsed_ns < MIN_RUN_NS);
+    *scan_ns = (double)elapsed_ns / replayed;
+}
+
+/* Whether every query got the answer of its policy */
+static bool check_answers(int count)
+{
+    static uint8_t reply[DNS_LEN];
+
+    for (int kind = 0; kind < NUM_KINDS; kind++) {
+        for (int idx = 0; idx < NUM_QUERIES; idx++) {
+            const query_t* query = &_queries[kind][idx];
+            const capt_dns_policy_t* policy = scan_policies(query->dotted, count);
+            int len = capt_dns_build_reply(query->data, query->len, reply, sizeof(reply));
+            const void* expected = policy ? (const void*)&policy->ip : AP_IP4;
+
+            if ((len < 4) || (memcmp(&reply[len - 4], expected, 4) != 0) ||
+                ((kind == KIND_MISS) == (policy != NULL))) {
+                fprintf(stderr, "%d policies: wrong answer for %s\n", count, query->dotted);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int main(void)
+{
+    static const int COUNTS[] = {2, 16, 64, 256, CONFIG_CAPT_DNS_POLICY_MAX};
+
+    capt_dns_query_init(AP_IP4, NULL);
+
+    printf("ns/query");
+    for (int kind = 0; kind < NUM_KINDS; kind++) {
+        printf("  %-19s", KIND_NAMES[kind]);
+    }
+    printf("\npolicies");
+    for (int kind = 0; kind < NUM_KINDS; kind++) {
+        printf("  %9s %9s", "table", "scan");
+    }
+    printf("\n");
+    for (size_t c = 0; c < sizeof(COUNTS) / sizeof(COUNTS[0]); c++) {
+        int count = COUNTS[c];
+
+        fill_policies(count);
+        fill_queries(count);
+        if (!capt_dns_set_policies(_policies, count)) {
+            fprintf(stderr, "%d policies rejected\n", count);
+            return 1;
+        }
+        if (!check_answers(count)) {
+            return 1;
+        }
+
+        printf("%8d", count);
+        for (int kind = 0; kind < NUM_KINDS; kind++) {
+            double reply_ns, scan_ns;
+            time_kind(kind, count, &reply_ns, &scan_ns);
+            printf("  %9.1f %9.1f", reply_ns, scan_ns);
+        }
+        printf("\n");
+    }
+    return 0;
+}
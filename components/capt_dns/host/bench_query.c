@@ -0,0 +1,354 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Throughput of the DNS reply builder on the host. Replays the queries of pcap captures (UDP to
+port 53, over Ethernet, Linux cooked or raw IP) or of raw message files such as the fuzz corpus
+through capt_dns_build_reply() until about a second has passed, then prints queries per second
+and the time per query. It then replays the queries of each question type on their own and
+prints the same for each: A and AAAA are answered with the soft AP's address and NS with the
+name "ns", while HTTPS, SVCB and most others get NODATA with an SOA record. Queries without a
+readable question are counted as "none". Build and run from this directory with
+
+    make bench_query && ./bench_query capture.pcap
+
+or over the fuzz corpus and the client queries with make bench-corpus.
+
+Captures are easiest taken on the machine of a client of the soft AP:
+tcpdump -i wlan0 -w capture.pcap udp dst port 53
+*/
+
+#include "capt_dns_query.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MAX_QUERIES (100000)
+
+/* Replay all queries until this much time has passed, and those of each type for this long */
+#define MIN_RUN_NS      (1000000000LL)
+#define MIN_TYPE_RUN_NS (200000000LL)
+
+#define PCAP_MAGIC      (0xa1b2c3d4U)
+#define PCAP_MAGIC_NSEC (0xa1b23c4dU)
+
+#define LINKTYPE_ETHERNET  (1)
+#define LINKTYPE_RAW       (101)
+#define LINKTYPE_LINUX_SLL (113)
+#define LINKTYPE_IPV4      (228)
+#define LINKTYPE_IPV6      (229)
+
+#define ETHERTYPE_IPV4 (0x0800)
+#define ETHERTYPE_IPV6 (0x86dd)
+#define ETHERTYPE_VLAN (0x8100)
+
+#define IPPROTO_UDP_ (17)
+
+#define QTYPE_A     (1)
+#define QTYPE_NS    (2)
+#define QTYPE_AAAA  (28)
+#define QTYPE_SVCB  (64)
+#define QTYPE_HTTPS (65)
+
+#define HEADER_LEN (12)
+
+typedef enum
+{
+    TYPE_A,
+    TYPE_AAAA,
+    TYPE_NS,
+    TYPE_HTTPS,
+    TYPE_OTHER,
+    TYPE_NO_QUESTION,
+    NUM_TYPES,
+} query_type_t;
+
+static const char* const TYPE_NAMES[NUM_TYPES] = {"A",     "AAAA", "NS", "HTTPS/SVCB",
+                                                  "other", "none"};
+
+typedef struct {
+    uint8_t* data;
+    int len;
+    query_type_t type;
+} query_t;
+
+typedef struct {
+    long long replayed;
+    long long answered;
+    long long reply_bytes;
+    long long elapsed_ns;
+} run_t;
+
+static query_t _queries[MAX_QUERIES];
+static int _num_queries = 0;
+
+static uint16_t get16(const uint8_t* p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get32(const uint8_t* p, bool is_swapped)
+{
+    uint32_t val;
+    memcpy(&val, p, sizeof(val));
+    return is_swapped ? __builtin_bswap32(val) : val;
+}
+
+/* The type of the first question, by how the reply builder treats it */
+static query_type_t query_type(const uint8_t* data, size_t len)
+{
+    size_t pos = HEADER_LEN;
+
+    if ((len < HEADER_LEN) || (get16(&data[4]) == 0)) {
+        return TYPE_NO_QUESTION;
+    }
+    while ((pos < len) && (data[pos] != 0)) {
+        if ((data[pos] & 0xc0) != 0) {
+            return TYPE_NO_QUESTION;
+        }
+        pos += data[pos] + 1;
+    }
+    if (pos + 3 > len) {
+        return TYPE_NO_QUESTION;
+    }
+    switch (get16(&data[pos + 1])) {
+    case QTYPE_A:
+        return TYPE_A;
+    case QTYPE_AAAA:
+        return TYPE_AAAA;
+    case QTYPE_NS:
+        return TYPE_NS;
+    case QTYPE_SVCB:
+    case QTYPE_HTTPS:
+        return TYPE_HTTPS;
+    default:
+        return TYPE_OTHER;
+    }
+}
+
+static void add_query(const uint8_t* data, size_t len)
+{
+    if ((_num_queries == MAX_QUERIES) || (len == 0) || (len > DNS_LEN)) {
+        return;
+    }
+    _queries[_num_queries].data = malloc(len);
+    memcpy(_queries[_num_queries].data, data, len);
+    _queries[_num_queries].len = (int)len;
+    _queries[_num_queries].type = query_type(data, len);
+    _num_queries++;
+}
+
+/* Add the payload of a UDP datagram to port 53 in an IPv4 or IPv6 packet */
+static void add_ip_packet(const uint8_t* pkt, size_t len)
+{
+    const uint8_t* udp;
+    size_t udp_len;
+
+    if (len < 1) {
+        return;
+    }
+    if ((pkt[0] >> 4) == 4) {
+        size_t ihl = (pkt[0] & 0x0f) * 4;
+        // Skip other protocols, non-first fragments and fragments to come
+        if ((len < 20) || (ihl < 20) || (len < ihl) || (pkt[9] != IPPROTO_UDP_) ||
+            (get16(&pkt[6]) & 0x3fff)) {
+            return;
+        }
+        udp = &pkt[ihl];
+        udp_len = len - ihl;
+    } else if ((pkt[0] >> 4) == 6) {
+        // Extension headers are not followed
+        if ((len < 40) || (pkt[6] != IPPROTO_UDP_)) {
+            return;
+        }
+        udp = &pkt[40];
+        udp_len = len - 40;
+    } else {
+        return;
+    }
+    if ((udp_len < 8) || (get16(&udp[2]) != DNS_PORT)) {
+        return;
+    }
+    if ((get16(&udp[4]) >= 8) && (get16(&udp[4]) < udp_len)) {
+        udp_len = get16(&udp[4]);
+    }
+    add_query(&udp[8], udp_len - 8);
+}
+
+static void add_frame(uint32_t linktype, const uint8_t* frame, size_t len)
+{
+    size_t offset;
+    uint16_t ethertype;
+
+    switch (linktype) {
+    case LINKTYPE_ETHERNET:
+        if (len < 14) {
+            return;
+        }
+        ethertype = get16(&frame[12]);
+        offset = 14;
+        if ((ethertype == ETHERTYPE_VLAN) && (len >= 18)) {
+            ethertype = get16(&frame[16]);
+            offset = 18;
+        }
+        break;
+    case LINKTYPE_LINUX_SLL:
+        if (len < 16) {
+            return;
+        }
+        ethertype = get16(&frame[14]);
+        offset = 16;
+        break;
+    case LINKTYPE_RAW:
+    case LINKTYPE_IPV4:
+    case LINKTYPE_IPV6:
+        add_ip_packet(frame, len);
+        return;
+    default:
+        return;
+    }
+    if ((ethertype == ETHERTYPE_IPV4) || (ethertype == ETHERTYPE_IPV6)) {
+        add_ip_packet(&frame[offset], len - offset);
+    }
+}
+
+/* Load the queries of a pcap capture, or the file as one message if it is none */
+static bool load_file(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    uint8_t* buf;
+    long size;
+
+    if (!file) {
+        perror(path);
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    buf = malloc(size ? size : 1);
+    if (!buf || (fread(buf, 1, size, file) != (size_t)size)) {
+        fprintf(stderr, "%s: read failed\n", path);
+        fclose(file);
+        free(buf);
+        return false;
+    }
+    fclose(file);
+
+    uint32_t magic = (size >= 24) ? get32(buf, false) : 0;
+    bool is_swapped = (magic == __builtin_bswap32(PCAP_MAGIC)) ||
+                      (magic == __builtin_bswap32(PCAP_MAGIC_NSEC));
+    if (!is_swapped && (magic != PCAP_MAGIC) && (magic != PCAP_MAGIC_NSEC)) {
+        add_query(buf, size);
+        free(buf);
+        return true;
+    }
+
+    uint32_t linktype = get32(&buf[20], is_swapped) & 0xffff;
+    long pos = 24;
+    while (pos + 16 <= size) {
+        uint32_t incl_len = get32(&buf[pos + 8], is_swapped);
+        pos += 16;
+        if (incl_len > (uint32_t)(size - pos)) {
+            break;
+        }
+        add_frame(linktype, &buf[pos], incl_len);
+        pos += incl_len;
+    }
+    free(buf);
+    return true;
+}
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Replays the queries until min_ns has passed */
+static void replay(const query_t* queries, int num_queries, long long min_ns, run_t* run)
+{
+    static uint8_t reply[DNS_LEN];
+    volatile uint8_t sink = 0;
+    long long start_ns = now_ns();
+
+    memset(run, 0, sizeof(*run));
+    do {
+        for (int idx = 0; idx < num_queries; idx++) {
+            int len = capt_dns_build_reply(queries[idx].data, queries[idx].len, reply,
+                                           sizeof(reply));
+            if (len > 0) {
+                run->answered++;
+                run->reply_bytes += len;
+                sink ^= reply[len - 1];
+            }
+        }
+        run->replayed += num_queries;
+        run->elapsed_ns = now_ns() - start_ns;
+    } while (run->elapsed_ns < min_ns);
+}
+
+int main(int argc, char** argv)
+{
+    static const uint8_t ap_ip4[4] = {192, 168, 4, 1};
+    static query_t by_type[MAX_QUERIES];
+    run_t run;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s capture.pcap|message ...\n", argv[0]);
+        return 2;
+    }
+    for (int idx = 1; idx < argc; idx++) {
+        if (!load_file(argv[idx])) {
+            return 1;
+        }
+    }
+    if (_num_queries == 0) {
+        fprintf(stderr, "No DNS queries found\n");
+        return 1;
+    }
+
+    capt_dns_query_init(ap_ip4, NULL);
+
+    replay(_queries, _num_queries, MIN_RUN_NS, &run);
+    printf("%d queries, replayed %lld times\n", _num_queries, run.replayed / _num_queries);
+    printf("%.0f queries/s, %.1f ns/query, %.1f%% answered, %.1f bytes/reply\n",
+           run.replayed * 1e9 / run.elapsed_ns, (double)run.elapsed_ns / run.replayed,
+           100.0 * run.answered / run.replayed,
+           run.answered ? (double)run.reply_bytes / run.answered : 0.0);
+
+    printf("\n%-10s %8s %6s %9s %9s %12s\n", "qtype", "queries", "share", "ns/query", "answered",
+           "bytes/reply");
+    for (int type = 0; type < NUM_TYPES; type++) {
+        int num = 0;
+
+        for (int idx = 0; idx < _num_queries; idx++) {
+            if (_queries[idx].type == type) {
+                by_type[num++] = _queries[idx];
+            }
+        }
+        if (num == 0) {
+            continue;
+        }
+        replay(by_type, num, MIN_TYPE_RUN_NS, &run);
+        printf("%-10s %8d %5.1f%% %9.1f %8.1f%% %12.1f\n", TYPE_NAMES[type], num,
+               100.0 * num / _num_queries, (double)run.elapsed_ns / run.replayed,
+               100.0 * run.answered / run.replayed,
+               run.answered ? (double)run.reply_bytes / run.answered : 0.0);
+    }
+    return 0;
+}
@@ -0,0 +1,121 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+libFuzzer target for the DNS message parser and reply builder. Every input is handed to each
+function of capt_dns_query.h that reads a received message, with policies and local host names
+set so that all answer paths are reachable. Build and run from this directory with
+
+    make fuzz && ./fuzz_query corpus
+
+Without libFuzzer (make fuzz-replay), main() runs the files named on the command line once each,
+which replays the corpus or a crash under plain ASan and UBSan.
+*/
+
+#include "capt_dns_query.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t AP_IP4[4] = {192, 168, 4, 1};
+static const uint8_t AP_IP6[16] = {0xfd, 0x00, 0xca, 0x97, 0x00, 0x1e, 0, 0,
+                                   0,    0,    0,    0,    0,    0,    0, 1};
+
+static const capt_dns_policy_t POLICIES[] = {
+    {"captive.apple.com", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_AP_IP, 0},
+    {"use-application-dns.net", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_NXDOMAIN, 0},
+    {"example.com", CAPT_DNS_MATCH_SUFFIX, CAPT_DNS_ACTION_IP, 0x0100000a},
+};
+
+static const char* const LOCAL_HOSTS[] = {"my-device.local", "setup"};
+
+// Rewrites the TTL as the forwarder's cache does, to catch writes out of bounds
+static void visit_record(uint16_t type, uint8_t* rr, void* arg)
+{
+    (void)type;
+    memset(&rr[4], 0, 4);
+    (*(int*)arg)++;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    static bool is_initialized = false;
+    uint8_t reply[DNS_LEN];
+    uint8_t* packet;
+    uint32_t key;
+    uint32_t name_hash;
+    uint16_t qtype;
+    int records = 0;
+    int length;
+    int end;
+
+    if (!is_initialized) {
+        capt_dns_query_init(AP_IP4, AP_IP6);
+        capt_dns_set_policies(POLICIES, sizeof(POLICIES) / sizeof(POLICIES[0]));
+        capt_dns_set_local_names(LOCAL_HOSTS, sizeof(LOCAL_HOSTS) / sizeof(LOCAL_HOSTS[0]));
+        is_initialized = true;
+    }
+    if (size > DNS_LEN) {
+        // The servers never hand over more than DNS_LEN bytes
+        return 0;
+    }
+    // Exactly sized copy, so that ASan catches accesses past the end of the message
+    length = (int)size;
+    packet = malloc(size ? size : 1);
+    if (!packet) {
+        return 0;
+    }
+    memcpy(packet, data, size);
+
+    capt_dns_build_reply(packet, length, reply, sizeof(reply));
+    capt_dns_build_error_reply(packet, length, reply, sizeof(reply), DNS_RCODE_SERVFAIL);
+    capt_dns_is_local_query(packet, length);
+    capt_dns_question_info(packet, length, &name_hash, &qtype);
+    end = capt_dns_question_key(packet, length, &key);
+    if (end > 0) {
+        capt_dns_question_equal(packet, end, packet, end);
+    }
+
+    // The forwarder rewrites upstream replies in place
+    capt_dns_for_each_record(packet, length, visit_record, &records);
+    memcpy(packet, data, size);
+    capt_dns_strip_additional(packet, length);
+
+    free(packet);
+    return 0;
+}
+
+#ifdef FUZZ_REPLAY
+#include <stdio.h>
+
+int main(int argc, char** argv)
+{
+    static uint8_t data[DNS_LEN + 1];
+
+    for (int idx = 1; idx < argc; idx++) {
+        FILE* file = fopen(argv[idx], "rb");
+        if (!file) {
+            perror(argv[idx]);
+            return 1;
+        }
+        size_t size = fread(data, 1, sizeof(data), file);
+        fclose(file);
+        LLVMFuzzerTestOneInput(data, size);
+    }
+    printf("Replayed %d inputs\n", argc - 1);
+    return 0;
+}
+#endif
@@ -0,0 +1,206 @@
+#!/usr/bin/env python
+#
+# Copyright 2021 Aaron Fontaine
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Writes the seed corpus of fuzz_query and bench_query: one raw DNS message per file.
+
+The seeds cover the queries clients send to a captive portal, the upstream replies the forwarder
+rewrites, and a few malformed messages at the edges of the parser.
+
+Also writes the EDNS queries of the clients directory that test_clients replays. The glibc_*
+files there are captures, not written by this script: getaddrinfo() of glibc 2.36 with
+RES_OPTIONS="edns0 trust-ad" querying a local stand-in server. The others are built here after
+the EDNS variants of the resolvers they are named for: the advertised UDP size, the DO, AD and CD
+bits, EDNS options, and 0x20 randomised case.
+"""
+
+import argparse
+import os
+import struct
+
+QTYPE_A = 1
+QTYPE_NS = 2
+QTYPE_CNAME = 5
+QTYPE_SOA = 6
+QTYPE_PTR = 12
+QTYPE_MX = 15
+QTYPE_TXT = 16
+QTYPE_AAAA = 28
+QTYPE_OPT = 41
+QTYPE_SVCB = 64
+QTYPE_HTTPS = 65
+QTYPE_ANY = 255
+QCLASS_IN = 1
+
+FLAGS_QUERY_RD = 0x0100
+FLAGS_QUERY_RD_AD = 0x0120
+FLAGS_QUERY_RD_CD = 0x0110
+
+EDNS_DO = 0x8000
+
+OPTION_ECS = 8
+OPTION_COOKIE = 10
+OPTION_PADDING = 12
+FLAGS_REPLY = 0x8180
+
+
+def name(dotted):
+    out = b''
+    for label in dotted.split('.'):
+        if label:
+            out += struct.pack('B', len(label)) + label.encode('ascii')
+    return out + b'\0'
+
+
+def header(flags=FLAGS_QUERY_RD, qd=1, an=0, ns=0, ar=0, id=0x1234):
+    return struct.pack('>HHHHHH', id, flags, qd, an, ns, ar)
+
+
+def question(dotted, qtype=QTYPE_A, qclass=QCLASS_IN):
+    return name(dotted) + struct.pack('>HH', qtype, qclass)
+
+
+def opt(udp_size=1232, flags=0, options=b''):
+    return b'\0' + struct.pack('>HHIH', QTYPE_OPT, udp_size, flags, len(options)) + options
+
+
+def option(code, data):
+    return struct.pack('>HH', code, len(data)) + data
+
+
+def record(owner, rtype, rdata, ttl=300):
+    return owner + struct.pack('>HHIH', rtype, QCLASS_IN, ttl, len(rdata)) + rdata
+
+
+def query(dotted, qtype=QTYPE_A, edns=False):
+    return header(ar=1 if edns else 0) + question(dotted, qtype) + (opt() if edns else b'')
+
+
+# Pointer to the name of the first question, right after the 12-byte header
+PTR_QNAME = b'\xc0\x0c'
+
+SEEDS = {
+    # What clients ask a captive portal
+    'a_apple': query('captive.apple.com'),
+    'a_android': query('connectivitycheck.gstatic.com', edns=True),
+    'a_windows': query('www.msftconnecttest.com', edns=True),
+    'a_firefox': query('detectportal.firefox.com'),
+    'a_mixed_case': query('CaPtIvE.ApPlE.CoM'),
+    'a_trailing_dot': header() + b'\x05apple\x03com\x00\x00' + struct.pack('>HH', QTYPE_A, 1),
+    'a_local_host': query('my-device.local'),
+    'a_policy_ip': query('portal.example.com'),
+    'a_policy_nxdomain': query('use-application-dns.net'),
+    'aaaa_apple': query('captive.apple.com', QTYPE_AAAA, edns=True),
+    'https_apple': query('captive.apple.com', QTYPE_HTTPS, edns=True),
+    'svcb': query('_dns.resolver.arpa', QTYPE_SVCB),
+    'ptr_reverse': query('1.4.168.192.in-addr.arpa', QTYPE_PTR),
+    'any': query('example.org', QTYPE_ANY),
+    'mx': query('example.org', QTYPE_MX),
+    'txt_chaos': header() + question('version.bind', QTYPE_TXT, 3),
+    'edns_cookie': header(ar=1) + question('captive.apple.com') +
+                   opt(4096, 0x8000, struct.pack('>HH', 10, 8) + b'\x01' * 8),
+    'edns_small_udp': header(ar=1) + question('captive.apple.com') + opt(256),
+    'edns_version1': header(ar=1) + question('captive.apple.com') + opt(1232, 0x00010000),
+    'two_questions': header(qd=2) + question('a.example.org') + question('b.example.org'),
+    'long_name': query('.'.join(['a' * 63] * 3 + ['b' * 61])),
+    'many_labels': query('.'.join(['x'] * 127)),
+    'root': header() + b'\0' + struct.pack('>HH', QTYPE_NS, 1),
+
+    # Upstream replies, as the forwarder sees them
+    'reply_a': header(FLAGS_REPLY, an=2) + question('example.org') +
+               record(PTR_QNAME, QTYPE_A, b'\x5d\xb8\xd8\x22') +
+               record(PTR_QNAME, QTYPE_A, b'\x5d\xb8\xd8\x23', 60),
+    'reply_cname_chain': header(FLAGS_REPLY, an=2) + question('www.example.org') +
+                         record(PTR_QNAME, QTYPE_CNAME, b'\x03cdn' + PTR_QNAME) +
+                         record(b'\xc0\x2d', QTYPE_A, b'\x0a\x00\x00\x01'),
+    'reply_nxdomain_soa': header(0x8183, ns=1) + question('nope.example.org') +
+                          record(b'\xc0\x11', QTYPE_SOA, name('ns.example.org') +
+                                 name('admin.example.org') + struct.pack('>IIIII', 1, 2, 3, 4, 5)),
+    'reply_edns': header(FLAGS_REPLY, an=1, ar=1) + question('example.org') +
+                  record(PTR_QNAME, QTYPE_A, b'\x01\x02\x03\x04') + opt(),
+
+    # Malformed
+    'empty': b'',
+    'header_only': header(qd=0),
+    'truncated_name': header() + b'\x07captive\x05app',
+    'truncated_type': header() + name('captive.apple.com') + b'\x00',
+    'label_too_long': header() + b'\x40' + b'a' * 64 + b'\0' + struct.pack('>HH', 1, 1),
+    'pointer_loop': header() + b'\xc0\x0c' + struct.pack('>HH', 1, 1),
+    'pointer_forward': header() + b'\xc0\x20' + struct.pack('>HH', 1, 1) + b'\0' * 16,
+    'qdcount_lies': header(qd=40) + question('captive.apple.com'),
+    'reply_rdlength_lies': header(FLAGS_REPLY, an=1) + question('example.org') +
+                           PTR_QNAME + struct.pack('>HHIH', QTYPE_A, 1, 300, 400) + b'\x01\x02',
+    'response_bit': header(FLAGS_REPLY) + question('captive.apple.com'),
+    'opcode_notify': header(0x2000) + question('example.org', QTYPE_SOA),
+}
+
+# Client queries. Each must be answered with NOERROR, the address for A and AAAA, and an OPT record.
+CLIENTS = {
+    # Android: RD only, a UDP size as large as its answer buffer
+    'android_a_gstatic': header(ar=1) + question('connectivitycheck.gstatic.com') + opt(8192),
+    'android_aaaa_gstatic': header(ar=1) + question('connectivitycheck.gstatic.com', QTYPE_AAAA) +
+                            opt(8192),
+    'android_a_google': header(ar=1) + question('www.google.com') + opt(8192),
+
+    # iOS: A, AAAA and HTTPS queries for the probe host side by side
+    'ios_a_apple': header(ar=1) + question('captive.apple.com') + opt(4096),
+    'ios_aaaa_apple': header(ar=1) + question('captive.apple.com', QTYPE_AAAA) + opt(4096),
+    'ios_https_apple': header(ar=1) + question('captive.apple.com', QTYPE_HTTPS) + opt(4096),
+
+    # systemd-resolved at its highest feature level: DO set, and AD to ask for validation
+    'resolved_a_gstatic': header(FLAGS_QUERY_RD_AD, ar=1) +
+                          question('connectivitycheck.gstatic.com') + opt(1232, EDNS_DO),
+    'resolved_aaaa_gnome': header(FLAGS_QUERY_RD_AD, ar=1) +
+                           question('nmcheck.gnome.org', QTYPE_AAAA) + opt(1232, EDNS_DO),
+    # ... and the stub listener's own size, when a client forwards what resolved sends it
+    'resolved_stub_a_gnome': header(ar=1) + question('nmcheck.gnome.org') + opt(65494),
+    # Validating with checks disabled, after a DNSSEC failure
+    'resolved_cd_a_gnome': header(FLAGS_QUERY_RD_CD, ar=1) + question('nmcheck.gnome.org') +
+                           opt(1232, EDNS_DO),
+
+    # Options and quirks of other stub and forwarding resolvers
+    'cookie_a_msft': header(ar=1) + question('www.msftconnecttest.com') +
+                     opt(1232, 0, option(OPTION_COOKIE, bytes(range(8)))),
+    'ecs_a_firefox': header(ar=1) + question('detectportal.firefox.com') +
+                     opt(4096, 0, option(OPTION_ECS, b'\x00\x01\x18\x00\xc0\xa8\x04')),
+    'padding_a_apple': header(ar=1) + question('captive.apple.com') +
+                       opt(1232, 0, option(OPTION_PADDING, b'\0' * 72)),
+    'case20_a_apple': header(ar=1) + question('cAPtIVe.APplE.cOm') + opt(1232),
+    'small_udp_a_apple': header(ar=1) + question('captive.apple.com') + opt(512),
+}
+
+
+def write_messages(out_dir, messages):
+    if not os.path.isdir(out_dir):
+        os.makedirs(out_dir)
+    for message, data in sorted(messages.items()):
+        with open(os.path.join(out_dir, message), 'wb') as f:
+            f.write(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('out_dir', nargs='?', default=os.path.join(os.path.dirname(__file__),
+                                                                   'corpus'))
+    parser.add_argument('--clients', default=os.path.join(os.path.dirname(__file__), 'clients'),
+                        help='directory of the client queries (default: %(default)s)')
+    args = parser.parse_args()
+
+    write_messages(args.out_dir, SEEDS)
+    write_messages(args.clients, CLIENTS)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,25 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef LWIP_INET_H
+#define LWIP_INET_H
+
+#include <arpa/inet.h>
+
+#define ip4_addr1(ipaddr) (((const uint8_t*)(&(ipaddr)->addr))[0])
+#define ip4_addr2(ipaddr) (((const uint8_t*)(&(ipaddr)->addr))[1])
+#define ip4_addr3(ipaddr) (((const uint8_t*)(&(ipaddr)->addr))[2])
+#define ip4_addr4(ipaddr) (((const uint8_t*)(&(ipaddr)->addr))[3])
+
+#endif
@@ -0,0 +1,35 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/* Host stand-ins for the ESP-IDF, FreeRTOS and lwIP headers that capt_dns.c and
+ * capt_dns_forward.c include. The functions are implemented by the test. */
+
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+/* Kconfig defaults, with the forwarder built in and the parts that need the target left out */
+#define CONFIG_CAPT_DNS_SPLIT_HORIZON         1
+#define CONFIG_CAPT_DNS_LOCAL_HOSTS_MAX       4
+#define CONFIG_CAPT_DNS_FORWARD_PENDING       8
+#define CONFIG_CAPT_DNS_FORWARD_CACHE_SIZE    16
+#define CONFIG_CAPT_DNS_FORWARD_CACHE_MAX_TTL 300
+#define CONFIG_CAPT_DNS_NEGATIVE_TTL          60
+#define CONFIG_CAPT_DNS_POLICY_MAX            16
+#define CONFIG_CAPT_DNS_LOG_QUERIES           0
+#define CONFIG_CAPT_DNS_ANSWER_AAAA           0
+#define CONFIG_CAPT_DNS_RATELIMIT             0
+#define CONFIG_CAPT_DNS_TELEMETRY             0
+#define CONFIG_CAPT_DNS_TCP                   0
+
+#endif
@@ -0,0 +1,202 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Replays the EDNS queries of real clients through capt_dns_build_reply() and checks each reply:
+NOERROR, the question as it was asked, the soft AP's address for A and AAAA, no answer for other
+types, and an OPT record with the query's DO bit. Build and run from this directory with
+
+    make test
+
+which replays the files of the clients directory. gen_corpus.py describes where they come from.
+*/
+
+#include "capt_dns_query.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define QTYPE_A    1
+#define QTYPE_AAAA 28
+#define QTYPE_OPT  41
+
+#define RCODE_NOERROR 0
+
+#define FLAG_QR (1 << 15)
+
+#define EDNS_FLAG_DO 0x80
+
+#define HEADER_LEN   12
+#define OPT_RR_LEN   11
+#define RR_FIXED_LEN 10
+
+static const uint8_t AP_IP4[4] = {192, 168, 4, 1};
+static const uint8_t AP_ULA[16] = {0xfd, 0x00, 0xca, 0x97, 0x00, 0x1e, 0, 0,
+                                   0,    0,    0,    0,    0,    0,    0, 1};
+
+static uint16_t get16(const uint8_t* p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/* Returns the offset past the name at pos, or -1 if it runs past len */
+static int skip_name(const uint8_t* msg, int len, int pos)
+{
+    while (pos < len) {
+        if ((msg[pos] & 0xc0) == 0xc0) {
+            return (pos + 2 <= len) ? pos + 2 : -1;
+        }
+        if (msg[pos] == 0) {
+            return pos + 1;
+        }
+        pos += msg[pos] + 1;
+    }
+    return -1;
+}
+
+/* Returns the offset of the OPT record of a query, or -1 if it has none */
+static int find_opt(const uint8_t* msg, int len, int pos)
+{
+    for (int idx = 0; idx < get16(&msg[6]) + get16(&msg[8]) + get16(&msg[10]); idx++) {
+        int rr = pos;
+        pos = skip_name(msg, len, pos);
+        if ((pos < 0) || (pos + RR_FIXED_LEN > len)) {
+            return -1;
+        }
+        if (get16(&msg[pos]) == QTYPE_OPT) {
+            return rr;
+        }
+        pos += RR_FIXED_LEN + get16(&msg[pos + 8]);
+    }
+    return -1;
+}
+
+/* Returns the problem with the reply to a query, or NULL if there is none */
+static const char* check_reply(const uint8_t* query, int query_len, const uint8_t* reply,
+                               int reply_len)
+{
+    int question_end;
+    int query_opt;
+    uint16_t qtype;
+    int pos;
+
+    if (query_len < HEADER_LEN) {
+        return "query shorter than a header";
+    }
+    question_end = skip_name(query, query_len, HEADER_LEN);
+    if ((question_end < 0) || (question_end + 4 > query_len)) {
+        return "query has no complete question";
+    }
+    qtype = get16(&query[question_end]);
+    question_end += 4;
+    query_opt = find_opt(query, query_len, question_end);
+    if (query_opt < 0) {
+        return "query has no OPT record";
+    }
+
+    if (reply_len <= 0) {
+        return "no reply";
+    }
+    if ((reply_len < question_end) || (get16(&reply[0]) != get16(&query[0])) ||
+        !(get16(&reply[2]) & FLAG_QR)) {
+        return "not a reply to the query";
+    }
+    if ((get16(&reply[2]) & 0x0f) != RCODE_NOERROR) {
+        return "RCODE is not NOERROR";
+    }
+    if ((get16(&reply[4]) != 1) ||
+        (memcmp(&reply[HEADER_LEN], &query[HEADER_LEN], question_end - HEADER_LEN) != 0)) {
+        return "question not echoed as asked";
+    }
+
+    pos = question_end;
+    if ((qtype == QTYPE_A) || (qtype == QTYPE_AAAA)) {
+        const uint8_t* addr = (qtype == QTYPE_A) ? AP_IP4 : AP_ULA;
+        int addr_len = (qtype == QTYPE_A) ? sizeof(AP_IP4) : sizeof(AP_ULA);
+
+        if (get16(&reply[6]) != 1) {
+            return "not exactly one answer";
+        }
+        pos = skip_name(reply, reply_len, pos);
+        if ((pos < 0) || (pos + RR_FIXED_LEN + addr_len > reply_len) ||
+            (get16(&reply[pos]) != qtype) || (get16(&reply[pos + 8]) != addr_len) ||
+            (memcmp(&reply[pos + RR_FIXED_LEN], addr, addr_len) != 0)) {
+            return "answer is not the soft AP's address";
+        }
+        pos += RR_FIXED_LEN + addr_len;
+    } else if (get16(&reply[6]) != 0) {
+        return "answer for a type without records";
+    }
+
+    // The authority section of a NODATA answer comes before the OPT record
+    for (int idx = 0; idx < get16(&reply[8]); idx++) {
+        pos = skip_name(reply, reply_len, pos);
+        if ((pos < 0) || (pos + RR_FIXED_LEN > reply_len)) {
+            return "authority section truncated";
+        }
+        pos += RR_FIXED_LEN + get16(&reply[pos + 8]);
+    }
+    if ((get16(&reply[10]) != 1) || (pos + OPT_RR_LEN != reply_len) || (reply[pos] != 0) ||
+        (get16(&reply[pos + 1]) != QTYPE_OPT)) {
+        return "no OPT record at the end";
+    }
+    // Type and class follow the name. The TTL holds the upper bits of the RCODE, the version and
+    // the flags.
+    const uint8_t* reply_ttl = &reply[pos + 5];
+    pos = skip_name(query, query_len, query_opt);
+    if (reply_ttl[0] != 0) {
+        return "extended RCODE is not NOERROR";
+    }
+    if ((reply_ttl[2] & EDNS_FLAG_DO) != (query[pos + 6] & EDNS_FLAG_DO)) {
+        return "DO bit not copied";
+    }
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    static uint8_t query[DNS_LEN + 1];
+    static uint8_t reply[DNS_LEN];
+    int failures = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s query ...\n", argv[0]);
+        return 2;
+    }
+    capt_dns_query_init(AP_IP4, AP_ULA);
+
+    for (int idx = 1; idx < argc; idx++) {
+        FILE* file = fopen(argv[idx], "rb");
+        if (!file) {
+            perror(argv[idx]);
+            return 1;
+        }
+        int query_len = (int)fread(query, 1, sizeof(query), file);
+        fclose(file);
+
+        int reply_len = capt_dns_build_reply(query, query_len, reply, sizeof(reply));
+        const char* problem = check_reply(query, query_len, reply, reply_len);
+        if (problem) {
+            fprintf(stderr, "%s: %s\n", argv[idx], problem);
+            failures++;
+        }
+    }
+
+    if (failures) {
+        fprintf(stderr, "%d of %d queries failed\n", failures, argc - 1);
+        return 1;
+    }
+    printf("All %d queries answered\n", argc - 1);
+    return 0;
+}
@@ -0,0 +1,535 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Tests of split-horizon mode: capt_dns.c and the forwarder in capt_dns_forward.c, built against the
+stand-in headers of shim/. A UDP socket on the loopback interface plays the upstream server of the
+station interface and answers every query with one A record. The test drives the forwarder the
+way the socket backend's task does and moves the tick count by hand. Build and run from this
+directory with
+
+    make test
+*/
+
+#include "capt_dns.h"
+#include "capt_dns_priv.h"
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+
+#define QTYPE_A    1
+#define QTYPE_AAAA 28
+#define QTYPE_OPT  41
+
+#define RCODE_NOERROR  0
+#define RCODE_SERVFAIL 2
+
+#define FLAG_QR (1 << 15)
+
+#define HEADER_LEN   12
+#define RR_FIXED_LEN 10
+
+/* What the stand-in resolver answers with */
+#define UPSTREAM_TTL 300
+static const uint8_t UPSTREAM_ADDR[4] = {93, 184, 216, 34};
+
+#define AP_ADDR     "192.168.4.1"
+#define CLIENT_ADDR "192.168.4.2"
+
+#define WAIT_MS 1000
+
+static int _failures = 0;
+
+#define CHECK(cond)                                                                        \
+    do {                                                                                   \
+        if (!(cond)) {                                                                     \
+            fprintf(stderr, "%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, __func__, \
+                    #cond);                                                                \
+            _failures++;                                                                   \
+        }                                                                                  \
+    } while (0)
+
+/* A DNS message under construction */
+typedef struct {
+    uint8_t data[DNS_LEN];
+    int len;
+} msg_t;
+
+static uint32_t _now_ms = 1000;
+static bool _has_upstream = true;
+static int _ap_netif;
+static int _sta_netif;
+static int _fwd_fd = -1;
+static int _resolver_fd = -1;
+
+// Platform functions of the shim headers
+
+TickType_t xTaskGetTickCount(void)
+{
+    return _now_ms;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return _now_ms * 1000LL;
+}
+
+uint32_t esp_random(void)
+{
+    return (uint32_t)random();
+}
+
+esp_err_t esp_netif_get_ip_info(esp_netif_t* esp_netif, esp_netif_ip_info_t* ip_info)
+{
+    ip_info->ip.addr = inet_addr(AP_ADDR);
+    ip_info->netmask.addr = inet_addr("255.255.255.0");
+    ip_info->gw.addr = inet_addr(AP_ADDR);
+    return ESP_OK;
+}
+
+esp_netif_t* esp_netif_get_handle_from_ifkey(const char* if_key)
+{
+    return (strcmp(if_key, "WIFI_STA_DEF") == 0) ? (esp_netif_t*)&_sta_netif : NULL;
+}
+
+esp_err_t esp_netif_get_dns_info(esp_netif_t* esp_netif, esp_netif_dns_type_t type,
+                                 esp_netif_dns_info_t* dns)
+{
+    if ((esp_netif != (esp_netif_t*)&_sta_netif) || !_has_upstream) {
+        return ESP_FAIL;
+    }
+    dns->ip.type = ESP_IPADDR_TYPE_V4;
+    dns->ip.u_addr.ip4.addr = htonl(INADDR_LOOPBACK);
+    return ESP_OK;
+}
+
+// Backend: only the forwarder's socket, as the socket backend opens it
+
+esp_err_t capt_dns_backend_start(esp_netif_t* softap_netif_handle,
+                                 const esp_netif_ip_info_t* ip_info)
+{
+    _fwd_fd = capt_dns_forward_open();
+    return (_fwd_fd != -1) ? ESP_OK : ESP_FAIL;
+}
+
+void capt_dns_backend_stop(void)
+{
+    capt_dns_forward_close();
+    _fwd_fd = -1;
+}
+
+// Messages
+
+static void put16(msg_t* msg, uint16_t val)
+{
+    msg->data[msg->len++] = val >> 8;
+    msg->data[msg->len++] = val & 0xff;
+}
+
+static uint16_t get16(const uint8_t* p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+    return ((uint32_t)get16(p) << 16) | get16(&p[2]);
+}
+
+static void put_name(msg_t* msg, const char* dotted)
+{
+    while (*dotted) {
+        const char* dot = strchr(dotted, '.');
+        int len = dot ? (int)(dot - dotted) : (int)strlen(dotted);
+        msg->data[msg->len++] = len;
+        memcpy(&msg->data[msg->len], dotted, len);
+        msg->len += len;
+        dotted += len + (dot ? 1 : 0);
+    }
+    msg->data[msg->len++] = 0;
+}
+
+/* Query for one name, with an OPT record advertising udp_size unless it is 0 */
+static void build_query(msg_t* msg, uint16_t id, const char* dotted, uint16_t qtype,
+                        uint16_t udp_size)
+{
+    msg->len = 0;
+    put16(msg, id);
+    put16(msg, 0x0100);
+    put16(msg, 1);
+    put16(msg, 0);
+    put16(msg, 0);
+    put16(msg, udp_size ? 1 : 0);
+    put_name(msg, dotted);
+    put16(msg, qtype);
+    put16(msg, 1);
+    if (udp_size) {
+        msg->data[msg->len++] = 0;
+        put16(msg, QTYPE_OPT);
+        put16(msg, udp_size);
+        put16(msg, 0);
+        put16(msg, 0);
+        put16(msg, 0);
+    }
+}
+
+/* Offset past the question of a message with one question */
+static int question_end(const uint8_t* msg)
+{
+    int pos = HEADER_LEN;
+    while (msg[pos] != 0) {
+        pos += msg[pos] + 1;
+    }
+    return pos + 1 + 4;
+}
+
+/* Offset of the RDATA of the first answer, whose owner is a pointer or the question's name */
+static int first_rdata(const uint8_t* msg)
+{
+    int pos = question_end(msg);
+    if ((msg[pos] & 0xc0) == 0xc0) {
+        pos += 2;
+    } else {
+        while (msg[pos] != 0) {
+            pos += msg[pos] + 1;
+        }
+        pos++;
+    }
+    return pos + RR_FIXED_LEN;
+}
+
+/* UDP size advertised by the OPT record at the end of a query, or 0 */
+static uint16_t opt_udp_size(const uint8_t* msg, int len)
+{
+    int pos = question_end(msg);
+    if ((get16(&msg[10]) == 0) || (pos + 11 > len) || (get16(&msg[pos + 1]) != QTYPE_OPT)) {
+        return 0;
+    }
+    return get16(&msg[pos + 3]);
+}
+
+static struct sockaddr_storage client_addr(uint16_t port)
+{
+    struct sockaddr_storage client = {0};
+    struct sockaddr_in* client4 = (struct sockaddr_in*)&client;
+
+    client4->sin_family = AF_INET;
+    client4->sin_addr.s_addr = inet_addr(CLIENT_ADDR);
+    client4->sin_port = htons(port);
+    return client;
+}
+
+// Stand-in resolver
+
+static bool resolver_open(void)
+{
+    struct sockaddr_in addr = {0};
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(CAPT_DNS_UPSTREAM_PORT);
+    _resolver_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if ((_resolver_fd == -1) || (bind(_resolver_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)) {
+        perror("stand-in resolver");
+        return false;
+    }
+    return true;
+}
+
+static bool wait_readable(int fd, int timeout_ms)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    return (poll(&pfd, 1, timeout_ms) == 1);
+}
+
+/* Waits for a query to the resolver. Returns false if none came within timeout_ms. */
+static bool resolver_recv(msg_t* query, struct sockaddr_in* from, int timeout_ms)
+{
+    socklen_t fromlen = sizeof(*from);
+
+    if (!wait_readable(_resolver_fd, timeout_ms)) {
+        return false;
+    }
+    query->len = recvfrom(_resolver_fd, query->data, sizeof(query->data), 0,
+                          (struct sockaddr*)from, &fromlen);
+    return (query->len >= HEADER_LEN);
+}
+
+/* Answers a query from socket fd with one A record under the given ID, and an OPT record if it
+ * had one */
+static void answer_from(int fd, const msg_t* query, uint16_t id, const struct sockaddr_in* to)
+{
+    bool has_opt = (opt_udp_size(query->data, query->len) != 0);
+    msg_t reply;
+
+    reply.len = question_end(query->data);
+    memcpy(reply.data, query->data, reply.len);
+    reply.data[0] = id >> 8;
+    reply.data[1] = id & 0xff;
+    reply.data[2] = 0x81;
+    reply.data[3] = 0x80;
+    reply.data[7] = 1;
+    reply.data[11] = has_opt ? 1 : 0;
+    put16(&reply, 0xc000 | HEADER_LEN);
+    put16(&reply, QTYPE_A);
+    put16(&reply, 1);
+    put16(&reply, UPSTREAM_TTL >> 16);
+    put16(&reply, UPSTREAM_TTL & 0xffff);
+    put16(&reply, sizeof(UPSTREAM_ADDR));
+    memcpy(&reply.data[reply.len], UPSTREAM_ADDR, sizeof(UPSTREAM_ADDR));
+    reply.len += sizeof(UPSTREAM_ADDR);
+    if (has_opt) {
+        reply.data[reply.len++] = 0;
+        put16(&reply, QTYPE_OPT);
+        put16(&reply, 1232);
+        put16(&reply, 0);
+        put16(&reply, 0);
+        put16(&reply, 0);
+    }
+    sendto(fd, reply.data, reply.len, 0, (const struct sockaddr*)to, sizeof(*to));
+}
+
+static void resolver_answer(const msg_t* query, uint16_t id, const struct sockaddr_in* to)
+{
+    answer_from(_resolver_fd, query, id, to);
+}
+
+/* Waits for the forwarder's socket and receives the upstream reply, as the backend's task
+ * does. Returns the length of the reply for the client, or 0. */
+static int forward_recv(struct sockaddr_storage* client, msg_t* reply)
+{
+    if (!wait_readable(_fwd_fd, WAIT_MS)) {
+        return 0;
+    }
+    reply->len = capt_dns_forward_recv(client, reply->data, sizeof(reply->data));
+    return reply->len;
+}
+
+static esp_err_t start(capt_dns_mode_t mode)
+{
+    static const char* const LOCAL_HOSTS[] = {"my-device.local"};
+    capt_dns_config_t config = {
+        .netif_handle = (esp_netif_t*)&_ap_netif,
+        .mode = mode,
+        .local_hosts = LOCAL_HOSTS,
+        .num_local_hosts = 1,
+    };
+
+    return capt_dns_start(&config);
+}
+
+// Tests
+
+static void test_local_names_answered_locally(void)
+{
+    capt_dns_stats_t before, after;
+    msg_t query;
+    msg_t reply;
+
+    capt_dns_get_stats(&before);
+
+    build_query(&query, 0x1001, "My-Device.local", QTYPE_A, 0);
+    reply.len = capt_dns_handle_query(inet_addr(CLIENT_ADDR), query.data, query.len, reply.data,
+                                      sizeof(reply.data));
+    CHECK(reply.len > 0);
+    CHECK(get16(&reply.data[0]) == 0x1001);
+    CHECK((get16(&reply.data[2]) & 0x0f) == RCODE_NOERROR);
+    CHECK(get16(&reply.data[6]) == 1);
+    uint32_t ap_addr = inet_addr(AP_ADDR);
+    CHECK(memcmp(&reply.data[first_rdata(reply.data)], &ap_addr, 4) == 0);
+
+    // No ULA in this build: NODATA rather than a forwarded query
+    build_query(&query, 0x1002, "my-device.local", QTYPE_AAAA, 0);
+    reply.len = capt_dns_handle_query(inet_addr(CLIENT_ADDR), query.data, query.len, reply.data,
+                                      sizeof(reply.data));
+    CHECK(reply.len > 0);
+    CHECK((get16(&reply.data[2]) & 0x0f) == RCODE_NOERROR);
+    CHECK(get16(&reply.data[6]) == 0);
+
+    build_query(&query, 0x1003, "example.org", QTYPE_A, 0);
+    reply.len = capt_dns_handle_query(inet_addr(CLIENT_ADDR), query.data, query.len, reply.data,
+                                      sizeof(reply.data));
+    CHECK(reply.len == CAPT_DNS_FORWARD);
+
+    capt_dns_get_stats(&after);
+    CHECK(after.queries - before.queries == 3);
+    CHECK(after.answered - before.answered == 2);
+    CHECK(after.forwarded - before.forwarded == 1);
+}
+
+static void test_forwarded_answer(void)
+{
+    struct sockaddr_storage client = client_addr(40001);
+    struct sockaddr_storage reply_to;
+    struct sockaddr_in from;
+    msg_t query;
+    msg_t upstream;
+    msg_t reply;
+
+    build_query(&query, 0x2001, "example.org", QTYPE_A, 4096);
+    CHECK(capt_dns_forward_query(&client, query.data, query.len, reply.data,
+                                 sizeof(reply.data)) == 0);
+
+    CHECK(resolver_recv(&upstream, &from, WAIT_MS));
+    if (upstream.len < HEADER_LEN) {
+        return;
+    }
+    // Same question, under the forwarder's own ID, and no larger replies than it can receive
+    CHECK(upstream.len == query.len);
+    CHECK(memcmp(&upstream.data[2], &query.data[2], question_end(query.data) - 2) == 0);
+    CHECK(opt_udp_size(upstream.data, upstream.len) == DNS_LEN);
+
+    resolver_answer(&upstream, get16(upstream.data), &from);
+    CHECK(forward_recv(&reply_to, &reply) > 0);
+    CHECK(memcmp(&reply_to, &client, sizeof(client)) == 0);
+    CHECK(get16(&reply.data[0]) == 0x2001);
+    CHECK(get16(&reply.data[2]) & FLAG_QR);
+    CHECK((get16(&reply.data[2]) & 0x0f) == RCODE_NOERROR);
+    CHECK(get16(&reply.data[6]) == 1);
+    CHECK(memcmp(&reply.data[first_rdata(reply.data)], UPSTREAM_ADDR, 4) == 0);
+}
+
+static void test_cached_answer(void)
+{
+    struct sockaddr_storage client = client_addr(40002);
+    struct sockaddr_in from;
+    msg_t query;
+    msg_t upstream;
+    msg_t reply;
+
+    // Ten seconds after test_forwarded_answer, in another case and without EDNS
+    _now_ms += 10000;
+    build_query(&query, 0x3001, "EXAMPLE.org", QTYPE_A, 0);
+    reply.len = capt_dns_forward_query(&client, query.data, query.len, reply.data,
+                                       sizeof(reply.data));
+    CHECK(reply.len > 0);
+    CHECK(!resolver_recv(&upstream, &from, 0));
+    if (reply.len <= 0) {
+        return;
+    }
+    CHECK(get16(&reply.data[0]) == 0x3001);
+    CHECK(memcmp(&reply.data[HEADER_LEN], &query.data[HEADER_LEN],
+                 question_end(query.data) - HEADER_LEN) == 0);
+    CHECK(get16(&reply.data[6]) == 1);
+    CHECK(get16(&reply.data[10]) == 0);
+    int rdata = first_rdata(reply.data);
+    CHECK(memcmp(&reply.data[rdata], UPSTREAM_ADDR, 4) == 0);
+    CHECK(get32(&reply.data[rdata - 6]) == UPSTREAM_TTL - 10);
+
+    // Gone once the TTL has run out
+    _now_ms += (UPSTREAM_TTL - 10) * 1000;
+    build_query(&query, 0x3002, "example.org", QTYPE_A, 0);
+    CHECK(capt_dns_forward_query(&client, query.data, query.len, reply.data,
+                                 sizeof(reply.data)) == 0);
+    CHECK(resolver_recv(&upstream, &from, WAIT_MS));
+    resolver_answer(&upstream, get16(upstream.data), &from);
+    CHECK(forward_recv(&client, &reply) > 0);
+}
+
+static void test_unexpected_reply_dropped(void)
+{
+    struct sockaddr_storage client = client_addr(40003);
+    struct sockaddr_in from;
+    msg_t query;
+    msg_t upstream;
+    msg_t reply;
+
+    build_query(&query, 0x4001, "other.example.org", QTYPE_A, 0);
+    CHECK(capt_dns_forward_query(&client, query.data, query.len, reply.data,
+                                 sizeof(reply.data)) == 0);
+    CHECK(resolver_recv(&upstream, &from, WAIT_MS));
+
+    resolver_answer(&upstream, get16(upstream.data) ^ 0x5555, &from);
+    CHECK(forward_recv(&client, &reply) == 0);
+
+    // The right ID from another port of the server
+    int other_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    answer_from(other_fd, &upstream, get16(upstream.data), &from);
+    CHECK(forward_recv(&client, &reply) == 0);
+    close(other_fd);
+
+    resolver_answer(&upstream, get16(upstream.data), &from);
+    CHECK(forward_recv(&client, &reply) > 0);
+    CHECK(get16(&reply.data[0]) == 0x4001);
+}
+
+static void test_no_upstream_servfail(void)
+{
+    struct sockaddr_storage client = client_addr(40004);
+    struct sockaddr_in from;
+    msg_t query;
+    msg_t upstream;
+    msg_t reply;
+
+    // Station not connected: fail at once instead of letting the client time out
+    _has_upstream = false;
+    build_query(&query, 0x5001, "nowhere.example.org", QTYPE_A, 0);
+    reply.len = capt_dns_forward_query(&client, query.data, query.len, reply.data,
+                                       sizeof(reply.data));
+    CHECK(reply.len > 0);
+    CHECK(get16(&reply.data[0]) == 0x5001);
+    CHECK((get16(&reply.data[2]) & 0x0f) == RCODE_SERVFAIL);
+    CHECK(!resolver_recv(&upstream, &from, 0));
+    _has_upstream = true;
+}
+
+static void test_captive_mode_answers_everything(void)
+{
+    msg_t query;
+    msg_t reply;
+
+    capt_dns_stop();
+    CHECK(start(CAPT_DNS_MODE_CAPTIVE) == ESP_OK);
+
+    build_query(&query, 0x6001, "example.org", QTYPE_A, 0);
+    reply.len = capt_dns_handle_query(inet_addr(CLIENT_ADDR), query.data, query.len, reply.data,
+                                      sizeof(reply.data));
+    CHECK(reply.len > 0);
+    uint32_t ap_addr = inet_addr(AP_ADDR);
+    CHECK(memcmp(&reply.data[first_rdata(reply.data)], &ap_addr, 4) == 0);
+}
+
+int main(void)
+{
+    if (!resolver_open()) {
+        return 1;
+    }
+    if (start(CAPT_DNS_MODE_SPLIT_HORIZON) != ESP_OK) {
+        fprintf(stderr, "capt_dns_start() failed\n");
+        return 1;
+    }
+
+    test_local_names_answered_locally();
+    test_forwarded_answer();
+    test_cached_answer();
+    test_unexpected_reply_dropped();
+    test_no_upstream_servfail();
+    test_captive_mode_answers_everything();
+
+    capt_dns_stop();
+    close(_resolver_fd);
+
+    if (_failures) {
+        fprintf(stderr, "%d checks failed\n", _failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,676 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Unit tests of the DNS message code in capt_dns_query.c. Build and run from this directory with
+
+    make test
+*/
+
+#include "capt_dns_query.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define QTYPE_A     1
+#define QTYPE_SOA   6
+#define QTYPE_AAAA  28
+#define QTYPE_OPT   41
+#define QTYPE_HTTPS 65
+
+#define RCODE_NOERROR  0
+#define RCODE_FORMERR  1
+#define RCODE_NXDOMAIN 3
+
+#define FLAG_QR (1 << 15)
+#define FLAG_TC (1 << 9)
+
+#define HEADER_LEN 12
+
+static int _failures = 0;
+
+#define CHECK(cond)                                                                        \
+    do {                                                                                   \
+        if (!(cond)) {                                                                     \
+            fprintf(stderr, "%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, __func__, \
+                    #cond);                                                                \
+            _failures++;                                                                   \
+        }                                                                                  \
+    } while (0)
+
+static const uint8_t AP_IP4[4] = {192, 168, 4, 1};
+static const uint8_t AP_ULA[16] = {0xfd, 0x00, 0xca, 0x97, 0x00, 0x1e, 0, 0,
+                                   0,    0,    0,    0,    0,    0,    0, 1};
+
+/* CONFIG_CAPT_DNS_NEGATIVE_TTL and CONFIG_CAPT_DNS_POLICY_MAX of the host build */
+#define NEGATIVE_TTL 60
+#define POLICY_MAX   16
+
+/* A DNS message under construction */
+typedef struct {
+    uint8_t data[DNS_LEN];
+    int len;
+} msg_t;
+
+static void put16(msg_t* msg, uint16_t val)
+{
+    msg->data[msg->len++] = val >> 8;
+    msg->data[msg->len++] = val & 0xff;
+}
+
+static void put32(msg_t* msg, uint32_t val)
+{
+    put16(msg, val >> 16);
+    put16(msg, val & 0xffff);
+}
+
+static uint16_t get16(const uint8_t* p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t get32(const uint8_t* p)
+{
+    return ((uint32_t)get16(p) << 16) | get16(&p[2]);
+}
+
+static void put_header(msg_t* msg, uint16_t flags, uint16_t qdcount, uint16_t arcount)
+{
+    msg->len = 0;
+    put16(msg, 0xbeef);
+    put16(msg, flags);
+    put16(msg, qdcount);
+    put16(msg, 0);
+    put16(msg, 0);
+    put16(msg, arcount);
+}
+
+static void put_name(msg_t* msg, const char* dotted)
+{
+    while (*dotted) {
+        const char* dot = strchr(dotted, '.');
+        int len = dot ? (int)(dot - dotted) : (int)strlen(dotted);
+        msg->data[msg->len++] = len;
+        memcpy(&msg->data[msg->len], dotted, len);
+        msg->len += len;
+        dotted += len + (dot ? 1 : 0);
+    }
+    msg->data[msg->len++] = 0;
+}
+
+static void put_question(msg_t* msg, const char* dotted, uint16_t qtype)
+{
+    put_name(msg, dotted);
+    put16(msg, qtype);
+    put16(msg, 1);
+}
+
+/* OPT pseudo-record. ttl holds extended rcode, version and flags. */
+static void put_opt(msg_t* msg, uint16_t udp_size, uint32_t ttl)
+{
+    msg->data[msg->len++] = 0;
+    put16(msg, QTYPE_OPT);
+    put16(msg, udp_size);
+    put32(msg, ttl);
+    put16(msg, 0);
+}
+
+/* Query with a single question and no EDNS0 */
+static void make_query(msg_t* msg, const char* dotted, uint16_t qtype)
+{
+    put_header(msg, 0x0100, 1, 0);
+    put_question(msg, dotted, qtype);
+}
+
+static int build_reply(const msg_t* query, msg_t* reply)
+{
+    reply->len = capt_dns_build_reply(query->data, query->len, reply->data, sizeof(reply->data));
+    return reply->len;
+}
+
+static int rcode_of(const msg_t* msg)
+{
+    return msg->data[3] & 0x0f;
+}
+
+static uint16_t flags_of(const msg_t* msg)
+{
+    return get16(&msg->data[2]);
+}
+
+static uint16_t count_of(const msg_t* msg, int section)
+{
+    // section: 0 questions, 1 answers, 2 authority, 3 additional
+    return get16(&msg->data[4 + 2 * section]);
+}
+
+/* Offset of the first resource record of a reply to a single-question query */
+static int first_record(const msg_t* msg)
+{
+    int offset = HEADER_LEN;
+    while (msg->data[offset] != 0) {
+        offset += msg->data[offset] + 1;
+    }
+    return offset + 1 + 4;
+}
+
+/* ---------------------------------------------------------------------------------------------
+ * Answers
+ */
+
+static void test_a_answer(void)
+{
+    msg_t query, reply;
+    make_query(&query, "captive.apple.com", QTYPE_A);
+
+    CHECK(build_reply(&query, &reply) > 0);
+    CHECK(get16(reply.data) == 0xbeef);
+    CHECK(flags_of(&reply) & FLAG_QR);
+    CHECK(rcode_of(&reply) == RCODE_NOERROR);
+    CHECK(count_of(&reply, 1) == 1);
+    CHECK(count_of(&reply, 3) == 0);
+
+    int rr = first_record(&reply);
+    // Name is a pointer to the question, then type, class, TTL and the 4-byte address
+    CHECK(get16(&reply.data[rr]) == (0xc000 | HEADER_LEN));
+    CHECK(get16(&reply.data[rr + 2]) == QTYPE_A);
+    CHECK(get16(&reply.data[rr + 10]) == 4);
+    CHECK(memcmp(&reply.data[rr + 12], AP_IP4, 4) == 0);
+    CHECK(reply.len == rr + 16);
+}
+
+static void test_second_question_points_to_its_name(void)
+{
+    msg_t query, reply;
+    put_header(&query, 0x0100, 2, 0);
+    put_question(&query, "a.example.org", QTYPE_A);
+    int second = query.len;
+    put_question(&query, "b.example.org", QTYPE_A);
+
+    CHECK(build_reply(&query, &reply) > 0);
+    CHECK(count_of(&reply, 1) == 2);
+    int rr = query.len;
+    CHECK(get16(&reply.data[rr]) == (0xc000 | HEADER_LEN));
+    CHECK(get16(&reply.data[rr + 16]) == (0xc000 | second));
+}
+
+static void test_no_reply_to_replies_and_runts(void)
+{
+    msg_t query, reply;
+
+    make_query(&query, "example.org", QTYPE_A);
+    query.data[2] |= 0x80;
+    CHECK(build_reply(&query, &reply) == 0);
+
+    make_query(&query, "example.org", QTYPE_A);
+    query.len = HEADER_LEN - 1;
+    CHECK(build_reply(&query, &reply) == 0);
+
+    // Question runs past the end of the message
+    make_query(&query, "example.org", QTYPE_A);
+    query.len -= 2;
+    CHECK(build_reply(&query, &reply) == 0);
+}
+
+static void test_truncated_when_reply_buffer_is_short(void)
+{
+    msg_t query;
+    uint8_t reply[DNS_LEN];
+    make_query(&query, "example.org", QTYPE_A);
+
+    int len = capt_dns_build_reply(query.data, query.len, reply, query.len + 4);
+    CHECK(len == query.len);
+    CHECK(get16(&reply[2]) & FLAG_TC);
+    CHECK(get16(&reply[6]) == 0);
+}
+
+/* ---------------------------------------------------------------------------------------------
+ * EDNS0
+ */
+
+static void test_edns_opt_echoed(void)
+{
+    msg_t query, reply;
+    put_header(&query, 0x0100, 1, 1);
+    put_question(&query, "captive.apple.com", QTYPE_A);
+    put_opt(&query, 1232, 0x00008000); // DO bit set
+
+    CHECK(build_reply(&query, &reply) > 0);
+    CHECK(rcode_of(&reply) == RCODE_NOERROR);
+    CHECK(count_of(&reply, 1) == 1);
+    CHECK(count_of(&reply, 3) == 1);
+
+    // Our OPT record is last: root name, type, payload size, ext rcode, version, flags
+    const uint8_t* opt = &reply.data[reply.len - 11];
+    CHECK(opt[0] == 0);
+    CHECK(get16(&opt[1]) == QTYPE_OPT);
+    CHECK(get16(&opt[3]) == DNS_LEN);
+    CHECK(get32(&opt[5]) == 0x00008000);
+    CHECK(get16(&opt[9]) == 0);
+}
+
+static void test_edns_bad_version(void)
+{
+    msg_t query, reply;
+    put_header(&query, 0x0100, 1, 1);
+    put_question(&query, "captive.apple.com", QTYPE_A);
+    put_opt(&query, 1232, 0x00010000); // Version 1
+
+    CHECK(build_reply(&query, &reply) > 0);
+    // BADVERS is 16: 0 in the header, 1 in the upper bits of the OPT record
+    CHECK(rcode_of(&reply) == RCODE_NOERROR);
+    CHECK(count_of(&reply, 1) == 0);
+    CHECK(count_of(&reply, 3) == 1);
+    CHECK(reply.data[reply.len - 11 + 5] == 1);
+}
+
+static void test_edns_two_opts_formerr(void)
+{
+    msg_t query, reply;
+    put_header(&query, 0x0100, 1, 2);
+    put_question(&query, "captive.apple.com", QTYPE_A);
+    put_opt(&query, 1232, 0);
+    put_opt(&query, 1232, 0);
+
+    CHECK(build_reply(&query, &reply) > 0);
+    CHECK(rcode_of(&reply) == RCODE_FORMERR);
+    CHECK(count_of(&reply, 1) == 0);
+    CHECK(count_of(&reply, 3) == 0);
+}
+
+static void test_edns_truncated_additional_formerr(void)
+{
+    msg_t query, reply;
+    put_header(&query, 0x0100, 1, 1);
+    put_question(&query, "captive.apple.com", QTYPE_A);
+    put_opt(&query, 1232, 0);
+    query.len -= 3;
+
+    CHECK(build_reply(&query, &reply) > 0);
+    CHECK(rcode_of(&reply) == RCODE_FORMERR);
+}
+
+static void test_edns_room_kept_for_opt(void)
+{
+    msg_t query;
+    uint8_t reply[DNS_LEN];
+    put_header(&query, 0x0100, 1, 1);
+    put_question(&query, "example.org", QTYPE_A);
+    put_opt(&query, 1232, 0);
+
+    // Room for the questions and the OPT record, but not for the answer as well
+    int questions = query.len - 11;
+    int len = capt_dns_build_reply(query.data, query.len, reply, questions + 11 + 15);
+    CHECK(len == questions + 11);
+    CHECK(get16(&reply[2]) & FLAG_TC);
+    CHECK(get16(&reply[10]) == 1);
+}
+
+/* ---------------------------------------------------------------------------------------------
+ * Negative answers
+ */
+
+/* Checks for NODATA: no answer, and an SOA carrying the negative TTL in the authority section */
+static void check_nodata(const msg_t* reply)
+{
+    CHECK(rcode_of(reply) == RCODE_NOERROR);
+    CHECK(count_of(reply, 1) == 0);
+    CHECK(count_of(reply, 2) == 1);
+
+    int rr = first_record(reply);
+    CHECK(get16(&reply->data[rr]) == (0xc000 | HEADER_LEN));
+    CHECK(get16(&reply->data[rr + 2]) == QTYPE_SOA);
+    CHECK(get32(&reply->data[rr + 6]) == NEGATIVE_TTL);
+    // MINIMUM is the last field of the SOA RDATA
+    CHECK(get32(&reply->data[reply->len - 4]) == NEGATIVE_TTL);
+}
+
+static void test_aaaa_nodata_without_ula(void)
+{
+    msg_t query, reply;
+    make_query(&query, "captive.apple.com", QTYPE_AAAA);
+
+    CHECK(build_reply(&query, &reply) > 0);
+    check_nodata(&reply);
+}
+
+static void test_https_nodata(void)
+{
+    msg_t query, reply;
+    make_query(&query, "captive.apple.com", QTYPE_HTTPS);
+
+    CHECK(build_reply(&query, &reply) > 0);
+    check_nodata(&reply);
+}
+
+static void test_aaaa_answer_with_ula(void)
+{
+    msg_t query, reply;
+    make_query(&query, "captive.apple.com", QTYPE_AAAA);
+
+    capt_dns_query_init(AP_IP4, AP_ULA);
+    CHECK(build_reply(&query, &reply) > 0);
+    capt_dns_query_init(AP_IP4, NULL);
+
+    CHECK(count_of(&reply, 1) == 1);
+    CHECK(count_of(&reply, 2) == 0);
+    int rr = first_record(&reply);
+    CHECK(get16(&reply.data[rr + 2]) == QTYPE_AAAA);
+    CHECK(get16(&reply.data[rr + 10]) == 16);
+    CHECK(memcmp(&reply.data[rr + 12], AP_ULA, 16) == 0);
+}
+
+static void test_no_soa_next_to_an_answer(void)
+{
+    msg_t query, reply;
+    put_header(&query, 0x0100, 2, 0);
+    put_question(&query, "example.org", QTYPE_AAAA);
+    put_question(&query, "example.org", QTYPE_A);
+
+    CHECK(build_reply(&query, &reply) > 0);
+    CHECK(count_of(&reply, 1) == 1);
+    CHECK(count_of(&reply, 2) == 0);
+}
+
+/* ---------------------------------------------------------------------------------------------
+ * Split-horizon mode
+ */
+
+static bool is_local(const char* dotted)
+{
+    msg_t query;
+    make_query(&query, dotted, QTYPE_A);
+    return capt_dns_is_local_query(query.data, query.len);
+}
+
+static void test_local_names(void)
+{
+    static const char* const hosts[] = {"my-device.local", "Setup."};
+
+    CHECK(capt_dns_set_local_names(hosts, 2));
+    CHECK(is_local("my-device.local"));
+    CHECK(is_local("MY-DEVICE.Local"));
+    CHECK(is_local("setup"));
+    CHECK(!is_local("my-device"));
+    CHECK(!is_local("x.my-device.local"));
+    CHECK(!is_local("example.org"));
+
+    CHECK(capt_dns_set_local_names(NULL, 0));
+    CHECK(!is_local("my-device.local"));
+}
+
+static void test_local_names_rejected(void)
+{
+    static const char* const empty_label[] = {"my-device..local"};
+    static const char* const too_many[] = {"a", "b", "c", "d", "e"};
+    static const char* const good[] = {"my-device.local"};
+
+    CHECK(capt_dns_set_local_names(good, 1));
+    CHECK(!capt_dns_set_local_names(empty_label, 1));
+    // A rejected table is left empty
+    CHECK(!is_local("my-device.local"));
+    CHECK(!capt_dns_set_local_names(too_many, 5));
+}
+
+static void test_local_query_must_be_a_query(void)
+{
+    static const char* const hosts[] = {"setup"};
+    msg_t query;
+
+    CHECK(capt_dns_set_local_names(hosts, 1));
+    make_query(&query, "setup", QTYPE_A);
+    query.data[2] |= 0x80;
+    CHECK(!capt_dns_is_local_query(query.data, query.len));
+    capt_dns_set_local_names(NULL, 0);
+}
+
+static void test_question_key_folds_case(void)
+{
+    msg_t a, b, c;
+    uint32_t key_a, key_b, key_c;
+
+    make_query(&a, "Example.ORG", QTYPE_A);
+    make_query(&b, "example.org", QTYPE_A);
+    make_query(&c, "example.org", QTYPE_AAAA);
+    int end_a = capt_dns_question_key(a.data, a.len, &key_a);
+    int end_b = capt_dns_question_key(b.data, b.len, &key_b);
+    int end_c = capt_dns_question_key(c.data, c.len, &key_c);
+
+    CHECK(end_a == a.len);
+    CHECK(key_a == key_b);
+    CHECK(key_a != key_c);
+    CHECK(capt_dns_question_equal(a.data, end_a, b.data, end_b));
+    CHECK(end_c == end_a);
+}
+
+/* Upstream reply: one A answer and an OPT record */
+static void make_upstream_reply(msg_t* msg)
+{
+    put_header(msg, 0x8180, 1, 1);
+    msg->data[7] = 1; // ancount
+    put_question(msg, "example.org", QTYPE_A);
+    put16(msg, 0xc000 | HEADER_LEN);
+    put16(msg, QTYPE_A);
+    put16(msg, 1);
+    put32(msg, 300);
+    put16(msg, 4);
+    put32(msg, 0x5db8d822);
+    put_opt(msg, 1232, 0);
+}
+
+/* Appends the type of each record to arg, whose first element counts them */
+static void collect_type(uint16_t type, uint8_t* rr, void* arg)
+{
+    uint16_t* types = arg;
+    types[types[0] + 1] = type;
+    types[0]++;
+    (void)rr;
+}
+
+static void test_for_each_record(void)
+{
+    msg_t msg;
+    uint16_t types[4] = {0};
+
+    make_upstream_reply(&msg);
+    CHECK(capt_dns_for_each_record(msg.data, msg.len, collect_type, types) == 0);
+    CHECK(types[0] == 2);
+    CHECK(types[1] == QTYPE_A);
+    CHECK(types[2] == QTYPE_OPT);
+
+    // RDLENGTH past the end
+    msg.len -= 12;
+    CHECK(capt_dns_for_each_record(msg.data, msg.len, NULL, NULL) < 0);
+}
+
+static void test_strip_additional(void)
+{
+    msg_t msg;
+
+    make_upstream_reply(&msg);
+    int len = capt_dns_strip_additional(msg.data, msg.len);
+    CHECK(len == msg.len - 11);
+    CHECK(count_of(&msg, 1) == 1);
+    CHECK(count_of(&msg, 3) == 0);
+}
+
+/* ---------------------------------------------------------------------------------------------
+ * Hostname policies
+ */
+
+#define IP_10_0_0_1 (0x0100000a) // Network byte order on a little-endian host
+#define IP_10_0_0_2 (0x0200000a)
+
+/* Rcode and answered address of an A query, or 0 if there is no answer */
+static int resolve(const char* dotted, uint32_t* ip)
+{
+    msg_t query, reply;
+
+    make_query(&query, dotted, QTYPE_A);
+    *ip = 0;
+    if (build_reply(&query, &reply) <= 0) {
+        return -1;
+    }
+    if (count_of(&reply, 1) == 1) {
+        memcpy(ip, &reply.data[first_record(&reply) + 12], 4);
+    }
+    return rcode_of(&reply);
+}
+
+static uint32_t ap_ip(void)
+{
+    uint32_t ip;
+    memcpy(&ip, AP_IP4, 4);
+    return ip;
+}
+
+static void test_policy_exact_beats_suffix(void)
+{
+    static const capt_dns_policy_t policies[] = {
+        {"apple.com", CAPT_DNS_MATCH_SUFFIX, CAPT_DNS_ACTION_IP, IP_10_0_0_1},
+        {"captive.apple.com", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_AP_IP, 0},
+    };
+    uint32_t ip;
+
+    CHECK(capt_dns_set_policies(policies, 2));
+    CHECK((resolve("captive.apple.com", &ip) == RCODE_NOERROR) && (ip == ap_ip()));
+    CHECK((resolve("x.captive.apple.com", &ip) == RCODE_NOERROR) && (ip == IP_10_0_0_1));
+    CHECK((resolve("apple.com", &ip) == RCODE_NOERROR) && (ip == IP_10_0_0_1));
+    CHECK((resolve("notapple.com", &ip) == RCODE_NOERROR) && (ip == ap_ip()));
+    capt_dns_set_policies(NULL, 0);
+}
+
+static void test_policy_longest_suffix_wins(void)
+{
+    static const capt_dns_policy_t policies[] = {
+        {"", CAPT_DNS_MATCH_SUFFIX, CAPT_DNS_ACTION_NXDOMAIN, 0},
+        {"example.org", CAPT_DNS_MATCH_SUFFIX, CAPT_DNS_ACTION_IP, IP_10_0_0_1},
+        {"Lab.Example.org", CAPT_DNS_MATCH_SUFFIX, CAPT_DNS_ACTION_IP, IP_10_0_0_2},
+    };
+    uint32_t ip;
+
+    CHECK(capt_dns_set_policies(policies, 3));
+    CHECK((resolve("host.lab.example.org", &ip) == RCODE_NOERROR) && (ip == IP_10_0_0_2));
+    CHECK((resolve("HOST.EXAMPLE.ORG", &ip) == RCODE_NOERROR) && (ip == IP_10_0_0_1));
+    CHECK((resolve("example.com", &ip) == RCODE_NXDOMAIN) && (ip == 0));
+    capt_dns_set_policies(NULL, 0);
+}
+
+static void test_policy_first_duplicate_wins(void)
+{
+    static const capt_dns_policy_t policies[] = {
+        {"setup.example", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_IP, IP_10_0_0_1},
+        {"setup.example", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_IP, IP_10_0_0_2},
+    };
+    uint32_t ip;
+
+    CHECK(capt_dns_set_policies(policies, 2));
+    CHECK((resolve("setup.example", &ip) == RCODE_NOERROR) && (ip == IP_10_0_0_1));
+    capt_dns_set_policies(NULL, 0);
+}
+
+static void test_policy_nxdomain_has_soa(void)
+{
+    static const capt_dns_policy_t policies[] = {
+        {"use-application-dns.net", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_NXDOMAIN, 0},
+    };
+    msg_t query, reply;
+
+    CHECK(capt_dns_set_policies(policies, 1));
+    make_query(&query, "use-application-dns.net", QTYPE_A);
+    CHECK(build_reply(&query, &reply) > 0);
+    CHECK(rcode_of(&reply) == RCODE_NXDOMAIN);
+    CHECK(count_of(&reply, 1) == 0);
+    CHECK(count_of(&reply, 2) == 1);
+    capt_dns_set_policies(NULL, 0);
+}
+
+static void test_policy_ip_nodata_for_aaaa(void)
+{
+    static const capt_dns_policy_t policies[] = {
+        {"example.org", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_IP, IP_10_0_0_1},
+    };
+    msg_t query, reply;
+
+    CHECK(capt_dns_set_policies(policies, 1));
+    capt_dns_query_init(AP_IP4, AP_ULA);
+    make_query(&query, "example.org", QTYPE_AAAA);
+    CHECK(build_reply(&query, &reply) > 0);
+    capt_dns_query_init(AP_IP4, NULL);
+    check_nodata(&reply);
+    capt_dns_set_policies(NULL, 0);
+}
+
+static void test_policy_table_rejected(void)
+{
+    static const capt_dns_policy_t bad[] = {
+        {"example.org", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_NXDOMAIN, 0},
+        {"bad..name", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_NXDOMAIN, 0},
+    };
+    static capt_dns_policy_t too_many[POLICY_MAX + 1];
+    uint32_t ip;
+
+    // A rejected table is left empty
+    CHECK(!capt_dns_set_policies(bad, 2));
+    CHECK((resolve("example.org", &ip) == RCODE_NOERROR) && (ip == ap_ip()));
+
+    for (int idx = 0; idx <= POLICY_MAX; idx++) {
+        too_many[idx].pattern = "example.org";
+    }
+    CHECK(!capt_dns_set_policies(too_many, POLICY_MAX + 1));
+    CHECK(capt_dns_set_policies(too_many, POLICY_MAX));
+    capt_dns_set_policies(NULL, 0);
+}
+
+int main(void)
+{
+    capt_dns_query_init(AP_IP4, NULL);
+
+    test_a_answer();
+    test_second_question_points_to_its_name();
+    test_no_reply_to_replies_and_runts();
+    test_truncated_when_reply_buffer_is_short();
+
+    test_edns_opt_echoed();
+    test_edns_bad_version();
+    test_edns_two_opts_formerr();
+    test_edns_truncated_additional_formerr();
+    test_edns_room_kept_for_opt();
+
+    test_aaaa_nodata_without_ula();
+    test_https_nodata();
+    test_aaaa_answer_with_ula();
+    test_no_soa_next_to_an_answer();
+
+    test_local_names();
+    test_local_names_rejected();
+    test_local_query_must_be_a_query();
+    test_question_key_folds_case();
+    test_for_each_record();
+    test_strip_additional();
+
+    test_policy_exact_beats_suffix();
+    test_policy_longest_suffix_wins();
+    test_policy_first_duplicate_wins();
+    test_policy_nxdomain_has_soa();
+    test_policy_ip_nodata_for_aaaa();
+    test_policy_table_rejected();
+
+    if (_failures) {
+        fprintf(stderr, "%d checks failed\n", _failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
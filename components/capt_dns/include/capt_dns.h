@@ -19,10 +19,165 @@
 #ifndef CAPT_DNS_H
 #define CAPT_DNS_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #include <esp_netif.h>
 
-esp_err_t capt_dns_start(esp_netif_t* softap_netif_handle);
+#include "capt_dns_policy.h"
+
+/**
+ * @brief   How the DNS server answers queries.
+ */
+typedef enum
+{
+    CAPT_DNS_MODE_CAPTIVE,       /*!< Every name resolves to the soft AP (default) */
+    CAPT_DNS_MODE_SPLIT_HORIZON, /*!< Names from the local host table resolve to the soft AP,
+                                      all others are forwarded to the station interface's DNS
+                                      server. Requires CONFIG_CAPT_DNS_SPLIT_HORIZON. */
+} capt_dns_mode_t;
+
+/**
+ * @brief   Counters kept by the captive DNS server since boot.
+ */
+typedef struct {
+    uint32_t queries;   /*!< Queries received from the soft AP subnet */
+    uint32_t answered;  /*!< Queries answered normally */
+    uint32_t refused;   /*!< Queries over the rate limit answered with REFUSED */
+    uint32_t dropped;   /*!< Queries over the rate limit dropped without answer */
+    uint32_t forwarded; /*!< Queries passed to the forwarder in split-horizon mode, or from
+                             clients exempt from the captive portal */
+} capt_dns_stats_t;
+
+/**
+ * @brief   Query types counted separately in the telemetry.
+ */
+typedef enum
+{
+    CAPT_DNS_QTYPE_A,     /*!< IPv4 address */
+    CAPT_DNS_QTYPE_AAAA,  /*!< IPv6 address */
+    CAPT_DNS_QTYPE_HTTPS, /*!< HTTPS and SVCB service bindings */
+    CAPT_DNS_QTYPE_PTR,   /*!< Reverse lookups */
+    CAPT_DNS_QTYPE_NS,    /*!< NS and SOA */
+    CAPT_DNS_QTYPE_OTHER, /*!< Anything else, including malformed queries */
+    CAPT_DNS_QTYPE_COUNT,
+} capt_dns_qtype_bucket_t;
+
+/** Number of buckets in the service time histogram */
+#define CAPT_DNS_LATENCY_BUCKETS 16
+
+/**
+ * @brief   One query as kept in the telemetry ring.
+ */
+typedef struct {
+    uint32_t timestamp_ms; /*!< Time the query was received, in ms since boot */
+    uint32_t src_key;      /*!< IPv4 source address in network byte order, or the four words
+                                of an IPv6 source address XORed together */
+    uint32_t qname_hash;   /*!< FNV-1a hash of the lower-cased name in the first question,
+                                0 if the query is malformed */
+    uint16_t qtype;        /*!< Type of the first question, 0 if the query is malformed */
+    uint16_t service_us;   /*!< Time taken to build the reply, saturates at 65535 */
+} capt_dns_query_record_t;
+
+/**
+ * @brief   Counters kept by the query telemetry since boot.
+ */
+typedef struct {
+    uint32_t qtype[CAPT_DNS_QTYPE_COUNT]; /*!< Queries per capt_dns_qtype_bucket_t */
+    uint32_t latency[CAPT_DNS_LATENCY_BUCKETS]; /*!< Bucket 0 counts service times below 2 us,
+                                                     bucket n those from 2^n to 2^(n+1)-1 us;
+                                                     the last bucket also counts all longer */
+} capt_dns_telemetry_t;
+
+/**
+ * @brief   Decides whether a client gets captive answers.
+ *
+ * Called for each query in captive mode from the DNS server's task, so it
+ * must not block. Only used with CONFIG_CAPT_DNS_SPLIT_HORIZON, whose
+ * forwarder resolves the names of exempt clients. Without a forwarder the
+ * filter is ignored and every client gets captive answers, since the only
+ * other choice would leave released clients with no DNS at all until the
+ * server stops.
+ *
+ * @param[in] src_key IPv4 source address of the query in network byte order,
+ *                    or the four words of an IPv6 source address XORed together
+ *
+ * @return false if the client is exempt from the captive portal. Its queries
+ *         are then forwarded upstream as in split-horizon mode.
+ */
+typedef bool (*capt_dns_client_filter_t)(uint32_t src_key);
+
+/**
+ * @brief   Configuration of the DNS server.
+ */
+typedef struct {
+    esp_netif_t* netif_handle; /*!< Interface on which to answer queries, typically the soft AP.
+                                    Its address is the answer to all names without a policy. */
+    capt_dns_mode_t mode;      /*!< How queries are answered */
+    const char* const* local_hosts; /*!< Split-horizon mode only: dotted host names answered
+                                         locally, e.g. "my-device.local". Matching is exact
+                                         and case-insensitive. */
+    size_t num_local_hosts;    /*!< Number of entries in local_hosts, at most
+                                    CONFIG_CAPT_DNS_LOCAL_HOSTS_MAX */
+    const capt_dns_policy_t* policies; /*!< Policies for names answered locally, may be NULL.
+                                            Must stay valid until capt_dns_stop(). */
+    size_t num_policies;       /*!< Number of entries in policies, at most
+                                    CONFIG_CAPT_DNS_POLICY_MAX */
+    capt_dns_client_filter_t client_filter; /*!< Captive mode only: clients for which this
+                                                 returns false are not captive. NULL makes
+                                                 every client captive. */
+} capt_dns_config_t;
+
+/**
+ * @brief   Starts the DNS server.
+ *
+ * @param[in] config Configuration. Only the policies are referenced after
+ *                   the call returns.
+ *
+ * @return
+ *  - ESP_OK on success
+ *  - ESP_ERR_INVALID_STATE if the server is already running
+ *  - ESP_ERR_INVALID_ARG if a host name or policy pattern is malformed, or
+ *    there are too many of them
+ *  - ESP_ERR_NOT_SUPPORTED if split-horizon mode is not enabled in the config
+ */
+esp_err_t capt_dns_start(const capt_dns_config_t* config);
 
 void capt_dns_stop(void);
 
+/**
+ * @brief   Gets a snapshot of the DNS server counters.
+ *
+ * @param[out] stats Counters
+ */
+void capt_dns_get_stats(capt_dns_stats_t* stats);
+
+/**
+ * @brief   Gets a snapshot of the per-type counters and the service time
+ *          histogram. Requires CONFIG_CAPT_DNS_TELEMETRY.
+ *
+ * @param[out] telemetry Counters
+ */
+void capt_dns_get_telemetry(capt_dns_telemetry_t* telemetry);
+
+/**
+ * @brief   Copies the most recent queries out of the telemetry ring, oldest
+ *          first. Can be called from any task while the server is running.
+ *          Requires CONFIG_CAPT_DNS_TELEMETRY.
+ *
+ * @param[out] records     Buffer for the records
+ * @param[in]  max_records Size of the buffer. At most
+ *                         CONFIG_CAPT_DNS_TELEMETRY_RING_SIZE - 1 records
+ *                         are returned.
+ *
+ * @return  Number of records copied
+ */
+size_t capt_dns_get_recent_queries(capt_dns_query_record_t* records, size_t max_records);
+
+/**
+ * @brief   Short name of a query type bucket, e.g. "AAAA".
+ */
+const char* capt_dns_qtype_bucket_name(capt_dns_qtype_bucket_t bucket);
+
 #endif
@@ -0,0 +1,57 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CAPT_DNS_POLICY_H
+#define CAPT_DNS_POLICY_H
+
+#include <stdint.h>
+
+/**
+ * @brief   Which names a policy applies to.
+ */
+typedef enum
+{
+    CAPT_DNS_MATCH_EXACT,  /*!< The pattern itself only */
+    CAPT_DNS_MATCH_SUFFIX, /*!< The pattern and every name below it, e.g. "apple.com" matches
+                                "apple.com" and "captive.apple.com". The pattern "" matches all
+                                names. */
+} capt_dns_match_t;
+
+/**
+ * @brief   How names matched by a policy are answered.
+ */
+typedef enum
+{
+    CAPT_DNS_ACTION_AP_IP,    /*!< Answer with the soft AP's address, as for unmatched names */
+    CAPT_DNS_ACTION_NXDOMAIN, /*!< Answer that the name does not exist */
+    CAPT_DNS_ACTION_IP,       /*!< Answer A queries with the policy's address. Other types get
+                                   an empty answer. */
+} capt_dns_action_t;
+
+/**
+ * @brief   Answer policy for a host name pattern.
+ *
+ * An exact match takes precedence over a suffix match, and a longer suffix
+ * over a shorter one. Of two policies with the same pattern and match type,
+ * the first one is used.
+ */
+typedef struct {
+    const char* pattern;      /*!< Dotted name, matched case-insensitively */
+    capt_dns_match_t match;   /*!< Whether subdomains of pattern match, too */
+    capt_dns_action_t action; /*!< How to answer */
+    uint32_t ip;              /*!< IPv4 address for CAPT_DNS_ACTION_IP in network byte
+                                   order, e.g. ESP_IP4TOADDR(10, 0, 0, 1) */
+} capt_dns_policy_t;
+
+#endif
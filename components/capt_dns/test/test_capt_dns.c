@@ -0,0 +1,209 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+On-target tests of the DNS server, for the ESP-IDF unit test app. They bring up the soft AP and
+query the server over lwIP's loopback, so the queries come from the soft AP's own address.
+
+The soft AP stays up for the rest of the run once the first test has started it. The Wi-Fi
+driver's allocations would count as leaks of that test, so all tests carry the [leaks] tag and
+check the heap themselves where it matters.
+*/
+
+#include <string.h>
+
+#include "esp_event.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs_flash.h"
+#include "unity.h"
+
+#include "lwip/sockets.h"
+
+#include "capt_dns.h"
+
+#define START_STOP_CYCLES (10000)
+
+/* Cycles run before the heap is measured, so that state lwIP allocates on first use is
+ * already in place */
+#define WARMUP_CYCLES (10)
+
+/* Allowed drift of the heap figures over all cycles: well above what the idle Wi-Fi driver
+ * allocates in the background, well below one byte per cycle */
+#define HEAP_TOLERANCE (1024)
+
+#define QUERY_TIMEOUT_MS (500)
+
+static esp_netif_t* _ap_netif;
+
+static esp_netif_t* start_softap(void)
+{
+    esp_err_t ret;
+
+    if (_ap_netif) {
+        return _ap_netif;
+    }
+
+    ret = nvs_flash_init();
+    if ((ret == ESP_ERR_NVS_NO_FREE_PAGES) || (ret == ESP_ERR_NVS_NEW_VERSION_FOUND)) {
+        TEST_ESP_OK(nvs_flash_erase());
+        ret = nvs_flash_init();
+    }
+    TEST_ESP_OK(ret);
+    TEST_ESP_OK(esp_netif_init());
+    TEST_ESP_OK(esp_event_loop_create_default());
+    _ap_netif = esp_netif_create_default_wifi_ap();
+    TEST_ASSERT_NOT_NULL(_ap_netif);
+
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+    TEST_ESP_OK(esp_wifi_init(&cfg));
+    TEST_ESP_OK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+    TEST_ESP_OK(esp_wifi_set_mode(WIFI_MODE_AP));
+    TEST_ESP_OK(esp_wifi_start());
+
+    for (int i = 0; (i < 50) && !esp_netif_is_netif_up(_ap_netif); i++) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+    TEST_ASSERT_TRUE(esp_netif_is_netif_up(_ap_netif));
+    return _ap_netif;
+}
+
+static void start_server(esp_netif_t* netif)
+{
+    capt_dns_config_t config = {
+        .netif_handle = netif,
+        .mode = CAPT_DNS_MODE_CAPTIVE,
+    };
+
+    TEST_ESP_OK(capt_dns_start(&config));
+}
+
+/* Sends an A query for captive.apple.com to the soft AP. Returns whether it was answered with
+ * the soft AP's address within timeout_ms. */
+static bool query_soft_ap(esp_netif_t* netif, int timeout_ms)
+{
+    static const uint8_t QUESTION[] = "\x07" "captive" "\x05" "apple" "\x03" "com" "\x00"
+                                      "\x00\x01" "\x00\x01";
+    static uint16_t query_id = 0x4000;
+    esp_netif_ip_info_t ip_info;
+    struct sockaddr_in server = {0};
+    struct timeval timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    uint8_t query[12 + sizeof(QUESTION)];
+    uint8_t reply[128];
+    bool is_answered = false;
+    int fd;
+    int len;
+
+    TEST_ESP_OK(esp_netif_get_ip_info(netif, &ip_info));
+    server.sin_family = AF_INET;
+    server.sin_port = htons(53);
+    server.sin_addr.s_addr = ip_info.ip.addr;
+
+    query_id++;
+    memset(query, 0, 12);
+    query[0] = query_id >> 8;
+    query[1] = query_id & 0xff;
+    query[2] = 0x01; /* RD */
+    query[5] = 1;    /* QDCOUNT */
+    memcpy(&query[12], QUESTION, sizeof(QUESTION) - 1);
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    TEST_ASSERT_GREATER_OR_EQUAL(0, fd);
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    sendto(fd, query, 12 + sizeof(QUESTION) - 1, 0, (struct sockaddr*)&server, sizeof(server));
+
+    while ((len = recv(fd, reply, sizeof(reply), 0)) > 0) {
+        if ((len < 12) || (((reply[0] << 8) | reply[1]) != query_id)) {
+            continue; /* Late answer to an earlier query */
+        }
+        /* Answered, RCODE 0, one answer whose RDATA ends the message */
+        is_answered = ((reply[3] & 0x0f) == 0) && (reply[7] == 1) &&
+                      (memcmp(&reply[len - 4], &ip_info.ip.addr, 4) == 0);
+        break;
+    }
+    close(fd);
+    return is_answered;
+}
+
+TEST_CASE("capt_dns answers only while started", "[capt_dns][leaks]")
+{
+    esp_netif_t* netif = start_softap();
+
+    for (int i = 0; i < 3; i++) {
+        start_server(netif);
+        TEST_ASSERT_TRUE(query_soft_ap(netif, QUERY_TIMEOUT_MS));
+        capt_dns_stop();
+        // The sockets are closed while the task is parked
+        TEST_ASSERT_FALSE(query_soft_ap(netif, QUERY_TIMEOUT_MS));
+    }
+}
+
+TEST_CASE("capt_dns start/stop cycles keep the heap flat", "[capt_dns][leaks][timeout=600]")
+{
+    esp_netif_t* netif = start_softap();
+    size_t free_before, free_after;
+    size_t largest_before, largest_after;
+    size_t low_water_before, low_water_after;
+    int fd_before, fd_after;
+
+    for (int i = 0; i < WARMUP_CYCLES; i++) {
+        start_server(netif);
+        capt_dns_stop();
+    }
+
+    esp_log_level_set("capt_dns", ESP_LOG_WARN);
+
+    fd_before = socket(AF_INET, SOCK_DGRAM, 0);
+    close(fd_before);
+    free_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    largest_before = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    low_water_before = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+
+    for (int i = 0; i < START_STOP_CYCLES; i++) {
+        start_server(netif);
+        capt_dns_stop();
+        if ((i % 1000) == 999) {
+            printf("%d cycles, %u bytes free\n", i + 1,
+                   (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT));
+        }
+    }
+
+    fd_after = socket(AF_INET, SOCK_DGRAM, 0);
+    close(fd_after);
+    free_after = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    largest_after = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    low_water_after = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+
+    esp_log_level_set("capt_dns", CONFIG_LOG_DEFAULT_LEVEL);
+
+    printf("free %u -> %u, largest block %u -> %u, low water %u -> %u\n",
+           (unsigned)free_before, (unsigned)free_after, (unsigned)largest_before,
+           (unsigned)largest_after, (unsigned)low_water_before, (unsigned)low_water_after);
+
+    // No socket left open, nothing allocated per cycle, the heap no more fragmented and its
+    // high-water mark where it was
+    TEST_ASSERT_EQUAL(fd_before, fd_after);
+    TEST_ASSERT_UINT32_WITHIN(HEAP_TOLERANCE, free_before, free_after);
+    TEST_ASSERT_GREATER_OR_EQUAL(largest_before - HEAP_TOLERANCE, largest_after);
+    TEST_ASSERT_GREATER_OR_EQUAL(low_water_before - HEAP_TOLERANCE, low_water_after);
+
+    // Still serving after all that
+    start_server(netif);
+    TEST_ASSERT_TRUE(query_soft_ap(netif, QUERY_TIMEOUT_MS));
+    capt_dns_stop();
+}
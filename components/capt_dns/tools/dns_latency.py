@@ -0,0 +1,182 @@
+#!/usr/bin/env python
+#
+# Copyright 2021 Aaron Fontaine
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Measures the answer latency of the captive DNS server from a client of the soft AP.
+
+Sends A queries to the device one at a time, or in bursts like the connectivity probes of a
+phone joining the network, and prints the median and tail latency of the answers. Run it from a
+computer connected to the soft AP, once per firmware build to compare:
+
+    python dns_latency.py 192.168.4.1 --count 500
+    python dns_latency.py 192.168.4.1 --count 500 --burst 8
+
+With --sweep it runs once for each of several burst sizes and prints a table of throughput,
+latency and losses. The throughput is the answers per second of time spent in bursts, from the
+first query sent to the last answer received. Run it against firmware built with different
+values of CONFIG_CAPT_DNS_BATCH_SIZE to see how draining several queries per wakeup scales:
+
+    python dns_latency.py 192.168.4.1 --count 500 --sweep 1,2,4,8,16,32
+"""
+
+import argparse
+import random
+import select
+import socket
+import struct
+import sys
+import time
+
+QTYPE_A = 1
+QCLASS_IN = 1
+FLAGS_QUERY_RD = 0x0100
+
+
+def build_query(query_id, dotted):
+    qname = b''
+    for label in dotted.split('.'):
+        if label:
+            qname += struct.pack('B', len(label)) + label.encode('ascii')
+    return (struct.pack('>HHHHHH', query_id, FLAGS_QUERY_RD, 1, 0, 0, 0) + qname + b'\0' +
+            struct.pack('>HH', QTYPE_A, QCLASS_IN))
+
+
+def percentile(sorted_values, pct):
+    if not sorted_values:
+        return float('nan')
+    idx = int(round(pct / 100.0 * (len(sorted_values) - 1)))
+    return sorted_values[idx]
+
+
+def run_burst(sock, server, names, timeout):
+    """Sends one query per name back to back, then collects the answers.
+
+    Returns the latencies in seconds of the answered queries, the number of lost ones and the
+    seconds from the first query sent to the last answer received.
+    """
+    pending = {}
+    start = time.perf_counter()
+    last = start
+    for dotted in names:
+        query_id = random.randint(0, 0xffff)
+        while query_id in pending:
+            query_id = random.randint(0, 0xffff)
+        pending[query_id] = time.perf_counter()
+        sock.sendto(build_query(query_id, dotted), server)
+
+    latencies = []
+    deadline = time.perf_counter() + timeout
+    while pending:
+        remaining = deadline - time.perf_counter()
+        if remaining <= 0 or not select.select([sock], [], [], remaining)[0]:
+            break
+        reply, _ = sock.recvfrom(4096)
+        now = time.perf_counter()
+        if len(reply) < 12:
+            continue
+        sent = pending.pop(struct.unpack('>H', reply[:2])[0], None)
+        if sent is not None:
+            latencies.append(now - sent)
+            last = now
+    return latencies, len(pending), last - start
+
+
+def run(sock, server, names, count, burst_size, timeout, interval):
+    """Sends count queries in bursts of burst_size.
+
+    Returns the sorted latencies in milliseconds, the number of lost queries and the seconds
+    spent in bursts.
+    """
+    latencies = []
+    lost = 0
+    busy = 0.0
+    sent = 0
+    while sent < count:
+        burst = min(burst_size, count - sent)
+        burst_names = [names[(sent + idx) % len(names)] for idx in range(burst)]
+        burst_latencies, burst_lost, burst_busy = run_burst(sock, server, burst_names, timeout)
+        latencies += burst_latencies
+        lost += burst_lost
+        busy += burst_busy
+        sent += burst
+        time.sleep(interval)
+    return sorted(1000.0 * value for value in latencies), lost, busy
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('server', nargs='?', default='192.168.4.1',
+                        help='address of the soft AP (default: %(default)s)')
+    parser.add_argument('--port', type=int, default=53, help='DNS port (default: %(default)s)')
+    parser.add_argument('--count', type=int, default=200, help='queries to send in total')
+    parser.add_argument('--burst', type=int, default=1,
+                        help='queries sent back to back before waiting for the answers')
+    parser.add_argument('--sweep', metavar='SIZES',
+                        help='comma separated burst sizes to run one after the other, '
+                             'e.g. 1,2,4,8,16,32')
+    parser.add_argument('--name', action='append',
+                        help='name to query, may be repeated (default: the probe names of '
+                             'common OSes)')
+    parser.add_argument('--timeout', type=float, default=2.0,
+                        help='seconds to wait for the answers of a burst')
+    parser.add_argument('--interval', type=float, default=0.05,
+                        help='seconds to pause between bursts')
+    args = parser.parse_args()
+
+    names = args.name or ['connectivitycheck.gstatic.com', 'captive.apple.com',
+                          'www.msftconnecttest.com', 'detectportal.firefox.com']
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    server = (args.server, args.port)
+
+    if args.sweep:
+        try:
+            sizes = [int(size) for size in args.sweep.split(',')]
+        except ValueError:
+            parser.error('--sweep takes burst sizes separated by commas')
+        if any(size < 1 for size in sizes):
+            parser.error('burst sizes must be at least 1')
+
+        print('%d queries per burst size' % args.count)
+        print('%5s %12s %8s %8s %8s %6s' % ('burst', 'answers/s', 'p50 ms', 'p90 ms', 'p99 ms',
+                                            'lost'))
+        answered = 0
+        for size in sizes:
+            ms, lost, busy = run(sock, server, names, args.count, size, args.timeout,
+                                 args.interval)
+            answered += len(ms)
+            print('%5d %12.0f %8.1f %8.1f %8.1f %6d' %
+                  (size, len(ms) / busy if busy > 0 else 0.0, percentile(ms, 50),
+                   percentile(ms, 90), percentile(ms, 99), lost))
+        if not answered:
+            print('No answers from %s port %d' % server)
+            return 1
+        return 0
+
+    ms, lost, _ = run(sock, server, names, args.count, args.burst, args.timeout, args.interval)
+    if not ms:
+        print('No answers from %s port %d' % server)
+        return 1
+
+    print('%d queries in bursts of %d, %d answered, %d lost' %
+          (args.count, args.burst, len(ms), lost))
+    print('latency ms: min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f' %
+          (percentile(ms, 0), percentile(ms, 50), percentile(ms, 90), percentile(ms, 99),
+           percentile(ms, 100)))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
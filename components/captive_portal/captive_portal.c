@@ -18,8 +18,12 @@
 #include <esp_err.h>
 #include <esp_log.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <strings.h>
 
 #include "capt_dns.h"
+#include "captive_portal_priv.h"
+#include "sdkconfig.h"
 
 /* Is there a constant available for this in the esp/lwip headers somewhere? */
 #define PROV_WEBPAGE_URI_MAX (64)
@@ -30,33 +34,235 @@ static const char* TAG = "captive-portal";
 static const char* WEBPROV_URI_SCHEME = "http://";
 
 static bool _is_started = false;
+static volatile bool _is_captive = false; /* Reported by the Captive Portal API */
 
 static char _portal_redirect_uri[PROV_WEBPAGE_URI_MAX];
 static char _portal_redirect_full_url[PROV_WEBPAGE_URI_MAX];
+static char _portal_host[16]; /* Dotted IP address of the portal */
+
+#if CONFIG_CAPTIVE_PORTAL_REDIRECT_307
+#define PORTAL_REDIRECT_STATUS "307 Temporary Redirect"
+#else
+#define PORTAL_REDIRECT_STATUS "302 Found"
+#endif
+
+/* Answers for well-known names. All other names resolve to the soft AP. */
+static const capt_dns_policy_t _default_dns_policies[] = {
+    /* Connectivity probes of the common OSes. Answered with our address so that the device
+     * notices the portal right away. */
+    {"connectivitycheck.gstatic.com", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_AP_IP, 0},
+    {"clients3.google.com", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_AP_IP, 0},
+    {"captive.apple.com", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_AP_IP, 0},
+    {"www.msftconnecttest.com", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_AP_IP, 0},
+    {"www.msftncsi.com", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_AP_IP, 0},
+    {"detectportal.firefox.com", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_AP_IP, 0},
+    {"nmcheck.gnome.org", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_AP_IP, 0},
+    /* Canary domains. NXDOMAIN tells Firefox not to use DNS over HTTPS and Apple devices not to
+     * use iCloud Private Relay, both of which would bypass our DNS server. */
+    {"use-application-dns.net", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_NXDOMAIN, 0},
+    {"mask.icloud.com", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_NXDOMAIN, 0},
+    {"mask-h2.icloud.com", CAPT_DNS_MATCH_EXACT, CAPT_DNS_ACTION_NXDOMAIN, 0},
+};
+
+/* Room for a complete canned probe response: headers, the full portal URL
+ * (twice in the refresh page) and the page itself */
+#define PROBE_RESPONSE_MAX (512)
+
+/* Connectivity probes send a fixed request and expect a fixed answer on an
+ * open network. Anything else makes the OS conclude that it is behind a
+ * captive portal, but how quickly it then shows the portal depends on what
+ * it gets instead.
+ */
+typedef enum
+{
+    /* 302 to the portal. Android and ChromeOS take the portal URL from the
+     * Location header for their sign-in notification; Windows and Firefox
+     * show their sign-in prompt and open the browser, which ends up here. */
+    PROBE_RESPONSE_REDIRECT,
+
+    /* 200 with a page that refreshes to the portal. Apple's Captive Network
+     * Assistant expects a "Success" page; any other page is shown in the
+     * assistant right away, which then follows the refresh. */
+    PROBE_RESPONSE_REFRESH,
+
+    PROBE_RESPONSE_COUNT,
+} probe_response_t;
+
+typedef struct {
+    const char* path; /* URI path of the probe, without query string */
+    probe_response_t response;
+} probe_t;
+
+static const probe_t _probes[] = {
+    {"/generate_204", PROBE_RESPONSE_REDIRECT},              /* Android, ChromeOS */
+    {"/gen_204", PROBE_RESPONSE_REDIRECT},                   /* Android */
+    {"/hotspot-detect.html", PROBE_RESPONSE_REFRESH},        /* iOS, macOS */
+    {"/library/test/success.html", PROBE_RESPONSE_REFRESH},  /* Older iOS */
+    {"/connecttest.txt", PROBE_RESPONSE_REDIRECT},           /* Windows 10 and later */
+    {"/ncsi.txt", PROBE_RESPONSE_REDIRECT},                  /* Older Windows */
+    {"/success.txt", PROBE_RESPONSE_REDIRECT},               /* Firefox */
+    {"/canonical.html", PROBE_RESPONSE_REDIRECT},            /* Firefox */
+    {"/check_network_status.txt", PROBE_RESPONSE_REDIRECT},  /* GNOME NetworkManager */
+};
+
+/* Complete HTTP responses to the probes, built in captive_portal_start() so
+ * that answering a probe is a single send. */
+static char _probe_responses[PROBE_RESPONSE_COUNT][PROBE_RESPONSE_MAX];
+static size_t _probe_response_lens[PROBE_RESPONSE_COUNT];
+
+#define NUM_PROBES (sizeof(_probes) / sizeof(_probes[0]))
+
+/* Routes of the portal: the redirect URI, the Captive Portal API, each
+ * probe and everything else. Added on top of the application's routes while
+ * the portal is active. */
+static uri_router_route_t _routes[NUM_PROBES + 3];
+
+static uri_router_handle_t _router;
+
+static esp_err_t send_probe_response(httpd_req_t* req, const probe_t* probe)
+{
+    const char* response = _probe_responses[probe->response];
+    size_t len = _probe_response_lens[probe->response];
+
+    ESP_LOGD(TAG, "Answering connectivity probe %s", probe->path);
+
+    if (httpd_send(req, response, len) != (int)len) {
+        return ESP_FAIL;
+    }
+    /* The canned response says "Connection: close", so make it so. */
+    httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+    return ESP_OK;
+}
+
+/* Whether the request was sent to the portal's address. The browser then
+ * follows the redirect over the same connection. */
+static bool is_addressed_to_portal(httpd_req_t* req)
+{
+#if CONFIG_CAPTIVE_PORTAL_KEEP_ALIVE
+    char host[sizeof(_portal_host) + 6]; /* Room for a ":port" suffix */
+
+    if (httpd_req_get_hdr_value_str(req, "Host", host, sizeof(host)) != ESP_OK) {
+        /* No Host header, or one too long to be our address */
+        return false;
+    }
+    host[strcspn(host, ":")] = '\0';
+    return (strcasecmp(host, _portal_host) == 0);
+#else
+    return false;
+#endif
+}
+
+#if CONFIG_CAPTIVE_PORTAL_API
+/* Captive Portal API (RFC 8908). Clients configured with the API URL poll it
+ * to learn whether they are still captive and where to sign in. */
+static esp_err_t send_captive_portal_api_response(httpd_req_t* req, bool captive)
+{
+    char json[sizeof(_portal_redirect_full_url) + 48];
+
+    snprintf(json, sizeof(json), "{\"captive\":%s,\"user-portal-url\":\"%s\"}",
+             captive ? "true" : "false", _portal_redirect_full_url);
+
+    httpd_resp_set_type(req, "application/captive+json");
+    httpd_resp_set_hdr(req, "Cache-Control", "private, no-store");
+    return httpd_resp_send(req, json, HTTPD_RESP_USE_STRLEN);
+}
+#endif
+
+static captive_portal_client_state_t get_client_state(httpd_req_t* req, uint32_t* client_ip)
+{
+    *client_ip = 0;
+    if (captive_portal_sockfd_to_ip(httpd_req_to_sockfd(req), client_ip) != ESP_OK) {
+        return CAPTIVE_PORTAL_CLIENT_CAPTIVE;
+    }
+    return captive_portal_get_client_state(*client_ip);
+}
+
+/* Requested page is under the redirection URI. Forward to the application
+ * for normal webpage handling. */
+static esp_err_t portal_page_handler(httpd_req_t* req)
+{
+    uint32_t client_ip;
+
+    if (get_client_state(req, &client_ip) == CAPTIVE_PORTAL_CLIENT_CAPTIVE) {
+        captive_portal_set_client_state(client_ip, CAPTIVE_PORTAL_CLIENT_PORTAL_LOADED);
+    }
+    return uri_router_next(_router, req);
+}
+
+#if CONFIG_CAPTIVE_PORTAL_API
+static esp_err_t captive_portal_api_handler(httpd_req_t* req)
+{
+    uint32_t client_ip;
+    bool released = (get_client_state(req, &client_ip) == CAPTIVE_PORTAL_CLIENT_RELEASED);
+
+    return send_captive_portal_api_response(req, _is_captive && !released);
+}
+#endif
 
-static httpd_handle_t* _httpd_handle;
-static uri_handler_func_t _app_get_handler;
-static void* _app_get_ctx;
+static esp_err_t probe_handler(httpd_req_t* req)
+{
+    uint32_t client_ip;
 
-static esp_err_t captive_portal_common_get_handler(httpd_req_t* req)
+    if (get_client_state(req, &client_ip) == CAPTIVE_PORTAL_CLIENT_RELEASED) {
+        // Done with the portal. Serve this client as if the portal were not there.
+        return uri_router_next(_router, req);
+    }
+    return send_probe_response(req, req->user_ctx);
+}
+
+static esp_err_t redirect_handler(httpd_req_t* req)
 {
+    uint32_t client_ip;
+
+    if (get_client_state(req, &client_ip) == CAPTIVE_PORTAL_CLIENT_RELEASED) {
+        return uri_router_next(_router, req);
+    }
+
     // Note: URIs coming in through httpd_req_t only contain the subdirectory/path
     //   portion of the URL. However, when responding with a 302, we should provide
     //   the complete URL.
-    if (strncmp(req->uri, _portal_redirect_uri, strlen(_portal_redirect_uri)) == 0) {
-        // Requested page matches the redirection URI.
-        // Forward to application's GET handler for normal webpage handling.
-        return _app_get_handler(req);
-    } else {
-        // Requested page does not match the redirection URI.
-        // Send a 302 response with the full URL in the Location header.
-        httpd_resp_set_status(req, "302 Found");
-        httpd_resp_set_type(req, "text/plain");
-        httpd_resp_set_hdr(req, "Location", _portal_redirect_full_url);
+    // Requested page does not match the redirection URI.
+    // Send a redirect with the full URL in the Location header.
+    bool keep_alive = is_addressed_to_portal(req);
+
+    httpd_resp_set_status(req, PORTAL_REDIRECT_STATUS);
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_set_hdr(req, "Location", _portal_redirect_full_url);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-store");
+    if (!keep_alive) {
         httpd_resp_set_hdr(req, "Connection", "close");
-        httpd_resp_send(req, NULL, 0);
-        return ESP_OK;
     }
+    httpd_resp_send(req, NULL, 0);
+    if (!keep_alive) {
+        httpd_sess_trigger_close(req->handle, httpd_req_to_sockfd(req));
+    }
+    return ESP_OK;
+}
+
+static size_t build_routes(void)
+{
+    size_t num_routes = 0;
+
+    _routes[num_routes++] = (uri_router_route_t){_portal_redirect_uri, URI_ROUTER_MATCH_PREFIX,
+                                                 portal_page_handler, NULL};
+#if CONFIG_CAPTIVE_PORTAL_API
+    _routes[num_routes++] = (uri_router_route_t){CAPTIVE_PORTAL_API_URI, URI_ROUTER_MATCH_EXACT,
+                                                 captive_portal_api_handler, NULL};
+#endif
+    for (size_t i = 0; i < NUM_PROBES; i++) {
+        _routes[num_routes++] = (uri_router_route_t){_probes[i].path, URI_ROUTER_MATCH_EXACT,
+                                                     probe_handler, (void*)&_probes[i]};
+    }
+    _routes[num_routes++] =
+        (uri_router_route_t){"/", URI_ROUTER_MATCH_PREFIX, redirect_handler, NULL};
+
+    return num_routes;
+}
+
+/* DNS client filter: everyone but released clients gets captive answers */
+static bool is_captive_client(uint32_t src_key)
+{
+    return (captive_portal_get_client_state(src_key) != CAPTIVE_PORTAL_CLIENT_RELEASED);
 }
 
 static esp_err_t build_full_portal_redirect_url(esp_netif_t* softap_if_handle)
@@ -73,6 +279,7 @@ static esp_err_t build_full_portal_redirect_url(esp_netif_t* softap_if_handle)
     strcpy(_portal_redirect_full_url, WEBPROV_URI_SCHEME);
 
     char* dotted_ip_addr_str = inet_ntoa(ip_info.ip);
+    strlcpy(_portal_host, dotted_ip_addr_str, sizeof(_portal_host));
     strlcat(_portal_redirect_full_url, dotted_ip_addr_str, sizeof(_portal_redirect_full_url));
 
     strlcat(_portal_redirect_full_url, _portal_redirect_uri, sizeof(_portal_redirect_full_url));
@@ -80,6 +287,50 @@ static esp_err_t build_full_portal_redirect_url(esp_netif_t* softap_if_handle)
     return ESP_OK;
 }
 
+static esp_err_t build_probe_responses(void)
+{
+    static const char REFRESH_PAGE_FORMAT[] =
+        "<!DOCTYPE html><html><head>"
+        "<meta http-equiv=\"refresh\" content=\"0; url=%s\"><title>Sign in</title>"
+        "</head><body><a href=\"%s\">Sign in</a></body></html>";
+    char page[PROBE_RESPONSE_MAX];
+    int page_len, len;
+
+    len = snprintf(_probe_responses[PROBE_RESPONSE_REDIRECT], PROBE_RESPONSE_MAX,
+                   "HTTP/1.1 302 Found\r\n"
+                   "Location: %s\r\n"
+                   "Content-Length: 0\r\n"
+                   "Cache-Control: no-store\r\n"
+                   "Connection: close\r\n"
+                   "\r\n",
+                   _portal_redirect_full_url);
+    if ((len < 0) || (len >= PROBE_RESPONSE_MAX)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    _probe_response_lens[PROBE_RESPONSE_REDIRECT] = len;
+
+    page_len = snprintf(page, sizeof(page), REFRESH_PAGE_FORMAT, _portal_redirect_full_url,
+                        _portal_redirect_full_url);
+    if ((page_len < 0) || (page_len >= (int)sizeof(page))) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    len = snprintf(_probe_responses[PROBE_RESPONSE_REFRESH], PROBE_RESPONSE_MAX,
+                   "HTTP/1.1 200 OK\r\n"
+                   "Content-Type: text/html\r\n"
+                   "Content-Length: %d\r\n"
+                   "Cache-Control: no-store\r\n"
+                   "Connection: close\r\n"
+                   "\r\n"
+                   "%s",
+                   page_len, page);
+    if ((len < 0) || (len >= PROBE_RESPONSE_MAX)) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    _probe_response_lens[PROBE_RESPONSE_REFRESH] = len;
+
+    return ESP_OK;
+}
+
 esp_err_t captive_portal_start(captive_portal_config_t* p_config)
 {
     esp_err_t ret;
@@ -94,21 +345,37 @@ esp_err_t captive_portal_start(captive_portal_config_t* p_config)
     if (!p_config->netif_handle) {
         return ESP_ERR_INVALID_ARG;
     }
-    if (!p_config->httpd_handle) {
+    if (!p_config->router) {
         return ESP_ERR_INVALID_ARG;
     }
     if (!p_config->redirect_uri) {
         return ESP_ERR_INVALID_ARG;
     }
-    if (!p_config->app_get_handler) {
-        return ESP_ERR_INVALID_ARG;
+
+    /* Track stations so that they can be released one by one */
+    ret = captive_portal_clients_start();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start client tracking");
+        return ret;
     }
 
     /* Start the DNS server to redirect DNS queries to this device. */
-    ret = capt_dns_start(p_config->netif_handle);
+    capt_dns_config_t dns_config = {
+        .netif_handle = p_config->netif_handle,
+        .mode = CAPT_DNS_MODE_CAPTIVE,
+        .policies = p_config->dns_policies,
+        .num_policies = p_config->num_dns_policies,
+        .client_filter = is_captive_client,
+    };
+    if (!dns_config.policies) {
+        dns_config.policies = _default_dns_policies;
+        dns_config.num_policies =
+            sizeof(_default_dns_policies) / sizeof(_default_dns_policies[0]);
+    }
+    ret = capt_dns_start(&dns_config);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to start captive dns server");
-        return ret;
+        goto err_clients;
     }
 
     strlcpy(_portal_redirect_uri, p_config->redirect_uri, sizeof(_portal_redirect_uri));
@@ -117,37 +384,44 @@ esp_err_t captive_portal_start(captive_portal_config_t* p_config)
     ret = build_full_portal_redirect_url(p_config->netif_handle);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to build redirection URL");
-        capt_dns_stop();
-        return ret;
+        goto err_dns;
     }
 
-    /* Take over the common GET handler on the HTTP server */
-    _app_get_handler = p_config->app_get_handler;
-
-    ret = httpd_unregister_uri_handler(*(p_config->httpd_handle), "/*", HTTP_GET);
-    if ((ret != ESP_OK) && (ret != ESP_ERR_NOT_FOUND)) {
-        ESP_LOGE(TAG, "Failed to unregister application's GET handler for /*.");
-        capt_dns_stop();
-        return ret;
+    ret = build_probe_responses();
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to build connectivity probe responses");
+        goto err_dns;
     }
 
-    httpd_uri_t common_get_uri = {.uri = "/*",
-                                  .method = HTTP_GET,
-                                  .handler = captive_portal_common_get_handler,
-                                  .user_ctx = p_config->app_get_ctx};
-    ret = httpd_register_uri_handler(*(p_config->httpd_handle), &common_get_uri);
+#if CONFIG_CAPTIVE_PORTAL_HTTPS_RESET
+    ret = captive_portal_https_start(p_config->netif_handle);
     if (ret != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to register captive portal's GET handler for /*");
-        capt_dns_stop();
-        return ret;
+        ESP_LOGE(TAG, "Failed to start HTTPS reset listener");
+        goto err_dns;
     }
+#endif
 
-    /* Save additional parameters needed when stopping captive portal */
-    _httpd_handle = p_config->httpd_handle;
-    _app_get_ctx = p_config->app_get_ctx;
+    /* Take over GET requests on the HTTP server */
+    _router = p_config->router;
+    ret = uri_router_add_routes(_router, _routes, build_routes());
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to add captive portal's routes");
+        goto err_https;
+    }
 
+    _is_captive = true;
     _is_started = true;
     return ESP_OK;
+
+err_https:
+#if CONFIG_CAPTIVE_PORTAL_HTTPS_RESET
+    captive_portal_https_stop();
+#endif
+err_dns:
+    capt_dns_stop();
+err_clients:
+    captive_portal_clients_stop();
+    return ret;
 }
 
 void captive_portal_stop(void)
@@ -157,14 +431,29 @@ void captive_portal_stop(void)
     }
 
     capt_dns_stop();
+#if CONFIG_CAPTIVE_PORTAL_HTTPS_RESET
+    captive_portal_https_stop();
+#endif
+    captive_portal_clients_stop();
 
-    /* Unregister captive portal's common GET handler */
-    httpd_unregister_uri_handler(*_httpd_handle, "/*", HTTP_GET);
-
-    /* Restore application's common GET handler */
-    httpd_uri_t common_get_uri = {
-        .uri = "/*", .method = HTTP_GET, .handler = _app_get_handler, .user_ctx = _app_get_ctx};
-    httpd_register_uri_handler(*_httpd_handle, &common_get_uri);
+    /* Hand GET requests back to the application */
+    uri_router_remove_routes(_router, _routes);
 
+    _is_captive = false;
     _is_started = false;
 }
+
+void captive_portal_set_captive(bool captive)
+{
+    _is_captive = captive;
+}
+
+esp_err_t captive_portal_release_client(int sockfd)
+{
+    uint32_t ip;
+
+    if (captive_portal_sockfd_to_ip(sockfd, &ip) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    return captive_portal_set_client_state(ip, CAPTIVE_PORTAL_CLIENT_RELEASED);
+}
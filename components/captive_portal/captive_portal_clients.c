@@ -0,0 +1,276 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Per-client captive state. Stations are added when they associate with the soft AP and removed
+when they leave; their addresses are filled in from the DHCP server's lease list whenever it
+assigns one. The DNS server and the HTTP handler only know a client by its IPv4 address, so
+that is looked up through a small open-addressing index into the station table.
+
+Wi-Fi and IP events arrive in the default event loop task, lookups come from the DNS server
+and the HTTP server, so the table is guarded by a spinlock. No critical section does more than
+a few dozen loads and stores.
+*/
+
+#include "captive_portal.h"
+#include "captive_portal_priv.h"
+
+#include <esp_event.h>
+#include <esp_log.h>
+#include <esp_netif_sta_list.h>
+#include <esp_wifi.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "lwip/sockets.h"
+#include "sdkconfig.h"
+
+#define MAX_CLIENTS CONFIG_CAPTIVE_PORTAL_MAX_CLIENTS
+
+/* Slots in the address index. At most a third full, so probe sequences stay short. */
+#define IP_INDEX_SIZE (32)
+
+_Static_assert((IP_INDEX_SIZE & (IP_INDEX_SIZE - 1)) == 0, "Index size must be a power of two");
+_Static_assert(IP_INDEX_SIZE >= 3 * MAX_CLIENTS, "Index too small for the client table");
+
+static const char* TAG = "captive-portal";
+
+typedef struct {
+    bool in_use;
+    uint8_t state; /* captive_portal_client_state_t */
+    uint8_t mac[6];
+    uint32_t ip; /* Network byte order, 0 until the DHCP server assigns one */
+} client_t;
+
+static client_t _clients[MAX_CLIENTS];
+static uint8_t _ip_index[IP_INDEX_SIZE]; /* Index into _clients plus one, 0 if empty */
+static portMUX_TYPE _clients_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Multiplicative hash so that sequential DHCP leases spread over the index.
+static uint32_t ip_index_slot(uint32_t ip)
+{
+    uint32_t h = ip * 2654435761U;
+    return (h ^ (h >> 16)) & (IP_INDEX_SIZE - 1);
+}
+
+static client_t* find_by_ip(uint32_t ip)
+{
+    uint32_t slot = ip_index_slot(ip);
+
+    while (_ip_index[slot]) {
+        client_t* client = &_clients[_ip_index[slot] - 1];
+        if (client->ip == ip) {
+            return client;
+        }
+        slot = (slot + 1) & (IP_INDEX_SIZE - 1);
+    }
+    return NULL;
+}
+
+static client_t* find_by_mac(const uint8_t* mac)
+{
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (_clients[i].in_use && (memcmp(_clients[i].mac, mac, sizeof(_clients[i].mac)) == 0)) {
+            return &_clients[i];
+        }
+    }
+    return NULL;
+}
+
+static client_t* add_client(const uint8_t* mac)
+{
+    client_t* client = find_by_mac(mac);
+
+    if (client) {
+        return client;
+    }
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (!_clients[i].in_use) {
+            client = &_clients[i];
+            client->in_use = true;
+            client->state = CAPTIVE_PORTAL_CLIENT_CAPTIVE;
+            memcpy(client->mac, mac, sizeof(client->mac));
+            client->ip = 0;
+            return client;
+        }
+    }
+    return NULL;
+}
+
+// Clients come and go rarely, so rather than deleting from the open-addressing index, build it
+// again from the table.
+static void rebuild_ip_index(void)
+{
+    memset(_ip_index, 0, sizeof(_ip_index));
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        if (_clients[i].in_use && _clients[i].ip) {
+            uint32_t slot = ip_index_slot(_clients[i].ip);
+            while (_ip_index[slot]) {
+                slot = (slot + 1) & (IP_INDEX_SIZE - 1);
+            }
+            _ip_index[slot] = i + 1;
+        }
+    }
+}
+
+// Takes the addresses of all associated stations from the DHCP server's lease list.
+static void sync_station_list(void)
+{
+    wifi_sta_list_t wifi_sta_list;
+    esp_netif_sta_list_t netif_sta_list;
+
+    if ((esp_wifi_ap_get_sta_list(&wifi_sta_list) != ESP_OK) ||
+        (esp_netif_get_sta_list(&wifi_sta_list, &netif_sta_list) != ESP_OK)) {
+        return;
+    }
+
+    portENTER_CRITICAL(&_clients_lock);
+    for (int i = 0; i < netif_sta_list.num; i++) {
+        client_t* client = add_client(netif_sta_list.sta[i].mac);
+        if (client) {
+            client->ip = netif_sta_list.sta[i].ip.addr;
+        }
+    }
+    rebuild_ip_index();
+    portEXIT_CRITICAL(&_clients_lock);
+}
+
+static void wifi_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id,
+                               void* event_data)
+{
+    if (event_id == WIFI_EVENT_AP_STACONNECTED) {
+        wifi_event_ap_staconnected_t* event = event_data;
+        client_t* client;
+
+        portENTER_CRITICAL(&_clients_lock);
+        client = add_client(event->mac);
+        portEXIT_CRITICAL(&_clients_lock);
+
+        if (!client) {
+            /* Unknown clients are treated as captive, so nothing is lost but
+             * the tracking of this one. */
+            ESP_LOGW(TAG, "Client table full, " MACSTR " not tracked", MAC2STR(event->mac));
+        }
+    } else if (event_id == WIFI_EVENT_AP_STADISCONNECTED) {
+        wifi_event_ap_stadisconnected_t* event = event_data;
+
+        portENTER_CRITICAL(&_clients_lock);
+        client_t* client = find_by_mac(event->mac);
+        if (client) {
+            client->in_use = false;
+            client->ip = 0;
+            rebuild_ip_index();
+        }
+        portEXIT_CRITICAL(&_clients_lock);
+    }
+}
+
+static void ip_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id,
+                             void* event_data)
+{
+    // The event carries only the address. The lease list has the MAC to go with it.
+    sync_station_list();
+}
+
+esp_err_t captive_portal_clients_start(void)
+{
+    esp_err_t ret;
+
+    portENTER_CRITICAL(&_clients_lock);
+    memset(_clients, 0, sizeof(_clients));
+    memset(_ip_index, 0, sizeof(_ip_index));
+    portEXIT_CRITICAL(&_clients_lock);
+
+    ret = esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_AP_STACONNECTED, wifi_event_handler,
+                                     NULL);
+    if (ret == ESP_OK) {
+        ret = esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_AP_STADISCONNECTED,
+                                         wifi_event_handler, NULL);
+    }
+    if (ret == ESP_OK) {
+        ret = esp_event_handler_register(IP_EVENT, IP_EVENT_AP_STAIPASSIGNED, ip_event_handler,
+                                         NULL);
+    }
+    if (ret != ESP_OK) {
+        captive_portal_clients_stop();
+        return ret;
+    }
+
+    /* Pick up stations that associated before the portal started */
+    sync_station_list();
+    return ESP_OK;
+}
+
+void captive_portal_clients_stop(void)
+{
+    esp_event_handler_unregister(WIFI_EVENT, WIFI_EVENT_AP_STACONNECTED, wifi_event_handler);
+    esp_event_handler_unregister(WIFI_EVENT, WIFI_EVENT_AP_STADISCONNECTED, wifi_event_handler);
+    esp_event_handler_unregister(IP_EVENT, IP_EVENT_AP_STAIPASSIGNED, ip_event_handler);
+}
+
+captive_portal_client_state_t captive_portal_get_client_state(uint32_t ip)
+{
+    captive_portal_client_state_t state = CAPTIVE_PORTAL_CLIENT_CAPTIVE;
+
+    portENTER_CRITICAL(&_clients_lock);
+    client_t* client = find_by_ip(ip);
+    if (client) {
+        state = client->state;
+    }
+    portEXIT_CRITICAL(&_clients_lock);
+
+    return state;
+}
+
+esp_err_t captive_portal_set_client_state(uint32_t ip, captive_portal_client_state_t state)
+{
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+
+    portENTER_CRITICAL(&_clients_lock);
+    client_t* client = find_by_ip(ip);
+    if (client) {
+        client->state = state;
+        ret = ESP_OK;
+    }
+    portEXIT_CRITICAL(&_clients_lock);
+
+    return ret;
+}
+
+esp_err_t captive_portal_sockfd_to_ip(int sockfd, uint32_t* ip)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+
+    if (getpeername(sockfd, (struct sockaddr*)&addr, &addr_len) < 0) {
+        return ESP_FAIL;
+    }
+
+    if (addr.ss_family == AF_INET) {
+        *ip = ((struct sockaddr_in*)&addr)->sin_addr.s_addr;
+        return ESP_OK;
+    }
+#if CONFIG_LWIP_IPV6
+    /* The HTTP server listens on a dual-stack socket, which reports IPv4
+     * peers as IPv4-mapped IPv6 addresses. */
+    static const uint8_t V4MAPPED_PREFIX[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+    const uint8_t* addr6 = ((struct sockaddr_in6*)&addr)->sin6_addr.s6_addr;
+    if ((addr.ss_family == AF_INET6) &&
+        (memcmp(addr6, V4MAPPED_PREFIX, sizeof(V4MAPPED_PREFIX)) == 0)) {
+        memcpy(ip, &addr6[12], sizeof(*ip));
+        return ESP_OK;
+    }
+#endif
+    return ESP_ERR_NOT_SUPPORTED;
+}
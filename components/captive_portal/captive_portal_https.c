@@ -0,0 +1,117 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Fail-fast responder for HTTPS. While the portal is up, every name resolves to the soft AP, so a
+client that tries an https:// URL first connects to port 443 here. A tcp_pcb listening on that
+port aborts each connection as soon as lwIP has accepted it, which sends a RST. The client fails
+on its first attempt and moves on to plain HTTP, where the portal answers.
+*/
+
+#include "captive_portal_priv.h"
+
+#include <esp_log.h>
+
+#include "lwip/err.h"
+#include "lwip/priv/tcpip_priv.h"
+#include "lwip/tcp.h"
+
+#define HTTPS_PORT (443)
+
+static const char* TAG = "captive-portal";
+
+static struct tcp_pcb* _listen_pcb = NULL;
+
+typedef struct {
+    struct tcpip_api_call_data call;
+    struct netif* netif;
+} https_api_call_t;
+
+// Called by lwIP in the TCP/IP thread once the handshake of a new connection is complete.
+static err_t https_accept(void* arg, struct tcp_pcb* newpcb, err_t err)
+{
+    if ((err != ERR_OK) || (newpcb == NULL)) {
+        return ERR_VAL;
+    }
+
+    ESP_LOGD(TAG, "Resetting HTTPS connection");
+
+    // Frees newpcb and sends a RST. lwIP requires ERR_ABRT in return.
+    tcp_abort(newpcb);
+    return ERR_ABRT;
+}
+
+static err_t https_start_in_tcpip(struct tcpip_api_call_data* call)
+{
+    https_api_call_t* msg = (https_api_call_t*)call;
+    struct tcp_pcb* pcb;
+    err_t err;
+
+    pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (pcb == NULL) {
+        return ERR_MEM;
+    }
+
+    // Leave connections to port 443 on other interfaces alone
+    tcp_bind_netif(pcb, msg->netif);
+
+    err = tcp_bind(pcb, IP_ANY_TYPE, HTTPS_PORT);
+    if (err != ERR_OK) {
+        tcp_close(pcb);
+        return err;
+    }
+
+    // On success, pcb is freed and replaced by the smaller listening pcb
+    _listen_pcb = tcp_listen(pcb);
+    if (_listen_pcb == NULL) {
+        tcp_close(pcb);
+        return ERR_MEM;
+    }
+
+    tcp_accept(_listen_pcb, https_accept);
+    return ERR_OK;
+}
+
+static err_t https_stop_in_tcpip(struct tcpip_api_call_data* call)
+{
+    if (_listen_pcb) {
+        tcp_close(_listen_pcb);
+        _listen_pcb = NULL;
+    }
+    return ERR_OK;
+}
+
+esp_err_t captive_portal_https_start(esp_netif_t* softap_netif_handle)
+{
+    https_api_call_t msg = {.netif = esp_netif_get_netif_impl(softap_netif_handle)};
+
+    if (msg.netif == NULL) {
+        ESP_LOGE(TAG, "No lwIP netif for softAP interface.");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // pcb functions must only be called from the TCP/IP thread.
+    if (tcpip_api_call(https_start_in_tcpip, &msg.call) != ERR_OK) {
+        ESP_LOGE(TAG, "Failed to listen on port %d.", HTTPS_PORT);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void captive_portal_https_stop(void)
+{
+    https_api_call_t msg = {.netif = NULL};
+
+    tcpip_api_call(https_stop_in_tcpip, &msg.call);
+}
@@ -0,0 +1,74 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CAPTIVE_PORTAL_PRIV_H_
+#define CAPTIVE_PORTAL_PRIV_H_
+
+#include <esp_err.h>
+#include <esp_netif.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+/**
+ * @brief   Starts tracking the stations of the soft AP.
+ *
+ * Stations that are already associated are added with the captive state.
+ *
+ * @return
+ *  - ESP_OK : Success
+ *  - Error from esp_event_handler_register() otherwise
+ */
+esp_err_t captive_portal_clients_start(void);
+
+/**
+ * @brief   Stops tracking the stations of the soft AP.
+ */
+void captive_portal_clients_stop(void);
+
+/**
+ * @brief   Gets the IPv4 address of the peer of a connected socket.
+ *
+ * @param[in]  sockfd Connected socket
+ * @param[out] ip     Address in network byte order
+ *
+ * @return
+ *  - ESP_OK                : Success
+ *  - ESP_ERR_NOT_SUPPORTED : The peer has an IPv6 address
+ *  - ESP_FAIL              : The socket is not connected
+ */
+esp_err_t captive_portal_sockfd_to_ip(int sockfd, uint32_t* ip);
+
+#if CONFIG_CAPTIVE_PORTAL_HTTPS_RESET
+
+/**
+ * @brief   Starts resetting HTTPS connections to the soft AP.
+ *
+ * @param[in] softap_netif_handle Interface on which to listen on port 443
+ *
+ * @return
+ *  - ESP_OK              : Success
+ *  - ESP_ERR_INVALID_ARG : The interface has no lwIP netif
+ *  - ESP_FAIL            : Port 443 could not be opened, e.g. because it is in use
+ */
+esp_err_t captive_portal_https_start(esp_netif_t* softap_netif_handle);
+
+/**
+ * @brief   Stops resetting HTTPS connections and frees port 443.
+ */
+void captive_portal_https_stop(void);
+
+#endif
+
+#endif /* CAPTIVE_PORTAL_PRIV_H_ */
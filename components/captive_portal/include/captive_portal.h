@@ -17,8 +17,29 @@
 
 #include <esp_http_server.h>
 #include <esp_netif.h>
+#include <stdbool.h>
 
-typedef esp_err_t (*uri_handler_func_t)(httpd_req_t* req);
+#include "capt_dns_policy.h"
+#include "uri_router.h"
+
+/* Path of the Captive Portal API (RFC 8908) endpoint. The DHCP server of
+ * ESP-IDF 4.2 cannot send option 114 (RFC 8910), so the URL is not
+ * advertised and clients only use the API if configured with it. */
+#define CAPTIVE_PORTAL_API_URI "/captive-portal/api"
+
+/**
+ * @brief   Captive state of a client of the soft AP.
+ */
+typedef enum
+{
+    CAPTIVE_PORTAL_CLIENT_CAPTIVE,       /*!< Redirected to the portal. Also the state of
+                                              clients that are not tracked. */
+    CAPTIVE_PORTAL_CLIENT_PORTAL_LOADED, /*!< Has requested a page of the portal, still
+                                              redirected */
+    CAPTIVE_PORTAL_CLIENT_RELEASED,      /*!< Done with the portal. Gets no redirects and is
+                                              exempt from captive DNS answers (see
+                                              capt_dns_client_filter_t). */
+} captive_portal_client_state_t;
 
 typedef struct captive_portal_config {
     /**
@@ -37,11 +58,12 @@ typedef struct captive_portal_config {
     esp_netif_t* netif_handle;
 
     /**
-     * HTTP server on which to operate the captive portal. Captive portal will
-     * take over GET requests on this server. The server must already be
-     * started and running.
+     * Router of the HTTP server on which to operate the captive portal.
+     * While the portal is active, its routes sit on top of the application's:
+     * requests under redirect_uri are passed on to the application's routes,
+     * all others are redirected.
      */
-    httpd_handle_t* httpd_handle;
+    uri_router_handle_t router;
 
     /**
      * The subdirectory to which redirects should point. This is the subdirectory
@@ -53,24 +75,18 @@ typedef struct captive_portal_config {
     const char* redirect_uri;
 
     /**
-     * The application's common GET handler function.
-     *
-     * esp_http_server lacks a mechanism to get an already registered URI handler.
-     * However, it needs to take over the common GET handler and forward requests
-     * only when the match the redirect URI.
-     *
-     * This parameter is used:
-     *   - When forwarding HTTP requests that match the URI redirect string.
-     *   - When captive portal is stopped, it reregisters this handler with the
-     *     HTTP server.
+     * Host name policies for the captive DNS server (optional). NULL selects
+     * a built-in table that answers the connectivity probes of common OSes
+     * with the portal's address and the DNS-over-HTTPS and iCloud Private
+     * Relay canary domains with NXDOMAIN. The table must stay valid until
+     * the portal is stopped.
      */
-    uri_handler_func_t app_get_handler;
+    const capt_dns_policy_t* dns_policies;
 
     /**
-     * Context pointer to forward to application's common get handler.
-     * This comes through the user_ctx field of the httpd_req_t object.
+     * Number of entries in dns_policies.
      */
-    void* app_get_ctx;
+    size_t num_dns_policies;
 } captive_portal_config_t;
 
 /**
@@ -79,7 +95,7 @@ typedef struct captive_portal_config {
  *
  * @note Uses capt_dns module to set up captive DNS server.
  *
- * @note Takes over common GET handler of http server while portal is active.
+ * @note Takes over GET requests of the router while portal is active.
  *
  * @param[in] config Configuration of the captive portal
  *
@@ -95,4 +111,50 @@ esp_err_t captive_portal_start(captive_portal_config_t* p_config);
  */
 void captive_portal_stop(void);
 
+/**
+ * @brief   Sets whether the Captive Portal API reports clients as captive.
+ *
+ * The API reports "captive": true from captive_portal_start() on. Call this
+ * with false once the user is done with the portal (e.g. provisioning has
+ * completed), so that clients polling the API release their captive state
+ * before the portal is stopped. Redirects are not affected.
+ *
+ * @param[in] captive Value to report
+ */
+void captive_portal_set_captive(bool captive);
+
+/**
+ * @brief   Gets the captive state of a client.
+ *
+ * @param[in] ip IPv4 address of the client in network byte order
+ *
+ * @return State of the client, CAPTIVE_PORTAL_CLIENT_CAPTIVE if it is unknown
+ */
+captive_portal_client_state_t captive_portal_get_client_state(uint32_t ip);
+
+/**
+ * @brief   Sets the captive state of a client.
+ *
+ * @param[in] ip    IPv4 address of the client in network byte order
+ * @param[in] state New state
+ *
+ * @return
+ *  - ESP_OK            : Success
+ *  - ESP_ERR_NOT_FOUND : No station of the soft AP has this address
+ */
+esp_err_t captive_portal_set_client_state(uint32_t ip, captive_portal_client_state_t state);
+
+/**
+ * @brief   Releases the client at the other end of an HTTP session from the
+ *          captive portal, while the portal stays up for everyone else.
+ *
+ * @param[in] sockfd Socket of the session, e.g. from httpd_req_to_sockfd()
+ *
+ * @return
+ *  - ESP_OK            : Success
+ *  - ESP_ERR_NOT_FOUND : The client is not a tracked station of the soft AP
+ *  - ESP_FAIL          : The socket has no IPv4 peer
+ */
+esp_err_t captive_portal_release_client(int sockfd);
+
 #endif /* CAPTIVE_PORTAL_H_ */
@@ -0,0 +1,336 @@
+#!/usr/bin/env python
+#
+# Copyright 2021 Aaron Fontaine
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Checks the captive portal of a device from a client of its soft AP.
+
+probes    Replays the connectivity probe requests of common OSes, byte for byte as they send
+          them, and checks that each gets the response that makes that OS show the portal.
+          Exits with 1 if any does not.
+
+pageload  Loads the portal the way a browser does after being redirected: follows the redirects
+          from the start URL, fetches the portal page and then each asset it references, one
+          request at a time. Prints the total time and the number of TCP connections it took.
+          --no-keep-alive asks the device to close each connection, for a comparison on the
+          same build.
+
+Run it from a computer connected to the soft AP while the portal is active:
+
+    python portal_check.py probes 192.168.4.1
+    python portal_check.py pageload 192.168.4.1 --runs 10
+    python portal_check.py pageload 192.168.4.1 --runs 10 --no-keep-alive
+"""
+
+import argparse
+import http.client
+import re
+import socket
+import sys
+import time
+from urllib.parse import urljoin, urlparse
+
+# Seconds to wait for the server to close the connection after a response
+CLOSE_TIMEOUT = 1.0
+
+REDIRECT = 'redirect'
+REFRESH = 'refresh'
+
+MAX_REDIRECTS = 5
+
+# Resources a page loads on its own: scripts, images, stylesheets and icons
+ASSET_RE = re.compile(r'<(?:script|img|link)\b[^>]*?\b(?:src|href)\s*=\s*["\']([^"\']+)["\']',
+                      re.IGNORECASE)
+
+# (OS, request, expected response). The requests are as captured from each OS; the Host header
+# names the probe server, which the captive DNS server resolves to the device.
+PROBES = [
+    ('Android', REDIRECT,
+     b'GET /generate_204 HTTP/1.1\r\n'
+     b'User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) '
+     b'Chrome/60.0.3112.32 Safari/537.36\r\n'
+     b'Host: connectivitycheck.gstatic.com\r\n'
+     b'Connection: Keep-Alive\r\n'
+     b'Accept-Encoding: gzip\r\n'
+     b'\r\n'),
+    ('Android (fallback)', REDIRECT,
+     b'GET /gen_204 HTTP/1.1\r\n'
+     b'User-Agent: Dalvik/2.1.0 (Linux; U; Android 11; Pixel 4a Build/RQ3A.210605.005)\r\n'
+     b'Host: www.google.com\r\n'
+     b'Connection: Keep-Alive\r\n'
+     b'Accept-Encoding: gzip\r\n'
+     b'\r\n'),
+    ('ChromeOS', REDIRECT,
+     b'GET /generate_204 HTTP/1.1\r\n'
+     b'Host: clients3.google.com\r\n'
+     b'Connection: keep-alive\r\n'
+     b'Pragma: no-cache\r\n'
+     b'Cache-Control: no-cache\r\n'
+     b'\r\n'),
+    ('iOS, macOS', REFRESH,
+     b'GET /hotspot-detect.html HTTP/1.0\r\n'
+     b'Host: captive.apple.com\r\n'
+     b'Connection: close\r\n'
+     b'User-Agent: CaptiveNetworkSupport-407.0.1 wispr\r\n'
+     b'\r\n'),
+    ('Older iOS', REFRESH,
+     b'GET /library/test/success.html HTTP/1.0\r\n'
+     b'Host: www.apple.com\r\n'
+     b'User-Agent: CaptiveNetworkSupport-209.39 wispr\r\n'
+     b'Connection: close\r\n'
+     b'\r\n'),
+    ('Windows 10', REDIRECT,
+     b'GET /connecttest.txt HTTP/1.1\r\n'
+     b'Connection: Close\r\n'
+     b'User-Agent: Microsoft NCSI\r\n'
+     b'Host: www.msftconnecttest.com\r\n'
+     b'\r\n'),
+    ('Windows 7', REDIRECT,
+     b'GET /ncsi.txt HTTP/1.1\r\n'
+     b'Connection: Close\r\n'
+     b'User-Agent: Microsoft NCSI\r\n'
+     b'Host: www.msftncsi.com\r\n'
+     b'\r\n'),
+    ('Firefox', REDIRECT,
+     b'GET /success.txt?ipv4 HTTP/1.1\r\n'
+     b'Host: detectportal.firefox.com\r\n'
+     b'User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:91.0) Gecko/20100101 Firefox/91.0\r\n'
+     b'Accept: */*\r\n'
+     b'Accept-Language: en-US,en;q=0.5\r\n'
+     b'Accept-Encoding: gzip, deflate\r\n'
+     b'Cache-Control: no-cache\r\n'
+     b'Pragma: no-cache\r\n'
+     b'Connection: keep-alive\r\n'
+     b'\r\n'),
+    ('Firefox (canonical)', REDIRECT,
+     b'GET /canonical.html HTTP/1.1\r\n'
+     b'Host: detectportal.firefox.com\r\n'
+     b'User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:91.0) Gecko/20100101 Firefox/91.0\r\n'
+     b'Accept: */*\r\n'
+     b'Cache-Control: no-cache\r\n'
+     b'Pragma: no-cache\r\n'
+     b'Connection: keep-alive\r\n'
+     b'\r\n'),
+    ('GNOME', REDIRECT,
+     b'GET /check_network_status.txt HTTP/1.1\r\n'
+     b'Host: nmcheck.gnome.org\r\n'
+     b'Accept: */*\r\n'
+     b'Connection: close\r\n'
+     b'User-Agent: NetworkManager/1.30.0\r\n'
+     b'\r\n'),
+]
+
+
+def fetch_raw(server, port, request, timeout):
+    """Sends a raw request on a new connection.
+
+    Returns the response, its body, the time to the end of the body in seconds, and whether the
+    server closed the connection after the response.
+    """
+    sock = socket.create_connection((server, port), timeout)
+    try:
+        start = time.perf_counter()
+        sock.sendall(request)
+        response = http.client.HTTPResponse(sock)
+        response.begin()
+        body = response.read()
+        elapsed = time.perf_counter() - start
+        sock.settimeout(CLOSE_TIMEOUT)
+        try:
+            is_closed = (sock.recv(1) == b'')
+        except socket.timeout:
+            is_closed = False
+    finally:
+        sock.close()
+    return response, body, elapsed, is_closed
+
+
+def check_probe(expected, portal_url, response, body, is_closed):
+    """Returns the ways in which a probe response differs from what the OS needs."""
+    problems = []
+    if expected == REDIRECT:
+        if response.status not in (302, 307):
+            problems.append('status %d, expected a redirect' % response.status)
+        if response.getheader('Location') != portal_url:
+            problems.append('Location %r, expected %r' %
+                            (response.getheader('Location'), portal_url))
+        if body:
+            problems.append('%d bytes of body, expected none' % len(body))
+    else:
+        if response.status != 200:
+            problems.append('status %d, expected 200' % response.status)
+        if not (response.getheader('Content-Type') or '').startswith('text/html'):
+            problems.append('Content-Type %r, expected text/html' %
+                            response.getheader('Content-Type'))
+        # The Success page would tell the OS that there is no portal
+        if b'Success' in body:
+            problems.append('body is the Success page')
+        if ('url=%s' % portal_url).encode('ascii') not in body:
+            problems.append('body does not refresh to %s' % portal_url)
+    if response.getheader('Content-Length') != str(len(body)):
+        problems.append('Content-Length %r, body has %d bytes' %
+                        (response.getheader('Content-Length'), len(body)))
+    if 'no-store' not in (response.getheader('Cache-Control') or ''):
+        problems.append('response may be cached')
+    if (response.getheader('Connection') or '').lower() != 'close':
+        problems.append('no "Connection: close"')
+    elif not is_closed:
+        problems.append('connection left open')
+    return problems
+
+
+def run_probes(args):
+    portal_url = 'http://%s%s' % (args.server, args.portal_path)
+    failures = 0
+
+    for os_name, expected, request in PROBES:
+        path = request.split(b' ')[1].decode('ascii')
+        try:
+            response, body, elapsed, is_closed = fetch_raw(args.server, args.port, request,
+                                                           args.timeout)
+            problems = check_probe(expected, portal_url, response, body, is_closed)
+            status = '%d' % response.status
+        except (OSError, http.client.HTTPException) as e:
+            problems = [str(e)]
+            status = '---'
+            elapsed = float('nan')
+        failures += 1 if problems else 0
+        print('%-4s %-20s %-28s %s %6.1f ms  %s' %
+              ('FAIL' if problems else 'ok', os_name, path, status, 1000.0 * elapsed,
+               '; '.join(problems)))
+
+    print('%d of %d probes answered as expected' % (len(PROBES) - failures, len(PROBES)))
+    return 1 if failures else 0
+
+
+class CountingConnection(http.client.HTTPConnection):
+    """Connection that counts the TCP connections it opens. Like a browser, it opens a new one
+    for the next request whenever the server closed the last."""
+
+    def __init__(self, *args, **kwargs):
+        http.client.HTTPConnection.__init__(self, *args, **kwargs)
+        self.connects = 0
+
+    def connect(self):
+        http.client.HTTPConnection.connect(self)
+        self.connects += 1
+
+
+def load_page(conn, server, url, keep_alive):
+    """Loads url and the assets of the page it leads to.
+
+    All requests go to the device, whatever host the URLs name, as they would with the captive
+    DNS server. Returns the number of requests and of body bytes. Raises RuntimeError if a
+    request other than a redirect fails.
+    """
+    requests = 0
+    body_bytes = 0
+
+    def get(url):
+        parsed = urlparse(url)
+        headers = {'Host': parsed.netloc or server, 'Accept': '*/*'}
+        if not keep_alive:
+            headers['Connection'] = 'close'
+        path = (parsed.path or '/') + ('?' + parsed.query if parsed.query else '')
+        conn.request('GET', path, headers=headers)
+        response = conn.getresponse()
+        return response, response.read()
+
+    for _ in range(MAX_REDIRECTS + 1):
+        response, body = get(url)
+        requests += 1
+        body_bytes += len(body)
+        if response.status not in (301, 302, 303, 307, 308):
+            break
+        url = urljoin(url, response.getheader('Location'))
+    if response.status != 200:
+        raise RuntimeError('%s: status %d' % (url, response.status))
+
+    for asset in ASSET_RE.findall(body.decode('utf-8', 'replace')):
+        asset_url = urljoin(url, asset)
+        if urlparse(asset_url).scheme != 'http':
+            continue
+        response, asset_body = get(asset_url)
+        requests += 1
+        body_bytes += len(asset_body)
+        if response.status != 200:
+            raise RuntimeError('%s: status %d' % (asset_url, response.status))
+    return requests, body_bytes
+
+
+def run_pageload(args):
+    start_url = 'http://%s%s' % (args.start_host or args.server, args.start_path)
+    totals = []
+
+    print('Loading %s %s keep-alive' % (start_url, 'with' if args.keep_alive else 'without'))
+    for run in range(args.runs):
+        conn = CountingConnection(args.server, args.port, timeout=args.timeout)
+        start = time.perf_counter()
+        try:
+            requests, body_bytes = load_page(conn, args.server, start_url, args.keep_alive)
+        except (OSError, http.client.HTTPException, RuntimeError) as e:
+            print('run %d failed: %s' % (run + 1, e))
+            return 1
+        finally:
+            conn.close()
+        elapsed = time.perf_counter() - start
+        totals.append(elapsed)
+        print('run %d: %7.1f ms, %d requests, %d connections, %d body bytes' %
+              (run + 1, 1000.0 * elapsed, requests, conn.connects, body_bytes))
+        time.sleep(args.interval)
+
+    totals.sort()
+    print('page load ms: min %.1f  median %.1f  max %.1f' %
+          (1000.0 * totals[0], 1000.0 * totals[len(totals) // 2], 1000.0 * totals[-1]))
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    subparsers = parser.add_subparsers(dest='command')
+    subparsers.required = True
+
+    probes = subparsers.add_parser('probes', help='replay OS connectivity probes')
+    probes.set_defaults(func=run_probes)
+
+    pageload = subparsers.add_parser('pageload', help='time loading the portal page')
+    pageload.add_argument('--start-path', default='/',
+                          help='path of the first request (default: %(default)s)')
+    pageload.add_argument('--start-host',
+                          help='Host header of the first request, e.g. a name the captive DNS '
+                               'server resolved to the device (default: the device address)')
+    pageload.add_argument('--no-keep-alive', dest='keep_alive', action='store_false',
+                          help='send "Connection: close" with every request')
+    pageload.add_argument('--runs', type=int, default=5, help='page loads to time')
+    pageload.add_argument('--interval', type=float, default=0.5,
+                          help='seconds to pause between page loads')
+    pageload.set_defaults(func=run_pageload)
+
+    for subparser in subparsers.choices.values():
+        subparser.add_argument('server', nargs='?', default='192.168.4.1',
+                               help='address of the soft AP (default: %(default)s)')
+        subparser.add_argument('--port', type=int, default=80,
+                               help='HTTP port (default: %(default)s)')
+        subparser.add_argument('--portal-path', default='/prov',
+                               help='redirect_uri of the portal (default: %(default)s)')
+        subparser.add_argument('--timeout', type=float, default=5.0,
+                               help='seconds to wait for the device')
+
+    args = parser.parse_args()
+    return args.func(args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -19,6 +19,7 @@
 
 #include <esp_http_server.h>
 #include <esp_netif.h>
+#include <uri_router.h>
 #include <wifi_provisioning/manager.h>
 #include <wifi_provisioning/scheme_softap.h>
 
@@ -61,14 +62,10 @@ typedef struct {
     esp_netif_t* netif_handle;
 
     /**
-     * Application's common GET handler
+     * Router for GET requests of the HTTP server given below. Provisioning
+     * webpages must be served by its existing routes.
      */
-    esp_err_t (*app_get_handler)(httpd_req_t* req);
-
-    /**
-     * Private context structure to forward to app's GET handler
-     */
-    void* app_get_ctx;
+    uri_router_handle_t router;
 } captive_portal_settings_t;
 
 /**
@@ -77,9 +74,9 @@ typedef struct {
 typedef struct {
     /**
      * HTTP server on which to set up the protocomm provisioning endpoints.
-     * Webserver must already be running on this handle with common GET
-     * handler for all URI requests under "/". Provisioning webpages must
-     * be mounted under "/prov".
+     * Webserver must already be running on this handle with a router that
+     * serves all GET requests under "/". Provisioning webpages must be
+     * mounted under "/prov".
      */
     httpd_handle_t* httpd_handle;
 
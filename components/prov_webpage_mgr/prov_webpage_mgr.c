@@ -16,6 +16,9 @@
 
 #include <cJSON.h>
 #include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
 
 #include <esp_err.h>
 #include <esp_event.h>
@@ -23,7 +26,9 @@
 #include <esp_timer.h>
 #include <esp_vfs.h>
 
+#include "capt_dns.h"
 #include "captive_portal.h"
+#include "sdkconfig.h"
 
 /* Is there a constant available for this in the esp/lwip headers somewhere? */
 #define PROV_WEBPAGE_URI_MAX (64)
@@ -55,6 +60,12 @@ static const char* CUSTOM_PROV_ENDPOINT = "prov-custom";
 
 static char _homepage_uri[PROV_WEBPAGE_URI_MAX];
 
+#if CONFIG_CAPT_DNS_SPLIT_HORIZON
+/* Soft AP interface the captive portal ran on. DNS stays up on it in
+ * split-horizon mode during shutdown stage 1. */
+static esp_netif_t* _softap_netif = NULL;
+#endif
+
 /* Mutex to lock/unlock access to provisioning singleton
  * context data. This is allocated only once on first init
  * and never deleted as prov_webpage_mgr is a singleton */
@@ -135,6 +146,52 @@ static void reset_wifi_prov_service(void* arg)
     wifi_prov_mgr_reset_to_ready_state();
 }
 
+#if CONFIG_CAPT_DNS_SPLIT_HORIZON
+/* Restarts the DNS server in split-horizon mode. The host name of the
+ * homepage URI, e.g. "my-device.local" in "http://my-device.local/", and its
+ * alias with or without the ".local" suffix resolve to the device. All other
+ * names are forwarded upstream now that the station is connected.
+ */
+static void start_handoff_dns(void)
+{
+    static const char LOCAL_SUFFIX[] = ".local";
+    char host[PROV_WEBPAGE_URI_MAX];
+    char alias[PROV_WEBPAGE_URI_MAX];
+    const char* hosts[] = {host, alias};
+
+    if (!_softap_netif) {
+        return;
+    }
+
+    const char* start = strstr(_homepage_uri, "://");
+    start = start ? (start + 3) : _homepage_uri;
+    size_t len = strcspn(start, ":/");
+    if ((len == 0) || (len >= sizeof(host))) {
+        ESP_LOGW(TAG, "No host name in homepage URI. DNS not restarted for the handoff.");
+        return;
+    }
+    memcpy(host, start, len);
+    host[len] = '\0';
+
+    size_t suffix_len = sizeof(LOCAL_SUFFIX) - 1;
+    if ((len > suffix_len) && (strcasecmp(&host[len - suffix_len], LOCAL_SUFFIX) == 0)) {
+        strlcpy(alias, host, len - suffix_len + 1);
+    } else {
+        snprintf(alias, sizeof(alias), "%s%s", host, LOCAL_SUFFIX);
+    }
+
+    capt_dns_config_t dns_config = {
+        .netif_handle = _softap_netif,
+        .mode = CAPT_DNS_MODE_SPLIT_HORIZON,
+        .local_hosts = hosts,
+        .num_local_hosts = 2,
+    };
+    if (capt_dns_start(&dns_config) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to start split-horizon DNS for the handoff.");
+    }
+}
+#endif
+
 static void shutdown_wifi_prov_service_stage1(void* arg)
 {
     ESP_LOGI(TAG, "Webprov shutdown stage 1: captive portal only.");
@@ -143,6 +200,11 @@ static void shutdown_wifi_prov_service_stage1(void* arg)
     // (Does nothing if not started)
     captive_portal_stop();
 
+#if CONFIG_CAPT_DNS_SPLIT_HORIZON
+    // Keep name resolution working on the soft AP until stage 2
+    start_handoff_dns();
+#endif
+
     // Wait HANDOFF_DELAY more seconds before shutting down wifi provisioning
     // and soft AP completely.
     esp_timer_start_once(_wifi_prov_shutdown_stage2_timer, HANDOFF_DELAY_S * 1000U * 1000U);
@@ -195,6 +257,12 @@ esp_err_t custom_prov_extensions_handler(uint32_t session_id, const uint8_t* inb
             status_str = "command failed";
         }
     } else if (strcmp(cmd_str, "shutdown prov") == 0) {
+        /* Provisioning is done. Let the client that did it go at once (the
+         * session ID is the socket of the HTTP session). Clients polling the
+         * Captive Portal API can leave their captive state right away, too. */
+        captive_portal_release_client(session_id);
+        captive_portal_set_captive(false);
+
         /* This timer provides a slight delay before stopping captive portal. */
         if (esp_timer_start_once(_wifi_prov_shutdown_stage1_timer, 100 * 1000U) == ESP_OK) {
             status_str = "ok";
@@ -316,12 +384,13 @@ esp_err_t prov_webpage_mgr_start(const prov_webpage_mgr_config_t* p_config)
     if (p_config->enable_captive_portal) {
         captive_portal_config_t cp_config = {
             .netif_handle = p_config->captive_portal_setup.netif_handle,
-            .httpd_handle = p_config->httpd_handle,
-            .redirect_uri = WEBPROV_URI_PATH,
-            .app_get_handler = p_config->captive_portal_setup.app_get_handler,
-            .app_get_ctx = p_config->captive_portal_setup.app_get_ctx};
+            .router = p_config->captive_portal_setup.router,
+            .redirect_uri = WEBPROV_URI_PATH};
         WEBPROV_CHECK(captive_portal_start(&cp_config) == ESP_OK,
                       "Failed to start DNS server for the captive portal", err2);
+#if CONFIG_CAPT_DNS_SPLIT_HORIZON
+        _softap_netif = p_config->captive_portal_setup.netif_handle;
+#endif
     }
 
     WEBPROV_CHECK(create_timers() == ESP_OK, "", err2);
@@ -346,6 +415,12 @@ void prov_webpage_mgr_stop(void)
      */
     captive_portal_stop();
 
+#if CONFIG_CAPT_DNS_SPLIT_HORIZON
+    /* Stop the DNS server left running for the handoff, if any */
+    capt_dns_stop();
+    _softap_netif = NULL;
+#endif
+
     /* Unregister our own endpoint as part of cleanup. This is necessary
      * since otherwise the URI handler sticks around in our HTTP server.
      */
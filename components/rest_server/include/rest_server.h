@@ -15,11 +15,12 @@
 
 #include <esp_http_server.h>
 
-typedef esp_err_t (*uri_handler_func_t)(httpd_req_t* req);
+#include "asset_bundle.h"
+#include "uri_router.h"
 
 /**
- * @brief   Creates an HTTP server instance and registers a common GET
- *          handler to serve web files.
+ * @brief   Creates an HTTP server instance and a URI router that serves
+ *          web files for GET requests.
  *
  * Matches incoming URI requests to the filesystem starting at the mount
  * point specified by base_path. If URI specifies directory instead of
@@ -38,6 +39,21 @@ typedef esp_err_t (*uri_handler_func_t)(httpd_req_t* req);
  */
 esp_err_t rest_server_start(const char* base_path);
 
+/**
+ * @brief   Serves web files from a mapped asset image instead of the
+ *          file system.
+ *
+ * Files are sent straight from the mapping, without reading them into a
+ * buffer. They are looked up by request path, e.g. "/prov/index.html", and
+ * the image supplies their content type, encoding and ETag. base_path of
+ * rest_server_start() is not used for lookups then. Call before
+ * rest_server_start().
+ *
+ * @param[in] bundle Mapped image. Must stay mapped while the server runs.
+ *   NULL serves from the file system again.
+ */
+void rest_server_set_bundle(const asset_bundle_t* bundle);
+
 /**
  * @brief   Stops and removes the HTTP server instance created by
  *          rest_server_start().
@@ -65,25 +81,15 @@ void rest_server_stop(void);
 httpd_handle_t* rest_server_get_httpd_handle(void);
 
 /**
- * @brief   Helper function to return a function pointer for the
- *          RESTful server's common GET handler.
- *
- * @note This helper function is needed for setting up captive portal.
- *
- * @return
- *  - Pointer to common GET function.
- */
-uri_handler_func_t rest_server_get_common_get_handler(void);
-
-/**
- * @brief   Helper function to return the opaque context structure
- *          reference that is registered with the common GET URI handler.
+ * @brief   Gets the router for GET requests of the HTTP server.
  *
- * @note This helper function is needed for setting up captive portal.
+ * Web files are served by the router's bottom route table. Components that
+ * take over some paths (e.g. captive portal) add their routes on top.
  *
  * @return
- *  - Context reference
+ *  - Router handle if started.
+ *  - NULL if not started.
  */
-void* rest_server_get_common_get_ctx(void);
+uri_router_handle_t rest_server_get_router(void);
 
 #endif /* REST_SERVER_H_ */
@@ -11,9 +11,13 @@
  */
 #include <fcntl.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "rest_server.h"
+#include "rest_server_priv.h"
 
 #include "esp_err.h"
 #include "esp_log.h"
@@ -37,94 +41,197 @@ typedef struct rest_server_context {
     char scratch[SCRATCH_BUFSIZE];
 } rest_server_context_t;
 
-#define CHECK_FILE_EXTENSION(filename, ext) \
-    (strcasecmp(&filename[strlen(filename) - strlen(ext)], ext) == 0)
-
 /* Save the server handle here */
 static rest_server_context_t* _rest_context = NULL;
 static httpd_handle_t _server_handle = NULL;
+static uri_router_handle_t _router = NULL;
+static const asset_bundle_t* _bundle = NULL;
 
-typedef struct file_ext_to_mimetype {
-    char* file_ext;
-    char* mimetype;
-    bool is_zipped;
-} file_ext_to_mimetype_t;
-
-file_ext_to_mimetype_t file_ext_mappings[] = {
-    {".html", "text/html", true}, {".js", "application/javascript", true},
-    {".css", "text/css", true},   {".proto", "text/plain", true},
-    {".png", "image/png", false}, {".ico", "image/x-icon", false},
-    {".svg", "text/xml", true},   {".txt", "text/plain", true},
+static const uri_router_ext_t file_ext_mappings[] = {
+#define REST_MIME_TYPE(ext, type, is_zipped) {ext, type, is_zipped},
+#include "rest_server_mime_types.h"
+#undef REST_MIME_TYPE
 };
 
-#define NUM_FILE_TYPES (sizeof(file_ext_mappings) / sizeof(struct file_ext_to_mimetype))
+#define NUM_FILE_TYPES (sizeof(file_ext_mappings) / sizeof(file_ext_mappings[0]))
+
+/* The index page is looked up for directories */
+static const uri_router_ext_t* const INDEX_FILE_TYPE = &file_ext_mappings[0];
 
-/* Set HTTP response content type according to file extension */
-static esp_err_t set_content_type_from_file(httpd_req_t* req, char* filepath,
-                                            size_t filepath_max_len)
+/* Headers of a file response. The strings live on until the response is sent. */
+typedef struct {
+    const char* type;
+    const char* encoding;
+    const char* etag;
+    const char* cache_control;
+} file_headers_t;
+
+/* Get HTTP response content type according to file extension */
+static void get_content_type_from_file(file_headers_t* hdrs, const uri_router_ext_t* file_type,
+                                       char* filepath, size_t filepath_max_len)
 {
-    const char* type = "text/plain";
-#if CONFIG_EXAMPLE_MINIFY_AND_GZIP_WEBPAGES
-    bool is_zipped = false;
-#endif
+    hdrs->type = REST_DEFAULT_MIME_TYPE;
 
-    int idx;
-    for (idx = 0; idx < NUM_FILE_TYPES; idx++) {
-        if (CHECK_FILE_EXTENSION(filepath, file_ext_mappings[idx].file_ext)) {
-            type = file_ext_mappings[idx].mimetype;
+    if (file_type) {
+        hdrs->type = file_type->mimetype;
 #if CONFIG_EXAMPLE_MINIFY_AND_GZIP_WEBPAGES
-            is_zipped = file_ext_mappings[idx].is_zipped;
-#endif
-            break;
+        if (file_type->is_zipped) {
+            strlcat(filepath, ".gz", filepath_max_len);
+            hdrs->encoding = "gzip";
         }
+#endif
     }
+}
 
-#if CONFIG_EXAMPLE_MINIFY_AND_GZIP_WEBPAGES
-    if (is_zipped) {
-        strlcat(filepath, ".gz", filepath_max_len);
-        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+/* Hand the headers to the HTTP server for httpd_resp_send() */
+static void set_file_headers(httpd_req_t* req, const file_headers_t* hdrs)
+{
+    httpd_resp_set_type(req, hdrs->type);
+    if (hdrs->encoding) {
+        httpd_resp_set_hdr(req, "Content-Encoding", hdrs->encoding);
+    }
+    if (hdrs->etag) {
+        httpd_resp_set_hdr(req, "ETag", hdrs->etag);
+        httpd_resp_set_hdr(req, "Cache-Control", hdrs->cache_control);
     }
-#endif
-    return httpd_resp_set_type(req, type);
 }
 
-static bool uri_is_file(httpd_req_t* req)
+/* Cache-Control for names that change with their contents, e.g. "app.3f2a9c1b.js" */
+#define CACHE_CONTROL_HASHED "public, max-age=31536000, immutable"
+/* Cache-Control for everything else. Browsers keep the file but check the ETag first. */
+#define CACHE_CONTROL_DEFAULT "no-cache"
+
+/* Minimum number of hex digits of a content hash in a file name */
+#define NAME_HASH_MIN_DIGITS (8)
+
+/* Whether the file name contains a ".<hex digits>." content hash */
+static bool is_hashed_name(const char* filepath)
 {
-    // Check ending of URI string against all known file extensions.
-    // Return true if match is found. False otherwise.
-    int idx;
-    for (idx = 0; idx < NUM_FILE_TYPES; idx++) {
-        if (CHECK_FILE_EXTENSION(req->uri, file_ext_mappings[idx].file_ext)) {
+    const char* name = strrchr(filepath, '/');
+    const char* dot = strchr(name ? name : filepath, '.');
+
+    while (dot) {
+        const char* next = strchr(dot + 1, '.');
+        size_t digits = strspn(dot + 1, "0123456789abcdefABCDEF");
+        if (next && (digits == (size_t)(next - dot - 1)) && (digits >= NAME_HASH_MIN_DIGITS)) {
             return true;
         }
+        dot = next;
     }
     return false;
 }
 
-/* Send HTTP response with the contents of the requested file */
-static esp_err_t rest_common_get_handler(httpd_req_t* req)
+/* Whether the client's copy, named by If-None-Match, is still current */
+static bool is_not_modified(httpd_req_t* req, const char* etag)
 {
-    char filepath[FILE_PATH_MAX];
+    char if_none_match[128];
 
-    strlcpy(filepath, _rest_context->base_path, sizeof(filepath));
-    strlcat(filepath, req->uri, sizeof(filepath));
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match,
+                                    sizeof(if_none_match)) != ESP_OK) {
+        // Absent, or too long a list to be worth looking through
+        return false;
+    }
+    // A list of quoted tags, each maybe with a "W/" prefix. Comparison for
+    // If-None-Match is weak, so a plain search for the quoted tag is enough.
+    return (strcmp(if_none_match, "*") == 0) || (strstr(if_none_match, etag) != NULL);
+}
 
-    if (req->uri[strlen(req->uri) - 1] == '/') {
-        // URI already ends with "/", indicating a directory.
-        // Thus, we know we need to append "index.html" for file lookup.
-        strlcat(filepath, "index.html", sizeof(filepath));
-    } else {
-        if (!uri_is_file(req)) {
-            // The URI is not a file but also does not end with "/".
-            // Thus, we *assume* it is specifying a directory.
-            strlcat(filepath, "/index.html", sizeof(filepath));
+/* Send all of buf on the connection, however many writes the socket takes */
+static bool send_all(httpd_req_t* req, const char* buf, size_t len)
+{
+    while (len > 0) {
+        int sent = httpd_send(req, buf, len);
+        if (sent <= 0) {
+            return false;
         }
+        buf += sent;
+        len -= sent;
     }
+    return true;
+}
 
-    set_content_type_from_file(req, filepath, sizeof(filepath));
+/* Add the validator and caching headers. Returns true if a 304 was sent instead of the file. */
+static bool send_not_modified(httpd_req_t* req, const char* filepath, file_headers_t* hdrs,
+                              const char* etag)
+{
+    char* buf = _rest_context->scratch;
+    int hdr_len;
 
-    ESP_LOGI(TAG, "Request URI: %s", req->uri);
-    ESP_LOGI(TAG, "Corresponding filepath: %s", filepath);
+    hdrs->etag = etag;
+    hdrs->cache_control = is_hashed_name(filepath) ? CACHE_CONTROL_HASHED : CACHE_CONTROL_DEFAULT;
+
+    if (!is_not_modified(req, etag)) {
+        return false;
+    }
+    ESP_LOGI(TAG, "Not modified: %s", filepath);
+
+    /* A 304 has no body, so it carries none of the body's headers either. httpd_resp_send()
+     * would add Content-Type and Content-Length: 0, so the response is written here directly. */
+    hdr_len = snprintf(buf, SCRATCH_BUFSIZE,
+                       "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nCache-Control: %s\r\n\r\n", etag,
+                       hdrs->cache_control);
+    if (!send_all(req, buf, hdr_len)) {
+        ESP_LOGE(TAG, "Failed to send 304 for %s", filepath);
+    }
+    return true;
+}
+
+/* Read exactly len bytes */
+static bool read_all(int fd, char* buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t read_bytes = read(fd, buf, len);
+        if (read_bytes <= 0) {
+            return false;
+        }
+        buf += read_bytes;
+        len -= read_bytes;
+    }
+    return true;
+}
+
+/* Stream a file too large for one buffer. httpd_resp_send() needs the whole body at once and
+ * httpd_resp_send_chunk() would add chunk framing, so the header is written here directly,
+ * with the Content-Length known from fstat(). */
+static esp_err_t stream_file(httpd_req_t* req, int fd, size_t len, const file_headers_t* hdrs)
+{
+    char* buf = _rest_context->scratch;
+    int hdr_len;
+
+    hdr_len = snprintf(buf, SCRATCH_BUFSIZE, "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n"
+                       "Content-Length: %u\r\n", hdrs->type, (unsigned)len);
+    if (hdrs->encoding) {
+        hdr_len += snprintf(&buf[hdr_len], SCRATCH_BUFSIZE - hdr_len,
+                            "Content-Encoding: %s\r\n", hdrs->encoding);
+    }
+    if (hdrs->etag) {
+        hdr_len += snprintf(&buf[hdr_len], SCRATCH_BUFSIZE - hdr_len,
+                            "ETag: %s\r\nCache-Control: %s\r\n", hdrs->etag,
+                            hdrs->cache_control);
+    }
+    hdr_len += snprintf(&buf[hdr_len], SCRATCH_BUFSIZE - hdr_len, "\r\n");
+
+    if (!send_all(req, buf, hdr_len)) {
+        return ESP_FAIL;
+    }
+    while (len > 0) {
+        size_t part = (len < SCRATCH_BUFSIZE) ? len : SCRATCH_BUFSIZE;
+        // The status line is out, so all that is left on an error is to drop the connection,
+        // which the HTTP server does when the handler fails.
+        if (!read_all(fd, buf, part) || !send_all(req, buf, part)) {
+            return ESP_FAIL;
+        }
+        len -= part;
+    }
+    return ESP_OK;
+}
+
+/* Send a file from the file system with its exact Content-Length */
+static esp_err_t send_file(httpd_req_t* req, const char* filepath, const file_headers_t* hdrs)
+{
+    esp_err_t ret = ESP_FAIL;
+    struct stat st;
+    char* buf = NULL;
 
     int fd = open(filepath, O_RDONLY, 0);
     if (fd == -1) {
@@ -133,35 +240,134 @@ static esp_err_t rest_common_get_handler(httpd_req_t* req)
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read existing file");
         return ESP_FAIL;
     }
+    if (fstat(fd, &st) != 0) {
+        goto err_read;
+    }
 
-    char* chunk = _rest_context->scratch;
-    ssize_t read_bytes;
-    do {
-        /* Read file in chunks into the scratch buffer */
-        read_bytes = read(fd, chunk, SCRATCH_BUFSIZE);
-        if (read_bytes == -1) {
-            ESP_LOGE(TAG, "Failed to read file : %s", filepath);
-        } else if (read_bytes > 0) {
-            /* Send the buffer contents as HTTP response chunk */
-            if (httpd_resp_send_chunk(req, chunk, read_bytes) != ESP_OK) {
-                close(fd);
-                ESP_LOGE(TAG, "File sending failed!");
-                /* Abort sending file */
-                httpd_resp_sendstr_chunk(req, NULL);
-                /* Respond with 500 Internal Server Error */
-                httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to send file");
-                return ESP_FAIL;
-            }
+    /* Whole file in one send if it fits into a buffer */
+    if (st.st_size <= SCRATCH_BUFSIZE) {
+        buf = _rest_context->scratch;
+#if CONFIG_REST_SERVER_LARGE_WRITE
+    } else if (st.st_size <= CONFIG_REST_SERVER_LARGE_WRITE_MAX) {
+        buf = malloc(st.st_size);
+#endif
+    }
+    if (buf == NULL) {
+        ret = stream_file(req, fd, st.st_size, hdrs);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "File sending failed!");
         }
-    } while (read_bytes > 0);
-    /* Close file after sending complete */
+        close(fd);
+        return ret;
+    }
+
+    if (!read_all(fd, buf, st.st_size)) {
+        goto err_read;
+    }
+    set_file_headers(req, hdrs);
+    ret = httpd_resp_send(req, buf, st.st_size);
+    if (buf != _rest_context->scratch) {
+        free(buf);
+    }
     close(fd);
-    ESP_LOGI(TAG, "File sending complete");
-    /* Respond with an empty chunk to signal HTTP response completion */
-    httpd_resp_send_chunk(req, NULL, 0);
-    return ESP_OK;
+    return ret;
+
+err_read:
+    if (buf != _rest_context->scratch) {
+        free(buf);
+    }
+    close(fd);
+    ESP_LOGE(TAG, "Failed to read file : %s", filepath);
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read existing file");
+    return ESP_FAIL;
+}
+
+/* Send a file from the asset image, straight from where the image is mapped. The image's index
+ * has the headers, so neither the file system nor the extension table is needed. */
+static esp_err_t send_bundle_file(httpd_req_t* req, const char* path)
+{
+    file_headers_t hdrs = {0};
+    asset_bundle_file_t file;
+
+    if (!asset_bundle_find(_bundle, path, strlen(path), &file)) {
+        ESP_LOGE(TAG, "Not in asset image : %s", path);
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+
+    hdrs.type = file.mimetype;
+    hdrs.encoding = (file.encoding == ASSET_BUNDLE_ENCODING_GZIP) ? "gzip" : NULL;
+    if (send_not_modified(req, path, &hdrs, file.etag)) {
+        return ESP_OK;
+    }
+    set_file_headers(req, &hdrs);
+    return httpd_resp_send(req, (const char*)file.data, file.len);
 }
 
+/* Send HTTP response with the contents of the requested file */
+static esp_err_t rest_common_get_handler(httpd_req_t* req)
+{
+    /* The router has already split off the query string and found the
+     * file extension on its way through the URI. */
+    const uri_router_match_t* match = uri_router_get_match(_router);
+    const uri_router_ext_t* file_type = match->ext;
+    char filepath[FILE_PATH_MAX];
+    char etag[REST_ETAG_LEN];
+    file_headers_t hdrs = {0};
+
+    snprintf(filepath, sizeof(filepath), "%s%.*s", _rest_context->base_path,
+             (int)match->path_len, req->uri);
+
+    if (req->uri[match->path_len - 1] == '/') {
+        // URI already ends with "/", indicating a directory.
+        // Thus, we know we need to append "index.html" for file lookup.
+        strlcat(filepath, "index.html", sizeof(filepath));
+        file_type = INDEX_FILE_TYPE;
+    } else if (!file_type) {
+        // The URI is not a file but also does not end with "/".
+        // Thus, we *assume* it is specifying a directory.
+        strlcat(filepath, "/index.html", sizeof(filepath));
+        file_type = INDEX_FILE_TYPE;
+    }
+
+    ESP_LOGI(TAG, "Request URI: %s", req->uri);
+
+    if (_bundle) {
+        /* The image is indexed by request path, without the mount point */
+        return send_bundle_file(req, &filepath[strlen(_rest_context->base_path)]);
+    }
+
+    get_content_type_from_file(&hdrs, file_type, filepath, sizeof(filepath));
+
+    ESP_LOGI(TAG, "Corresponding filepath: %s", filepath);
+
+#if CONFIG_REST_SERVER_ASSET_CACHE
+    const rest_cache_entry_t* cached = rest_cache_find(filepath);
+    if (cached) {
+        if (send_not_modified(req, filepath, &hdrs, cached->etag)) {
+            return ESP_OK;
+        }
+        /* Whole file in one send, with Content-Length instead of chunks */
+        set_file_headers(req, &hdrs);
+        return httpd_resp_send(req, (const char*)cached->data, cached->len);
+    }
+#endif
+
+    /* etag stays in this frame until the response is sent */
+    if (rest_etag_of_file(filepath, _rest_context->scratch, SCRATCH_BUFSIZE, etag) == ESP_OK) {
+        if (send_not_modified(req, filepath, &hdrs, etag)) {
+            return ESP_OK;
+        }
+    }
+
+    return send_file(req, filepath, &hdrs);
+}
+
+/* URI handler for getting web server files */
+static const uri_router_route_t _file_routes[] = {
+    {"/", URI_ROUTER_MATCH_PREFIX, rest_common_get_handler, NULL},
+};
+
 esp_err_t rest_server_start(const char* base_path)
 {
     REST_CHECK(base_path, "wrong base path", err);
@@ -169,21 +375,42 @@ esp_err_t rest_server_start(const char* base_path)
     REST_CHECK(_rest_context, "No memory for rest context", err);
     strlcpy(_rest_context->base_path, base_path, sizeof(_rest_context->base_path));
 
+#if CONFIG_REST_SERVER_ASSET_CACHE
+    /* Serving works without the cache, so a failure here is not fatal. A
+     * mapped asset image needs no cache. */
+    if (!_bundle) {
+        rest_cache_load(_rest_context->base_path);
+    }
+#endif
+
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.uri_match_fn = httpd_uri_match_wildcard;
+    /* Browsers keep connections open after loading a page. Close the least
+     * recently used one when a new client connects and all sockets are taken. */
+    config.lru_purge_enable = true;
 
     ESP_LOGI(TAG, "Starting internal HTTP server");
     REST_CHECK(httpd_start(&_server_handle, &config) == ESP_OK, "Start server failed", err_start);
 
-    /* URI handler for getting web server files */
-    httpd_uri_t common_get_uri = {.uri = "/*",
-                                  .method = HTTP_GET,
-                                  .handler = rest_common_get_handler,
-                                  .user_ctx = _rest_context};
-    httpd_register_uri_handler(_server_handle, &common_get_uri);
+    /* All GET requests go through the router. The web server files are
+     * its bottom route table. */
+    _router = uri_router_create(_server_handle, file_ext_mappings, NUM_FILE_TYPES);
+    REST_CHECK(_router, "Failed to create URI router", err_router);
+    REST_CHECK(uri_router_add_routes(_router, _file_routes,
+                                     sizeof(_file_routes) / sizeof(_file_routes[0])) == ESP_OK,
+               "Failed to add web file route", err_routes);
 
     return ESP_OK;
+err_routes:
+    uri_router_delete(_router);
+    _router = NULL;
+err_router:
+    httpd_stop(_server_handle);
+    _server_handle = NULL;
 err_start:
+#if CONFIG_REST_SERVER_ASSET_CACHE
+    rest_cache_free();
+#endif
     free(_rest_context);
 err:
     return ESP_FAIL;
@@ -193,30 +420,36 @@ void rest_server_stop(void)
 {
     /* Stop handler for provisiong webpage files */
     ESP_LOGI(TAG, "Unregistering handler for /*");
-    httpd_unregister_uri_handler(_server_handle, "/*", HTTP_GET);
+    uri_router_delete(_router);
+    _router = NULL;
 
     /* Stop HTTPD server */
     ESP_LOGI(TAG, "Stopping internal HTTPD server");
     httpd_stop(_server_handle);
     _server_handle = NULL;
 
+#if CONFIG_REST_SERVER_ASSET_CACHE
+    rest_cache_free();
+#endif
+    rest_etag_clear();
+
     if (_rest_context)
         free(_rest_context);
 
     return;
 }
 
-httpd_handle_t* rest_server_get_httpd_handle(void)
+void rest_server_set_bundle(const asset_bundle_t* bundle)
 {
-    return &_server_handle;
+    _bundle = bundle;
 }
 
-uri_handler_func_t rest_server_get_common_get_handler(void)
+httpd_handle_t* rest_server_get_httpd_handle(void)
 {
-    return &rest_common_get_handler;
+    return &_server_handle;
 }
 
-void* rest_server_get_common_get_ctx(void)
+uri_router_handle_t rest_server_get_router(void)
 {
-    return (void*)_rest_context;
+    return _router;
 }
@@ -0,0 +1,199 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+RAM cache of the web files. rest_server_start() walks the web file directory once and reads
+each file that still fits the budget into a single buffer. The cache is read-only while the
+HTTP server runs, so the handler needs no locking.
+*/
+
+#include "rest_server_priv.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_vfs.h"
+
+static const char* TAG = "rest-server";
+
+#define CACHE_BUDGET CONFIG_REST_SERVER_ASSET_CACHE_BUDGET
+
+#if CONFIG_REST_SERVER_ASSET_CACHE_PSRAM
+#define CACHE_CAPS (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+#else
+#define CACHE_CAPS (MALLOC_CAP_8BIT)
+#endif
+
+/* Subdirectories deeper than this are not cached */
+#define MAX_DEPTH (4)
+
+static rest_cache_entry_t* _entries = NULL;
+static size_t _num_entries = 0;
+static size_t _cached_bytes = 0;
+
+// To compare paths by a word before comparing the strings
+static uint32_t hash_path(const char* path)
+{
+    return rest_hash_update(REST_HASH_INIT, path, strlen(path));
+}
+
+static uint8_t* alloc_file_buffer(size_t len)
+{
+    uint8_t* data = heap_caps_malloc(len, CACHE_CAPS);
+
+#if CONFIG_REST_SERVER_ASSET_CACHE_PSRAM
+    if (data == NULL) {
+        data = heap_caps_malloc(len, MALLOC_CAP_8BIT);
+    }
+#endif
+    return data;
+}
+
+static bool read_file(const char* path, uint8_t* data, size_t len)
+{
+    int fd = open(path, O_RDONLY, 0);
+    size_t done = 0;
+
+    if (fd == -1) {
+        return false;
+    }
+    while (done < len) {
+        ssize_t read_bytes = read(fd, &data[done], len - done);
+        if (read_bytes <= 0) {
+            break;
+        }
+        done += read_bytes;
+    }
+    close(fd);
+    return (done == len);
+}
+
+static esp_err_t add_file(const char* path, size_t len)
+{
+    if (_cached_bytes + len > CACHE_BUDGET) {
+        ESP_LOGI(TAG, "Not caching %s (%u bytes): over budget", path, (unsigned)len);
+        return ESP_OK;
+    }
+
+    rest_cache_entry_t* entries = realloc(_entries, (_num_entries + 1) * sizeof(*entries));
+    if (entries == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    _entries = entries;
+
+    rest_cache_entry_t* entry = &_entries[_num_entries];
+    entry->path = strdup(path);
+    entry->data = alloc_file_buffer(len ? len : 1);
+    if ((entry->path == NULL) || (entry->data == NULL)) {
+        free(entry->path);
+        free(entry->data);
+        return ESP_ERR_NO_MEM;
+    }
+    if (!read_file(path, entry->data, len)) {
+        ESP_LOGW(TAG, "Failed to read %s", path);
+        free(entry->path);
+        free(entry->data);
+        return ESP_OK;
+    }
+    entry->hash = hash_path(path);
+    entry->len = len;
+    rest_etag_format(rest_hash_update(REST_HASH_INIT, entry->data, len), len, entry->etag);
+
+    _num_entries++;
+    _cached_bytes += len;
+    return ESP_OK;
+}
+
+static esp_err_t load_dir(const char* dir_path, int depth)
+{
+    char path[ESP_VFS_PATH_MAX + 128];
+    esp_err_t ret = ESP_OK;
+    struct dirent* dirent;
+    struct stat st;
+
+    DIR* dir = opendir(dir_path);
+    if (dir == NULL) {
+        ESP_LOGW(TAG, "Failed to open directory %s", dir_path);
+        return ESP_OK;
+    }
+
+    while ((ret == ESP_OK) && ((dirent = readdir(dir)) != NULL)) {
+        if ((strcmp(dirent->d_name, ".") == 0) || (strcmp(dirent->d_name, "..") == 0)) {
+            continue;
+        }
+        // SPIFFS has no directories and lists "prov/index.html.gz" as one entry, FAT lists
+        // "prov" as a directory. Either way the result is the same path.
+        if (snprintf(path, sizeof(path), "%s/%s", dir_path, dirent->d_name) >= sizeof(path)) {
+            continue;
+        }
+        if (stat(path, &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            if (depth < MAX_DEPTH) {
+                ret = load_dir(path, depth + 1);
+            }
+        } else {
+            ret = add_file(path, st.st_size);
+        }
+    }
+    closedir(dir);
+    return ret;
+}
+
+esp_err_t rest_cache_load(const char* base_path)
+{
+    esp_err_t ret = load_dir(base_path, 0);
+
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Out of memory while caching web files");
+        rest_cache_free();
+        return ret;
+    }
+    ESP_LOGI(TAG, "Cached %u web files, %u bytes", (unsigned)_num_entries,
+             (unsigned)_cached_bytes);
+    return ESP_OK;
+}
+
+void rest_cache_free(void)
+{
+    for (size_t i = 0; i < _num_entries; i++) {
+        free(_entries[i].path);
+        free(_entries[i].data);
+    }
+    free(_entries);
+    _entries = NULL;
+    _num_entries = 0;
+    _cached_bytes = 0;
+}
+
+const rest_cache_entry_t* rest_cache_find(const char* path)
+{
+    uint32_t hash = hash_path(path);
+
+    for (size_t i = 0; i < _num_entries; i++) {
+        if ((_entries[i].hash == hash) && (strcmp(_entries[i].path, path) == 0)) {
+            return &_entries[i];
+        }
+    }
+    return NULL;
+}
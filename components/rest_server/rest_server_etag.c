@@ -0,0 +1,123 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+/*
+ETags of web files that are served from the file system. The HTTP server handles one request at
+a time, so the table is only ever used from its task and needs no locking.
+*/
+
+#include "rest_server_priv.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Initial size of the table. It doubles whenever it is full. */
+#define INITIAL_ETAGS (16)
+
+typedef struct {
+    char* path;
+    char etag[REST_ETAG_LEN];
+} etag_entry_t;
+
+static etag_entry_t* _etags = NULL;
+static int _num_etags = 0;
+static int _max_etags = 0;
+
+void rest_etag_format(uint32_t content_hash, size_t len, char* etag)
+{
+    snprintf(etag, REST_ETAG_LEN, "\"%08x-%x\"", (unsigned)content_hash, (unsigned)len);
+}
+
+static esp_err_t hash_file(const char* path, char* scratch, size_t scratch_len, char* etag)
+{
+    uint32_t hash = REST_HASH_INIT;
+    size_t len = 0;
+    ssize_t read_bytes;
+
+    int fd = open(path, O_RDONLY, 0);
+    if (fd == -1) {
+        return ESP_FAIL;
+    }
+    while ((read_bytes = read(fd, scratch, scratch_len)) > 0) {
+        hash = rest_hash_update(hash, scratch, read_bytes);
+        len += read_bytes;
+    }
+    close(fd);
+    if (read_bytes < 0) {
+        return ESP_FAIL;
+    }
+
+    rest_etag_format(hash, len, etag);
+    return ESP_OK;
+}
+
+/* Make room for one more entry */
+static bool grow_table(void)
+{
+    etag_entry_t* etags;
+    int max_etags;
+
+    if (_num_etags < _max_etags) {
+        return true;
+    }
+    max_etags = _max_etags ? (_max_etags * 2) : INITIAL_ETAGS;
+    etags = realloc(_etags, max_etags * sizeof(etag_entry_t));
+    if (!etags) {
+        return false;
+    }
+    _etags = etags;
+    _max_etags = max_etags;
+    return true;
+}
+
+esp_err_t rest_etag_of_file(const char* path, char* scratch, size_t scratch_len, char* etag)
+{
+    for (int idx = 0; idx < _num_etags; idx++) {
+        if (strcmp(_etags[idx].path, path) == 0) {
+            memcpy(etag, _etags[idx].etag, REST_ETAG_LEN);
+            return ESP_OK;
+        }
+    }
+
+    if (hash_file(path, scratch, scratch_len, etag) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    // Out of memory only costs the hash of this file on its next request
+    if (grow_table()) {
+        etag_entry_t* entry = &_etags[_num_etags];
+        entry->path = strdup(path);
+        if (entry->path) {
+            memcpy(entry->etag, etag, REST_ETAG_LEN);
+            _num_etags++;
+        }
+    }
+    return ESP_OK;
+}
+
+void rest_etag_clear(void)
+{
+    for (int idx = 0; idx < _num_etags; idx++) {
+        free(_etags[idx].path);
+    }
+    free(_etags);
+    _etags = NULL;
+    _num_etags = 0;
+    _max_etags = 0;
+}
@@ -0,0 +1,35 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Content types of the web files by extension, the one list for both the file system and the asset
+image. rest_server.c expands it into its extension table with REST_MIME_TYPE(extension, type,
+is_zipped). asset_bundle/tools/mkassetbundle.py reads it with --mime-types to label the files it
+packs, so keep one REST_MIME_TYPE() per line with literal strings.
+
+The first entry is the type of index pages. There is no include guard: the file is included where
+the list is expanded.
+*/
+
+/* Type of files with an extension not in the list */
+#define REST_DEFAULT_MIME_TYPE "text/plain"
+
+REST_MIME_TYPE(".html", "text/html", true)
+REST_MIME_TYPE(".js", "application/javascript", true)
+REST_MIME_TYPE(".css", "text/css", true)
+REST_MIME_TYPE(".proto", "text/plain", true)
+REST_MIME_TYPE(".png", "image/png", false)
+REST_MIME_TYPE(".ico", "image/x-icon", false)
+REST_MIME_TYPE(".svg", "text/xml", true)
+REST_MIME_TYPE(".txt", "text/plain", true)
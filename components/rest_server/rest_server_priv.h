@@ -0,0 +1,119 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef REST_SERVER_PRIV_H_
+#define REST_SERVER_PRIV_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#define REST_HASH_INIT (2166136261U)
+
+/* Quoted ETag, e.g. "\"1a2b3c4d-5e6f\"", including the terminator */
+#define REST_ETAG_LEN (22)
+
+/**
+ * @brief   Adds data to an FNV-1a hash.
+ *
+ * @param[in] hash REST_HASH_INIT, or the result of the previous call
+ * @param[in] data Data to add
+ * @param[in] len  Length of data
+ *
+ * @return Updated hash
+ */
+static inline uint32_t rest_hash_update(uint32_t hash, const void* data, size_t len)
+{
+    const uint8_t* bytes = data;
+
+    while (len--) {
+        hash = (hash ^ *bytes++) * 16777619U;
+    }
+    return hash;
+}
+
+/**
+ * @brief   Formats the strong ETag of a file.
+ *
+ * @param[in]  content_hash rest_hash_update() of the file contents
+ * @param[in]  len          File size
+ * @param[out] etag         Buffer of REST_ETAG_LEN bytes
+ */
+void rest_etag_format(uint32_t content_hash, size_t len, char* etag);
+
+/**
+ * @brief   Gets the ETag of a file in the file system.
+ *
+ * The file is hashed on the first request and the ETag is kept until
+ * rest_etag_clear(). Web files are deployed read-only, so it cannot go stale.
+ *
+ * @param[in]  path        Full path in the VFS
+ * @param[in]  scratch     Buffer to read the file through
+ * @param[in]  scratch_len Size of scratch
+ * @param[out] etag        Buffer of REST_ETAG_LEN bytes
+ *
+ * @return
+ *  - ESP_OK   : Success
+ *  - ESP_FAIL : File could not be read
+ */
+esp_err_t rest_etag_of_file(const char* path, char* scratch, size_t scratch_len, char* etag);
+
+/**
+ * @brief   Forgets all ETags from rest_etag_of_file().
+ */
+void rest_etag_clear(void);
+
+#if CONFIG_REST_SERVER_ASSET_CACHE
+
+/**
+ * @brief   Web file held in RAM.
+ */
+typedef struct {
+    char* path;    /* Full path in the VFS, e.g. "/www/prov/index.html.gz" */
+    uint32_t hash; /* Hash of path */
+    char etag[REST_ETAG_LEN];
+    uint8_t* data;
+    size_t len;
+} rest_cache_entry_t;
+
+/**
+ * @brief   Reads the files under base_path into RAM, up to the configured budget.
+ *
+ * @param[in] base_path Mount point of the web files
+ *
+ * @return
+ *  - ESP_OK         : Success, even if not all files fit
+ *  - ESP_ERR_NO_MEM : Out of memory for the cache index
+ */
+esp_err_t rest_cache_load(const char* base_path);
+
+/**
+ * @brief   Frees all cached files.
+ */
+void rest_cache_free(void);
+
+/**
+ * @brief   Finds a cached file.
+ *
+ * @param[in] path Full path in the VFS
+ *
+ * @return Cache entry, or NULL if the file is not cached
+ */
+const rest_cache_entry_t* rest_cache_find(const char* path);
+
+#endif
+
+#endif /* REST_SERVER_PRIV_H_ */
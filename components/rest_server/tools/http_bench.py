@@ -0,0 +1,413 @@
+#!/usr/bin/env python
+#
+# Copyright 2021 Aaron Fontaine
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Measures how the device serves its web files, from a computer on its network.
+
+throughput  Fetches the files over and over on keep-alive connections. Prints the requests and
+            bytes per second of the first round, which is cold right after the device boots,
+            and of the rounds after it (warm). Compare builds with and without
+            CONFIG_REST_SERVER_ASSET_CACHE, resetting the device before each run.
+
+revalidate  Loads each file, then loads it again with the ETag it got, as a browser does on a
+            reload. Checks that each repeat load is a 304 made of headers only, with the same
+            ETag and no body headers, and that names with a content hash are cacheable for
+            good. Prints the bytes on the wire of both loads. Exits with 1 if any check fails.
+
+transfer    Fetches each file a number of times and prints how it was framed (Content-Length
+            or chunked), its bytes on the wire against the bytes of the body, and the median
+            time to the first and to the last byte of the response.
+
+The files are given with --path, or are the assets referenced by the pages given with --page
+(default: the home page). For example:
+
+    python http_bench.py throughput 192.168.4.1 --page /prov/ --rounds 20 --connections 2
+    python http_bench.py revalidate 192.168.4.1 --page /prov/
+    python http_bench.py transfer 192.168.4.1 --page /prov/ --runs 20
+"""
+
+import argparse
+import re
+import socket
+import sys
+import threading
+import time
+from urllib.parse import urljoin, urlparse
+
+# Resources a page loads on its own: scripts, images, stylesheets and icons
+ASSET_RE = re.compile(r'<(?:script|img|link)\b[^>]*?\b(?:src|href)\s*=\s*["\']([^"\']+)["\']',
+                      re.IGNORECASE)
+
+# Sent with every request, as by a browser
+BROWSER_HEADERS = 'Accept: */*\r\nAccept-Encoding: gzip, deflate\r\n'
+
+RECV_SIZE = 16384
+
+# Same rule as is_hashed_name() in rest_server.c: a ".<8 or more hex digits>." in the name
+HASHED_NAME_RE = re.compile(r'\.[0-9a-fA-F]{8,}\.[^/]*$')
+
+# Headers that describe a body, which a 304 must not carry
+BODY_HEADERS = ('content-length', 'content-type', 'content-encoding', 'transfer-encoding')
+
+
+class Response(object):
+    def __init__(self):
+        self.status = 0
+        self.headers = {}     # Lower-case names
+        self.body = b''
+        self.wire_bytes = 0   # Bytes received for the response: headers, body and framing
+        self.header_bytes = 0
+        self.is_chunked = False
+        self.trailing_bytes = 0  # Bytes already received past the end of the response
+        self.ttfb = 0.0       # Seconds from sending the request to the first byte of the response
+        self.ttlb = 0.0       # Seconds from sending the request to the last byte of the response
+
+
+class Connection(object):
+    """HTTP/1.1 client connection that keeps count of the bytes on the wire. It reconnects for
+    the next request whenever the server closed the connection."""
+
+    def __init__(self, server, port, timeout):
+        self.address = (server, port)
+        self.host = server if port == 80 else '%s:%d' % (server, port)
+        self.timeout = timeout
+        self.sock = None
+        self.buf = b''
+        self.connects = 0
+
+    def close(self):
+        if self.sock:
+            self.sock.close()
+        self.sock = None
+        self.buf = b''
+
+    def _fill(self, response, start):
+        data = self.sock.recv(RECV_SIZE)
+        if not data:
+            raise EOFError('connection closed by the device')
+        if not response.ttfb:
+            response.ttfb = time.perf_counter() - start
+        self.buf += data
+
+    def _take(self, length):
+        data, self.buf = self.buf[:length], self.buf[length:]
+        return data
+
+    def _read_until(self, delimiter, response, start):
+        while delimiter not in self.buf:
+            self._fill(response, start)
+        return self._take(self.buf.index(delimiter) + len(delimiter))
+
+    def _read_exact(self, length, response, start):
+        while len(self.buf) < length:
+            self._fill(response, start)
+        return self._take(length)
+
+    def _read_body(self, response, start):
+        if (response.status in (204, 304)) or (100 <= response.status < 200):
+            return b'', 0
+        if 'chunked' in response.headers.get('transfer-encoding', '').lower():
+            response.is_chunked = True
+            body = b''
+            wire_bytes = 0
+            while True:
+                line = self._read_until(b'\r\n', response, start)
+                wire_bytes += len(line)
+                size = int(line.split(b';')[0], 16)
+                if size == 0:
+                    break
+                chunk = self._read_exact(size + 2, response, start)
+                wire_bytes += len(chunk)
+                body += chunk[:-2]
+            # Trailers up to the empty line
+            while True:
+                line = self._read_until(b'\r\n', response, start)
+                wire_bytes += len(line)
+                if line == b'\r\n':
+                    return body, wire_bytes
+        if 'content-length' in response.headers:
+            body = self._read_exact(int(response.headers['content-length']), response, start)
+            return body, len(body)
+        # Delimited by the end of the connection
+        while True:
+            try:
+                self._fill(response, start)
+            except EOFError:
+                break
+        body = self._take(len(self.buf))
+        self.close()
+        return body, len(body)
+
+    def get(self, path, headers=''):
+        """Sends a GET request and reads the whole response."""
+        if self.sock is None:
+            self.sock = socket.create_connection(self.address, self.timeout)
+            self.sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+            self.connects += 1
+
+        response = Response()
+        request = 'GET %s HTTP/1.1\r\nHost: %s\r\n%s%s\r\n' % (path, self.host, BROWSER_HEADERS,
+                                                               headers)
+        start = time.perf_counter()
+        try:
+            self.sock.sendall(request.encode('ascii'))
+            head = self._read_until(b'\r\n\r\n', response, start)
+            lines = head.decode('iso-8859-1').split('\r\n')
+            response.status = int(lines[0].split(' ')[1])
+            for line in lines[1:]:
+                if ':' in line:
+                    name, value = line.split(':', 1)
+                    response.headers[name.strip().lower()] = value.strip()
+            response.header_bytes = len(head)
+            response.body, body_wire_bytes = self._read_body(response, start)
+            response.wire_bytes = response.header_bytes + body_wire_bytes
+            response.trailing_bytes = len(self.buf)
+        except Exception:
+            self.close()
+            raise
+        response.ttlb = time.perf_counter() - start
+        if response.headers.get('connection', '').lower() == 'close':
+            self.close()
+        return response
+
+
+def find_paths(args):
+    """Returns the paths to fetch: those given, or the pages given and their assets."""
+    if args.path:
+        return args.path
+    conn = Connection(args.server, args.port, args.timeout)
+    paths = []
+    try:
+        for page in args.page or ['/']:
+            response = conn.get(page)
+            if response.status != 200:
+                raise RuntimeError('%s: status %d' % (page, response.status))
+            paths.append(page)
+            page_url = 'http://%s%s' % (conn.host, page)
+            for asset in ASSET_RE.findall(response.body.decode('utf-8', 'replace')):
+                url = urlparse(urljoin(page_url, asset))
+                if (url.scheme == 'http') and (url.netloc == conn.host):
+                    path = url.path + ('?' + url.query if url.query else '')
+                    if path not in paths:
+                        paths.append(path)
+    finally:
+        conn.close()
+    return paths
+
+
+def percentile(sorted_values, pct):
+    idx = int(round(pct / 100.0 * (len(sorted_values) - 1)))
+    return sorted_values[idx]
+
+
+def print_round_stats(label, results, elapsed):
+    """Prints the throughput of the (latency, body bytes) results of one or more rounds."""
+    latencies = sorted(latency for latency, _ in results)
+    body_bytes = sum(length for _, length in results)
+    print('%-5s %5d requests  %7.1f req/s  %8.1f KB/s  latency ms p50 %.1f  p99 %.1f' %
+          (label, len(results), len(results) / elapsed, body_bytes / 1024.0 / elapsed,
+           1000.0 * percentile(latencies, 50), 1000.0 * percentile(latencies, 99)))
+
+
+def run_throughput(args):
+    paths = find_paths(args)
+    print('%d files: %s' % (len(paths), ' '.join(paths)))
+
+    conns = [Connection(args.server, args.port, args.timeout) for _ in range(args.connections)]
+    errors = []
+
+    def fetch_round(conn_idx, results):
+        conn = conns[conn_idx]
+        try:
+            # Each connection starts at a different file, as a browser's parallel fetches do
+            for idx in range(len(paths)):
+                path = paths[(conn_idx + idx) % len(paths)]
+                response = conn.get(path)
+                if response.status != 200:
+                    raise RuntimeError('%s: status %d' % (path, response.status))
+                results.append((response.ttlb, len(response.body)))
+        except Exception as e:
+            errors.append(e)
+
+    cold_results = []
+    warm_results = []
+    warm_elapsed = 0.0
+    for round_idx in range(args.rounds):
+        results = cold_results if round_idx == 0 else warm_results
+        threads = [threading.Thread(target=fetch_round, args=(idx, results))
+                   for idx in range(args.connections)]
+        start = time.perf_counter()
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        elapsed = time.perf_counter() - start
+        if errors:
+            print('Failed: %s' % errors[0])
+            return 1
+        if round_idx == 0:
+            print_round_stats('cold', cold_results, elapsed)
+        else:
+            warm_elapsed += elapsed
+
+    if warm_results:
+        print_round_stats('warm', warm_results, warm_elapsed)
+    print('%d TCP connections' % sum(conn.connects for conn in conns))
+    for conn in conns:
+        conn.close()
+    return 0
+
+
+def check_revalidation(path, first, repeat, stale):
+    """Returns the ways in which the loads of a file differ from proper revalidation."""
+    problems = []
+    etag = first.headers.get('etag')
+    cache_control = first.headers.get('cache-control', '')
+
+    if first.status != 200:
+        return ['status %d' % first.status]
+    if not etag or etag.startswith('W/'):
+        return ['no strong ETag']
+    if HASHED_NAME_RE.search(path.split('?')[0]):
+        if ('immutable' not in cache_control) or ('max-age' not in cache_control):
+            problems.append('hashed name but Cache-Control %r' % cache_control)
+    elif 'no-store' in cache_control:
+        problems.append('Cache-Control %r' % cache_control)
+
+    if repeat.status != 304:
+        problems.append('repeat load status %d, expected 304' % repeat.status)
+    else:
+        if repeat.trailing_bytes:
+            problems.append('304 followed by %d bytes of body' % repeat.trailing_bytes)
+        for name in BODY_HEADERS:
+            if name in repeat.headers:
+                problems.append('304 has %s' % name)
+        if repeat.headers.get('etag') != etag:
+            problems.append('304 ETag %r, expected %r' % (repeat.headers.get('etag'), etag))
+        if repeat.headers.get('cache-control') != first.headers.get('cache-control'):
+            problems.append('304 Cache-Control differs')
+
+    if (stale.status != 200) or (stale.body != first.body):
+        problems.append('stale ETag did not get the file again')
+    return problems
+
+
+def run_revalidate(args):
+    paths = find_paths(args)
+    conn = Connection(args.server, args.port, args.timeout)
+    first_total = 0
+    repeat_total = 0
+    failures = 0
+
+    print('%-40s %10s %10s' % ('', 'first', 'repeat'))
+    try:
+        for path in paths:
+            first = conn.get(path)
+            etag = first.headers.get('etag', '')
+            repeat = conn.get(path, 'If-None-Match: %s\r\n' % etag) if etag else first
+            stale = conn.get(path, 'If-None-Match: "00000000-0"\r\n')
+            problems = check_revalidation(path, first, repeat, stale)
+            failures += 1 if problems else 0
+            first_total += first.wire_bytes
+            repeat_total += repeat.wire_bytes
+            print('%-40s %10d %10d  %s%s' % (path, first.wire_bytes, repeat.wire_bytes,
+                                             'FAIL ' if problems else '', '; '.join(problems)))
+    finally:
+        conn.close()
+
+    print('%-40s %10d %10d' % ('total bytes on the wire', first_total, repeat_total))
+    print('%d of %d files revalidated with headers only' % (len(paths) - failures, len(paths)))
+    return 1 if failures else 0
+
+
+def run_transfer(args):
+    paths = find_paths(args)
+    conn = Connection(args.server, args.port, args.timeout)
+    totals = {'body': 0, 'wire': 0, 'ttlb': 0.0}
+
+    print('%-32s %-7s %9s %9s %8s %9s %9s %9s' % ('', 'framing', 'body', 'wire', 'overhead',
+                                                  'TTFB ms', 'TTLB ms', 'KB/s'))
+    try:
+        for path in paths:
+            responses = []
+            for _ in range(args.runs):
+                response = conn.get(path)
+                if response.status != 200:
+                    raise RuntimeError('%s: status %d' % (path, response.status))
+                responses.append(response)
+            ttfb = sorted(response.ttfb for response in responses)[len(responses) // 2]
+            ttlb = sorted(response.ttlb for response in responses)[len(responses) // 2]
+            body = len(responses[0].body)
+            wire = responses[0].wire_bytes
+            totals['body'] += body
+            totals['wire'] += wire
+            totals['ttlb'] += ttlb
+            print('%-32s %-7s %9d %9d %7.1f%% %9.1f %9.1f %9.1f' %
+                  (path, 'chunked' if responses[0].is_chunked else 'length', body, wire,
+                   100.0 * (wire - body) / max(body, 1), 1000.0 * ttfb, 1000.0 * ttlb,
+                   body / 1024.0 / ttlb))
+    finally:
+        conn.close()
+
+    print('%-32s %-7s %9d %9d %7.1f%% %9s %9.1f %9.1f' %
+          ('total', '', totals['body'], totals['wire'],
+           100.0 * (totals['wire'] - totals['body']) / max(totals['body'], 1), '',
+           1000.0 * totals['ttlb'], totals['body'] / 1024.0 / totals['ttlb']))
+    print('%d TCP connections' % conn.connects)
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    subparsers = parser.add_subparsers(dest='command')
+    subparsers.required = True
+
+    throughput = subparsers.add_parser('throughput', help='cold and warm throughput')
+    throughput.add_argument('--rounds', type=int, default=10,
+                            help='times to fetch each file per connection')
+    throughput.add_argument('--connections', type=int, default=1,
+                            help='connections fetching in parallel')
+    throughput.set_defaults(func=run_throughput)
+
+    revalidate = subparsers.add_parser('revalidate', help='check that repeat loads get 304s')
+    revalidate.set_defaults(func=run_revalidate)
+
+    transfer = subparsers.add_parser('transfer', help='bytes on the wire and time to last byte')
+    transfer.add_argument('--runs', type=int, default=10, help='times to fetch each file')
+    transfer.set_defaults(func=run_transfer)
+
+    for subparser in subparsers.choices.values():
+        subparser.add_argument('server', nargs='?', default='192.168.4.1',
+                               help='address of the device (default: %(default)s)')
+        subparser.add_argument('--port', type=int, default=80,
+                               help='HTTP port (default: %(default)s)')
+        subparser.add_argument('--page', action='append',
+                               help='page whose assets to fetch, may be repeated')
+        subparser.add_argument('--path', action='append',
+                               help='file to fetch, may be repeated; overrides --page')
+        subparser.add_argument('--timeout', type=float, default=10.0,
+                               help='seconds to wait for the device')
+
+    args = parser.parse_args()
+    try:
+        return args.func(args)
+    except (OSError, EOFError, RuntimeError, ValueError) as e:
+        print('Failed: %s' % e)
+        return 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,399 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Time to route a GET request, with the trie against the linear dispatch it replaced. Build and
+run from this directory with
+
+    make bench
+
+Both ways start the same: esp_http_server walks its handler table with httpd_uri_match_wildcard()
+past the POST endpoints of provisioning to the one GET handler, which matches any path. Then:
+
+linear  The handlers as they were. While the portal is active, captive_portal compares the path
+        with the redirect URI and the Captive Portal API, and then with each probe path in turn.
+        rest_server checks the path against every known extension to see if it is a file, and
+        again to find its MIME type.
+trie    The router's lookup in the portal's table, walking the extension trie at the same time,
+        and for portal pages a second lookup in rest_server's table.
+
+Two URI mixes are replayed, each for about a second: a phone joining the soft AP while the portal
+is active (probes, redirects and the portal page with its assets), and the web app loading once
+the portal has stopped. Every URI is checked to be routed the same way by both.
+*/
+
+#include "uri_router_trie.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+/* Replay each mix until this much time has passed */
+#define MIN_RUN_NS (1000000000LL)
+
+#define REDIRECT_URI "/prov"
+#define API_URI      "/captive-portal/api"
+
+/* How a request ends up being handled */
+typedef enum
+{
+    ROUTE_PORTAL_PAGE, /* Handed to rest_server by captive_portal */
+    ROUTE_API,
+    ROUTE_PROBE,
+    ROUTE_REDIRECT,
+    ROUTE_FILE, /* Served by rest_server directly */
+} route_kind_t;
+
+typedef struct {
+    route_kind_t kind;
+    int probe; /* ROUTE_PROBE: which one */
+    int ext;   /* Portal pages and files: known extension, -1 for a directory */
+} route_t;
+
+/* Handlers registered with the HTTP server, in order. The protocomm endpoints are POST. */
+typedef struct {
+    const char* uri;
+    bool is_get;
+} httpd_handler_t;
+
+static const httpd_handler_t HTTPD_HANDLERS[] = {
+    {"/prov-scan", false},   {"/prov-session", false}, {"/prov-config", false},
+    {"/proto-ver", false},   {"/prov-custom", false},  {"/*", true},
+};
+#define NUM_HTTPD_HANDLERS (sizeof(HTTPD_HANDLERS) / sizeof(HTTPD_HANDLERS[0]))
+
+/* File extensions of rest_server before the router */
+static const char* const EXTS[] = {".html", ".js", ".css", ".proto",
+                                   ".png",  ".ico", ".svg", ".txt"};
+#define NUM_EXTS (sizeof(EXTS) / sizeof(EXTS[0]))
+
+static const char* const PROBES[] = {
+    "/generate_204",   "/gen_204",  "/hotspot-detect.html", "/library/test/success.html",
+    "/connecttest.txt", "/ncsi.txt", "/success.txt",         "/canonical.html",
+    "/check_network_status.txt",
+};
+#define NUM_PROBES (sizeof(PROBES) / sizeof(PROBES[0]))
+
+static const char* const PORTAL_MIX[] = {
+    "/generate_204",
+    "/hotspot-detect.html",
+    "/generate_204",
+    "/connecttest.txt",
+    "/success.txt?ipv4",
+    "/canonical.html",
+    "/captive-portal/api",
+    "/",
+    "/favicon.ico",
+    "/prov",
+    "/prov/index.html",
+    "/prov/js/app.js",
+    "/prov/js/chunk-vendors.js",
+    "/prov/css/app.css",
+    "/prov/favicon.ico",
+    "/prov/img/logo.png",
+    "/hotspot-detect.html",
+    "/generate_204",
+    "/check_network_status.txt",
+    "/search?q=weather",
+};
+
+static const char* const APP_MIX[] = {
+    "/",
+    "/index.html",
+    "/js/app.js",
+    "/js/chunk-vendors.js",
+    "/css/app.css",
+    "/css/chunk-vendors.css",
+    "/favicon.ico",
+    "/img/logo.png",
+    "/img/icons/wifi.svg",
+    "/settings",
+    "/settings/",
+    "/js/app.js?v=3",
+};
+
+static uri_trie_t _portal_trie;
+static uri_trie_t _rest_trie;
+static uri_trie_t _ext_trie;
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* httpd_uri_match_wildcard() of ESP-IDF 4.2 */
+static bool httpd_uri_match_wildcard(const char* template, const char* uri, size_t len)
+{
+    const size_t tpl_len = strlen(template);
+    size_t exact_match_chars = tpl_len;
+
+    const char last = (const char)(tpl_len > 0 ? template[tpl_len - 1] : 0);
+    const char prevlast = (const char)(tpl_len > 1 ? template[tpl_len - 2] : 0);
+    const bool asterisk = last == '*' || (prevlast == '*' && last == '?');
+    const bool quest = last == '?' || (prevlast == '?' && last == '*');
+
+    if (exact_match_chars < asterisk + quest * 2) {
+        return false;
+    }
+    exact_match_chars -= asterisk + quest * 2;
+
+    if (len < exact_match_chars) {
+        return false;
+    }
+
+    if (!quest) {
+        if (!asterisk && len != exact_match_chars) {
+            return false;
+        }
+        return (strncmp(template, uri, exact_match_chars) == 0);
+    } else {
+        if (len > exact_match_chars && template[exact_match_chars] != uri[exact_match_chars]) {
+            return false;
+        }
+        if (strncmp(template, uri, exact_match_chars) != 0) {
+            return false;
+        }
+        return asterisk || len <= exact_match_chars + 1;
+    }
+}
+
+/* esp_http_server's search for the handler of a GET request */
+static const httpd_handler_t* httpd_find_get_handler(const char* uri)
+{
+    size_t uri_len = strcspn(uri, "?");
+
+    for (size_t idx = 0; idx < NUM_HTTPD_HANDLERS; idx++) {
+        if (httpd_uri_match_wildcard(HTTPD_HANDLERS[idx].uri, uri, uri_len) &&
+            HTTPD_HANDLERS[idx].is_get) {
+            return &HTTPD_HANDLERS[idx];
+        }
+    }
+    return NULL;
+}
+
+// The linear dispatch
+
+#define CHECK_FILE_EXTENSION(filename, ext) \
+    (strcasecmp(&filename[strlen(filename) - strlen(ext)], ext) == 0)
+
+/* rest_server: uri_is_file(), then set_content_type_from_file() */
+static void linear_rest(const char* uri, route_t* route)
+{
+    size_t idx;
+
+    route->ext = -1;
+    if (uri[strlen(uri) - 1] != '/') {
+        for (idx = 0; idx < NUM_EXTS; idx++) {
+            if (CHECK_FILE_EXTENSION(uri, EXTS[idx])) {
+                break;
+            }
+        }
+        if (idx == NUM_EXTS) {
+            return; // A directory
+        }
+    }
+    for (idx = 0; idx < NUM_EXTS; idx++) {
+        if (CHECK_FILE_EXTENSION(uri, EXTS[idx])) {
+            route->ext = idx;
+            break;
+        }
+    }
+}
+
+static int find_probe(const char* uri)
+{
+    size_t path_len = strcspn(uri, "?");
+
+    for (size_t idx = 0; idx < NUM_PROBES; idx++) {
+        if ((strlen(PROBES[idx]) == path_len) && (strncmp(uri, PROBES[idx], path_len) == 0)) {
+            return idx;
+        }
+    }
+    return -1;
+}
+
+static void route_linear(const char* uri, bool is_portal_active, route_t* route)
+{
+    httpd_find_get_handler(uri);
+
+    if (!is_portal_active) {
+        route->kind = ROUTE_FILE;
+        linear_rest(uri, route);
+        return;
+    }
+
+    if (strncmp(uri, REDIRECT_URI, strlen(REDIRECT_URI)) == 0) {
+        route->kind = ROUTE_PORTAL_PAGE;
+        linear_rest(uri, route);
+        return;
+    }
+    size_t path_len = strcspn(uri, "?");
+    if ((path_len == strlen(API_URI)) && (strncmp(uri, API_URI, path_len) == 0)) {
+        route->kind = ROUTE_API;
+        return;
+    }
+    route->probe = find_probe(uri);
+    route->kind = (route->probe >= 0) ? ROUTE_PROBE : ROUTE_REDIRECT;
+}
+
+// The trie, with the route tables of captive_portal and rest_server
+
+enum
+{
+    PORTAL_ROUTE_PAGE,
+    PORTAL_ROUTE_API,
+    PORTAL_ROUTE_PROBES,
+    PORTAL_ROUTE_REDIRECT = PORTAL_ROUTE_PROBES + NUM_PROBES,
+};
+
+static bool build_tries(void)
+{
+    size_t total_len = strlen(REDIRECT_URI) + strlen(API_URI) + 1;
+
+    for (size_t idx = 0; idx < NUM_PROBES; idx++) {
+        total_len += strlen(PROBES[idx]);
+    }
+    if (!uri_trie_init(&_portal_trie, total_len) || !uri_trie_init(&_rest_trie, 1) ||
+        !uri_trie_init(&_ext_trie, 32)) {
+        return false;
+    }
+    uri_trie_insert(&_portal_trie, REDIRECT_URI, strlen(REDIRECT_URI), true, PORTAL_ROUTE_PAGE);
+    uri_trie_insert(&_portal_trie, API_URI, strlen(API_URI), false, PORTAL_ROUTE_API);
+    for (size_t idx = 0; idx < NUM_PROBES; idx++) {
+        uri_trie_insert(&_portal_trie, PROBES[idx], strlen(PROBES[idx]), false,
+                        PORTAL_ROUTE_PROBES + idx);
+    }
+    uri_trie_insert(&_portal_trie, "/", 1, true, PORTAL_ROUTE_REDIRECT);
+
+    uri_trie_insert(&_rest_trie, "/", 1, true, 0);
+    for (size_t idx = 0; idx < NUM_EXTS; idx++) {
+        uri_trie_insert(&_ext_trie, &EXTS[idx][1], strlen(EXTS[idx]) - 1, false, idx);
+    }
+    return true;
+}
+
+static void route_trie(const char* uri, bool is_portal_active, route_t* route)
+{
+    size_t path_len;
+    int ext;
+    int idx;
+
+    httpd_find_get_handler(uri);
+
+    if (!is_portal_active) {
+        uri_trie_lookup(&_rest_trie, &_ext_trie, uri, &path_len, &ext);
+        route->kind = ROUTE_FILE;
+        route->ext = ext;
+        return;
+    }
+
+    idx = uri_trie_lookup(&_portal_trie, &_ext_trie, uri, &path_len, &ext);
+    if (idx == PORTAL_ROUTE_PAGE) {
+        // uri_router_next(): rest_server's table below
+        uri_trie_lookup(&_rest_trie, NULL, uri, &path_len, NULL);
+        route->kind = ROUTE_PORTAL_PAGE;
+        route->ext = ext;
+    } else if (idx == PORTAL_ROUTE_API) {
+        route->kind = ROUTE_API;
+    } else if (idx < PORTAL_ROUTE_REDIRECT) {
+        route->kind = ROUTE_PROBE;
+        route->probe = idx - PORTAL_ROUTE_PROBES;
+    } else {
+        route->kind = ROUTE_REDIRECT;
+    }
+}
+
+static bool is_same_route(const route_t* a, const route_t* b)
+{
+    if (a->kind != b->kind) {
+        return false;
+    }
+    switch (a->kind) {
+    case ROUTE_PROBE:
+        return (a->probe == b->probe);
+    case ROUTE_PORTAL_PAGE:
+    case ROUTE_FILE:
+        return (a->ext == b->ext);
+    default:
+        return true;
+    }
+}
+
+/* Nanoseconds per request of one mix */
+static double time_mix(void (*route_fn)(const char*, bool, route_t*), const char* const* uris,
+                       size_t num_uris, bool is_portal_active)
+{
+    volatile int sink = 0;
+    long long routed = 0;
+    long long start_ns = now_ns();
+    long long elapsed_ns;
+    route_t route;
+
+    do {
+        for (size_t idx = 0; idx < num_uris; idx++) {
+            route_fn(uris[idx], is_portal_active, &route);
+            sink ^= route.kind;
+        }
+        routed += num_uris;
+        elapsed_ns = now_ns() - start_ns;
+    } while (elapsed_ns < MIN_RUN_NS);
+    return (double)elapsed_ns / routed;
+}
+
+static bool bench_mix(const char* label, const char* const* uris, size_t num_uris,
+                      bool is_portal_active)
+{
+    for (size_t idx = 0; idx < num_uris; idx++) {
+        route_t linear = {0, -1, -1};
+        route_t trie = {0, -1, -1};
+
+        // Before the router, query strings reached the extension scans. Those are compared
+        // without.
+        char path[128];
+        snprintf(path, sizeof(path), "%.*s", (int)strcspn(uris[idx], "?"), uris[idx]);
+
+        route_linear(path, is_portal_active, &linear);
+        route_trie(uris[idx], is_portal_active, &trie);
+        if (!is_same_route(&linear, &trie)) {
+            fprintf(stderr, "%s: %s routed differently\n", label, uris[idx]);
+            return false;
+        }
+    }
+
+    double linear_ns = time_mix(route_linear, uris, num_uris, is_portal_active);
+    double trie_ns = time_mix(route_trie, uris, num_uris, is_portal_active);
+    printf("%-8s %2zu URIs  linear %7.1f ns/request  trie %7.1f ns/request  linear/trie %.2f\n",
+           label, num_uris, linear_ns, trie_ns, linear_ns / trie_ns);
+    return true;
+}
+
+int main(void)
+{
+    if (!build_tries()) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    if (!bench_mix("portal", PORTAL_MIX, sizeof(PORTAL_MIX) / sizeof(PORTAL_MIX[0]), true) ||
+        !bench_mix("app", APP_MIX, sizeof(APP_MIX) / sizeof(APP_MIX[0]), false)) {
+        return 1;
+    }
+
+    uri_trie_free(&_portal_trie);
+    uri_trie_free(&_rest_trie);
+    uri_trie_free(&_ext_trie);
+    return 0;
+}
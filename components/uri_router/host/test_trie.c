@@ -0,0 +1,246 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Unit tests of the routing trie in uri_router_trie.c. Build and run from this directory with
+
+    make test
+*/
+
+#include "uri_router_trie.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int _failures = 0;
+
+#define CHECK(cond)                                                                        \
+    do {                                                                                   \
+        if (!(cond)) {                                                                     \
+            fprintf(stderr, "%s:%d: %s: CHECK(%s) failed\n", __FILE__, __LINE__, __func__, \
+                    #cond);                                                                \
+            _failures++;                                                                   \
+        }                                                                                  \
+    } while (0)
+
+typedef struct {
+    const char* key;
+    bool is_prefix;
+} trie_key_t;
+
+/* Builds a trie of keys, each indexed by its position */
+static void build(uri_trie_t* trie, const trie_key_t* keys, int count)
+{
+    size_t total_len = 0;
+
+    for (int idx = 0; idx < count; idx++) {
+        total_len += strlen(keys[idx].key);
+    }
+    CHECK(uri_trie_init(trie, total_len));
+    for (int idx = 0; idx < count; idx++) {
+        CHECK(uri_trie_insert(trie, keys[idx].key, strlen(keys[idx].key), keys[idx].is_prefix,
+                              idx));
+    }
+}
+
+static int route(const uri_trie_t* routes, const char* uri)
+{
+    size_t path_len;
+    return uri_trie_lookup(routes, NULL, uri, &path_len, NULL);
+}
+
+static int ext_of(const uri_trie_t* exts, const char* uri)
+{
+    size_t path_len;
+    int ext;
+    uri_trie_lookup(NULL, exts, uri, &path_len, &ext);
+    return ext;
+}
+
+/* ---------------------------------------------------------------------------------------------
+ * Routes
+ */
+
+static void test_exact_beats_prefix(void)
+{
+    static const trie_key_t keys[] = {
+        {"/prov", true},
+        {"/prov/", true},
+        {"/prov", false},
+        {"/prov/index.html", false},
+    };
+    uri_trie_t trie;
+
+    build(&trie, keys, 4);
+    CHECK(route(&trie, "/prov") == 2);
+    CHECK(route(&trie, "/prov/index.html") == 3);
+    CHECK(route(&trie, "/prov/index.htm") == 1);
+    CHECK(route(&trie, "/prov/") == 1);
+    CHECK(route(&trie, "/prov?x=1") == 2);
+    uri_trie_free(&trie);
+}
+
+static void test_prefix_ends_on_segment(void)
+{
+    static const trie_key_t keys[] = {
+        {"/prov", true},
+        {"/api/", true},
+    };
+    uri_trie_t trie;
+
+    build(&trie, keys, 2);
+    CHECK(route(&trie, "/prov") == 0);
+    CHECK(route(&trie, "/prov/x") == 0);
+    CHECK(route(&trie, "/prov?x") == 0);
+    CHECK(route(&trie, "/provision") == -1);
+    CHECK(route(&trie, "/pro") == -1);
+
+    // A pattern ending in '/' matches whatever follows, but not the bare directory
+    CHECK(route(&trie, "/api/") == 1);
+    CHECK(route(&trie, "/api/v1/x") == 1);
+    CHECK(route(&trie, "/api") == -1);
+    uri_trie_free(&trie);
+}
+
+static void test_longest_prefix_wins(void)
+{
+    static const trie_key_t keys[] = {
+        {"/", true},
+        {"/captive-portal", true},
+        {"/captive-portal/api", true},
+    };
+    uri_trie_t trie;
+
+    build(&trie, keys, 3);
+    CHECK(route(&trie, "/index.html") == 0);
+    CHECK(route(&trie, "/captive-portal/x") == 1);
+    CHECK(route(&trie, "/captive-portal/api") == 2);
+    CHECK(route(&trie, "/captive-portal/api/") == 2);
+    CHECK(route(&trie, "/captive-portal/apix") == 1);
+    uri_trie_free(&trie);
+}
+
+static void test_first_of_equal_keys_kept(void)
+{
+    static const trie_key_t keys[] = {
+        {"/a", false},
+        {"/a", false},
+        {"/a", true},
+        {"/a", true},
+    };
+    uri_trie_t trie;
+
+    build(&trie, keys, 4);
+    CHECK(route(&trie, "/a") == 0);
+    CHECK(route(&trie, "/a/b") == 2);
+    uri_trie_free(&trie);
+}
+
+static void test_path_len_stops_at_query(void)
+{
+    static const trie_key_t keys[] = {{"/x", false}};
+    uri_trie_t trie;
+    size_t path_len;
+
+    build(&trie, keys, 1);
+    CHECK(uri_trie_lookup(&trie, NULL, "/x?y=/z", &path_len, NULL) == 0);
+    CHECK(path_len == 2);
+    CHECK(uri_trie_lookup(NULL, NULL, "/a/b", &path_len, NULL) == -1);
+    CHECK(path_len == 4);
+    uri_trie_free(&trie);
+}
+
+static void test_full_trie(void)
+{
+    uri_trie_t trie;
+
+    CHECK(uri_trie_init(&trie, 3));
+    CHECK(uri_trie_insert(&trie, "/ab", 3, false, 0));
+    // Shares all nodes with "/ab"
+    CHECK(uri_trie_insert(&trie, "/a", 2, true, 1));
+    CHECK(!uri_trie_insert(&trie, "/b", 2, false, 2));
+    uri_trie_free(&trie);
+
+    CHECK(!uri_trie_init(&trie, UINT16_MAX));
+}
+
+/* ---------------------------------------------------------------------------------------------
+ * File extensions
+ */
+
+static void test_extensions(void)
+{
+    static const trie_key_t keys[] = {
+        {"html", false},
+        {"js", false},
+        {"gz", false},
+    };
+    uri_trie_t trie;
+
+    build(&trie, keys, 3);
+    CHECK(ext_of(&trie, "/index.html") == 0);
+    CHECK(ext_of(&trie, "/prov/prov_bundle.min.js") == 1);
+    CHECK(ext_of(&trie, "/Index.HTML") == 0);
+    CHECK(ext_of(&trie, "/a.js?v=1.html") == 1);
+    CHECK(ext_of(&trie, "/x.tar.gz") == 2);
+
+    // Unknown, partial and longer extensions
+    CHECK(ext_of(&trie, "/a.jsx") == -1);
+    CHECK(ext_of(&trie, "/a.j") == -1);
+    CHECK(ext_of(&trie, "/a.") == -1);
+    CHECK(ext_of(&trie, "/index") == -1);
+
+    // Only the last path segment counts
+    CHECK(ext_of(&trie, "/v1.html/data") == -1);
+    CHECK(ext_of(&trie, "/dir.js/") == -1);
+    uri_trie_free(&trie);
+}
+
+static void test_routes_and_extension_together(void)
+{
+    static const trie_key_t route_keys[] = {{"/", true}};
+    static const trie_key_t ext_keys[] = {{"css", false}};
+    uri_trie_t routes;
+    uri_trie_t exts;
+    size_t path_len;
+    int ext;
+
+    build(&routes, route_keys, 1);
+    build(&exts, ext_keys, 1);
+    CHECK(uri_trie_lookup(&routes, &exts, "/prov/spectre.min.css?x", &path_len, &ext) == 0);
+    CHECK(path_len == 21);
+    CHECK(ext == 0);
+    uri_trie_free(&routes);
+    uri_trie_free(&exts);
+}
+
+int main(void)
+{
+    test_exact_beats_prefix();
+    test_prefix_ends_on_segment();
+    test_longest_prefix_wins();
+    test_first_of_equal_keys_kept();
+    test_path_len_stops_at_query();
+    test_full_trie();
+
+    test_extensions();
+    test_routes_and_extension_together();
+
+    if (_failures) {
+        fprintf(stderr, "%d checks failed\n", _failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,150 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef URI_ROUTER_H_
+#define URI_ROUTER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <esp_err.h>
+#include <esp_http_server.h>
+
+/**
+ * @brief   How a route's pattern is matched against the request path.
+ */
+typedef enum
+{
+    URI_ROUTER_MATCH_EXACT,  /*!< The path equals the pattern */
+    URI_ROUTER_MATCH_PREFIX, /*!< The path starts with the pattern at a segment boundary, e.g.
+                                  "/prov" matches "/prov" and "/prov/index.html" but not
+                                  "/provider". "/" matches all paths. */
+} uri_router_match_type_t;
+
+/**
+ * @brief   Route for GET requests.
+ *
+ * An exact route takes precedence over a prefix route, and a longer prefix
+ * over a shorter one. Of two routes with the same pattern and match type in
+ * one table, the first one is used.
+ */
+typedef struct {
+    const char* pattern;           /*!< Path without query string, e.g. "/prov" */
+    uri_router_match_type_t match; /*!< Exact or prefix match */
+    esp_err_t (*handler)(httpd_req_t* req); /*!< Called for matching requests */
+    void* user_ctx;                /*!< Passed to the handler in req->user_ctx */
+} uri_router_route_t;
+
+/**
+ * @brief   File type known by its extension.
+ */
+typedef struct {
+    const char* ext;      /*!< Extension including the dot, matched case-insensitively */
+    const char* mimetype; /*!< Content type to send */
+    bool is_zipped;       /*!< Whether the file is deployed gzipped */
+} uri_router_ext_t;
+
+/**
+ * @brief   Result of routing a request, as seen by the route's handler.
+ */
+typedef struct {
+    const uri_router_route_t* route; /*!< Matched route */
+    const uri_router_ext_t* ext;     /*!< Known extension of the last path segment, or NULL */
+    size_t path_len;                 /*!< Length of the path, i.e. of req->uri without the
+                                          query string */
+} uri_router_match_t;
+
+typedef struct uri_router* uri_router_handle_t;
+
+/**
+ * @brief   Creates a router and makes it the GET handler for all URIs of an
+ *          HTTP server.
+ *
+ * The server must use httpd_uri_match_wildcard as its uri_match_fn. Other
+ * methods (e.g. POST endpoints of the provisioning manager) are still
+ * registered with and matched by the HTTP server itself.
+ *
+ * @param[in] server  Running HTTP server
+ * @param[in] exts    File extensions to recognize, must stay valid as long
+ *                    as the router
+ * @param[in] num_exts Number of entries in exts
+ *
+ * @return
+ *  - Router handle
+ *  - NULL if out of memory, an extension is invalid or the GET handler could
+ *    not be registered
+ */
+uri_router_handle_t uri_router_create(httpd_handle_t server, const uri_router_ext_t* exts,
+                                      size_t num_exts);
+
+/**
+ * @brief   Unregisters the router's GET handler and frees the router.
+ *
+ * @param[in] router Router to delete, may be NULL
+ */
+void uri_router_delete(uri_router_handle_t router);
+
+/**
+ * @brief   Adds a table of routes on top of those already added.
+ *
+ * A request is routed by the most recently added table that has a
+ * matching route. Tables added later can pass requests on to the ones
+ * below with uri_router_next().
+ *
+ * @param[in] router     Router
+ * @param[in] routes     Routes, must stay valid until removed
+ * @param[in] num_routes Number of entries in routes
+ *
+ * @return
+ *  - ESP_OK              : Success
+ *  - ESP_ERR_INVALID_ARG : A pattern is NULL or does not start with "/"
+ *  - ESP_ERR_NO_MEM      : Out of memory
+ */
+esp_err_t uri_router_add_routes(uri_router_handle_t router, const uri_router_route_t* routes,
+                                size_t num_routes);
+
+/**
+ * @brief   Removes a table of routes added with uri_router_add_routes().
+ *
+ * @param[in] router Router
+ * @param[in] routes Same pointer as passed to uri_router_add_routes()
+ */
+void uri_router_remove_routes(uri_router_handle_t router, const uri_router_route_t* routes);
+
+/**
+ * @brief   Gets the result of routing the request being handled.
+ *
+ * @note Only valid in a route handler.
+ *
+ * @param[in] router Router that called the handler
+ *
+ * @return Match of the current request
+ */
+const uri_router_match_t* uri_router_get_match(uri_router_handle_t router);
+
+/**
+ * @brief   Passes the request being handled on to the route tables below
+ *          the one of the current handler.
+ *
+ * @note Only valid in a route handler.
+ *
+ * @param[in] router Router that called the handler
+ * @param[in] req    Request being handled
+ *
+ * @return Result of the next handler. If there is none, a 404 response is
+ *         sent and ESP_FAIL returned.
+ */
+esp_err_t uri_router_next(uri_router_handle_t router, httpd_req_t* req);
+
+#endif /* URI_ROUTER_H_ */
@@ -0,0 +1,299 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+GET request router. One wildcard handler on the HTTP server routes all GET requests through a
+stack of route tables, each compiled into a trie when it is added. The table on top is tried
+first, so a component can take over some or all paths for a while (as the captive portal does)
+and hand requests back to the tables below, without re-registering handlers with the server.
+
+Tables are added and removed from any task. The lock only covers walking the stack, never a
+handler, so a slow response does not hold up anyone changing the routes. A table may therefore be
+freed while one of its handlers runs: handlers get the route, which lives in the caller's array,
+and the router remembers the table only by ID.
+*/
+
+#include "uri_router.h"
+#include "uri_router_trie.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+static const char* TAG = "uri-router";
+
+typedef struct route_table {
+    struct route_table* below; /* Next older table */
+    uint32_t id;               /* Unique for the life of the router, unlike the address */
+    const uri_router_route_t* routes;
+    uri_trie_t trie;
+} route_table_t;
+
+struct uri_router {
+    httpd_handle_t server;
+    SemaphoreHandle_t lock;
+    route_table_t* top;
+    uint32_t next_id;
+    const uri_router_ext_t* exts;
+    uri_trie_t ext_trie;
+
+    /* Request being handled. Only used in the server's task. */
+    uri_router_match_t match;
+    uint32_t current_id; /* Table of the running handler */
+};
+
+// Finds the first table at or below table with a route for uri. Call with the lock held.
+static const route_table_t* find_route(const route_table_t* table, const char* uri,
+                                       int* route_idx)
+{
+    size_t path_len;
+
+    for (; table; table = table->below) {
+        *route_idx = uri_trie_lookup(&table->trie, NULL, uri, &path_len, NULL);
+        if (*route_idx >= 0) {
+            return table;
+        }
+    }
+    return NULL;
+}
+
+// Looks up the route of a table found by find_route() or the top table. Call with the lock held,
+// as the table may be freed as soon as it is released.
+static const uri_router_route_t* resolve_route(uri_router_handle_t router,
+                                               const route_table_t* table, int route_idx)
+{
+    if (table == NULL) {
+        return NULL;
+    }
+    router->current_id = table->id;
+    return &table->routes[route_idx];
+}
+
+static esp_err_t call_route(uri_router_handle_t router, httpd_req_t* req,
+                            const uri_router_route_t* route)
+{
+    if (route == NULL) {
+        ESP_LOGD(TAG, "No route for %s", req->uri);
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, NULL);
+        return ESP_FAIL;
+    }
+
+    router->match.route = route;
+    req->user_ctx = route->user_ctx;
+    return route->handler(req);
+}
+
+static esp_err_t uri_router_get_handler(httpd_req_t* req)
+{
+    uri_router_handle_t router = req->user_ctx;
+    const route_table_t* table = NULL;
+    const uri_router_route_t* route;
+    int route_idx = -1;
+    int ext_idx;
+
+    xSemaphoreTake(router->lock, portMAX_DELAY);
+    // The top table is walked together with the extension trie, the others only if it has no
+    // route for the path.
+    route_idx = uri_trie_lookup(router->top ? &router->top->trie : NULL, &router->ext_trie,
+                                req->uri, &router->match.path_len, &ext_idx);
+    if (route_idx >= 0) {
+        table = router->top;
+    } else if (router->top) {
+        table = find_route(router->top->below, req->uri, &route_idx);
+    }
+    route = resolve_route(router, table, route_idx);
+    xSemaphoreGive(router->lock);
+
+    router->match.ext = (ext_idx >= 0) ? &router->exts[ext_idx] : NULL;
+    return call_route(router, req, route);
+}
+
+esp_err_t uri_router_next(uri_router_handle_t router, httpd_req_t* req)
+{
+    const route_table_t* table;
+    const uri_router_route_t* route;
+    int route_idx = -1;
+
+    xSemaphoreTake(router->lock, portMAX_DELAY);
+    // The current table may have been removed in the meantime. Then there is nothing below it.
+    for (table = router->top; table && (table->id != router->current_id); table = table->below) {
+    }
+    if (table) {
+        table = find_route(table->below, req->uri, &route_idx);
+    }
+    route = resolve_route(router, table, route_idx);
+    xSemaphoreGive(router->lock);
+
+    return call_route(router, req, route);
+}
+
+const uri_router_match_t* uri_router_get_match(uri_router_handle_t router)
+{
+    return &router->match;
+}
+
+static bool build_ext_trie(uri_trie_t* trie, const uri_router_ext_t* exts, size_t num_exts)
+{
+    size_t total_len = 0;
+    size_t idx;
+
+    for (idx = 0; idx < num_exts; idx++) {
+        const char* ext = exts[idx].ext;
+        if ((ext == NULL) || (ext[0] != '.') || (strpbrk(&ext[1], "./") != NULL)) {
+            ESP_LOGE(TAG, "Invalid file extension %s", ext ? ext : "(null)");
+            return false;
+        }
+        total_len += strlen(ext) - 1;
+    }
+    if ((num_exts > INT16_MAX) || !uri_trie_init(trie, total_len)) {
+        return false;
+    }
+
+    for (idx = 0; idx < num_exts; idx++) {
+        char lower[16];
+        size_t len = strlen(exts[idx].ext) - 1;
+        if (len > sizeof(lower)) {
+            ESP_LOGE(TAG, "File extension %s too long", exts[idx].ext);
+            uri_trie_free(trie);
+            return false;
+        }
+        for (size_t i = 0; i < len; i++) {
+            lower[i] = tolower((unsigned char)exts[idx].ext[i + 1]);
+        }
+        uri_trie_insert(trie, lower, len, false, idx);
+    }
+    return true;
+}
+
+uri_router_handle_t uri_router_create(httpd_handle_t server, const uri_router_ext_t* exts,
+                                      size_t num_exts)
+{
+    uri_router_handle_t router = calloc(1, sizeof(*router));
+
+    if (router == NULL) {
+        return NULL;
+    }
+    router->server = server;
+    router->exts = exts;
+
+    if (!build_ext_trie(&router->ext_trie, exts, num_exts)) {
+        goto err_ext;
+    }
+
+    router->lock = xSemaphoreCreateMutex();
+    if (router->lock == NULL) {
+        goto err_lock;
+    }
+
+    httpd_uri_t get_uri = {
+        .uri = "/*", .method = HTTP_GET, .handler = uri_router_get_handler, .user_ctx = router};
+    if (httpd_register_uri_handler(server, &get_uri) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to register GET handler for /*");
+        goto err_register;
+    }
+    return router;
+
+err_register:
+    vSemaphoreDelete(router->lock);
+err_lock:
+    uri_trie_free(&router->ext_trie);
+err_ext:
+    free(router);
+    return NULL;
+}
+
+void uri_router_delete(uri_router_handle_t router)
+{
+    if (router == NULL) {
+        return;
+    }
+
+    httpd_unregister_uri_handler(router->server, "/*", HTTP_GET);
+
+    while (router->top) {
+        route_table_t* table = router->top;
+        router->top = table->below;
+        uri_trie_free(&table->trie);
+        free(table);
+    }
+    uri_trie_free(&router->ext_trie);
+    vSemaphoreDelete(router->lock);
+    free(router);
+}
+
+esp_err_t uri_router_add_routes(uri_router_handle_t router, const uri_router_route_t* routes,
+                                size_t num_routes)
+{
+    route_table_t* table;
+    size_t total_len = 0;
+    size_t idx;
+
+    for (idx = 0; idx < num_routes; idx++) {
+        if ((routes[idx].pattern == NULL) || (routes[idx].pattern[0] != '/') ||
+            (routes[idx].handler == NULL)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        total_len += strlen(routes[idx].pattern);
+    }
+    if (num_routes > INT16_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    table = calloc(1, sizeof(*table));
+    if (table == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (!uri_trie_init(&table->trie, total_len)) {
+        free(table);
+        return ESP_ERR_NO_MEM;
+    }
+    for (idx = 0; idx < num_routes; idx++) {
+        uri_trie_insert(&table->trie, routes[idx].pattern, strlen(routes[idx].pattern),
+                        routes[idx].match == URI_ROUTER_MATCH_PREFIX, idx);
+    }
+    table->routes = routes;
+
+    xSemaphoreTake(router->lock, portMAX_DELAY);
+    table->id = ++router->next_id;
+    table->below = router->top;
+    router->top = table;
+    xSemaphoreGive(router->lock);
+
+    return ESP_OK;
+}
+
+void uri_router_remove_routes(uri_router_handle_t router, const uri_router_route_t* routes)
+{
+    route_table_t** link;
+    route_table_t* table = NULL;
+
+    xSemaphoreTake(router->lock, portMAX_DELAY);
+    for (link = &router->top; *link; link = &(*link)->below) {
+        if ((*link)->routes == routes) {
+            table = *link;
+            *link = table->below;
+            break;
+        }
+    }
+    xSemaphoreGive(router->lock);
+
+    if (table) {
+        uri_trie_free(&table->trie);
+        free(table);
+    }
+}
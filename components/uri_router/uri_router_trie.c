@@ -0,0 +1,156 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+Trie behind the URI router. Route patterns and file extensions each go into a trie of bytes.
+A lookup walks the request path once, advancing in the route trie and, from each '.' of the
+last path segment on, in the extension trie. Both tries are built when routes are added and
+never change afterwards, so lookups need no allocation. Plain C without IDF dependencies.
+*/
+
+#include "uri_router_trie.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+
+#define NO_NODE 0 /* The root is never a child, so index 0 doubles as "none" */
+
+static void init_node(uri_trie_node_t* node, char c)
+{
+    node->child = NO_NODE;
+    node->sibling = NO_NODE;
+    node->exact = -1;
+    node->prefix = -1;
+    node->prefix_open = false;
+    node->c = c;
+}
+
+bool uri_trie_init(uri_trie_t* trie, size_t total_key_len)
+{
+    trie->nodes = NULL;
+    trie->num_nodes = 0;
+    trie->max_nodes = 0;
+
+    if (total_key_len >= UINT16_MAX) {
+        return false;
+    }
+    trie->nodes = malloc((total_key_len + 1) * sizeof(uri_trie_node_t));
+    if (trie->nodes == NULL) {
+        return false;
+    }
+    trie->max_nodes = total_key_len + 1;
+    trie->num_nodes = 1;
+    init_node(&trie->nodes[0], '\0');
+    return true;
+}
+
+void uri_trie_free(uri_trie_t* trie)
+{
+    free(trie->nodes);
+    trie->nodes = NULL;
+    trie->num_nodes = 0;
+    trie->max_nodes = 0;
+}
+
+static uint16_t find_child(const uri_trie_t* trie, uint16_t node, char c)
+{
+    uint16_t child = trie->nodes[node].child;
+
+    while ((child != NO_NODE) && (trie->nodes[child].c != c)) {
+        child = trie->nodes[child].sibling;
+    }
+    return child;
+}
+
+bool uri_trie_insert(uri_trie_t* trie, const char* key, size_t len, bool is_prefix,
+                     int16_t index)
+{
+    uint16_t node = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        uint16_t child = find_child(trie, node, key[i]);
+        if (child == NO_NODE) {
+            if (trie->num_nodes >= trie->max_nodes) {
+                return false;
+            }
+            child = trie->num_nodes++;
+            init_node(&trie->nodes[child], key[i]);
+            trie->nodes[child].sibling = trie->nodes[node].child;
+            trie->nodes[node].child = child;
+        }
+        node = child;
+    }
+
+    if (is_prefix) {
+        if (trie->nodes[node].prefix < 0) {
+            trie->nodes[node].prefix = index;
+            trie->nodes[node].prefix_open = (len > 0) && (key[len - 1] == '/');
+        }
+    } else if (trie->nodes[node].exact < 0) {
+        trie->nodes[node].exact = index;
+    }
+    return true;
+}
+
+static inline bool is_path_end(char c)
+{
+    return (c == '\0') || (c == '?');
+}
+
+int uri_trie_lookup(const uri_trie_t* routes, const uri_trie_t* exts, const char* uri,
+                    size_t* path_len, int* ext)
+{
+    uint16_t node = 0;
+    bool in_routes = (routes != NULL);
+    int best = -1;
+    uint16_t ext_node = 0;
+    bool in_ext = false;
+    size_t i;
+
+    for (i = 0; !is_path_end(uri[i]); i++) {
+        char c = uri[i];
+
+        if (in_routes) {
+            node = find_child(routes, node, c);
+            if (node == NO_NODE) {
+                in_routes = false;
+            } else if ((routes->nodes[node].prefix >= 0) &&
+                       (routes->nodes[node].prefix_open || (uri[i + 1] == '/') ||
+                        is_path_end(uri[i + 1]))) {
+                best = routes->nodes[node].prefix;
+            }
+        }
+
+        if (exts) {
+            if (c == '/') {
+                in_ext = false;
+            } else if (c == '.') {
+                in_ext = true;
+                ext_node = 0;
+            } else if (in_ext) {
+                ext_node = find_child(exts, ext_node, tolower((unsigned char)c));
+                in_ext = (ext_node != NO_NODE);
+            }
+        }
+    }
+
+    *path_len = i;
+    if (in_routes && (routes->nodes[node].exact >= 0)) {
+        best = routes->nodes[node].exact;
+    }
+    if (ext) {
+        *ext = in_ext ? exts->nodes[ext_node].exact : -1;
+    }
+    return best;
+}
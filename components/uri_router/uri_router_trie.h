@@ -0,0 +1,80 @@
+// Copyright 2021 Aaron Fontaine
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef URI_ROUTER_TRIE_H_
+#define URI_ROUTER_TRIE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Byte trie in a single allocation. Node 0 is the root. Children of a node
+ * are a singly linked list through the sibling field. */
+typedef struct {
+    uint16_t child;   /* First child, 0 if none */
+    uint16_t sibling; /* Next sibling, 0 if none */
+    int16_t exact;    /* Index of the key ending here, -1 if none */
+    int16_t prefix;   /* Index of the prefix key ending here, -1 if none */
+    bool prefix_open; /* The prefix key ends with '/', so any character may follow */
+    char c;
+} uri_trie_node_t;
+
+typedef struct {
+    uri_trie_node_t* nodes;
+    uint16_t num_nodes;
+    uint16_t max_nodes;
+} uri_trie_t;
+
+/**
+ * @brief   Allocates an empty trie with room for keys of the given total length.
+ *
+ * @return false if out of memory or total_key_len is too large
+ */
+bool uri_trie_init(uri_trie_t* trie, size_t total_key_len);
+
+/**
+ * @brief   Frees the nodes of a trie.
+ */
+void uri_trie_free(uri_trie_t* trie);
+
+/**
+ * @brief   Adds a key. Of two equal keys of the same kind, the first one is kept.
+ *
+ * @param[in] key       Key, characters are stored as given
+ * @param[in] len       Length of key
+ * @param[in] is_prefix Whether the key is matched as a path prefix
+ * @param[in] index     Returned by uri_trie_lookup() for this key
+ *
+ * @return false if the trie is full
+ */
+bool uri_trie_insert(uri_trie_t* trie, const char* key, size_t len, bool is_prefix,
+                     int16_t index);
+
+/**
+ * @brief   Routes a request URI in a single pass over its path.
+ *
+ * @param[in]  routes   Trie of route patterns, may be NULL
+ * @param[in]  exts     Trie of lower-case file extensions without the dot, may be NULL
+ * @param[in]  uri      Request URI, optionally with a query string
+ * @param[out] path_len Length of the path, i.e. of uri up to the query string
+ * @param[out] ext      Index of the extension of the last path segment, -1 if
+ *                      unknown (may be NULL if exts is)
+ *
+ * @return Index of the exact route matching the path if there is one, else
+ *         of the longest matching prefix route, else -1
+ */
+int uri_trie_lookup(const uri_trie_t* routes, const uri_trie_t* exts, const char* uri,
+                    size_t* path_len, int* ext);
+
+#endif /* URI_ROUTER_TRIE_H_ */
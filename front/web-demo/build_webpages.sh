@@ -69,3 +69,9 @@ else
 fi
 
 cd ..
+
+# Pack the build output into a single asset bundle with a perfect hash index of
+# request paths. The memory-mapped deploy mode flashes this instead of a
+# SPIFFS image of dist.
+python ../../components/asset_bundle/tools/mkassetbundle.py \
+  --mime-types ../../components/rest_server/rest_server_mime_types.h dist www.bundle
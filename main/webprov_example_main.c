@@ -7,6 +7,7 @@
    CONDITIONS OF ANY KIND, either express or implied.
 */
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -36,6 +37,10 @@
 #include "driver/sdmmc_host.h"
 #endif
 
+#if CONFIG_EXAMPLE_WEB_DEPLOY_MMAP
+#include "asset_bundle.h"
+#endif
+#include "capt_dns.h"
 #include "prov_webpage_mgr.h"
 #include "rest_server.h"
 
@@ -167,6 +172,55 @@ static void wifi_prov_event_handler(void* arg, wifi_prov_cb_event_t event, void*
     }
 }
 
+/* Number of recent DNS queries listed by the "get dns stats" command */
+#define DNS_STATS_RECENT_QUERIES 8
+
+static void add_dns_stats(cJSON* resp_root)
+{
+    capt_dns_stats_t stats;
+    cJSON* dns = cJSON_CreateObject();
+
+    capt_dns_get_stats(&stats);
+    cJSON_AddNumberToObject(dns, "queries", stats.queries);
+    cJSON_AddNumberToObject(dns, "answered", stats.answered);
+    cJSON_AddNumberToObject(dns, "refused", stats.refused);
+    cJSON_AddNumberToObject(dns, "dropped", stats.dropped);
+    cJSON_AddNumberToObject(dns, "forwarded", stats.forwarded);
+
+#if CONFIG_CAPT_DNS_TELEMETRY
+    capt_dns_telemetry_t telemetry;
+    capt_dns_query_record_t recent[DNS_STATS_RECENT_QUERIES];
+    char hex_str[9];
+
+    capt_dns_get_telemetry(&telemetry);
+    cJSON* qtypes = cJSON_AddObjectToObject(dns, "qtypes");
+    for (int i = 0; i < CAPT_DNS_QTYPE_COUNT; i++) {
+        cJSON_AddNumberToObject(qtypes, capt_dns_qtype_bucket_name(i), telemetry.qtype[i]);
+    }
+    /* Element n counts service times from 2^n to 2^(n+1)-1 microseconds */
+    cJSON* latency = cJSON_AddArrayToObject(dns, "latency_us_log2");
+    for (int i = 0; i < CAPT_DNS_LATENCY_BUCKETS; i++) {
+        cJSON_AddItemToArray(latency, cJSON_CreateNumber(telemetry.latency[i]));
+    }
+
+    size_t count = capt_dns_get_recent_queries(recent, DNS_STATS_RECENT_QUERIES);
+    cJSON* recent_arr = cJSON_AddArrayToObject(dns, "recent");
+    for (size_t i = 0; i < count; i++) {
+        cJSON* rec = cJSON_CreateObject();
+        cJSON_AddNumberToObject(rec, "time_ms", recent[i].timestamp_ms);
+        snprintf(hex_str, sizeof(hex_str), "%08" PRIx32, recent[i].src_key);
+        cJSON_AddStringToObject(rec, "src", hex_str);
+        cJSON_AddNumberToObject(rec, "qtype", recent[i].qtype);
+        snprintf(hex_str, sizeof(hex_str), "%08" PRIx32, recent[i].qname_hash);
+        cJSON_AddStringToObject(rec, "qname_hash", hex_str);
+        cJSON_AddNumberToObject(rec, "service_us", recent[i].service_us);
+        cJSON_AddItemToArray(recent_arr, rec);
+    }
+#endif
+
+    cJSON_AddItemToObject(resp_root, "dns", dns);
+}
+
 static esp_err_t rest_web_api_handler(httpd_req_t* req)
 {
     char content[64];
@@ -231,6 +285,9 @@ static esp_err_t rest_web_api_handler(httpd_req_t* req)
         cJSON* button_state_json_str_obj = cJSON_CreateString(button_state_str);
         cJSON_AddItemToObject(resp_root, "button", button_state_json_str_obj);
         status_str = "ok";
+    } else if (strcmp(cmd_str, "get dns stats") == 0) {
+        add_dns_stats(resp_root);
+        status_str = "ok";
     } else if (strcmp(cmd_str, "clear wifi settings") == 0) {
         /* Halt Wi-Fi, clear settings, and reset device three seconds from now. */
         if (esp_timer_start_once(_wifi_reset_timer, 3000 * 1000U) == ESP_OK) {
@@ -418,6 +475,22 @@ esp_err_t init_fs(void)
 }
 #endif
 
+#if CONFIG_EXAMPLE_WEB_DEPLOY_MMAP
+static asset_bundle_t _web_bundle;
+
+esp_err_t init_fs(void)
+{
+    esp_err_t ret = asset_bundle_map_partition("www", &_web_bundle);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to map web asset image (%s)", esp_err_to_name(ret));
+        return ESP_FAIL;
+    }
+    /* Nothing is mounted. The web server looks files up in the image. */
+    rest_server_set_bundle(&_web_bundle);
+    return ESP_OK;
+}
+#endif
+
 static void button_init(void)
 {
     gpio_config_t gpioConfig = {
@@ -460,8 +533,7 @@ static void start_webprov(void)
         .captive_portal_setup =
             {
                 .netif_handle = _softap_if_handle,
-                .app_get_handler = rest_server_get_common_get_handler(),
-                .app_get_ctx = rest_server_get_common_get_ctx(),
+                .router = rest_server_get_router(),
             },
     };
     ESP_ERROR_CHECK(prov_webpage_mgr_start(&webprov_config));
@@ -528,8 +600,8 @@ void app_main(void)
     netbiosns_init();
     netbiosns_set_name(CONFIG_EXAMPLE_MDNS_HOST_NAME);
 
-    /* Initialize filesystem specified in menuconfig: SPI Flash, SD Card, or
-     * Semihost */
+    /* Initialize filesystem specified in menuconfig: SPI Flash, SD Card,
+     * Semihost, or memory-mapped asset image */
     ESP_ERROR_CHECK(init_fs());
 
     /* Start the web server, telling it where the web files are mounted. */